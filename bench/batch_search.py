@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""
+Batch search benchmark
+
+Compares Q queries sent as Q SEARCH round trips with the same Q queries in
+one SEARCH_BATCH, which the server spreads over its worker threads and
+answers in a single MATCH_BATCH_RESULT. Both must return the same results.
+
+    python3 batch_search.py [--queries 1,10,100,500] [--vectors 10000] [--workers N]
+"""
+
+import argparse
+import sys
+import time
+
+from victorbench import (MSG_BATCH_RESULT, MSG_INSERT_BATCH, MSG_MATCH_BATCH_RESULT, MSG_MATCH_RESULT,
+                         MSG_SEARCH, MSG_SEARCH_BATCH, Client, Servers, float32_block, vector)
+
+
+def load(client: Client, dims: int, count: int):
+    """Inserts `count` vectors with INSERT_BATCH"""
+    for first in range(0, count, 1000):
+        ids = list(range(first + 1, min(first + 1000, count) + 1))
+        block = [x for i in ids for x in vector(dims, i)]
+        msg_type, result = client.request(MSG_INSERT_BATCH, [ids, [0] * len(ids), dims, float32_block(block)])
+        assert msg_type == MSG_BATCH_RESULT, result
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--dims", type=int, default=128)
+    parser.add_argument("--vectors", type=int, default=10000, help="vectors in the index")
+    parser.add_argument("--queries", default="1,10,100,500", help="comma-separated batch sizes")
+    parser.add_argument("--k", type=int, default=10, help="results per query")
+    parser.add_argument("--rounds", type=int, default=20)
+    parser.add_argument("--workers", type=int, help="server worker threads (-w, default: CPU count)")
+    opts = parser.parse_args()
+
+    args = ["-w", str(opts.workers)] if opts.workers is not None else []
+    with Servers(dims=opts.dims, args=args) as servers:
+        client = Client(servers.index_socket)
+        load(client, opts.dims, opts.vectors)
+
+        print(f"{'Q':>5} {'single_ms':>10} {'batch_ms':>9} {'single_q/s':>11} {'batch_q/s':>10} {'speedup':>8}")
+        for count in (int(q) for q in opts.queries.split(",")):
+            queries = [vector(opts.dims, 7919 * q + 3) for q in range(count)]
+
+            start = time.perf_counter()
+            for _ in range(opts.rounds):
+                single = []
+                for q in queries:
+                    msg_type, result = client.request(MSG_SEARCH, [0, q, opts.k])
+                    assert msg_type == MSG_MATCH_RESULT, result
+                    single.append(result)
+            single_s = (time.perf_counter() - start) / opts.rounds
+
+            block = float32_block([x for q in queries for x in q])
+            start = time.perf_counter()
+            for _ in range(opts.rounds):
+                msg_type, batch = client.request(MSG_SEARCH_BATCH, [0, opts.k, opts.dims, block])
+                assert msg_type == MSG_MATCH_BATCH_RESULT, batch
+            batch_s = (time.perf_counter() - start) / opts.rounds
+
+            if [[r[0] for r in rows] for rows in batch] != [[r[0] for r in rows] for rows in single]:
+                print(f"FAIL: batch results differ from single results at Q={count}")
+                return 1
+            print(f"{count:>5} {single_s * 1e3:>10.2f} {batch_s * 1e3:>9.2f} {count / single_s:>11.0f} "
+                  f"{count / batch_s:>10.0f} {single_s / batch_s:>7.1f}x")
+        client.close()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
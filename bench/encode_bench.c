@@ -0,0 +1,248 @@
+/**
+ * @file encode_bench.c
+ * @brief Compares the streaming CBOR writers with the item-tree ones they replaced.
+ *
+ * The tree writers are kept here as they were in viproto.c: one libcbor item
+ * per value (one allocation per vector component), then cbor_serialize().
+ * The streaming writers are the ones in viproto.c. Each is timed at 128, 768
+ * and 1536 dimensions (MATCH_RESULT: as many results), and both outputs are
+ * read back with the viproto.c readers to check that they carry the same
+ * message.
+ *
+ * Usage: encode_bench [iterations]
+ */
+
+#include <cbor.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "buffer.h"
+#include "viproto.h"
+
+/** @brief Output space of the tree writers (the old ones wrote into buf->data unchecked) */
+#define TREE_OUT_MAX (64 * 1024)
+
+/** @brief Largest size measured */
+#define SIZE_LARGEST 1536
+
+static const size_t sizes[] = { 128, 768, SIZE_LARGEST };
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/**
+ * @brief Appends an item to an array, dropping the caller's reference.
+ */
+static int push(cbor_item_t *arr, cbor_item_t *item) {
+    int ok = item && cbor_array_push(arr, item);
+
+    if (item)
+        cbor_decref(&item);
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief Builds an array of float32 items, one allocation per component.
+ */
+static cbor_item_t *tree_vector(const float *vec, size_t dims) {
+    cbor_item_t *arr = cbor_new_definite_array(dims);
+
+    for (size_t i = 0; arr && i < dims; i++)
+        if (push(arr, cbor_build_float4(vec[i])) != 0)
+            cbor_decref(&arr);
+    return arr;
+}
+
+/**
+ * @brief Serializes and releases a tree.
+ *
+ * @return Bytes written, 0 on failure.
+ */
+static size_t tree_finish(cbor_item_t *root, uint8_t *out) {
+    size_t written;
+
+    if (!root)
+        return 0;
+    written = cbor_serialize(root, out, TREE_OUT_MAX);
+    cbor_decref(&root);
+    return written;
+}
+
+/** @brief INSERT as the tree writer encoded it: [id, tag, [float32...]] */
+static size_t tree_insert(uint8_t *out, uint64_t id, uint64_t tag, const float *vec, size_t dims) {
+    cbor_item_t *root = cbor_new_definite_array(3);
+
+    if (root && (push(root, cbor_build_uint64(id)) != 0 ||
+                 push(root, cbor_build_uint64(tag)) != 0 ||
+                 push(root, tree_vector(vec, dims)) != 0))
+        cbor_decref(&root);
+    return tree_finish(root, out);
+}
+
+/** @brief SEARCH as the tree writer encoded it: [tag, [float32...], n] */
+static size_t tree_search(uint8_t *out, uint64_t tag, const float *vec, size_t dims, int n) {
+    cbor_item_t *root = cbor_new_definite_array(3);
+
+    if (root && (push(root, cbor_build_uint64(tag)) != 0 ||
+                 push(root, tree_vector(vec, dims)) != 0 ||
+                 push(root, cbor_build_uint32((uint32_t)n)) != 0))
+        cbor_decref(&root);
+    return tree_finish(root, out);
+}
+
+/** @brief MATCH_RESULT as the tree writer encoded it: [[id, float32], ...] */
+static size_t tree_match_result(uint8_t *out, const uint64_t *ids, const float *distances, size_t n) {
+    cbor_item_t *root = cbor_new_definite_array(n);
+
+    for (size_t i = 0; root && i < n; i++) {
+        cbor_item_t *pair = cbor_new_definite_array(2);
+
+        if (!pair || push(pair, cbor_build_uint64(ids[i])) != 0 ||
+            push(pair, cbor_build_float4(distances[i])) != 0 || push(root, pair) != 0) {
+            cbor_decref(&root);
+            break;
+        }
+    }
+    return tree_finish(root, out);
+}
+
+/**
+ * @brief Copies the output of a tree writer into a message to read it back.
+ */
+static buffer_t *load(buffer_t *msg, const uint8_t *data, size_t len) {
+    if (len == 0 || buffer_reserve(msg, len) != 0)
+        return NULL;
+    memcpy(msg->data, data, len);
+    msg->hdr.len = (int)len;
+    return msg;
+}
+
+static int same_vector(proto_vector_t *v, const float *vec, size_t dims) {
+    int same = v->dims == dims && memcmp(v->data, vec, dims * sizeof(float)) == 0;
+
+    proto_vector_free(v);
+    return same;
+}
+
+/** @brief Tells whether @p msg is the INSERT encoded by the loops below */
+static int check_insert(const buffer_t *msg, uint64_t id, const float *vec, size_t dims) {
+    proto_vector_t v;
+    uint64_t got_id, tag;
+
+    return msg && buffer_read_insert(msg, &got_id, &tag, &v) == 0 &&
+           same_vector(&v, vec, dims) && got_id == id && tag == 7;
+}
+
+/** @brief Tells whether @p msg is the SEARCH encoded by the loops below */
+static int check_search(const buffer_t *msg, const float *vec, size_t dims) {
+    proto_vector_t v;
+    uint64_t tag;
+    int n;
+
+    return msg && buffer_read_search(msg, &tag, &v, &n) == 0 &&
+           same_vector(&v, vec, dims) && tag == 7 && n == 10;
+}
+
+/** @brief Tells whether @p msg is the MATCH_RESULT encoded by the loops below */
+static int check_match_result(const buffer_t *msg, const uint64_t *ids, const float *distances, size_t n) {
+    uint64_t got_ids[SIZE_LARGEST];
+    float got_distances[SIZE_LARGEST];
+    size_t count;
+
+    return msg && buffer_read_match_result(msg, got_ids, got_distances, n, &count) == 0 && count == n &&
+           memcmp(got_ids, ids, n * sizeof(uint64_t)) == 0 &&
+           memcmp(got_distances, distances, n * sizeof(float)) == 0;
+}
+
+/**
+ * @brief Prints one comparison.
+ *
+ * @param ok Both writers encoded the expected message.
+ * @return 0 if @p ok, -1 otherwise.
+ */
+static int report(const char *what, size_t size, double tree_ns, double stream_ns,
+                  size_t tree_len, const buffer_t *buf, int ok) {
+    printf("%-13s %6zu %8zu %8d %11.0f %11.0f %8.2f %8.2f %7.1fx%s\n",
+           what, size, tree_len, buf->hdr.len, tree_ns, stream_ns,
+           tree_ns / (double)size, stream_ns / (double)size, tree_ns / stream_ns,
+           ok ? "" : "  WRONG OUTPUT");
+    return ok ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    long iters = argc > 1 ? atol(argv[1]) : 20000;
+    size_t max = SIZE_LARGEST;
+    float *vec = malloc(max * sizeof(float));
+    uint64_t *ids = malloc(max * sizeof(uint64_t));
+    uint8_t *out = malloc(TREE_OUT_MAX);
+    buffer_t *buf = alloc_buffer(), *msg = alloc_buffer();
+    int ret = 0;
+
+    if (iters <= 0 || !vec || !ids || !out || !buf || !msg) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+    for (size_t i = 0; i < max; i++) {
+        vec[i] = (float)((i * 7) % 97 + 1) / 97.0f;
+        ids[i] = 1000000007ULL * (i + 1);
+    }
+
+    printf("%ld iterations per writer; times in ns per message and per element\n", iters);
+    printf("%-13s %6s %8s %8s %11s %11s %8s %8s %8s\n", "message", "size", "tree_b", "strm_b",
+           "tree_ns", "stream_ns", "tree/el", "strm/el", "speedup");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t dims = sizes[s], len = 0;
+        double t0, tree_ns, stream_ns;
+
+        t0 = now_ns();
+        for (long i = 0; i < iters; i++)
+            len = tree_insert(out, (uint64_t)i, 7, vec, dims);
+        tree_ns = (now_ns() - t0) / (double)iters;
+        t0 = now_ns();
+        for (long i = 0; i < iters; i++)
+            if (buffer_write_insert(buf, (uint64_t)i, 7, vec, dims) != 0)
+                ret = -1;
+        stream_ns = (now_ns() - t0) / (double)iters;
+        ret |= report("INSERT", dims, tree_ns, stream_ns, len, buf,
+                      check_insert(buf, (uint64_t)iters - 1, vec, dims) &&
+                      check_insert(load(msg, out, len), (uint64_t)iters - 1, vec, dims));
+
+        t0 = now_ns();
+        for (long i = 0; i < iters; i++)
+            len = tree_search(out, 7, vec, dims, 10);
+        tree_ns = (now_ns() - t0) / (double)iters;
+        t0 = now_ns();
+        for (long i = 0; i < iters; i++)
+            if (buffer_write_search(buf, 7, vec, dims, 10) != 0)
+                ret = -1;
+        stream_ns = (now_ns() - t0) / (double)iters;
+        ret |= report("SEARCH", dims, tree_ns, stream_ns, len, buf,
+                      check_search(buf, vec, dims) && check_search(load(msg, out, len), vec, dims));
+
+        t0 = now_ns();
+        for (long i = 0; i < iters; i++)
+            len = tree_match_result(out, ids, vec, dims);
+        tree_ns = (now_ns() - t0) / (double)iters;
+        t0 = now_ns();
+        for (long i = 0; i < iters; i++)
+            if (buffer_write_match_result(buf, ids, vec, dims) != 0)
+                ret = -1;
+        stream_ns = (now_ns() - t0) / (double)iters;
+        ret |= report("MATCH_RESULT", dims, tree_ns, stream_ns, len, buf,
+                      check_match_result(buf, ids, vec, dims) &&
+                      check_match_result(load(msg, out, len), ids, vec, dims));
+    }
+
+    free_buffer(msg);
+    free_buffer(buf);
+    free(out);
+    free(ids);
+    free(vec);
+    return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+"""
+Idle connections benchmark
+
+Times SEARCH round trips of one active client while the server holds more
+and more idle connections. The event loop only wakes up for ready
+connections, so the per-request cost must not grow with the idle ones.
+
+    python3 idle_conns.py [--idle 0,1000,4000] [--requests 5000]
+"""
+
+import argparse
+import resource
+import sys
+import time
+
+from victorbench import MSG_INSERT, MSG_SEARCH, Client, Servers, percentile, vector
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--dims", type=int, default=128)
+    parser.add_argument("--idle", default="0,1000,4000", help="comma-separated idle connection counts")
+    parser.add_argument("--requests", type=int, default=5000)
+    opts = parser.parse_args()
+    counts = [int(n) for n in opts.idle.split(",")]
+
+    # The server raises its own limit; the client needs one descriptor per connection.
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    if soft < max(counts) + 64:
+        resource.setrlimit(resource.RLIMIT_NOFILE, (min(hard, max(counts) + 64), hard))
+
+    with Servers(dims=opts.dims) as servers:
+        path = servers.index_socket
+        active = Client(path)
+        for i in range(100):
+            active.request(MSG_INSERT, [i + 1, 0, vector(opts.dims, i)])
+        query = [0, vector(opts.dims, 7), 3]
+
+        idle = []
+        print(f"{'idle':>6} {'mean_us':>9} {'p50_us':>9} {'p99_us':>9}")
+        for count in counts:
+            while len(idle) < count:
+                idle.append(Client(path))
+            # A round trip makes sure the server accepted them all.
+            active.request(MSG_SEARCH, query)
+            for _ in range(200):
+                active.request(MSG_SEARCH, query)
+
+            latencies = []
+            for _ in range(opts.requests):
+                start = time.perf_counter()
+                active.request(MSG_SEARCH, query)
+                latencies.append(time.perf_counter() - start)
+            print(f"{count:>6} {sum(latencies) / len(latencies) * 1e6:>9.1f} "
+                  f"{percentile(latencies, 50) * 1e6:>9.1f} {percentile(latencies, 99) * 1e6:>9.1f}")
+
+        for client in idle:
+            client.close()
+        active.close()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
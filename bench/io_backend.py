@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""
+I/O backend benchmark
+
+Runs the same workloads with the epoll loop and with io_uring (VICTOR_IO)
+and reports throughput and the system calls the server loop made per
+request, from the `io_requests` and `io_syscalls` counters of STATS:
+
+- SEARCH from 1 client, 8 clients, and 8 clients pipelining 16 requests;
+- INSERT from 8 clients in `fsync` mode, where io_uring links each WAL
+  write to its fdatasync (the WAL thread's calls are not in the counters).
+
+io_uring needs Linux 6.0 or later; the run says so if the server fell back
+to epoll.
+
+    python3 io_backend.py [--requests 4000] [--dims 128]
+"""
+
+import argparse
+import multiprocessing
+import sys
+import time
+
+from victorbench import MSG_INSERT, MSG_OP_RESULT, MSG_SEARCH, Client, Servers, dumps, frame, vector
+
+SEARCH_LOADS = ((1, 1), (8, 1), (8, 16))
+
+
+def search_worker(path: str, payload: bytes, requests: int, depth: int, done):
+    client = Client(path)
+    sent = got = 0
+    while got < requests:
+        burst = []
+        while sent < requests and sent - got < depth:
+            burst.append(frame(MSG_SEARCH, payload, sent))
+            sent += 1
+        if burst:
+            client.sock.sendall(b"".join(burst))
+        client.recv()
+        got += 1
+    client.close()
+    done.put(got)
+
+
+def insert_worker(path: str, dims: int, first: int, requests: int, done):
+    client = Client(path)
+    for i in range(requests):
+        msg_type, result = client.request(MSG_INSERT, [first + i, 0, vector(dims, i)])
+        assert msg_type == MSG_OP_RESULT and result[0] == 0, result
+    client.close()
+    done.put(requests)
+
+
+def measure(path: str, workers: list) -> tuple:
+    """Runs the worker processes; returns (requests/s, loop syscalls per request, io_uring)"""
+    stats = Client(path)
+    before = stats.stats()
+    done = multiprocessing.Queue()
+    procs = [multiprocessing.Process(target=target, args=args + (done,)) for target, args in workers]
+    start = time.perf_counter()
+    for p in procs:
+        p.start()
+    total = sum(done.get() for _ in procs)
+    elapsed = time.perf_counter() - start
+    for p in procs:
+        p.join()
+    after = stats.stats()
+    stats.close()
+    requests = after["io_requests"] - before["io_requests"]
+    syscalls = after["io_syscalls"] - before["io_syscalls"]
+    return total / elapsed, syscalls / requests if requests else 0.0, after["io_uring"]
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--dims", type=int, default=128)
+    parser.add_argument("--requests", type=int, default=4000, help="requests per client")
+    opts = parser.parse_args()
+
+    print(f"{'backend':<7} {'workload':<24} {'req/s':>8} {'syscalls/req':>13}")
+    for backend in ("epoll", "uring"):
+        env = {"VICTOR_IO": backend, "VICTOR_WAL_SYNC": "fsync"}
+        with Servers(dims=opts.dims, env=env) as servers:
+            path = servers.index_socket
+            client = Client(path)
+            for i in range(100):
+                client.request(MSG_INSERT, [i + 1, 0, vector(opts.dims, i)])
+            client.close()
+
+            payload = dumps([0, vector(opts.dims, 5), 5])
+            uring = 0
+            for clients, depth in SEARCH_LOADS:
+                rate, per_req, uring = measure(
+                    path, [(search_worker, (path, payload, opts.requests, depth))] * clients)
+                print(f"{backend:<7} {f'search {clients}x depth {depth}':<24} {rate:>8.0f} {per_req:>13.2f}")
+
+            inserts = max(1, opts.requests // 8)
+            rate, per_req, uring = measure(
+                path, [(insert_worker, (path, opts.dims, 1000 + k * inserts, inserts)) for k in range(8)])
+            print(f"{backend:<7} {'insert 8x fsync':<24} {rate:>8.0f} {per_req:>13.2f}")
+            if backend == "uring" and not uring:
+                print("note: io_uring was unavailable, the server fell back to epoll (see its log)")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+"""
+Shared-memory transport benchmark
+
+Times SEARCH requests over the UNIX socket and over the shared-memory
+rings (MSG_SHM_ATTACH, see src/shm.h) at several vector sizes: one request
+at a time (round trip), and in windows of pipelined requests. Linux only.
+
+    python3 shm_vs_socket.py [--dims 128,768,1536] [--requests 2000] [--window 32]
+"""
+
+import argparse
+import mmap
+import os
+import select
+import socket
+import struct
+import sys
+import time
+
+from victorbench import MSG_INSERT, MSG_MATCH_RESULT, MSG_SEARCH, MSG_SHM_ATTACH, Client, Servers, dumps, frame, loads, vector
+
+SHM_HDR_LEN = 64 * 1024
+SHM_FDS = 3
+REQ_HEAD, REQ_TAIL, RESP_HEAD, RESP_TAIL = 64, 128, 192, 256
+
+
+class ShmClient:
+    """Client moved to the shared-memory rings, with the interface of Client"""
+
+    def __init__(self, path: str, size: int = 0):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+        self.sock.sendall(frame(MSG_SHM_ATTACH, dumps(size), 1))
+        msg, fds, _, _ = socket.recv_fds(self.sock, 4096, SHM_FDS)
+        if len(fds) != SHM_FDS:
+            raise RuntimeError(f"attach refused: {loads(msg[12:])}")
+        self.memfd, self.server_bell, self.client_bell = fds
+        head = os.pread(self.memfd, 16, 0)
+        if head[:4] != b"VSHM":
+            raise RuntimeError("not a VictorDB ring")
+        self.size = struct.unpack_from("=Q", head, 8)[0]
+        self.map = mmap.mmap(self.memfd, SHM_HDR_LEN + 2 * self.size)
+        self.produced = 0
+        self.consumed = 0
+        self.pending = bytearray()
+
+    def _get(self, off: int) -> int:
+        return struct.unpack_from("=Q", self.map, off)[0]
+
+    def _put(self, off: int, value: int):
+        struct.pack_into("=Q", self.map, off, value)
+
+    def _wait(self):
+        select.select([self.client_bell], [], [], 1.0)
+        try:
+            os.eventfd_read(self.client_bell)
+        except BlockingIOError:
+            pass
+
+    def send_raw(self, data: bytes):
+        view = memoryview(data)
+        while view:
+            room = self.size - (self.produced - self._get(REQ_TAIL))
+            if room == 0:
+                self._wait()
+                continue
+            n = min(room, len(view))
+            pos = self.produced % self.size
+            first = min(n, self.size - pos)
+            self.map[SHM_HDR_LEN + pos:SHM_HDR_LEN + pos + first] = view[:first]
+            if n > first:
+                self.map[SHM_HDR_LEN:SHM_HDR_LEN + n - first] = view[first:n]
+            self.produced += n
+            self._put(REQ_HEAD, self.produced)
+            view = view[n:]
+            os.eventfd_write(self.server_bell, 1)
+
+    def send(self, msg_type: int, value, req_id=None):
+        self.send_raw(frame(msg_type, dumps(value), req_id))
+
+    def _pull(self) -> bool:
+        head = self._get(RESP_HEAD)
+        n = head - self.consumed
+        if n == 0:
+            return False
+        base = SHM_HDR_LEN + self.size
+        pos = self.consumed % self.size
+        first = min(n, self.size - pos)
+        self.pending += self.map[base + pos:base + pos + first]
+        if n > first:
+            self.pending += self.map[base:base + n - first]
+        self.consumed = head
+        self._put(RESP_TAIL, head)
+        os.eventfd_write(self.server_bell, 1)
+        return True
+
+    def recv(self):
+        while True:
+            buf = self.pending
+            if len(buf) >= 4:
+                if buf[0] >> 4 == 0xF and len(buf) >= 12:
+                    req_id, length = struct.unpack_from(">II", buf, 4)
+                    if len(buf) >= 12 + length:
+                        msg_type = int.from_bytes(buf[2:4], "big")
+                        value = loads(bytes(buf[12:12 + length]))
+                        del buf[:12 + length]
+                        return msg_type, value, req_id
+                elif buf[0] >> 4 != 0xF:
+                    length = struct.unpack_from(">I", buf)[0] & 0x0FFFFFFF
+                    if len(buf) >= 4 + length:
+                        msg_type = buf[0] >> 4
+                        value = loads(bytes(buf[4:4 + length]))
+                        del buf[:4 + length]
+                        return msg_type, value, None
+            if not self._pull():
+                self._wait()
+
+    def close(self):
+        self.map.close()
+        for fd in (self.memfd, self.server_bell, self.client_bell):
+            os.close(fd)
+        self.sock.close()
+
+
+def run(client, payload: bytes, requests: int, window: int) -> tuple:
+    """Returns (us per round trip, pipelined requests/s)"""
+    send = client.send_raw if isinstance(client, ShmClient) else client.sock.sendall
+    request = frame(MSG_SEARCH, payload)
+
+    start = time.perf_counter()
+    for _ in range(requests):
+        send(request)
+        msg_type, result, _ = client.recv()
+        assert msg_type == MSG_MATCH_RESULT, result
+    rtt = (time.perf_counter() - start) / requests
+
+    start = time.perf_counter()
+    for first in range(0, requests, window):
+        count = min(window, requests - first)
+        send(b"".join(frame(MSG_SEARCH, payload, first + i) for i in range(count)))
+        for _ in range(count):
+            client.recv()
+    return rtt * 1e6, requests / (time.perf_counter() - start)
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--dims", default="128,768,1536", help="comma-separated vector sizes")
+    parser.add_argument("--requests", type=int, default=2000)
+    parser.add_argument("--window", type=int, default=32, help="requests in flight when pipelining")
+    parser.add_argument("--vectors", type=int, default=200, help="vectors in the index")
+    opts = parser.parse_args()
+
+    print(f"{'dims':>5} {'req_KB':>7} {'transport':>9} {'rtt_us':>8} {'pipelined/s':>12}")
+    for dims in (int(d) for d in opts.dims.split(",")):
+        with Servers(dims=dims) as servers:
+            client = Client(servers.index_socket)
+            for i in range(opts.vectors):
+                client.request(MSG_INSERT, [i + 1, 0, vector(dims, i)])
+            client.close()
+
+            payload = dumps([0, vector(dims, 3), 5])
+            for name, make in (("socket", Client), ("shm", ShmClient)):
+                client = make(servers.index_socket)
+                rtt, rate = run(client, payload, opts.requests, opts.window)
+                client.close()
+                print(f"{dims:>5} {len(payload) / 1024:>7.1f} {name:>9} {rtt:>8.1f} {rate:>12.0f}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""
+Slow-client test
+
+One client sends half a frame header, stalls, then trickles the rest of its
+SEARCH one byte at a time, while other clients time their own requests. A
+server that waits for the whole frame of the slow client would stall them
+for the whole trickle; here their latency must stay in the same range as
+without it. Exits with status 1 if it does not.
+
+    python3 trickle.py [--clients 4] [--requests 500] [--stall 1.0]
+"""
+
+import argparse
+import sys
+import threading
+import time
+
+from victorbench import MSG_MATCH_RESULT, MSG_INSERT, MSG_SEARCH, Client, Servers, dumps, frame, percentile, vector
+
+
+def measure(path: str, dims: int, clients: int, requests: int) -> list:
+    """Runs `clients` threads each timing `requests` SEARCH round trips"""
+    latencies: list = []
+    lock = threading.Lock()
+
+    def run(seed: int):
+        client = Client(path)
+        mine = []
+        for i in range(requests):
+            start = time.perf_counter()
+            msg_type, _ = client.request(MSG_SEARCH, [0, vector(dims, seed + i), 3])
+            mine.append(time.perf_counter() - start)
+            assert msg_type == MSG_MATCH_RESULT, msg_type
+        client.close()
+        with lock:
+            latencies.extend(mine)
+
+    threads = [threading.Thread(target=run, args=(k,)) for k in range(clients)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    return latencies
+
+
+def report(name: str, latencies: list):
+    print(f"{name:<10} requests={len(latencies)} p50={percentile(latencies, 50) * 1e3:.3f}ms "
+          f"p99={percentile(latencies, 99) * 1e3:.3f}ms max={max(latencies) * 1e3:.3f}ms")
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--dims", type=int, default=128)
+    parser.add_argument("--clients", type=int, default=4)
+    parser.add_argument("--requests", type=int, default=500)
+    parser.add_argument("--stall", type=float, default=1.0, help="seconds the slow client spends on its frame")
+    opts = parser.parse_args()
+
+    with Servers(dims=opts.dims) as servers:
+        path = servers.index_socket
+        client = Client(path)
+        for i in range(100):
+            client.request(MSG_INSERT, [i + 1, 0, vector(opts.dims, i)])
+        client.close()
+
+        report("baseline", measure(path, opts.dims, opts.clients, opts.requests))
+
+        slow = Client(path)
+        data = frame(MSG_SEARCH, dumps([0, vector(opts.dims, 1), 1]))
+        done = threading.Event()
+
+        def trickle():
+            slow.sock.sendall(data[:2])
+            time.sleep(opts.stall / 2)
+            pause = opts.stall / 2 / len(data)
+            for b in data[2:]:
+                slow.sock.sendall(bytes([b]))
+                time.sleep(pause)
+            done.set()
+
+        trickler = threading.Thread(target=trickle)
+        trickler.start()
+        time.sleep(0.05)
+        start = time.perf_counter()
+        latencies = measure(path, opts.dims, opts.clients, opts.requests)
+        elapsed = time.perf_counter() - start
+        overlapped = not done.is_set()
+        trickler.join()
+        msg_type, result, _ = slow.recv()
+        slow.close()
+        report("trickling", latencies)
+
+    if msg_type != MSG_MATCH_RESULT:
+        print(f"FAIL: slow client got message type {msg_type}: {result}")
+        return 1
+    if not overlapped:
+        print(f"note: the other clients finished after the trickle ({elapsed:.2f}s); raise --stall")
+    if max(latencies) >= opts.stall / 2:
+        print(f"FAIL: a request waited {max(latencies):.3f}s behind the slow client")
+        return 1
+    print("ok: other clients were not held up by the slow client")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
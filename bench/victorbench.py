@@ -0,0 +1,273 @@
+"""
+VictorDB benchmark helpers
+
+Minimal client and server launcher shared by the benchmark scripts. It only
+uses the Python standard library: CBOR values are encoded and decoded here,
+covering what the VictorDB protocol uses (unsigned integers, float32 and
+float64, byte and text strings, arrays, maps and tags).
+"""
+
+import os
+import shutil
+import socket
+import struct
+import subprocess
+import tempfile
+import time
+from typing import Any, List, Optional, Tuple
+
+# Message types (see src/protocol.h)
+MSG_INSERT = 0x01
+MSG_DELETE = 0x02
+MSG_SEARCH = 0x03
+MSG_MATCH_RESULT = 0x04
+MSG_PUT = 0x06
+MSG_DEL = 0x07
+MSG_GET = 0x08
+MSG_GET_RESULT = 0x09
+MSG_OP_RESULT = 0x0A
+MSG_ERROR = 0x0B
+MSG_INSERT_BATCH = 0x10
+MSG_SEARCH_BATCH = 0x11
+MSG_BATCH_RESULT = 0x12
+MSG_MATCH_BATCH_RESULT = 0x13
+MSG_STATS = 0x14
+MSG_STATS_RESULT = 0x15
+MSG_SHM_ATTACH = 0x17
+
+# Tag of a little-endian float32 typed array (RFC 8746)
+TAG_FLOAT32_LE = 85
+
+BIN_DIR = os.environ.get("VICTOR_BIN", os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src"))
+
+
+class Tag:
+    """CBOR tagged value"""
+
+    def __init__(self, tag: int, value: Any):
+        self.tag = tag
+        self.value = value
+
+    def __repr__(self):
+        return f"Tag({self.tag}, {self.value!r})"
+
+
+def _head(major: int, value: int) -> bytes:
+    if value < 24:
+        return bytes([major << 5 | value])
+    if value < 1 << 8:
+        return bytes([major << 5 | 24, value])
+    if value < 1 << 16:
+        return bytes([major << 5 | 25]) + struct.pack(">H", value)
+    if value < 1 << 32:
+        return bytes([major << 5 | 26]) + struct.pack(">I", value)
+    return bytes([major << 5 | 27]) + struct.pack(">Q", value)
+
+
+def dumps(value: Any) -> bytes:
+    """Encodes a value in CBOR (floats as float32, as the servers store them)"""
+    if isinstance(value, bool) or value is None:
+        return bytes([0xF5 if value else 0xF6 if value is None else 0xF4])
+    if isinstance(value, int):
+        return _head(0, value) if value >= 0 else _head(1, -1 - value)
+    if isinstance(value, float):
+        return b"\xfa" + struct.pack(">f", value)
+    if isinstance(value, (bytes, bytearray, memoryview)):
+        return _head(2, len(value)) + bytes(value)
+    if isinstance(value, str):
+        data = value.encode()
+        return _head(3, len(data)) + data
+    if isinstance(value, (list, tuple)):
+        return _head(4, len(value)) + b"".join(dumps(v) for v in value)
+    if isinstance(value, dict):
+        return _head(5, len(value)) + b"".join(dumps(k) + dumps(v) for k, v in value.items())
+    if isinstance(value, Tag):
+        return _head(6, value.tag) + dumps(value.value)
+    raise TypeError(f"cannot encode {type(value).__name__}")
+
+
+def _load(data: bytes, pos: int) -> Tuple[Any, int]:
+    ib = data[pos]
+    pos += 1
+    major, info = ib >> 5, ib & 31
+    if major == 7:
+        if info == 25:
+            return struct.unpack(">e", data[pos:pos + 2])[0], pos + 2
+        if info == 26:
+            return struct.unpack(">f", data[pos:pos + 4])[0], pos + 4
+        if info == 27:
+            return struct.unpack(">d", data[pos:pos + 8])[0], pos + 8
+        return {20: False, 21: True, 22: None}.get(info), pos
+    if info < 24:
+        value = info
+    else:
+        n = 1 << (info - 24)
+        value = int.from_bytes(data[pos:pos + n], "big")
+        pos += n
+    if major == 0:
+        return value, pos
+    if major == 1:
+        return -1 - value, pos
+    if major in (2, 3):
+        raw = data[pos:pos + value]
+        return (bytes(raw) if major == 2 else raw.decode()), pos + value
+    if major == 4:
+        items = []
+        for _ in range(value):
+            item, pos = _load(data, pos)
+            items.append(item)
+        return items, pos
+    if major == 5:
+        items = {}
+        for _ in range(value):
+            key, pos = _load(data, pos)
+            items[key], pos = _load(data, pos)
+        return items, pos
+    item, pos = _load(data, pos)
+    return Tag(value, item), pos
+
+
+def loads(data: bytes) -> Any:
+    """Decodes a CBOR value"""
+    return _load(data, 0)[0] if data else None
+
+
+def float32_block(values: List[float]) -> Tag:
+    """Packs floats as a little-endian float32 typed array"""
+    return Tag(TAG_FLOAT32_LE, struct.pack(f"<{len(values)}f", *values))
+
+
+def frame(msg_type: int, payload: bytes, req_id: Optional[int] = None) -> bytes:
+    """
+    Frames a message.
+
+    Types up to 0x0F fit the 4-byte header; larger ones, or a request id,
+    take the 12-byte header.
+    """
+    if req_id is None and msg_type < 0x10:
+        return struct.pack(">I", msg_type << 28 | len(payload)) + payload
+    return struct.pack(">BBHII", 0xF2, 0, msg_type, req_id or 0, len(payload)) + payload
+
+
+def recv_exact(sock: socket.socket, n: int) -> bytes:
+    """Reads exactly n bytes"""
+    data = bytearray()
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise EOFError("connection closed by the server")
+        data += chunk
+    return bytes(data)
+
+
+def recv_frame(sock: socket.socket) -> Tuple[int, Any, Optional[int]]:
+    """Reads a message: (type, decoded payload, request id or None)"""
+    head = struct.unpack(">I", recv_exact(sock, 4))[0]
+    if head >> 28 == 0xF:
+        msg_type = head & 0xFFFF
+        req_id, length = struct.unpack(">II", recv_exact(sock, 8))
+        return msg_type, loads(recv_exact(sock, length)), req_id
+    return head >> 28, loads(recv_exact(sock, head & 0x0FFFFFFF)), None
+
+
+class Client:
+    """Blocking client of one server"""
+
+    def __init__(self, path: str):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+
+    def send(self, msg_type: int, value: Any, req_id: Optional[int] = None):
+        self.sock.sendall(frame(msg_type, dumps(value), req_id))
+
+    def recv(self) -> Tuple[int, Any, Optional[int]]:
+        return recv_frame(self.sock)
+
+    def request(self, msg_type: int, value: Any) -> Tuple[int, Any]:
+        """Sends a request and waits for its response"""
+        self.send(msg_type, value)
+        return self.recv()[:2]
+
+    def stats(self) -> dict:
+        self.sock.sendall(frame(MSG_STATS, b"", 1))
+        return self.recv()[1]
+
+    def close(self):
+        self.sock.close()
+
+
+class Servers:
+    """
+    Runs victor_index and/or victor_table on a scratch database.
+
+    Used as a context manager; the database and sockets are removed on exit.
+    `env` adds environment variables (e.g. VICTOR_WAL_SYNC) to the servers'.
+    """
+
+    def __init__(self, dims: int = 128, index: bool = True, table: bool = False,
+                 env: Optional[dict] = None, root: Optional[str] = None, args: Optional[list] = None):
+        self.dims = dims
+        self.want_index = index
+        self.want_table = table
+        self.env = dict(os.environ, **(env or {}))
+        self.keep = root is not None
+        self.root = root or tempfile.mkdtemp(prefix="victorbench.")
+        self.args = args or []
+        self.env["VICTOR_DB_ROOT"] = self.root
+        self.index_socket = os.path.join(self.root, "index.sock")
+        self.table_socket = os.path.join(self.root, "table.sock")
+        self.procs: List[subprocess.Popen] = []
+        self.ready_s = 0.0
+
+    def _start(self, argv: List[str], path: str, log: str) -> subprocess.Popen:
+        start = time.perf_counter()
+        proc = subprocess.Popen(argv, env=self.env, stdout=subprocess.DEVNULL,
+                                stderr=open(os.path.join(self.root, log), "w"))
+        while True:
+            if proc.poll() is not None:
+                raise RuntimeError(f"{argv[0]} exited with {proc.returncode}, see {self.root}/{log}")
+            try:
+                Client(path).close()
+                break
+            except OSError:
+                time.sleep(0.002)
+        self.ready_s = time.perf_counter() - start
+        return proc
+
+    def start(self):
+        os.makedirs(self.root, exist_ok=True)
+        if self.want_index:
+            self.procs.append(self._start(
+                [os.path.join(BIN_DIR, "victor_index"), "-n", "bench", "-d", str(self.dims),
+                 "-u", self.index_socket] + self.args, self.index_socket, "index.log"))
+        if self.want_table:
+            self.procs.append(self._start(
+                [os.path.join(BIN_DIR, "victor_table"), "-n", "bench", "-u", self.table_socket],
+                self.table_socket, "table.log"))
+        return self
+
+    def stop(self):
+        for proc in self.procs:
+            proc.terminate()
+        for proc in self.procs:
+            proc.wait()
+        self.procs = []
+
+    def __enter__(self):
+        return self.start()
+
+    def __exit__(self, *exc):
+        self.stop()
+        if not self.keep:
+            shutil.rmtree(self.root, ignore_errors=True)
+
+
+def percentile(values: List[float], p: float) -> float:
+    """Nearest-rank percentile of unsorted values"""
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * p / 100))] if ordered else 0.0
+
+
+def vector(dims: int, seed: int) -> List[float]:
+    """Deterministic non-zero test vector"""
+    return [float((seed * 31 + i * 7) % 97 + 1) / 97.0 for i in range(dims)]
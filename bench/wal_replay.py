@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+"""
+WAL replay startup benchmark
+
+Writes a transaction log of each size with walgen (build it with
+`make walgen`), then times how long the server takes to replay it and
+accept connections, with one replay thread and with the default number.
+Checkpoints are disabled, so every start replays the whole log.
+
+    python3 wal_replay.py [--records 1000000,10000000] [--dims 128] [--table]
+"""
+
+import argparse
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+from victorbench import Servers
+
+WALGEN = os.path.join(os.path.dirname(os.path.abspath(__file__)), "walgen")
+
+NO_CHECKPOINT = {
+    "VICTOR_CHECKPOINT_BYTES": "0",
+    "VICTOR_CHECKPOINT_INTERVAL_MS": "0",
+    "VICTOR_CHECKPOINT_REPLAY_MS": "0",
+    "VICTOR_EXPORT_THRESHOLD": "0",
+}
+
+
+def replay(root: str, opts, threads: str) -> tuple:
+    """Starts the server on `root`; returns (seconds until ready, records replayed)"""
+    env = dict(NO_CHECKPOINT)
+    if threads:
+        env["VICTOR_REPLAY_THREADS"] = threads
+    servers = Servers(dims=opts.dims, index=not opts.table, table=opts.table, env=env, root=root)
+    with servers:
+        ready = servers.ready_s
+    log = open(os.path.join(root, "table.log" if opts.table else "index.log")).read()
+    match = re.search(r"(?:Transaction log recovered:|WAL import completed:) (\d+)", log)
+    return ready, int(match.group(1)) if match else 0
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--records", default="1000000,10000000", help="comma-separated log sizes")
+    parser.add_argument("--dims", type=int, default=128)
+    parser.add_argument("--table", action="store_true", help="replay PUTs into victor_table instead")
+    parser.add_argument("--threads", default="1,", help="VICTOR_REPLAY_THREADS values (empty: default)")
+    opts = parser.parse_args()
+
+    if not os.access(WALGEN, os.X_OK):
+        print(f"{WALGEN} not found: run `make walgen` first")
+        return 1
+
+    print(f"{'records':>10} {'log_MB':>8} {'threads':>8} {'startup_s':>10} {'records/s':>11}")
+    for count in (int(n) for n in opts.records.split(",")):
+        root = tempfile.mkdtemp(prefix="victorbench.")
+        argv = [WALGEN, "-n", str(count), "-d", str(opts.dims)] + (["-t"] if opts.table else [])
+        subprocess.run(argv + [os.path.join(root, "bench")], check=True, stdout=subprocess.DEVNULL)
+        size = sum(os.path.getsize(os.path.join(root, "bench", f)) for f in os.listdir(os.path.join(root, "bench")))
+        for threads in opts.threads.split(","):
+            ready, replayed = replay(root, opts, threads)
+            if replayed != count:
+                print(f"replayed {replayed} of {count} records, see {root}")
+                return 1
+            print(f"{count:>10} {size / 1e6:>8.0f} {threads or 'default':>8} {ready:>10.2f} {count / ready:>11.0f}")
+        shutil.rmtree(root, ignore_errors=True)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+"""
+WAL durability benchmark
+
+Runs concurrent INSERT clients against the index server in each durability
+mode (VICTOR_WAL_SYNC) and reports throughput and latency. Each client waits
+for its response before sending the next request, so in `flush` and `fsync`
+modes every response waits for the group commit of its record.
+
+    python3 wal_sync.py [--clients 16] [--requests 500] [--window-ms 0]
+"""
+
+import argparse
+import sys
+import threading
+import time
+
+from victorbench import MSG_INSERT, MSG_OP_RESULT, Client, Servers, percentile, vector
+
+
+def run_mode(mode: str, opts) -> tuple:
+    env = {"VICTOR_WAL_SYNC": mode, "VICTOR_WAL_WINDOW_MS": str(opts.window_ms)}
+    latencies: list = []
+    lock = threading.Lock()
+
+    with Servers(dims=opts.dims, env=env) as servers:
+        def run(k: int):
+            client = Client(servers.index_socket)
+            mine = []
+            for i in range(opts.requests):
+                msg = [k * opts.requests + i + 1, 0, vector(opts.dims, i)]
+                start = time.perf_counter()
+                msg_type, result = client.request(MSG_INSERT, msg)
+                mine.append(time.perf_counter() - start)
+                assert msg_type == MSG_OP_RESULT and result[0] == 0, result
+            client.close()
+            with lock:
+                latencies.extend(mine)
+
+        threads = [threading.Thread(target=run, args=(k,)) for k in range(opts.clients)]
+        start = time.perf_counter()
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        elapsed = time.perf_counter() - start
+    return len(latencies) / elapsed, percentile(latencies, 50), percentile(latencies, 99)
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--dims", type=int, default=128)
+    parser.add_argument("--clients", type=int, default=16)
+    parser.add_argument("--requests", type=int, default=500, help="inserts per client")
+    parser.add_argument("--window-ms", type=int, default=0, help="group commit window (VICTOR_WAL_WINDOW_MS)")
+    parser.add_argument("--modes", default="none,flush,fsync")
+    opts = parser.parse_args()
+
+    print(f"{'mode':<6} {'ops/s':>9} {'p50_ms':>8} {'p99_ms':>8}")
+    for mode in opts.modes.split(","):
+        ops, p50, p99 = run_mode(mode, opts)
+        print(f"{mode:<6} {ops:>9.0f} {p50 * 1e3:>8.3f} {p99 * 1e3:>8.3f}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
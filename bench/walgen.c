@@ -0,0 +1,121 @@
+/**
+ * @file walgen.c
+ * @brief Writes a synthetic transaction log, to time its replay at startup.
+ *
+ * The records are appended with wal_append(), so the segments are exactly
+ * what a server writes: INSERTs of distinct ids for victor_index (db.iwal),
+ * or PUTs of distinct keys for victor_table (db.twal, with -t). Run the
+ * server on the database directory afterwards to replay them.
+ *
+ * Usage: walgen [-t] [-n RECORDS] [-d DIMS] [-v BYTES] DIR
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "fileutils.h"
+#include "wal.h"
+
+static void print_usage(const char *prog_name) {
+    printf("Usage: %s [OPTIONS] DIR\n", prog_name);
+    printf("\nWrites a synthetic VictorDB transaction log into DIR.\n");
+    printf("\nOptions:\n");
+    printf("  -n, --records N   Number of records (default: 1000000)\n");
+    printf("  -d, --dims N      Vector dimensions of the INSERTs (default: 128)\n");
+    printf("  -t, --table       Write PUTs for victor_table instead of INSERTs\n");
+    printf("  -v, --value N     Value size of the PUTs in bytes (default: 64)\n");
+    printf("  -h, --help        Show this help message\n");
+}
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"records", required_argument, 0, 'n'},
+        {"dims",    required_argument, 0, 'd'},
+        {"table",   no_argument,       0, 't'},
+        {"value",   required_argument, 0, 'v'},
+        {"help",    no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+    uint64_t records = 1000000;
+    size_t dims = 128, vlen = 64;
+    int table = 0, opt;
+    char prefix[PATH_MAX], key[32];
+    float *vec;
+    uint8_t *val;
+    wal_t *wal;
+
+    while ((opt = getopt_long(argc, argv, "n:d:tv:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                records = strtoull(optarg, NULL, 10);
+                break;
+            case 'd':
+                dims = strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                table = 1;
+                break;
+            case 'v':
+                vlen = strtoul(optarg, NULL, 10);
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1 || dims == 0 || dims > UINT16_MAX) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (mkdir(argv[optind], 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    snprintf(prefix, sizeof(prefix), "%s/%s", argv[optind], table ? TWAL_FILE : IWAL_FILE);
+
+    vec = malloc(dims * sizeof(float));
+    val = malloc(vlen ? vlen : 1);
+    if (!vec || !val || (wal = wal_open(prefix, 1, WAL_SYNC_NONE, 0)) == NULL) {
+        fprintf(stderr, "unable to open %s: %s\n", prefix, strerror(errno));
+        return 1;
+    }
+    memset(val, 'v', vlen);
+
+    for (uint64_t i = 0; i < records; i++) {
+        wal_record_t rec = {0};
+
+        if (table) {
+            rec.op = WAL_OP_PUT;
+            rec.klen = (size_t)snprintf(key, sizeof(key), "key:%" PRIu64, i);
+            rec.key = key;
+            rec.val = val;
+            rec.vlen = vlen;
+        } else {
+            for (size_t d = 0; d < dims; d++)
+                vec[d] = (float)((i + d * 7) % 97 + 1) / 97.0f;
+            rec.op = WAL_OP_INSERT;
+            rec.id = i + 1;
+            rec.dims = dims;
+            rec.vectors = vec;
+        }
+        if (wal_append(wal, &rec) != 0) {
+            fprintf(stderr, "unable to append record %" PRIu64 ": %s\n", i, strerror(errno));
+            wal_close(wal);
+            return 1;
+        }
+    }
+    printf("%" PRIu64 " records, %" PRIu64 " bytes in %s.*\n", records, wal_size(wal), prefix);
+    wal_close(wal);
+    free(val);
+    free(vec);
+    return 0;
+}
@@ -1,65 +1,234 @@
 #include "buffer.h"
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
 #include "socket.h"
 #include <arpa/inet.h>
 /**
- * @brief Serializes a protocol header into a 4-byte buffer.
- *
- * El header ahora usa 4 bits para el tipo y 28 bits para el tamaño.
- * - Los 4 bits más altos: tipo (0-15)
- * - Los 28 bits restantes: tamaño (0-268435455)
+ * @brief Size of the serialized form of a header.
+ */
+static int hdr_size(const proto_header_t *hdr) {
+    return hdr->version == HDR_V2 ? HDR_V2_LEN : HDR_LEN;
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    v = htonl(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static uint32_t get_be32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntohl(v);
+}
+
+/**
+ * @brief Serializes a protocol header.
  *
- * El resultado se almacena en orden de red de 4 bytes (big-endian).
+ * The v1 header packs a 4-bit type and a 28-bit length in network order;
+ * type 0xF is reserved as the v2 escape. The v2 header is
+ * `[0xF2][flags][type:16][id:32][len:32]`, big endian.
  *
- * @param buff Pointer to a 4-byte buffer where the header will be written.
+ * @param buff Output area of hdr_size(hdr) bytes.
  * @param hdr Pointer to the protocol header to serialize.
- * @return 0 on success, -1 if the length exceeds 28-bit range.
+ * @return 0 on success, -1 if the type or length do not fit the header version.
  */
 static int hdr_serialize(uint8_t *buff, const proto_header_t *hdr) {
-    if (hdr->type > 0xF || hdr->len > 0x0FFFFFFF)
+    if (hdr->len < 0 || hdr->len > BUFFER_MAX_PAYLOAD || hdr->type < 0)
         return -1;
 
-    uint32_t raw = ((uint32_t)(hdr->type & 0xF) << 28) | (hdr->len & 0x0FFFFFFF);
-    raw = htonl(raw);
-    memcpy(buff, &raw, sizeof(raw));  
+    if (hdr->version != HDR_V2) {
+        if (hdr->type > HDR_V1_MAX_TYPE)
+            return -1;
+        put_be32(buff, ((uint32_t)hdr->type << 28) | (uint32_t)hdr->len);
+        return 0;
+    }
+
+    if (hdr->type > HDR_V2_MAX_TYPE)
+        return -1;
+    buff[0] = 0xF0 | HDR_V2;
+    buff[1] = hdr->flags;
+    buff[2] = (uint8_t)(hdr->type >> 8);
+    buff[3] = (uint8_t)hdr->type;
+    put_be32(buff + 4, hdr->id);
+    put_be32(buff + 8, (uint32_t)hdr->len);
     return 0;
 }
 
 /**
- * @brief Deserializes a 4-byte buffer into a protocol header.
+ * @brief Deserializes a protocol header of either version.
  *
- * Ahora espera:
- * - 4 bits altos: tipo
- * - 28 bits bajos: tamaño
- *
- * @param buff Pointer to the 4-byte buffer to unpack.
+ * @param buff Bytes available at the frame boundary.
+ * @param avail Number of bytes available in @p buff.
  * @param hdr Pointer to the protocol header structure to populate.
- * @return 0 on success, -1 if input pointers are NULL.
+ * @return Header size on success, 0 if more bytes are needed,
+ *         -1 if the header is invalid.
+ */
+static int hdr_deserialize(const uint8_t *buff, size_t avail, proto_header_t *hdr) {
+    uint32_t len;
+
+    if (avail < HDR_LEN)
+        return 0;
+
+    if ((buff[0] >> 4) != 0xF) {
+        uint32_t raw = get_be32(buff);
+        hdr->type    = (raw >> 28) & 0xF;
+        hdr->len     = raw & 0x0FFFFFFF;
+        hdr->version = HDR_V1;
+        hdr->flags   = 0;
+        hdr->id      = 0;
+        return HDR_LEN;
+    }
+
+    if ((buff[0] & 0xF) != HDR_V2)
+        return -1;
+    if (avail < HDR_V2_LEN)
+        return 0;
+    if (buff[1] & ~HDR_FLAGS_SUPPORTED)
+        return -1;
+    if ((len = get_be32(buff + 8)) > BUFFER_MAX_PAYLOAD)
+        return -1;
+
+    hdr->version = HDR_V2;
+    hdr->flags   = buff[1];
+    hdr->type    = ((int)buff[2] << 8) | buff[3];
+    hdr->id      = get_be32(buff + 4);
+    hdr->len     = (int)len;
+    return HDR_V2_LEN;
+}
+
+/**
+ * @brief Decodes a frame header from a partially received byte stream.
+ *
+ * @param raw Bytes received so far, starting at the frame boundary.
+ * @param avail Number of bytes available in @p raw.
+ * @param hdr Output header.
+ * @return Header size in bytes on success, 0 if more bytes are needed,
+ *         -1 if the header is invalid.
  */
-static int hdr_deserialize(uint8_t *buff, proto_header_t *hdr) {
-    if (!buff || !hdr)
+int buffer_decode_header(const uint8_t *raw, size_t avail, proto_header_t *hdr) {
+    return hdr_deserialize(raw, avail, hdr);
+}
+
+/**
+ * @brief Serializes the buffer header in front of its payload.
+ *
+ * @param buffer Buffer whose `hdr` describes the payload in `data`.
+ * @param frame Output pointer to the first byte of the frame.
+ * @return Total frame size in bytes, or -1 if the header cannot be encoded.
+ */
+int buffer_encode_header(buffer_t *buffer, const uint8_t **frame) {
+    uint8_t *start;
+
+    if (!buffer)
         return -1;
+    /* The header ends right where the payload starts. */
+    start = buffer->data - hdr_size(&buffer->hdr);
+    if (hdr_serialize(start, &buffer->hdr) < 0)
+        return -1;
+    *frame = start;
+    return hdr_size(&buffer->hdr) + buffer->hdr.len;
+}
+
+/** @brief Idle buffers ready for reuse */
+static buffer_t *pool = NULL;
+
+/** @brief Number of buffers in the pool */
+static size_t pool_size = 0;
 
-    uint32_t raw;
-    memcpy(&raw, buff, 4);
-    raw = ntohl(raw);
-    hdr->type = (raw >> 28) & 0xF;
-    hdr->len  = raw & 0x0FFFFFFF;
+/**
+ * @brief (Re)allocates the storage of a buffer for a given payload capacity.
+ *
+ * @return 0 on success, -1 on allocation failure (the buffer is left untouched).
+ */
+static int buffer_resize(buffer_t *b, size_t cap) {
+    uint8_t *p = realloc(b->_data, BUFFER_HEADROOM + cap);
+    if (!p)
+        return -1;
+    b->_data = p;
+    b->data  = p + BUFFER_HEADROOM;
+    b->cap   = cap;
     return 0;
 }
 
 /**
- * @brief Allocates and initializes a buffer_t structure.
+ * @brief Takes a buffer from the pool, allocating a new one if it is empty.
  *
- * @return Pointer to a new buffer_t structure, or NULL on failure.
+ * @return Pointer to a buffer_t structure, or NULL on failure.
  */
 buffer_t *alloc_buffer(void) {
-    buffer_t *b = (buffer_t *)calloc(1, sizeof(buffer_t));
-    b->data = &b->_data[4];
+    buffer_t *b = pool;
+
+    if (b) {
+        pool = b->next;
+        pool_size--;
+    } else {
+        b = (buffer_t *)calloc(1, sizeof(buffer_t));
+        if (!b)
+            return NULL;
+        if (buffer_resize(b, BUFFER_INITIAL_CAP) != 0) {
+            free(b);
+            return NULL;
+        }
+    }
+    b->next = NULL;
+    b->fd = -1;
+    memset(&b->hdr, 0, sizeof(proto_header_t));
+    b->hdr.version = HDR_V1;
     return b;
 }
 
+/**
+ * @brief Returns a buffer to the pool.
+ *
+ * @param buffer Buffer to release (may be NULL).
+ */
+void free_buffer(buffer_t *buffer) {
+    if (!buffer)
+        return;
+
+    if (buffer->fd >= 0) {
+        close(buffer->fd);
+        buffer->fd = -1;
+    }
+    if (pool_size >= BUFFER_POOL_MAX) {
+        free(buffer->_data);
+        free(buffer);
+        return;
+    }
+    if (buffer->cap > BUFFER_POOL_TRIM)
+        buffer_resize(buffer, BUFFER_INITIAL_CAP);
+
+    buffer->next = pool;
+    pool = buffer;
+    pool_size++;
+}
+
+/**
+ * @brief Ensures the payload area can hold at least @p len bytes.
+ *
+ * Capacity grows geometrically so that repeated small increments stay cheap.
+ *
+ * @param buffer Buffer to grow.
+ * @param len Required payload capacity.
+ * @return 0 on success, -1 if @p len exceeds BUFFER_MAX_PAYLOAD or on allocation failure.
+ */
+int buffer_reserve(buffer_t *buffer, size_t len) {
+    size_t cap;
+
+    if (!buffer || len > BUFFER_MAX_PAYLOAD)
+        return -1;
+    if (len <= buffer->cap)
+        return 0;
+
+    cap = buffer->cap * 2;
+    if (cap < len)
+        cap = len;
+    if (cap > BUFFER_MAX_PAYLOAD)
+        cap = BUFFER_MAX_PAYLOAD;
+    return buffer_resize(buffer, cap);
+}
+
 /**
  * @brief Receives a complete message from a file descriptor.
  *
@@ -70,15 +239,24 @@ buffer_t *alloc_buffer(void) {
  * @return 0 on success, -1 on failure or connection closed.
  */
 int recv_msg(int fd, buffer_t *buffer) {
+    int hlen;
+
     if (!buffer) return -1;
 
-    if (recv_all(fd, buffer->_data, 4) < 0)
+    if (recv_all(fd, buffer->_data, HDR_LEN) < 0)
         return -1;
 
-    if (hdr_deserialize(buffer->_data, &buffer->hdr) < 0)
+    hlen = hdr_deserialize(buffer->_data, HDR_LEN, &buffer->hdr);
+    if (hlen == 0) {
+        /* v2 header: fetch the remaining bytes. */
+        if (recv_all(fd, buffer->_data + HDR_LEN, HDR_V2_LEN - HDR_LEN) < 0)
+            return -1;
+        hlen = hdr_deserialize(buffer->_data, HDR_V2_LEN, &buffer->hdr);
+    }
+    if (hlen < 0)
         return -1;
 
-    if (buffer->hdr.len > 0x0FFFFFFF)
+    if (buffer_reserve(buffer, buffer->hdr.len) < 0)
         return -1;
 
     return recv_all(fd, buffer->data, buffer->hdr.len);
@@ -94,15 +272,37 @@ int recv_msg(int fd, buffer_t *buffer) {
  * @return 0 on success, -1 on failure.
  */
 int send_msg(int fd, buffer_t *buffer) {
-    if (!buffer) return -1;
+    const uint8_t *frame;
+    int len;
 
-    if (hdr_serialize(buffer->_data, &buffer->hdr) < 0)
+    if ((len = buffer_encode_header(buffer, &frame)) < 0)
         return -1;
 
-    return send_all(fd, buffer->_data, buffer->hdr.len+4);
+    return send_all(fd, frame, (size_t)len);
 }
 
 
+/**
+ * @brief Serializes the header of the WAL record holding a message.
+ *
+ * The record uses a v1 header whenever the type fits in one, regardless of
+ * the header the client sent, and never carries the client's request id.
+ *
+ * @param buf Message to log.
+ * @param raw Output area of at least HDR_V2_LEN bytes.
+ * @return Header size in bytes, or -1 on error.
+ */
+int buffer_wal_header(const buffer_t *buf, uint8_t *raw) {
+    proto_header_t hdr = buf->hdr;
+
+    hdr.version = hdr.type > HDR_V1_MAX_TYPE ? HDR_V2 : HDR_V1;
+    hdr.flags = 0;
+    hdr.id = 0;
+    if (hdr_serialize(raw, &hdr) < 0)
+        return -1;
+    return hdr_size(&hdr);
+}
+
 /**
  * @brief Dumps the buffer (header + payload) to a file (WAL).
  *
@@ -111,8 +311,13 @@ int send_msg(int fd, buffer_t *buffer) {
  * @return 0 on success, -1 on error.
  */
 int buffer_dump_wal(const buffer_t *buf, FILE *file) {
-    size_t total = 4 + buf->hdr.len;
-    if (fwrite(buf->_data, 1, total, file) != total)
+    uint8_t raw[HDR_V2_LEN];
+    int hlen;
+
+    if ((hlen = buffer_wal_header(buf, raw)) < 0)
+        return -1;
+    if (fwrite(raw, 1, hlen, file) != (size_t)hlen ||
+        fwrite(buf->data, 1, buf->hdr.len, file) != (size_t)buf->hdr.len)
         return -1;
     fflush(file);
     return 0;
@@ -122,7 +327,7 @@ int buffer_dump_wal(const buffer_t *buf, FILE *file) {
  * @brief Loads the buffer (header + payload) from a file (WAL).
  *
  * Reads a serialized message from the given file stream into the provided buffer.
- * The message must start with a 4-byte header, followed by a payload of variable size.
+ * The message must start with a v1 or v2 header, followed by a payload of variable size.
  *
  * @param buf Pointer to a buffer_t structure to populate.
  * @param file FILE* already opened in binary mode for reading.
@@ -138,16 +343,23 @@ int buffer_load_wal(buffer_t *buf, FILE *file) {
     if (!buf || !file)
         return -1;
 
-    size_t read = fread(buf->_data, 1, 4, file);
+    size_t read = fread(buf->_data, 1, HDR_LEN, file);
+    int hlen;
     if (read == 0 && feof(file))
         return 0; 
-    if (read != 4)
+    if (read != HDR_LEN)
         return -1;
 
-    if (hdr_deserialize(buf->_data, &buf->hdr) < 0)
+    hlen = hdr_deserialize(buf->_data, HDR_LEN, &buf->hdr);
+    if (hlen == 0) {
+        if (fread(buf->_data + HDR_LEN, 1, HDR_V2_LEN - HDR_LEN, file) != HDR_V2_LEN - HDR_LEN)
+            return -1;
+        hlen = hdr_deserialize(buf->_data, HDR_V2_LEN, &buf->hdr);
+    }
+    if (hlen < 0)
         return -1;
 
-    if (buf->hdr.len > 0x0FFFFFFF)
+    if (buffer_reserve(buf, buf->hdr.len) < 0)
         return -1;
 
     if (fread(buf->data, 1, buf->hdr.len, file) != (size_t) buf->hdr.len)
@@ -8,31 +8,139 @@
  * @brief Protocol header structure.
  *
  * Contains metadata about the message such as its length and type.
+ *
+ * Two wire formats exist, told apart by the high nibble of the first byte:
+ *
+ * - v1 (4 bytes, big endian): 4-bit type (0x0-0xE) and 28-bit length.
+ * - v2 (12 bytes, big endian), first nibble 0xF:
+ *   `[0xF2][flags:8][type:16][id:32][length:32]`
+ *
+ * Responses are sent with the version and request id of the request they
+ * answer, so v1 clients keep receiving v1 frames.
  */
 typedef struct {
     int len;
     int type;
+    uint8_t  version;  /**< HDR_V1 or HDR_V2 (0 is treated as HDR_V1) */
+    uint8_t  flags;    /**< v2 flags (HDR_FLAG_*) */
+    uint32_t id;       /**< v2 client chosen request id, echoed in the response */
 } proto_header_t;
 
+/** @brief Header format versions */
+#define HDR_V1 1
+#define HDR_V2 2
+
+/** @brief Highest type a v1 header can carry (0xF introduces a v2 header) */
+#define HDR_V1_MAX_TYPE 0xE
+
+/** @brief Highest type a v2 header can carry */
+#define HDR_V2_MAX_TYPE 0xFFFF
+
+/**
+ * @brief v2 flags.
+ *
+ * Reserved for payload compression and encoding hints. Frames carrying a
+ * flag this server does not implement are rejected as malformed, so that a
+ * flag may later change how the payload must be read.
+ */
+#define HDR_FLAG_COMPRESSED 0x01
+#define HDR_FLAGS_SUPPORTED 0x00
+
+/** @brief Largest payload a frame can carry (28-bit length field) */
+#define BUFFER_MAX_PAYLOAD  0x0FFFFFFF
+
+/** @brief Payload capacity of a freshly allocated buffer */
+#define BUFFER_INITIAL_CAP  4096
+
+/** @brief Buffers that grew past this size are shrunk when released to the pool */
+#define BUFFER_POOL_TRIM    (1024 * 1024)
+
+/** @brief Maximum number of idle buffers kept in the pool */
+#define BUFFER_POOL_MAX     64
+
 /**
  * @brief Buffer structure for message transmission.
  *
- * Includes the protocol header and a preallocated data buffer for reading/writing messages.
- * The maximum size is now 2^28-1 (268,435,455 bytes) + 4 bytes for the header.
+ * Holds the protocol header and a growable payload area. Room for the
+ * serialized frame header is reserved right in front of the payload, so a
+ * frame can be sent or logged as one contiguous block.
+ *
+ * Buffers are recycled through a pool: get one with alloc_buffer(), make
+ * room with buffer_reserve() and give it back with free_buffer().
  */
-typedef struct {
+typedef struct buffer {
     proto_header_t hdr;
-    uint8_t *data;
-    uint8_t _data[0x0FFFFFFF + 4];
+    uint8_t *data;          /**< Payload, placed after the header room */
+    uint8_t *_data;         /**< Allocation start (header room + payload) */
+    size_t   cap;           /**< Payload capacity in bytes */
+    int      fd;            /**< Descriptor received with the frame (SCM_RIGHTS), or -1.
+                                 Closed by free_buffer(). */
+    struct buffer *next;    /**< Pool link (internal) */
 } buffer_t;
 
+/** @brief Size in bytes of a serialized v1 frame header */
+#define HDR_LEN 4
+
+/** @brief Size in bytes of a serialized v2 frame header */
+#define HDR_V2_LEN 12
+
 /**
- * @brief Allocates and initializes a buffer_t structure.
+ * @brief Decodes a frame header from a partially received byte stream.
  *
- * @return Pointer to a new buffer_t structure, or NULL on failure.
+ * @param raw Bytes received so far, starting at the frame boundary.
+ * @param avail Number of bytes available in @p raw.
+ * @param hdr Output header.
+ * @return Header size in bytes on success, 0 if more bytes are needed,
+ *         -1 if the header is invalid.
+ */
+extern int buffer_decode_header(const uint8_t *raw, size_t avail, proto_header_t *hdr);
+
+/**
+ * @brief Serializes the buffer header in front of its payload.
+ *
+ * After this call the complete frame (header + payload) is laid out
+ * contiguously, starting at the returned address.
+ *
+ * @param buffer Buffer whose `hdr` describes the payload in `data`.
+ * @param frame Output pointer to the first byte of the frame.
+ * @return Total frame size in bytes, or -1 if the header cannot be encoded.
+ */
+extern int buffer_encode_header(buffer_t *buffer, const uint8_t **frame);
+
+/** @brief Header room reserved in front of the payload (largest header) */
+#define BUFFER_HEADROOM HDR_V2_LEN
+
+/**
+ * @brief Takes a buffer from the pool, allocating a new one if it is empty.
+ *
+ * The returned buffer has at least BUFFER_INITIAL_CAP bytes of payload room.
+ *
+ * @return Pointer to a buffer_t structure, or NULL on failure.
  */
 extern buffer_t *alloc_buffer(void);
 
+/**
+ * @brief Returns a buffer to the pool.
+ *
+ * Buffers larger than BUFFER_POOL_TRIM are shrunk back to BUFFER_INITIAL_CAP,
+ * and buffers beyond BUFFER_POOL_MAX idle entries are released to the system.
+ * A descriptor still attached to the buffer is closed.
+ *
+ * @param buffer Buffer to release (may be NULL).
+ */
+extern void free_buffer(buffer_t *buffer);
+
+/**
+ * @brief Ensures the payload area can hold at least @p len bytes.
+ *
+ * Existing payload bytes are preserved.
+ *
+ * @param buffer Buffer to grow.
+ * @param len Required payload capacity.
+ * @return 0 on success, -1 if @p len exceeds BUFFER_MAX_PAYLOAD or on allocation failure.
+ */
+extern int buffer_reserve(buffer_t *buffer, size_t len);
+
 /**
  * @brief Receives a complete message from a file descriptor.
  *
@@ -56,6 +164,15 @@ extern int recv_msg(int fd, buffer_t *buffer);
  */
 extern int send_msg(int fd, buffer_t *buffer);
 
+/**
+ * @brief Serializes the header of the WAL record holding a message.
+ *
+ * @param buf Message to log.
+ * @param raw Output area of at least HDR_V2_LEN bytes.
+ * @return Header size in bytes, or -1 on error.
+ */
+extern int buffer_wal_header(const buffer_t *buf, uint8_t *raw);
+
 extern int buffer_dump_wal(const buffer_t *buf, FILE *file);
 
 extern int buffer_load_wal(buffer_t *buf, FILE *file);
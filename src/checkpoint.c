@@ -0,0 +1,213 @@
+/**
+ * @file checkpoint.c
+ * @brief Checkpoint policy: when to export the database and retire the WAL.
+ */
+
+#include <string.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <time.h>
+#include "checkpoint.h"
+#include "server.h"
+#include "log.h"
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Gets the WAL bytes a replay would read now.
+ */
+static uint64_t pending_bytes(const checkpoint_t *cp, uint64_t wal_bytes) {
+    return cp->backlog + (wal_bytes - cp->base);
+}
+
+/**
+ * @brief Estimates how long replaying @p bytes takes (milliseconds).
+ */
+static uint64_t replay_estimate(const checkpoint_t *cp, uint64_t bytes) {
+    return (uint64_t)((double)bytes * 1000.0 / (double)cp->replay_rate);
+}
+
+/**
+ * @brief Gets the minimum time between the end of the last checkpoint and the next.
+ */
+static uint64_t min_gap(const checkpoint_t *cp, int reason) {
+    /* Even the replay limit waits as long as a checkpoint takes, so that
+     * failing ones are not retried back to back. */
+    return reason == CHECKPOINT_REPLAY ? cp->last_ms : cp->last_ms * CHECKPOINT_COST_RATIO;
+}
+
+void checkpoint_init(checkpoint_t *cp) {
+    memset(cp, 0, sizeof(checkpoint_t));
+    cp->bytes       = get_checkpoint_bytes();
+    cp->interval_ms = get_checkpoint_interval();
+    cp->replay_ms   = get_checkpoint_replay();
+    cp->ops         = (uint64_t)get_export_threshold();
+    cp->replay_rate = CHECKPOINT_REPLAY_RATE;
+    cp->since_ms    = now_ms();
+
+    log_message(LOG_INFO,
+        "Checkpoint policy: %" PRIu64 " WAL bytes, %" PRIu64 " ms interval, %" PRIu64
+        " ms replay, %" PRIu64 " operations (0 = off)",
+        cp->bytes, cp->interval_ms, cp->replay_ms, cp->ops
+    );
+}
+
+void checkpoint_replayed(checkpoint_t *cp, uint64_t bytes, uint64_t ms) {
+    cp->backlog = bytes;
+    if (bytes >= CHECKPOINT_REPLAY_SAMPLE && ms > 0)
+        cp->replay_rate = bytes * 1000 / ms;
+}
+
+int checkpoint_due(checkpoint_t *cp, uint64_t ops, uint64_t wal_bytes) {
+    uint64_t bytes = pending_bytes(cp, wal_bytes);
+    int64_t now = now_ms();
+    int reason = CHECKPOINT_NONE;
+
+    if (ops == 0 && bytes == 0)
+        return CHECKPOINT_NONE;
+
+    if (cp->replay_ms && replay_estimate(cp, bytes) >= cp->replay_ms)
+        reason = CHECKPOINT_REPLAY;
+    else if (cp->bytes && bytes >= cp->bytes)
+        reason = CHECKPOINT_BYTES;
+    else if (cp->ops && ops > cp->ops)
+        reason = CHECKPOINT_OPS;
+    else if (cp->interval_ms && (uint64_t)(now - cp->since_ms) >= cp->interval_ms)
+        reason = CHECKPOINT_INTERVAL;
+    if (reason == CHECKPOINT_NONE)
+        return CHECKPOINT_NONE;
+
+    if (cp->end_ms && (uint64_t)(now - cp->end_ms) < min_gap(cp, reason)) {
+        if (!cp->deferred)
+            cp->throttled++;
+        cp->deferred = reason;
+        return CHECKPOINT_NONE;
+    }
+    cp->deferred = 0;
+    cp->reason = reason;
+    cp->started[reason]++;
+    return reason;
+}
+
+int checkpoint_wakeup(const checkpoint_t *cp, uint64_t wal_bytes) {
+    int64_t now = now_ms(), at = -1;
+
+    if (cp->deferred)
+        at = cp->end_ms + (int64_t)min_gap(cp, cp->deferred);
+    else if (cp->interval_ms && pending_bytes(cp, wal_bytes) > 0)
+        at = cp->since_ms + (int64_t)cp->interval_ms;
+    if (at < 0)
+        return -1;
+    if (at <= now)
+        return 1;
+    return at - now > INT_MAX ? INT_MAX : (int)(at - now);
+}
+
+void checkpoint_start(checkpoint_t *cp, uint64_t wal_bytes) {
+    cp->prev_base = cp->base;
+    cp->prev_backlog = cp->backlog;
+    cp->base = wal_bytes;
+    cp->backlog = 0;
+    cp->start_ms = now_ms();
+}
+
+void checkpoint_done(checkpoint_t *cp, int ok) {
+    cp->end_ms = now_ms();
+    cp->last_ms = (uint64_t)(cp->end_ms - cp->start_ms);
+    if (ok) {
+        cp->since_ms = cp->start_ms;
+    } else {
+        cp->base = cp->prev_base;
+        cp->backlog = cp->prev_backlog;
+        cp->failed++;
+    }
+}
+
+/** @brief Settings a CONFIG request can change */
+static const struct {
+    const char *name;
+    size_t      off;
+} settings[] = {
+    { "checkpoint_bytes",       offsetof(checkpoint_t, bytes) },
+    { "checkpoint_interval_ms", offsetof(checkpoint_t, interval_ms) },
+    { "checkpoint_replay_ms",   offsetof(checkpoint_t, replay_ms) },
+    { "checkpoint_ops",         offsetof(checkpoint_t, ops) },
+};
+
+#define SETTINGS (sizeof(settings) / sizeof(settings[0]))
+
+static int setting_find(const char *name, size_t len) {
+    for (size_t i = 0; i < SETTINGS; i++)
+        if (strlen(settings[i].name) == len && memcmp(settings[i].name, name, len) == 0)
+            return (int)i;
+    return -1;
+}
+
+int checkpoint_set(checkpoint_t *cp, const char *name, size_t len, uint64_t value) {
+    int i = setting_find(name, len);
+
+    if (i < 0)
+        return -1;
+    *(uint64_t *)((char *)cp + settings[i].off) = value;
+    log_message(LOG_INFO, "Checkpoint policy: %s set to %" PRIu64, settings[i].name, value);
+    return 0;
+}
+
+int checkpoint_config(checkpoint_t *cp, buffer_t *msg) {
+    proto_setting_t req[SETTINGS];
+    proto_stat_t res[CHECKPOINT_STATS];
+    size_t n;
+
+    if (buffer_read_config(msg, req, SETTINGS, &n) != 0) {
+        log_message(LOG_WARNING, "invalid CONFIG message");
+        return -1;
+    }
+    /* All or nothing: check every name before changing anything. */
+    for (size_t i = 0; i < n; i++)
+        if (setting_find(req[i].name, req[i].len) < 0)
+            return buffer_write_op_result(msg, MSG_ERROR, 400, "unknown setting");
+    for (size_t i = 0; i < n; i++)
+        checkpoint_set(cp, req[i].name, req[i].len, req[i].value);
+
+    checkpoint_stats(cp, res, cp->base);
+    return buffer_write_stats(msg, res, SETTINGS);
+}
+
+size_t checkpoint_stats(const checkpoint_t *cp, proto_stat_t *stats, uint64_t wal_bytes) {
+    uint64_t bytes = pending_bytes(cp, wal_bytes);
+    proto_stat_t s[CHECKPOINT_STATS] = {
+        { "checkpoint_bytes",            cp->bytes },
+        { "checkpoint_interval_ms",      cp->interval_ms },
+        { "checkpoint_replay_ms",        cp->replay_ms },
+        { "checkpoint_ops",              cp->ops },
+        { "checkpoint_pending_bytes",    bytes },
+        { "checkpoint_replay_estimate_ms", replay_estimate(cp, bytes) },
+        { "checkpoint_replay_rate",      cp->replay_rate },
+        { "checkpoint_age_ms",           (uint64_t)(now_ms() - cp->since_ms) },
+        { "checkpoint_last_ms",          cp->last_ms },
+        { "checkpoint_reason",           (uint64_t)cp->reason },
+        { "checkpoints_bytes",           cp->started[CHECKPOINT_BYTES] },
+        { "checkpoints_interval",        cp->started[CHECKPOINT_INTERVAL] },
+        { "checkpoints_replay",          cp->started[CHECKPOINT_REPLAY] },
+        { "checkpoints_ops",             cp->started[CHECKPOINT_OPS] },
+        { "checkpoints_throttled",       cp->throttled },
+        { "checkpoints_failed",          cp->failed },
+    };
+
+    memcpy(stats, s, sizeof(s));
+    return CHECKPOINT_STATS;
+}
+
+const char *checkpoint_reason_name(int reason) {
+    switch (reason) {
+    case CHECKPOINT_BYTES:    return "WAL size";
+    case CHECKPOINT_INTERVAL: return "interval";
+    case CHECKPOINT_REPLAY:   return "replay time";
+    case CHECKPOINT_OPS:      return "operations";
+    default:                  return "none";
+    }
+}
@@ -0,0 +1,206 @@
+/**
+ * @file checkpoint.h
+ * @brief Checkpoint policy: when to export the database and retire the WAL.
+ *
+ * An export rewrites the whole database, so its cost does not depend on
+ * how many operations it covers, while the startup replay grows with the
+ * WAL. A checkpoint is started when one of these limits is reached:
+ *
+ * - `bytes`: WAL bytes written since the last checkpoint
+ *   (VICTOR_CHECKPOINT_BYTES, default 64 MiB).
+ * - `interval_ms`: time since the last checkpoint, if the WAL is not empty
+ *   (VICTOR_CHECKPOINT_INTERVAL_MS, default 10 minutes).
+ * - `replay_ms`: estimated time to replay the WAL at startup
+ *   (VICTOR_CHECKPOINT_REPLAY_MS, default 60 seconds). The estimate uses
+ *   the replay speed measured at the last startup.
+ * - `ops`: operations since the last checkpoint (VICTOR_EXPORT_THRESHOLD,
+ *   off by default).
+ *
+ * A limit of 0 is disabled. Except for `replay_ms`, which caps the
+ * recovery time, a checkpoint is not started until the time elapsed since
+ * the previous one is CHECKPOINT_COST_RATIO times what that one took, so
+ * the server spends at most a fraction of its time exporting.
+ *
+ * The policy is read from the environment once at startup and can be
+ * changed while serving with a CONFIG request (see checkpoint_set()).
+ */
+
+#ifndef __CHECKPOINT_H
+#define __CHECKPOINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "protocol.h"
+
+#define DEFAULT_CHECKPOINT_BYTES       (64ULL * 1024 * 1024)
+#define DEFAULT_CHECKPOINT_INTERVAL_MS (10ULL * 60 * 1000)
+#define DEFAULT_CHECKPOINT_REPLAY_MS   (60ULL * 1000)
+
+/** @brief Minimum time between checkpoints, in multiples of the last one's duration */
+#define CHECKPOINT_COST_RATIO 4
+
+/** @brief Replay speed assumed until one is measured (bytes per second) */
+#define CHECKPOINT_REPLAY_RATE (32ULL * 1024 * 1024)
+
+/** @brief Smallest replay timed to measure the replay speed (bytes) */
+#define CHECKPOINT_REPLAY_SAMPLE (1024 * 1024)
+
+/** @brief Reasons a checkpoint is started */
+#define CHECKPOINT_NONE     0
+#define CHECKPOINT_BYTES    1
+#define CHECKPOINT_INTERVAL 2
+#define CHECKPOINT_REPLAY   3
+#define CHECKPOINT_OPS      4
+#define CHECKPOINT_REASONS  5
+
+/** @brief Number of counters filled by checkpoint_stats() */
+#define CHECKPOINT_STATS 16
+
+/**
+ * @brief Gets a checkpoint limit from environment or default value.
+ *
+ * @param name Environment variable holding the limit (0 disables it).
+ * @param def Value used if it is not set or invalid.
+ * @return Limit
+ */
+static inline uint64_t get_checkpoint_limit(const char *name, uint64_t def) {
+    const char *env_val = getenv(name);
+    if (env_val && *env_val) {
+        char *end;
+        unsigned long long limit = strtoull(env_val, &end, 10);
+        if (*end == '\0' && *env_val != '-') {
+            return (uint64_t)limit;
+        }
+    }
+    return def;
+}
+
+/**
+ * @brief Gets the WAL size that starts a checkpoint (VICTOR_CHECKPOINT_BYTES).
+ */
+static inline uint64_t get_checkpoint_bytes(void) {
+    return get_checkpoint_limit("VICTOR_CHECKPOINT_BYTES", DEFAULT_CHECKPOINT_BYTES);
+}
+
+/**
+ * @brief Gets the time that starts a checkpoint (VICTOR_CHECKPOINT_INTERVAL_MS).
+ */
+static inline uint64_t get_checkpoint_interval(void) {
+    return get_checkpoint_limit("VICTOR_CHECKPOINT_INTERVAL_MS", DEFAULT_CHECKPOINT_INTERVAL_MS);
+}
+
+/**
+ * @brief Gets the estimated replay time that starts a checkpoint (VICTOR_CHECKPOINT_REPLAY_MS).
+ */
+static inline uint64_t get_checkpoint_replay(void) {
+    return get_checkpoint_limit("VICTOR_CHECKPOINT_REPLAY_MS", DEFAULT_CHECKPOINT_REPLAY_MS);
+}
+
+/** @brief Checkpoint policy and the state it decides on */
+typedef struct {
+    uint64_t bytes;          /**< WAL bytes limit, 0 if disabled */
+    uint64_t interval_ms;    /**< Time limit, 0 if disabled */
+    uint64_t replay_ms;      /**< Replay time limit, 0 if disabled */
+    uint64_t ops;            /**< Operation count limit, 0 if disabled */
+
+    uint64_t replay_rate;    /**< Measured replay speed (bytes per second) */
+    uint64_t backlog;        /**< WAL bytes replayed at startup, not checkpointed yet */
+    uint64_t base;           /**< wal_size() at the last checkpoint */
+    uint64_t prev_base;      /**< `base` and `backlog` before the running checkpoint */
+    uint64_t prev_backlog;
+    int64_t  since_ms;       /**< Start of the last successful checkpoint */
+    int64_t  start_ms;       /**< Start of the running checkpoint */
+    int64_t  end_ms;         /**< End of the last checkpoint, 0 if none */
+    uint64_t last_ms;        /**< Duration of the last checkpoint */
+    int      reason;         /**< Reason of the last checkpoint started */
+    int      deferred;       /**< A limit is reached but the cost ratio holds it back */
+    uint64_t started[CHECKPOINT_REASONS];
+    uint64_t throttled;      /**< Times a checkpoint was deferred by the cost ratio */
+    uint64_t failed;         /**< Checkpoints that failed */
+} checkpoint_t;
+
+/**
+ * @brief Reads the policy from the environment and starts the first interval.
+ */
+extern void checkpoint_init(checkpoint_t *cp);
+
+/**
+ * @brief Records the startup replay, which measures the replay speed.
+ *
+ * @param bytes WAL bytes replayed.
+ * @param ms Time the replay took.
+ */
+extern void checkpoint_replayed(checkpoint_t *cp, uint64_t bytes, uint64_t ms);
+
+/**
+ * @brief Decides whether a checkpoint must start now.
+ *
+ * @param ops Operations logged since the last checkpoint.
+ * @param wal_bytes Current wal_size().
+ * @return CHECKPOINT_NONE, or the CHECKPOINT_* reason to start one.
+ */
+extern int checkpoint_due(checkpoint_t *cp, uint64_t ops, uint64_t wal_bytes);
+
+/**
+ * @brief Gets how long the loop may sleep before checkpoint_due() must be asked again.
+ *
+ * @param wal_bytes Current wal_size().
+ * @return Milliseconds, or -1 if only new writes can make a checkpoint due.
+ */
+extern int checkpoint_wakeup(const checkpoint_t *cp, uint64_t wal_bytes);
+
+/**
+ * @brief Records that a checkpoint started, at the WAL cut.
+ *
+ * @param wal_bytes wal_size() at the cut.
+ */
+extern void checkpoint_start(checkpoint_t *cp, uint64_t wal_bytes);
+
+/**
+ * @brief Records the outcome of the running checkpoint.
+ *
+ * @param ok 1 if the export and the checkpoint file were written. If not,
+ *        the bytes it covered count towards the next one.
+ */
+extern void checkpoint_done(checkpoint_t *cp, int ok);
+
+/**
+ * @brief Changes a policy setting.
+ *
+ * @param name Setting name (`checkpoint_bytes`, `checkpoint_interval_ms`,
+ *        `checkpoint_replay_ms` or `checkpoint_ops`), not NUL terminated.
+ * @param len Length of @p name.
+ * @param value New limit, 0 to disable it.
+ * @return 0 on success, -1 if the setting is unknown.
+ */
+extern int checkpoint_set(checkpoint_t *cp, const char *name, size_t len, uint64_t value);
+
+/**
+ * @brief Handles a CONFIG request changing the policy.
+ *
+ * Either every setting of the request is applied or, if one is unknown,
+ * none is and the response is an error. Otherwise the response is a
+ * STATS_RESULT holding the policy.
+ *
+ * @param msg Request, overwritten by the response.
+ * @return 0 if a response must be sent, -1 if the request is malformed.
+ */
+extern int checkpoint_config(checkpoint_t *cp, buffer_t *msg);
+
+/**
+ * @brief Reports the policy and its decisions.
+ *
+ * @param stats Output array of CHECKPOINT_STATS counters, the policy
+ *        settings first.
+ * @param wal_bytes Current wal_size().
+ * @return Number of counters filled.
+ */
+extern size_t checkpoint_stats(const checkpoint_t *cp, proto_stat_t *stats, uint64_t wal_bytes);
+
+/**
+ * @brief Gets the name of a CHECKPOINT_* reason.
+ */
+extern const char *checkpoint_reason_name(int reason);
+
+#endif /* __CHECKPOINT_H */
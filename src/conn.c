@@ -0,0 +1,584 @@
+/**
+ * @file conn.c
+ * @brief Client connection table shared by the servers.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "conn.h"
+
+/** @brief Initial number of slots of a connection table */
+#define CONN_TABLE_INITIAL 64
+
+uint64_t conn_syscalls;
+
+conn_queues_t conn_queues;
+
+/** @brief Received descriptors must not leak into exported children */
+#if defined(MSG_CMSG_CLOEXEC)
+#define RECV_FLAGS MSG_CMSG_CLOEXEC
+#else
+#define RECV_FLAGS 0
+#endif
+
+void conn_table_init(conn_table_t *t) {
+    memset(t, 0, sizeof(conn_table_t));
+}
+
+/**
+ * @brief Grows the slot array so that @p fd is a valid index.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int conn_table_reserve(conn_table_t *t, int fd) {
+    size_t cap = t->cap ? t->cap : CONN_TABLE_INITIAL;
+    conn_t **slots;
+
+    if ((size_t)fd < t->cap)
+        return 0;
+    while (cap <= (size_t)fd)
+        cap *= 2;
+
+    slots = realloc(t->slots, cap * sizeof(conn_t *));
+    if (!slots)
+        return -1;
+    memset(slots + t->cap, 0, (cap - t->cap) * sizeof(conn_t *));
+    t->slots = slots;
+    t->cap = cap;
+    return 0;
+}
+
+conn_t *conn_table_add(conn_table_t *t, int fd) {
+    conn_t *c;
+
+    if (fd < 0 || conn_table_reserve(t, fd) != 0)
+        return NULL;
+
+    c = calloc(1, sizeof(conn_t));
+    if (!c)
+        return NULL;
+    c->fd = fd;
+    t->slots[fd] = c;
+    t->count++;
+    return c;
+}
+
+conn_t *conn_table_get(const conn_table_t *t, int fd) {
+    if (fd < 0 || (size_t)fd >= t->cap)
+        return NULL;
+    return t->slots[fd];
+}
+
+/**
+ * @brief Releases a connection, its input area and its queued requests.
+ */
+static void conn_free(conn_t *c) {
+    conn_queues.requests -= c->qlen;
+    conn_queues.bytes -= c->qbytes;
+    if (c->stalled)
+        conn_queues.stalled--;
+    while (c->head) {
+        conn_req_t *req = c->head;
+        c->head = req->next;
+        free_buffer(req->msg);
+        free(req);
+    }
+    shm_close(c->shm);
+    free(c->send);
+    for (int i = 0; i < c->nfds; i++)
+        close(c->fds[i]);
+    free(c->rbuf);
+    free(c);
+}
+
+int conn_table_alias(conn_table_t *t, int fd, conn_t *c) {
+    if (fd < 0 || conn_table_reserve(t, fd) != 0)
+        return -1;
+    t->slots[fd] = c;
+    return 0;
+}
+
+void conn_table_unalias(conn_table_t *t, int fd) {
+    if (fd >= 0 && (size_t)fd < t->cap)
+        t->slots[fd] = NULL;
+}
+
+void conn_table_remove(conn_table_t *t, int fd) {
+    conn_t *c = conn_table_get(t, fd);
+    if (!c)
+        return;
+    t->slots[fd] = NULL;
+    t->count--;
+    if (c->inflight > 0) {
+        c->closed = 1;
+        c->fd = -1;
+        return;
+    }
+    conn_free(c);
+}
+
+void conn_table_destroy(conn_table_t *t) {
+    for (size_t i = 0; i < t->cap; i++) {
+        /* Aliases point to a connection released through its own slot. */
+        if (t->slots[i] && (size_t)t->slots[i]->fd == i) {
+            close(t->slots[i]->fd);
+            conn_free(t->slots[i]);
+        }
+    }
+    free(t->slots);
+    memset(t, 0, sizeof(conn_table_t));
+}
+
+/**
+ * @brief Grows an I/O area to at least @p need bytes.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int area_reserve(uint8_t **area, size_t *cap, size_t need) {
+    size_t ncap = *cap ? *cap : CONN_READ_CHUNK;
+    uint8_t *p;
+
+    if (need <= *cap)
+        return 0;
+    while (ncap < need)
+        ncap *= 2;
+    if ((p = realloc(*area, ncap)) == NULL)
+        return -1;
+    *area = p;
+    *cap = ncap;
+    return 0;
+}
+
+/**
+ * @brief Releases an I/O area that grew past CONN_BUFFER_KEEP once drained.
+ */
+static void area_trim(uint8_t **area, size_t *cap) {
+    if (*cap > CONN_BUFFER_KEEP) {
+        free(*area);
+        *area = NULL;
+        *cap = 0;
+    }
+}
+
+/**
+ * @brief Keeps the descriptors that came with the bytes received at stream offset @p at.
+ */
+static void keep_fds(conn_t *c, struct msghdr *mh, uint64_t at) {
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(mh); cm; cm = CMSG_NXTHDR(mh, cm)) {
+        size_t n;
+
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+            continue;
+        n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < n; i++) {
+            int fd;
+
+            memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+            if (c->nfds == CONN_FDS_MAX) {
+                close(fd);
+                continue;
+            }
+            c->fds[c->nfds] = fd;
+            c->fds_at[c->nfds++] = at;
+        }
+    }
+}
+
+/**
+ * @brief Hands the descriptors that came with the frame ending at stream offset @p end to @p msg.
+ */
+static void take_fds(conn_t *c, buffer_t *msg, uint64_t end) {
+    int n = 0;
+
+    while (n < c->nfds && c->fds_at[n] < end) {
+        if (msg->fd < 0)
+            msg->fd = c->fds[n];
+        else
+            close(c->fds[n]);
+        n++;
+    }
+    if (n == 0)
+        return;
+    c->nfds -= n;
+    memmove(c->fds, c->fds + n, (size_t)c->nfds * sizeof(int));
+    memmove(c->fds_at, c->fds_at + n, (size_t)c->nfds * sizeof(uint64_t));
+}
+
+/**
+ * @brief Makes room in the input area for the rest of the current frame,
+ *        and at least @p min bytes.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int make_room(conn_t *c, size_t min) {
+    size_t room;
+
+    if (c->roff > 0) {
+        memmove(c->rbuf, c->rbuf + c->roff, c->rlen - c->roff);
+        c->rlen -= c->roff;
+        c->roff = 0;
+    }
+
+    /* Make room for the rest of the current frame in one go. */
+    room = c->want > c->rlen ? c->want - c->rlen : 0;
+    if (room < min)
+        room = min;
+    return area_reserve(&c->rbuf, &c->rcap, c->rlen + room);
+}
+
+int conn_read(conn_t *c) {
+    union {
+        struct cmsghdr hdr;
+        char           space[CMSG_SPACE(CONN_FDS_MAX * sizeof(int))];
+    } ctl;
+    struct msghdr mh;
+    struct iovec iov;
+    ssize_t r;
+
+    if (c->shm)
+        return shm_poll(c->shm);
+
+    if (make_room(c, CONN_READ_CHUNK) != 0)
+        return -1;
+
+    for (;;) {
+        iov.iov_base = c->rbuf + c->rlen;
+        iov.iov_len = c->rcap - c->rlen;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = ctl.space;
+        mh.msg_controllen = sizeof(ctl.space);
+        conn_syscalls++;
+        r = recvmsg(c->fd, &mh, RECV_FLAGS);
+        if (r >= 0 && mh.msg_controllen > 0)
+            keep_fds(c, &mh, c->rpos + (c->rlen - c->roff));
+        if (r > 0) {
+            c->rlen += (size_t)r;
+            return 1;
+        }
+        if (r == 0) {
+            c->eof = 1;
+            return -1;
+        }
+        if (errno == EINTR)
+            continue;
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+}
+
+int conn_feed(conn_t *c, const uint8_t *p, size_t len, struct msghdr *ctl) {
+    if (ctl && ctl->msg_controllen > 0)
+        keep_fds(c, ctl, c->rpos + (c->rlen - c->roff));
+    if (make_room(c, len) != 0)
+        return -1;
+    memcpy(c->rbuf + c->rlen, p, len);
+    c->rlen += len;
+    return 0;
+}
+
+/**
+ * @brief Copies the frame at the start of @p p into @p msg, if it is complete.
+ *
+ * @param used Output size of the frame, or of what is needed to complete it.
+ * @return 1 if a frame was copied, 0 if more bytes are needed, -1 if the
+ *         stream is malformed.
+ */
+static int take_frame(const uint8_t *p, size_t avail, buffer_t *msg, size_t *used) {
+    proto_header_t hdr;
+    int hlen;
+
+    hlen = buffer_decode_header(p, avail, &hdr);
+    if (hlen < 0)
+        return -1;
+    if (hlen == 0) {
+        *used = HDR_LEN;
+        return 0;
+    }
+
+    *used = (size_t)hlen + (size_t)hdr.len;
+    if (avail < *used)
+        return 0;
+
+    if (buffer_reserve(msg, (size_t)hdr.len) != 0)
+        return -1;
+    memcpy(msg->data, p + hlen, (size_t)hdr.len);
+    msg->hdr = hdr;
+    return 1;
+}
+
+int conn_next_frame(conn_t *c, buffer_t *msg) {
+    size_t avail, total;
+    int r;
+
+    if (c->shm) {
+        const uint8_t *p = shm_peek(c->shm, &avail);
+        if ((r = take_frame(p, avail, msg, &total)) == 1)
+            shm_consume(c->shm, total);
+        /* A request must fit in the ring to ever be complete. */
+        return (r == 0 && total > shm_size(c->shm)) ? -1 : r;
+    }
+
+    avail = c->rlen - c->roff;
+    if ((r = take_frame(c->rbuf + c->roff, avail, msg, &total)) != 1) {
+        c->want = total;
+        return r;
+    }
+    if (c->nfds > 0)
+        take_fds(c, msg, c->rpos + total);
+    c->roff += total;
+    c->rpos += total;
+    c->want = 0;
+
+    if (c->roff == c->rlen) {
+        c->roff = c->rlen = 0;
+        area_trim(&c->rbuf, &c->rcap);
+    }
+    return 1;
+}
+
+conn_req_t *conn_push(conn_t *c, buffer_t *msg) {
+    conn_req_t *req = calloc(1, sizeof(conn_req_t));
+    if (!req)
+        return NULL;
+    req->conn = c;
+    req->msg = msg;
+    req->prev = c->tail;
+    if (c->tail)
+        c->tail->next = req;
+    else
+        c->head = req;
+    c->tail = req;
+    c->qlen++;
+    conn_queues.requests++;
+    return req;
+}
+
+void conn_ready(conn_req_t *req) {
+    conn_t *c = req->conn;
+    const uint8_t *frame;
+    int len;
+
+    req->ready = 1;
+    if ((len = buffer_encode_header(req->msg, &frame)) < 0)
+        return;     /* conn_flush() fails on it, closing the connection. */
+    c->qbytes += (size_t)len;
+    conn_queues.bytes += (uint64_t)len;
+    if (c->qbytes > conn_queues.peak)
+        conn_queues.peak = c->qbytes;
+}
+
+int conn_complete(conn_req_t *req) {
+    conn_t *c = req->conn;
+
+    conn_ready(req);
+    c->inflight--;
+    if (!c->closed)
+        return 0;
+    if (c->inflight == 0)
+        conn_free(c);
+    return -1;
+}
+
+/**
+ * @brief Removes a request from its connection queue.
+ */
+static void conn_unlink(conn_t *c, conn_req_t *req) {
+    if (req->prev)
+        req->prev->next = req->next;
+    else
+        c->head = req->next;
+    if (req->next)
+        req->next->prev = req->prev;
+    else
+        c->tail = req->prev;
+    req->prev = req->next = NULL;
+}
+
+/**
+ * @brief Tells whether a response may overtake earlier ones.
+ *
+ * v2 responses carry the request id, so clients can match them in any
+ * order. v1 responses can only be matched by position.
+ */
+static int conn_unordered(const conn_req_t *req) {
+    return req->msg->hdr.version == HDR_V2;
+}
+
+/**
+ * @brief Gathers the completed responses that can be sent now.
+ *
+ * @return Number of responses gathered, or -1 if one cannot be encoded.
+ */
+static int gather(conn_t *c, struct iovec *iov, conn_req_t **batch) {
+    int cnt = 0, blocked = 0;
+
+    /*
+     * Gather completed responses in arrival order. A v1 request still
+     * running holds back the v1 responses behind it; v2 responses go
+     * out as soon as they are ready. A partially sent response is
+     * always at the head, so its bytes are never interleaved.
+     */
+    for (conn_req_t *req = c->head; req && cnt < CONN_IOV_MAX; req = req->next) {
+        const uint8_t *frame;
+        size_t off;
+        int len;
+
+        if (!req->ready) {
+            blocked |= !conn_unordered(req);
+            continue;
+        }
+        if (blocked && !conn_unordered(req))
+            continue;
+        if ((len = buffer_encode_header(req->msg, &frame)) < 0)
+            return -1;
+        off = (req == c->head) ? c->woff : 0;
+        iov[cnt].iov_base = (void *)(frame + off);
+        iov[cnt].iov_len  = (size_t)len - off;
+        batch[cnt++] = req;
+    }
+    return cnt;
+}
+
+/**
+ * @brief Releases the responses fully sent out of a gathered batch.
+ *
+ * @param w Number of bytes sent.
+ */
+static void advance(conn_t *c, const struct iovec *iov, conn_req_t **batch, int cnt, size_t w) {
+    /* Only responses counted by conn_ready() are gathered. */
+    c->qbytes -= w;
+    conn_queues.bytes -= w;
+    for (int i = 0; i < cnt && w > 0; i++) {
+        conn_req_t *req = batch[i];
+
+        if (w < iov[i].iov_len) {
+            /* Move the partially sent response to the head. */
+            c->woff = (req == c->head ? c->woff : 0) + w;
+            if (req != c->head) {
+                conn_unlink(c, req);
+                req->next = c->head;
+                c->head->prev = req;
+                c->head = req;
+            }
+            break;
+        }
+        w -= iov[i].iov_len;
+        if (req == c->head)
+            c->woff = 0;
+        conn_unlink(c, req);
+        c->qlen--;
+        conn_queues.requests--;
+        free_buffer(req->msg);
+        free(req);
+    }
+}
+
+/**
+ * @brief Writes completed responses to the socket, or to the response ring.
+ *
+ * @return See conn_flush().
+ */
+static int flush_responses(conn_t *c) {
+    struct iovec iov[CONN_IOV_MAX];
+    conn_req_t *batch[CONN_IOV_MAX];
+
+    for (;;) {
+        struct msghdr mh;
+        ssize_t w;
+        int cnt;
+
+        if ((cnt = gather(c, iov, batch)) <= 0) {
+            if (cnt < 0)
+                return -1;
+            break;
+        }
+
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = iov;
+        mh.msg_iovlen = cnt;
+        if (!c->shm)
+            conn_syscalls++;
+        w = c->shm ? shm_writev(c->shm, iov, cnt) : sendmsg(c->fd, &mh, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 1;
+        if (w <= 0)
+            return -1;
+        advance(c, iov, batch, cnt, (size_t)w);
+    }
+    return c->head ? 1 : 0;
+}
+
+int conn_flush(conn_t *c) {
+    int r = flush_responses(c);
+
+    /* One wakeup for everything consumed and produced meanwhile. */
+    if (c->shm)
+        shm_kick(c->shm);
+    return r;
+}
+
+/**
+ * @brief Tells whether the output queue of a connection holds more than a fraction of its bound.
+ *
+ * @param shift Fraction of the bounds, as a right shift (0 for the bounds).
+ */
+static int queue_above(const conn_t *c, size_t max, int shift) {
+    return c->qlen >= ((size_t)CONN_QUEUE_MAX >> shift) || c->qbytes >= (max >> shift);
+}
+
+int conn_stall(conn_t *c, size_t max) {
+    if (c->stalled || !queue_above(c, max, 0))
+        return c->stalled;
+    c->stalled = 1;
+    conn_queues.stalls++;
+    conn_queues.stalled++;
+    return 1;
+}
+
+int conn_resume(conn_t *c, size_t max) {
+    if (!c->stalled || queue_above(c, max, 1))
+        return 0;
+    c->stalled = 0;
+    conn_queues.stalled--;
+    return 1;
+}
+
+int conn_send_begin(conn_t *c) {
+    conn_send_t *s = c->send;
+    int cnt;
+
+    if (!s && (s = c->send = calloc(1, sizeof(conn_send_t))) == NULL)
+        return -1;
+    if ((cnt = gather(c, s->iov, s->batch)) <= 0)
+        return cnt;
+    memset(&s->mh, 0, sizeof(s->mh));
+    s->mh.msg_iov = s->iov;
+    s->mh.msg_iovlen = cnt;
+    s->cnt = cnt;
+    return cnt;
+}
+
+int conn_send_end(conn_t *c, size_t sent) {
+    conn_send_t *s = c->send;
+
+    advance(c, s->iov, s->batch, s->cnt, sent);
+    s->cnt = 0;
+    return c->head ? 1 : 0;
+}
+
+int conn_attach_shm(conn_t *c, shm_t *sh) {
+    if (c->head || c->rlen > c->roff) {
+        errno = EBUSY;
+        return -1;
+    }
+    c->shm = sh;
+    c->want = 0;
+    return 0;
+}
@@ -0,0 +1,373 @@
+/**
+ * @file conn.h
+ * @brief Client connection table shared by the servers.
+ *
+ * Connections are indexed directly by file descriptor. The table grows on
+ * demand, so the number of simultaneous clients is bounded only by the
+ * process descriptor limit.
+ */
+
+#ifndef __CONN_H
+#define __CONN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "buffer.h"
+#include "workers.h"
+#include "shm.h"
+
+/** @brief Minimum free space requested from the kernel on each read */
+#define CONN_READ_CHUNK   (64 * 1024)
+
+/** @brief Input areas larger than this are released once drained */
+#define CONN_BUFFER_KEEP  (1024 * 1024)
+
+/** @brief Maximum number of responses gathered by a single write */
+#define CONN_IOV_MAX      64
+
+/** @brief Maximum number of received descriptors waiting for their frame */
+#define CONN_FDS_MAX      4
+
+/** @brief Maximum number of requests queued on a connection, answered or not */
+#define CONN_QUEUE_MAX    1024
+
+/** @brief Default bound of the unsent responses of a connection (bytes) */
+#define DEFAULT_OUTPUT_QUEUE_BYTES (4 * 1024 * 1024)
+
+/**
+ * @brief Gets the output queue bound from environment or default value.
+ *
+ * Reads the VICTOR_OUTPUT_QUEUE_BYTES environment variable: the bytes of
+ * responses a connection may have waiting to be sent before the server
+ * stops reading its requests. If not set or invalid, returns
+ * DEFAULT_OUTPUT_QUEUE_BYTES.
+ *
+ * @return Output queue bound in bytes
+ */
+static inline size_t get_output_queue_bytes(void) {
+    const char *env_val = getenv("VICTOR_OUTPUT_QUEUE_BYTES");
+    if (env_val && *env_val) {
+        char *end;
+        unsigned long long bytes = strtoull(env_val, &end, 10);
+        if (*end == '\0' && *env_val != '-' && bytes > 0) {
+            return (size_t)bytes;
+        }
+    }
+    return DEFAULT_OUTPUT_QUEUE_BYTES;
+}
+
+struct conn;
+
+/**
+ * @brief A request waiting for its response to be sent.
+ *
+ * The request is decoded into its own buffer, which is overwritten in place
+ * by the response. Requests stay queued on their connection in arrival
+ * order. Responses to v1 requests are sent in that order even when later
+ * requests complete first; responses to v2 requests carry the request id
+ * and are sent as soon as they are ready.
+ */
+typedef struct conn_req {
+    work_t           work;    /**< Worker pool job, used when the request is deferred */
+    struct conn     *conn;    /**< Owning connection */
+    buffer_t        *msg;     /**< Request, then response */
+    void            *arg;     /**< Opaque pointer for the code completing the request */
+    int              status;  /**< Handler result, -1 closes the connection */
+    int              ready;   /**< Response is complete and can be sent */
+    struct conn_req *prev;    /**< Previous request in arrival order */
+    struct conn_req *next;    /**< Next request in arrival order */
+} conn_req_t;
+
+/**
+ * @brief Responses handed to an asynchronous send (io_uring backend).
+ *
+ * Kept until the send completes: the kernel reads the message header, the
+ * vector and the frames it points to meanwhile.
+ */
+typedef struct {
+    struct msghdr mh;
+    struct iovec  iov[CONN_IOV_MAX];
+    conn_req_t   *batch[CONN_IOV_MAX];
+    int           cnt;     /**< Responses in flight, 0 if no send is running */
+} conn_send_t;
+
+/**
+ * @brief State of a single client connection.
+ *
+ * Sockets are non-blocking. Incoming bytes accumulate in the input area
+ * until a complete frame is available, so a client that stalls in the middle
+ * of a frame never blocks the server. Responses are written out as they
+ * complete and as the socket accepts them (see conn_req_t for ordering).
+ * Once shared-memory rings are attached, frames are read from and written
+ * to the rings instead, with the same ordering.
+ *
+ * The output queue is bounded: once a connection has too many requests
+ * queued, or too many response bytes waiting to be sent, the server stops
+ * reading from it (see conn_stall()) until the client has read enough.
+ * A client that stops reading thus only fills its own queue and, through
+ * the socket buffers, blocks its own writes.
+ */
+typedef struct conn {
+    int fd;          /**< Connected socket descriptor (-1 once closed) */
+    int eof;         /**< Peer has shut down its sending side */
+    int closed;      /**< Removed from the table, waiting for deferred requests */
+    int inflight;    /**< Deferred requests not yet completed */
+    int writing;     /**< Requests queued on the writer thread (see SERVER_WRITE) */
+
+    uint8_t *rbuf;   /**< Input area */
+    size_t   rcap;   /**< Input area capacity */
+    size_t   rlen;   /**< Bytes received into the input area */
+    size_t   roff;   /**< Start of the first unparsed frame */
+    size_t   want;   /**< Bytes needed from `roff` to complete the current frame */
+    uint64_t rpos;   /**< Stream offset of the byte at `roff` */
+
+    int      fds[CONN_FDS_MAX];     /**< Descriptors received (SCM_RIGHTS), oldest first */
+    uint64_t fds_at[CONN_FDS_MAX];  /**< Stream offset of the byte each one came with */
+    int      nfds;
+
+    shm_t *shm;      /**< Shared-memory rings replacing the socket (see shm.h), or NULL */
+
+    conn_send_t *send;  /**< Asynchronous send (io_uring backend), NULL until the first one */
+    int ring_ops;       /**< Operations of the io_uring backend pending on the connection */
+    int closing;        /**< Closed by the io_uring backend, waiting for `ring_ops` to drain */
+    int receiving;      /**< The multishot receive of the io_uring backend is armed */
+
+    conn_req_t *head;  /**< Oldest request without a fully sent response */
+    conn_req_t *tail;  /**< Newest request */
+    size_t      woff;  /**< Bytes already sent of the head response (a partially
+                            sent response is always moved to the head) */
+    size_t      qlen;    /**< Requests queued */
+    size_t      qbytes;  /**< Bytes of complete responses not sent yet */
+    int         stalled; /**< Not read until the output queue drains (see conn_stall()) */
+} conn_t;
+
+/** @brief System calls made by conn_read() and conn_flush() on sockets (loop thread only) */
+extern uint64_t conn_syscalls;
+
+/** @brief Output queues of every connection (loop thread only) */
+typedef struct {
+    uint64_t requests;  /**< Requests queued */
+    uint64_t bytes;     /**< Bytes of complete responses not sent yet */
+    uint64_t peak;      /**< Largest `qbytes` of a connection so far */
+    uint64_t stalls;    /**< Times a connection was stalled by its output queue */
+    uint64_t stalled;   /**< Connections stalled right now */
+} conn_queues_t;
+
+extern conn_queues_t conn_queues;
+
+/**
+ * @brief Dynamically sized table of connections indexed by descriptor.
+ */
+typedef struct {
+    conn_t **slots;  /**< Slot array, slots[fd] is NULL when fd is not a client */
+    size_t   cap;    /**< Number of slots allocated */
+    size_t   count;  /**< Number of live connections */
+} conn_table_t;
+
+/**
+ * @brief Initializes an empty connection table.
+ *
+ * @param t Table to initialize.
+ */
+extern void conn_table_init(conn_table_t *t);
+
+/**
+ * @brief Creates and registers a connection for a descriptor.
+ *
+ * @param t Connection table.
+ * @param fd Connected socket descriptor.
+ * @return Pointer to the new connection, or NULL on allocation failure.
+ */
+extern conn_t *conn_table_add(conn_table_t *t, int fd);
+
+/**
+ * @brief Looks up the connection bound to a descriptor.
+ *
+ * @param t Connection table.
+ * @param fd Socket descriptor.
+ * @return Pointer to the connection, or NULL if @p fd is not a client.
+ */
+extern conn_t *conn_table_get(const conn_table_t *t, int fd);
+
+/**
+ * @brief Binds another descriptor to a connection (e.g. its shared-memory doorbell).
+ *
+ * @param t Connection table.
+ * @param fd Descriptor.
+ * @param c Connection it belongs to.
+ * @return 0 on success, -1 on allocation failure.
+ */
+extern int conn_table_alias(conn_table_t *t, int fd, conn_t *c);
+
+/**
+ * @brief Unbinds a descriptor bound by conn_table_alias().
+ *
+ * @param t Connection table.
+ * @param fd Descriptor.
+ */
+extern void conn_table_unalias(conn_table_t *t, int fd);
+
+/**
+ * @brief Unregisters and releases a connection.
+ *
+ * The socket itself is not closed. If deferred requests are still running,
+ * the connection is only marked closed and is released by the last
+ * conn_complete() call.
+ *
+ * @param t Connection table.
+ * @param fd Socket descriptor.
+ */
+extern void conn_table_remove(conn_table_t *t, int fd);
+
+/**
+ * @brief Reads whatever the socket has available into the input area.
+ *
+ * With shared-memory rings attached, nothing is copied: the frames are
+ * taken from the request ring by conn_next_frame().
+ *
+ * Descriptors passed by the client (SCM_RIGHTS, UNIX sockets only) are
+ * kept along with the position of the byte they came with, up to
+ * CONN_FDS_MAX; extra ones are closed.
+ *
+ * @param c Connection.
+ * @return 1 if bytes were read, 0 if the socket would block,
+ *         -1 if the peer closed the connection (`eof` is set) or an error
+ *         occurred.
+ */
+extern int conn_read(conn_t *c);
+
+/**
+ * @brief Appends bytes received by the caller to the input area.
+ *
+ * Used by the io_uring backend, whose receives complete into buffers of
+ * its own.
+ *
+ * @param c Connection.
+ * @param p Received bytes.
+ * @param len Number of bytes.
+ * @param ctl Ancillary data received along with them (SCM_RIGHTS), or NULL.
+ * @return 0 on success, -1 on allocation failure.
+ */
+extern int conn_feed(conn_t *c, const uint8_t *p, size_t len, struct msghdr *ctl);
+
+/**
+ * @brief Extracts the next complete frame from the input area.
+ *
+ * A descriptor that came with one of the bytes of the frame is handed
+ * over in `msg->fd`. A client passes at most one per frame; others are
+ * closed.
+ *
+ * @param c Connection.
+ * @param msg Buffer receiving the frame header and payload.
+ * @return 1 if a frame was extracted, 0 if more bytes are needed,
+ *         -1 if the stream is malformed.
+ */
+extern int conn_next_frame(conn_t *c, buffer_t *msg);
+
+/**
+ * @brief Queues a request at the tail of the connection.
+ *
+ * The connection takes ownership of @p msg, which is returned to the buffer
+ * pool once the response has been sent.
+ *
+ * @param c Connection.
+ * @param msg Decoded request.
+ * @return Pointer to the queued request, or NULL on allocation failure.
+ */
+extern conn_req_t *conn_push(conn_t *c, buffer_t *msg);
+
+/**
+ * @brief Marks the response of a request as complete and ready to be sent.
+ *
+ * @param req Request, whose buffer now holds the response.
+ */
+extern void conn_ready(conn_req_t *req);
+
+/**
+ * @brief Marks a deferred request as completed (see conn_ready()).
+ *
+ * @param req Request handed back by the worker pool.
+ * @return 0 if the connection is still open, -1 if it was closed meanwhile
+ *         (it is released once its last deferred request completes).
+ */
+extern int conn_complete(conn_req_t *req);
+
+/**
+ * @brief Writes completed responses until the socket would block.
+ *
+ * v1 responses are held back behind earlier v1 requests that are still
+ * running; v2 responses are written as soon as they are ready.
+ *
+ * @param c Connection.
+ * @return 0 if no request is pending, 1 if responses are still pending,
+ *         -1 on write error or if a response cannot be encoded.
+ */
+extern int conn_flush(conn_t *c);
+
+/**
+ * @brief Stalls a connection whose output queue is full.
+ *
+ * The queue is full once CONN_QUEUE_MAX requests are queued or @p max
+ * bytes of responses wait to be sent. A stalled connection is neither
+ * read nor parsed any further; bytes already received stay in the input
+ * area.
+ *
+ * @param c Connection.
+ * @param max Output queue bound in bytes.
+ * @return 1 if the connection is stalled, 0 if it may be read.
+ */
+extern int conn_stall(conn_t *c, size_t max);
+
+/**
+ * @brief Lifts the stall of a connection once half of its output queue drained.
+ *
+ * @param c Connection.
+ * @param max Output queue bound in bytes, as passed to conn_stall().
+ * @return 1 if the connection was stalled and may be read again, 0 otherwise.
+ */
+extern int conn_resume(conn_t *c, size_t max);
+
+/**
+ * @brief Gathers the responses ready to be sent into `c->send` (io_uring backend).
+ *
+ * Ordering is the same as for conn_flush(). Must not be called while a
+ * send is running (`c->send->cnt` is not 0).
+ *
+ * @param c Connection.
+ * @return Number of responses gathered, 0 if none is ready, -1 on
+ *         allocation failure or if a response cannot be encoded.
+ */
+extern int conn_send_begin(conn_t *c);
+
+/**
+ * @brief Releases the responses a send gathered by conn_send_begin() delivered.
+ *
+ * @param c Connection.
+ * @param sent Number of bytes the send wrote.
+ * @return 0 if no request is pending, 1 if responses are still pending.
+ */
+extern int conn_send_end(conn_t *c, size_t sent);
+
+/**
+ * @brief Moves the traffic of a connection to shared-memory rings.
+ *
+ * @param c Connection, with no request pending and no unparsed input.
+ * @param sh Rings, owned by the connection from now on.
+ * @return 0 on success, -1 if the connection is not idle (errno is EBUSY).
+ */
+extern int conn_attach_shm(conn_t *c, shm_t *sh);
+
+/**
+ * @brief Releases every connection and the table storage.
+ *
+ * Sockets of the remaining connections are closed. No deferred request
+ * may still be running.
+ *
+ * @param t Connection table.
+ */
+extern void conn_table_destroy(conn_table_t *t);
+
+#endif /* __CONN_H */
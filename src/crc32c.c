@@ -0,0 +1,121 @@
+/**
+ * @file crc32c.c
+ * @brief CRC-32C (Castagnoli) checksums.
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include "crc32c.h"
+
+/** @brief Reflected CRC-32C polynomial */
+#define CRC32C_POLY 0x82F63B78u
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CRC32C_HW "sse4.2"
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len) {
+    uint64_t c = ~crc;
+
+    while (len > 0 && ((uintptr_t)p & 7)) {
+        c = _mm_crc32_u8((uint32_t)c, *p++);
+        len--;
+    }
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    while (len-- > 0)
+        c = _mm_crc32_u8((uint32_t)c, *p++);
+    return ~(uint32_t)c;
+}
+
+static int crc32c_hw_supported(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_HW "armv8"
+
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len) {
+    uint32_t c = ~crc;
+
+    while (len > 0 && ((uintptr_t)p & 7)) {
+        c = __crc32cb(c, *p++);
+        len--;
+    }
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = __crc32cd(c, v);
+    }
+    while (len-- > 0)
+        c = __crc32cb(c, *p++);
+    return ~c;
+}
+
+static int crc32c_hw_supported(void) {
+    return 1;
+}
+#endif
+
+static uint32_t table[8][256];
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len) {
+    uint32_t c = ~crc;
+
+    while (len > 0 && ((uintptr_t)p & 7)) {
+        c = (c >> 8) ^ table[0][(c ^ *p++) & 0xFF];
+        len--;
+    }
+    for (; len >= 8; p += 8, len -= 8) {
+        uint32_t lo = c ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+                           (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 |
+                      (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+        c = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^
+            table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+            table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^
+            table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+    }
+    while (len-- > 0)
+        c = (c >> 8) ^ table[0][(c ^ *p++) & 0xFF];
+    return ~c;
+}
+
+static uint32_t (*impl)(uint32_t, const uint8_t *, size_t) = crc32c_sw;
+static const char *impl_name = "table";
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init(void) {
+#if defined(CRC32C_HW)
+    if (crc32c_hw_supported()) {
+        impl = crc32c_hw;
+        impl_name = CRC32C_HW;
+        return;
+    }
+#endif
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++)
+        for (int k = 1; k < 8; k++)
+            table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&once, crc32c_init);
+    return impl(crc, (const uint8_t *)data, len);
+}
+
+const char *crc32c_impl(void) {
+    pthread_once(&once, crc32c_init);
+    return impl_name;
+}
@@ -0,0 +1,34 @@
+/**
+ * @file crc32c.h
+ * @brief CRC-32C (Castagnoli) checksums.
+ *
+ * Uses the SSE4.2 `crc32` instruction on x86-64 CPUs that have it and the
+ * ARMv8 CRC32 extension when the compiler targets it, and a table driven
+ * implementation (slicing-by-8) otherwise. All variants give the same result.
+ */
+
+#ifndef __CRC32C_H
+#define __CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Extends a CRC-32C over more data.
+ *
+ * Start with a @p crc of 0; the result of one call can be passed as @p crc
+ * of the next to checksum data that is not contiguous.
+ *
+ * @param crc CRC of the preceding data, 0 to start.
+ * @param data Data to checksum.
+ * @param len Number of bytes.
+ * @return CRC-32C of the preceding data followed by @p data.
+ */
+extern uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+/**
+ * @brief Gets the name of the implementation in use ("sse4.2", "armv8" or "table").
+ */
+extern const char *crc32c_impl(void);
+
+#endif
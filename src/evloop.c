@@ -0,0 +1,157 @@
+/**
+ * @file evloop.c
+ * @brief Edge-triggered readiness notification (epoll / kqueue backends).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "evloop.h"
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#else
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+/** @brief Upper bound of kernel events fetched per evloop_wait() call */
+#define EVLOOP_BATCH 256
+
+struct evloop {
+    int fd;
+#if defined(__linux__)
+    struct epoll_event events[EVLOOP_BATCH];
+#else
+    struct kevent events[EVLOOP_BATCH];
+#endif
+};
+
+#if defined(__linux__)
+
+static uint32_t to_epoll(int events) {
+    uint32_t e = EPOLLET | EPOLLRDHUP;
+    if (events & EV_READ)  e |= EPOLLIN;
+    if (events & EV_WRITE) e |= EPOLLOUT;
+    return e;
+}
+
+evloop_t *evloop_create(void) {
+    evloop_t *ev = calloc(1, sizeof(evloop_t));
+    if (!ev)
+        return NULL;
+    ev->fd = epoll_create1(EPOLL_CLOEXEC);
+    if (ev->fd < 0) {
+        free(ev);
+        return NULL;
+    }
+    return ev;
+}
+
+int evloop_add(evloop_t *ev, int fd, int events) {
+    struct epoll_event e;
+    memset(&e, 0, sizeof(e));
+    e.events  = to_epoll(events);
+    e.data.fd = fd;
+    return epoll_ctl(ev->fd, EPOLL_CTL_ADD, fd, &e);
+}
+
+int evloop_mod(evloop_t *ev, int fd, int events) {
+    struct epoll_event e;
+    memset(&e, 0, sizeof(e));
+    e.events  = to_epoll(events);
+    e.data.fd = fd;
+    return epoll_ctl(ev->fd, EPOLL_CTL_MOD, fd, &e);
+}
+
+int evloop_del(evloop_t *ev, int fd) {
+    struct epoll_event e;
+    memset(&e, 0, sizeof(e));
+    return epoll_ctl(ev->fd, EPOLL_CTL_DEL, fd, &e);
+}
+
+int evloop_wait(evloop_t *ev, ev_event_t *out, int max, int timeout_ms) {
+    int n;
+    if (max > EVLOOP_BATCH)
+        max = EVLOOP_BATCH;
+    n = epoll_wait(ev->fd, ev->events, max, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        uint32_t e = ev->events[i].events;
+        out[i].fd = ev->events[i].data.fd;
+        out[i].events = 0;
+        if (e & EPOLLIN)  out[i].events |= EV_READ;
+        if (e & EPOLLOUT) out[i].events |= EV_WRITE;
+        if (e & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) out[i].events |= EV_HUP;
+    }
+    return n;
+}
+
+#else /* kqueue */
+
+static int kq_apply(evloop_t *ev, int fd, int events) {
+    struct kevent ch[2];
+    EV_SET(&ch[0], fd, EVFILT_READ,  EV_ADD | EV_CLEAR |
+           ((events & EV_READ)  ? EV_ENABLE : EV_DISABLE), 0, 0, NULL);
+    EV_SET(&ch[1], fd, EVFILT_WRITE, EV_ADD | EV_CLEAR |
+           ((events & EV_WRITE) ? EV_ENABLE : EV_DISABLE), 0, 0, NULL);
+    return kevent(ev->fd, ch, 2, NULL, 0, NULL);
+}
+
+evloop_t *evloop_create(void) {
+    evloop_t *ev = calloc(1, sizeof(evloop_t));
+    if (!ev)
+        return NULL;
+    ev->fd = kqueue();
+    if (ev->fd < 0) {
+        free(ev);
+        return NULL;
+    }
+    return ev;
+}
+
+int evloop_add(evloop_t *ev, int fd, int events) {
+    return kq_apply(ev, fd, events);
+}
+
+int evloop_mod(evloop_t *ev, int fd, int events) {
+    return kq_apply(ev, fd, events);
+}
+
+int evloop_del(evloop_t *ev, int fd) {
+    struct kevent ch[2];
+    EV_SET(&ch[0], fd, EVFILT_READ,  EV_DELETE, 0, 0, NULL);
+    EV_SET(&ch[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    return kevent(ev->fd, ch, 2, NULL, 0, NULL);
+}
+
+int evloop_wait(evloop_t *ev, ev_event_t *out, int max, int timeout_ms) {
+    struct timespec ts, *tp = NULL;
+    int n;
+
+    if (max > EVLOOP_BATCH)
+        max = EVLOOP_BATCH;
+    if (timeout_ms >= 0) {
+        ts.tv_sec  = timeout_ms / 1000;
+        ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+        tp = &ts;
+    }
+    n = kevent(ev->fd, NULL, 0, ev->events, max, tp);
+    for (int i = 0; i < n; i++) {
+        out[i].fd = (int)ev->events[i].ident;
+        out[i].events = ev->events[i].filter == EVFILT_WRITE ? EV_WRITE : EV_READ;
+        if (ev->events[i].flags & (EV_EOF | EV_ERROR))
+            out[i].events |= EV_HUP;
+    }
+    return n;
+}
+
+#endif
+
+void evloop_destroy(evloop_t *ev) {
+    if (!ev)
+        return;
+    close(ev->fd);
+    free(ev);
+}
@@ -0,0 +1,89 @@
+/**
+ * @file evloop.h
+ * @brief Edge-triggered readiness notification shared by the servers.
+ *
+ * Thin wrapper over epoll (Linux) or kqueue (BSD/macOS). Descriptors are
+ * always registered edge-triggered: after a readiness event the caller must
+ * drain the descriptor until it would block, otherwise no further event
+ * will be reported for data that is already queued.
+ */
+
+#ifndef __EVLOOP_H
+#define __EVLOOP_H
+
+/** @brief Descriptor is readable (or a listening socket has pending connections) */
+#define EV_READ   0x01
+/** @brief Descriptor is writable */
+#define EV_WRITE  0x02
+/** @brief Peer hung up or the descriptor is in error */
+#define EV_HUP    0x04
+
+/** @brief Opaque event loop handle */
+typedef struct evloop evloop_t;
+
+/**
+ * @brief Readiness event returned by evloop_wait().
+ */
+typedef struct {
+    int fd;      /**< Descriptor that became ready */
+    int events;  /**< Combination of EV_READ, EV_WRITE and EV_HUP */
+} ev_event_t;
+
+/**
+ * @brief Creates a new event loop.
+ *
+ * @return Pointer to the event loop, or NULL on failure (errno is set).
+ */
+extern evloop_t *evloop_create(void);
+
+/**
+ * @brief Registers a descriptor for edge-triggered notification.
+ *
+ * @param ev Event loop.
+ * @param fd Descriptor to watch.
+ * @param events Interest set (EV_READ and/or EV_WRITE).
+ * @return 0 on success, -1 on failure.
+ */
+extern int evloop_add(evloop_t *ev, int fd, int events);
+
+/**
+ * @brief Changes the interest set of a registered descriptor.
+ *
+ * @param ev Event loop.
+ * @param fd Registered descriptor.
+ * @param events New interest set (EV_READ and/or EV_WRITE).
+ * @return 0 on success, -1 on failure.
+ */
+extern int evloop_mod(evloop_t *ev, int fd, int events);
+
+/**
+ * @brief Removes a descriptor from the event loop.
+ *
+ * Must be called before the descriptor is closed.
+ *
+ * @param ev Event loop.
+ * @param fd Registered descriptor.
+ * @return 0 on success, -1 on failure.
+ */
+extern int evloop_del(evloop_t *ev, int fd);
+
+/**
+ * @brief Waits for readiness events.
+ *
+ * @param ev Event loop.
+ * @param out Array receiving the ready events.
+ * @param max Capacity of @p out.
+ * @param timeout_ms Timeout in milliseconds, -1 to wait forever.
+ * @return Number of events stored in @p out, 0 on timeout, -1 on error
+ *         (EINTR is reported as an error so signals can stop the loop).
+ */
+extern int evloop_wait(evloop_t *ev, ev_event_t *out, int max, int timeout_ms);
+
+/**
+ * @brief Releases the event loop.
+ *
+ * @param ev Event loop (may be NULL).
+ */
+extern void evloop_destroy(evloop_t *ev);
+
+#endif /* __EVLOOP_H */
@@ -0,0 +1,197 @@
+/**
+ * @file export.c
+ * @brief Crash-safe replacement of database files.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "export.h"
+#include "fileutils.h"
+#include "crc32c.h"
+#include "log.h"
+
+/** @brief Bytes read at a time to checksum a file */
+#define SUM_CHUNK (1 << 20)
+
+/** @brief Contents of a manifest file */
+typedef struct {
+    uint64_t size;
+    uint32_t crc;
+} file_sum_t;
+
+/**
+ * @brief Checksums the rest of an open file.
+ */
+static int sum_fd(int fd, file_sum_t *sum) {
+    uint8_t *buf = malloc(SUM_CHUNK);
+    ssize_t n;
+
+    if (!buf)
+        return -1;
+    sum->size = 0;
+    sum->crc = 0;
+    while ((n = read(fd, buf, SUM_CHUNK)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            free(buf);
+            return -1;
+        }
+        sum->crc = crc32c(sum->crc, buf, (size_t)n);
+        sum->size += (uint64_t)n;
+    }
+    free(buf);
+    return 0;
+}
+
+/**
+ * @brief Checks a file against a manifest, comparing the sizes first.
+ *
+ * @param size Output size of the file, 0 if it does not exist.
+ * @return 1 if it matches, 0 if it does not or does not exist, -1 on I/O error.
+ */
+static int sum_check(const char *path, const file_sum_t *want, uint64_t *size) {
+    file_sum_t have;
+    struct stat st;
+    int fd, ret;
+
+    *size = 0;
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return errno == ENOENT ? 0 : -1;
+    if (fstat(fd, &st) != 0) {
+        ret = -1;
+    } else if ((*size = (uint64_t)st.st_size) != want->size) {
+        ret = 0;
+    } else {
+        ret = sum_fd(fd, &have) != 0 ? -1 :
+              have.size == want->size && have.crc == want->crc;
+    }
+    close(fd);
+    return ret;
+}
+
+/**
+ * @brief Reads a manifest file.
+ *
+ * @return 0 on success, 1 if there is none, -1 if it is malformed (errno is
+ *         EINVAL) or cannot be read.
+ */
+static int sum_read(const char *path, file_sum_t *sum) {
+    FILE *f = fopen(path, "r");
+    int ret;
+
+    if (!f)
+        return errno == ENOENT ? 1 : -1;
+    ret = fscanf(f, "%" SCNu64 " %" SCNx32, &sum->size, &sum->crc) == 2 ? 0 : -1;
+    fclose(f);
+    if (ret != 0)
+        errno = EINVAL;
+    return ret;
+}
+
+/**
+ * @brief Atomically and durably replaces a manifest file.
+ */
+static int sum_write(const char *path, const file_sum_t *sum) {
+    char tmp[PATH_MAX];
+    FILE *f;
+    int ret;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if ((f = fopen(tmp, "w")) == NULL)
+        return -1;
+    ret = (fprintf(f, "%" PRIu64 " %08" PRIx32 "\n", sum->size, sum->crc) > 0 &&
+           fflush(f) == 0 && fsync(fileno(f)) == 0) ? 0 : -1;
+    if (fclose(f) != 0)
+        ret = -1;
+    if (ret == 0 && rename(tmp, path) == 0 && sync_dir_of(path) == 0)
+        return 0;
+    unlink(tmp);
+    return -1;
+}
+
+/**
+ * @brief Makes the manifest describe the database file again after a failed rename.
+ */
+static void sum_restore(const char *path, const char *sum) {
+    file_sum_t s;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        if (errno == ENOENT)
+            unlink(sum);
+        return;
+    }
+    if (sum_fd(fd, &s) == 0)
+        sum_write(sum, &s);
+    close(fd);
+}
+
+int export_commit(const char *tmp, const char *path, const char *sum) {
+    file_sum_t s;
+    int fd, ret, err;
+
+    if ((fd = open(tmp, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+    ret = (fsync(fd) == 0 && sum_fd(fd, &s) == 0) ? 0 : -1;
+    err = errno;
+    close(fd);
+    if (ret != 0) {
+        errno = err;
+        return -1;
+    }
+
+    /* From here on, a crash leaves a manifest that describes tmp or path. */
+    if (sum_write(sum, &s) != 0)
+        return -1;
+    if (rename(tmp, path) != 0) {
+        err = errno;
+        sum_restore(path, sum);
+        errno = err;
+        return -1;
+    }
+    return sync_dir_of(path);
+}
+
+int export_recover(const char *path, const char *tmp, const char *sum) {
+    file_sum_t want;
+    uint64_t size, tmp_size;
+    int ret;
+
+    if ((ret = sum_read(sum, &want)) != 0) {
+        if (ret < 0)
+            return -1;
+        /* Written by an older version: nothing to check against. */
+        unlink(tmp);
+        return 0;
+    }
+
+    if ((ret = sum_check(path, &want, &size)) != 0) {
+        if (ret > 0)
+            unlink(tmp);
+        return ret > 0 ? 0 : -1;
+    }
+    if ((ret = sum_check(tmp, &want, &tmp_size)) < 0)
+        return -1;
+    if (ret > 0) {
+        if (rename(tmp, path) != 0 || sync_dir_of(path) != 0)
+            return -1;
+        log_message(LOG_INFO, "Completed interrupted export of '%s' (%" PRIu64 " bytes)",
+                    path, want.size);
+        return 0;
+    }
+
+    log_message(LOG_ERROR,
+        "'%s' does not match '%s': %" PRIu64 " bytes, expected %" PRIu64 " bytes with CRC-32C %08" PRIx32,
+        path, sum, size, want.size, want.crc
+    );
+    errno = EINVAL;
+    return -1;
+}
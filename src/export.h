@@ -0,0 +1,50 @@
+/**
+ * @file export.h
+ * @brief Crash-safe replacement of database files.
+ *
+ * A database file (`db.index`, `db.table`) is never written in place. The
+ * export goes to a temporary file, which is flushed to disk, and its size
+ * and CRC-32C checksum are recorded in a manifest file (`db.index.sum`,
+ * `db.table.sum`) before the temporary file is renamed over the database
+ * file. Each rename is made durable by syncing the directory.
+ *
+ * At startup, the database file is checked against the manifest before it
+ * is loaded. A crash between the two renames leaves a manifest that
+ * describes the temporary file, which is then renamed: an export that was
+ * flushed is never lost, and one that was not is discarded. A database
+ * file that matches neither is reported instead of being loaded.
+ *
+ * Database files written by older versions have no manifest and are
+ * loaded without checking.
+ */
+
+#ifndef __EXPORT_H
+#define __EXPORT_H
+
+/**
+ * @brief Makes a completed export durable and replaces the database file with it.
+ *
+ * @param tmp Temporary file holding the export.
+ * @param path Database file.
+ * @param sum Manifest file.
+ * @return 0 on success, -1 on failure (errno is set). On failure, either
+ *         @p path is unchanged or it was replaced by the complete export.
+ */
+extern int export_commit(const char *tmp, const char *path, const char *sum);
+
+/**
+ * @brief Checks a database file against its manifest before it is loaded.
+ *
+ * Completes an export interrupted between the renames of export_commit(),
+ * and removes the temporary file of any other interrupted export.
+ *
+ * @param path Database file.
+ * @param tmp Temporary file of export_commit().
+ * @param sum Manifest file.
+ * @return 0 if @p path can be loaded, or does not exist and there is no
+ *         manifest; -1 if it does not match the manifest (errno is EINVAL)
+ *         or on I/O error (errno is set).
+ */
+extern int export_recover(const char *path, const char *tmp, const char *sum);
+
+#endif /* __EXPORT_H */
@@ -2,6 +2,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
@@ -39,3 +40,28 @@ int set_database_cwd(const char *name) {
     return -1;
 }
 
+
+void split_path(const char *path, char *dir, size_t dlen, const char **name) {
+    const char *slash = strrchr(path, '/');
+
+    if (!slash) {
+        snprintf(dir, dlen, ".");
+        *name = path;
+    } else {
+        snprintf(dir, dlen, "%.*s", (int)(slash - path) + (slash == path), path);
+        *name = slash + 1;
+    }
+}
+
+int sync_dir_of(const char *path) {
+    char dir[PATH_MAX];
+    const char *name;
+    int fd, ret;
+
+    split_path(path, dir, sizeof(dir), &name);
+    if ((fd = open(dir, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+    ret = fsync(fd);
+    close(fd);
+    return ret;
+}
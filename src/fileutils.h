@@ -10,6 +10,7 @@
 #define __FILE_UTILS_H
 
 #include <limits.h>
+#include <stddef.h>
 
 #ifndef PATH_MAX
 /** @brief Maximum path length if not defined by system */
@@ -22,12 +23,33 @@
 /** @brief Key-value table database file name */
 #define TABLE_FILE  "db.table"
 
-/** @brief Write-Ahead Log file for vector index operations */
+/** @brief Write-Ahead Log segment prefix for vector index operations */
 #define IWAL_FILE   "db.iwal"
 
-/** @brief Write-Ahead Log file for table operations */
+/** @brief Export of the vector index being written in the background */
+#define INDEX_TMP_FILE  "db.index.tmp"
+
+/** @brief Size and checksum of `INDEX_FILE` */
+#define INDEX_SUM_FILE  "db.index.sum"
+
+/** @brief LSN of the first vector index operation not covered by `INDEX_FILE` */
+#define ICKPT_FILE  "db.index.ckpt"
+
+/** @brief Prefix of the rows files referenced by the vector index WAL (see ingest.h) */
+#define INGEST_FILE "db.ingest"
+
+/** @brief Write-Ahead Log segment prefix for table operations */
 #define TWAL_FILE   "db.twal"
 
+/** @brief Export of the table being written */
+#define TABLE_TMP_FILE  "db.table.tmp"
+
+/** @brief Size and checksum of `TABLE_FILE` */
+#define TABLE_SUM_FILE  "db.table.sum"
+
+/** @brief LSN of the first table operation not covered by `TABLE_FILE` */
+#define TCKPT_FILE  "db.table.ckpt"
+
 /** @brief Default root directory for all database instances */
 #define DEFAULT_DB_ROOT "/var/lib/victord"
 
@@ -61,4 +83,25 @@ extern int set_database_cwd(const char *name);
  */
 extern const char *get_database_cwd(void);
 
+/**
+ * @brief Splits a path into its directory and file name.
+ *
+ * @param path Path to split.
+ * @param dir Output directory, "." if @p path has none.
+ * @param dlen Size of @p dir.
+ * @param name Output file name, pointing into @p path.
+ */
+extern void split_path(const char *path, char *dir, size_t dlen, const char **name);
+
+/**
+ * @brief Makes the directory entries of the directory holding @p path durable.
+ *
+ * Needed after a file was created, renamed or deleted for the change to
+ * survive a crash.
+ *
+ * @param path Path of a file in the directory.
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+extern int sync_dir_of(const char *path);
+
 #endif /* __FILE_UTILS_H */
\ No newline at end of file
@@ -1,16 +1,49 @@
 #include <victor/victor.h>
 #include <limits.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#if defined(__linux__)
+#include <sys/prctl.h>
+#endif
 #include "fileutils.h"
+#include "export.h"
+#include "ingest.h"
 #include "viproto.h"
 #include "socket.h"
 #include "buffer.h"
 #include "server.h"
+#include "wal.h"
+#include "replay.h"
+#include "workers.h"
 #include "index_server.h"
 #include "log.h"
 
+/**
+ * @brief Counts applied inserts and deletes towards the next export.
+ *
+ * Also keeps `core->vectors`, so STATS does not wait for the index lock.
+ * Writes run on the writer thread while the loop reads the counters.
+ */
+static void count_ops(VictorIndex *core, size_t added, size_t deleted) {
+    __atomic_fetch_add(&core->op_add_counter, (int)added, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&core->op_del_counter, (int)deleted, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&core->vectors, (uint64_t)added - (uint64_t)deleted, __ATOMIC_RELAXED);
+}
+
+/** @brief Gets the operations applied since the last export (any thread) */
+static uint64_t pending_ops(VictorIndex *core) {
+    return (uint64_t)(__atomic_load_n(&core->op_add_counter, __ATOMIC_RELAXED) +
+                      __atomic_load_n(&core->op_del_counter, __ATOMIC_RELAXED));
+}
+
 /**
  * @brief Handles a delete (vector and value removal) message.
  *
@@ -36,9 +69,9 @@
  * @warning If only one of the operations (vector or value deletion) fails, the system logs
  *          the issue but does not attempt to rollback the other deletion.
  */
-static int handle_delete_message(VictorIndex *core, buffer_t *msg, FILE *wal) {
+static int handle_delete_message(VictorIndex *core, buffer_t *msg, wal_t *wal) {
     uint64_t id;
-    int ret, vret;
+    int ret = 0, vret;
 
     ret = buffer_read_delete(msg, &id);
     if (ret == -1) {
@@ -46,19 +79,24 @@ static int handle_delete_message(VictorIndex *core, buffer_t *msg, FILE *wal) {
         return -1;
     }
         
-    if ((vret = delete(core->index, id)) != SUCCESS) {
+    /* Logged under the lock, so that an export cannot cut the log in between. */
+    pthread_rwlock_wrlock(&core->lock);
+    vret = delete(core->index, id);
+    if (vret == SUCCESS) {
+        wal_record_t rec = { .op = WAL_OP_DELETE, .id = id };
+
+        count_ops(core, 0, 1);
+        ret = wal ? wal_append(wal, &rec) : 0;
+    }
+    pthread_rwlock_unlock(&core->lock);
+
+    if (vret != SUCCESS) {
         log_message(LOG_ERROR, 
             "unable to delete (%llu) - index: %s",
             (unsigned long long)id, index_strerror(vret)
         );
-    } else {
-        core->op_del_counter++;
-        if (wal && buffer_dump_wal(msg, wal) != 0)
-            log_message(LOG_WARNING,
-                "writing wal (%d) - message: %s",
-                errno, strerror(errno)
-            );
-    }
+    } else if (ret != 0)
+        return buffer_write_op_result(msg, MSG_ERROR, 500, "transaction log write failed");
     return buffer_write_op_result(msg, MSG_OP_RESULT, vret, index_strerror(vret));
 }
 
@@ -90,21 +128,33 @@ static int handle_delete_message(VictorIndex *core, buffer_t *msg, FILE *wal) {
  * @warning The function performs dynamic memory allocations for vector and value, which
  *          are freed before return.
  */
-static int handle_insert_message(VictorIndex *core, buffer_t *msg, FILE *wal) {
-    float32_t *vector = NULL;
+static int handle_insert_message(VictorIndex *core, buffer_t *msg, wal_t *wal) {
+    proto_vector_t vector;
     uint64_t  id;
     uint64_t  tag;
-    size_t dims = 0;
     int code;
     int ret;
 
-    ret = buffer_read_insert(msg, &id, &tag, &vector, &dims); 
+    ret = buffer_read_insert(msg, &id, &tag, &vector); 
     if (ret == -1) {
         log_message(LOG_ERROR, "parsing add message");
         return -1;
     }
 
-    if ((code = insert(core->index, id, tag, vector, dims)) != SUCCESS) {
+    pthread_rwlock_wrlock(&core->lock);
+    code = insert(core->index, id, tag, (float32_t *)vector.data, (uint16_t)vector.dims);
+    if (code == SUCCESS) {
+        wal_record_t rec = {
+            .op = WAL_OP_INSERT, .id = id, .tag = tag,
+            .vectors = vector.data, .dims = vector.dims
+        };
+
+        count_ops(core, 1, 0);
+        ret = wal ? wal_append(wal, &rec) : 0;
+    }
+    pthread_rwlock_unlock(&core->lock);
+
+    if (code != SUCCESS) {
         if (code == SYSTEM_ERROR)
             log_message(LOG_ERROR, 
                 "at vector insert - code: %d - message: %s", 
@@ -117,17 +167,368 @@ static int handle_insert_message(VictorIndex *core, buffer_t *msg, FILE *wal) {
             );
         goto cleanup;
     }
+    if (ret != 0) {
+        proto_vector_free(&vector);
+        return buffer_write_op_result(msg, MSG_ERROR, 500, "transaction log write failed");
+    }
+
+cleanup:
+    proto_vector_free(&vector);
+    return buffer_write_op_result(msg, MSG_OP_RESULT, code, index_strerror(code));
+}
 
-    if (wal && buffer_dump_wal(msg, wal) != 0)
+/**
+ * @brief Logs the WAL record of a batch with only the entries that were applied.
+ *
+ * Replaying the original record would retry the failed entries, which may
+ * succeed on replay (e.g. an id freed by a later delete) and diverge from
+ * the state the client was told about. If the copy cannot be allocated,
+ * the applied entries are logged as single inserts instead.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int dump_applied_batch(const insert_batch_t *batch, const int *codes,
+                              size_t applied, wal_t *wal) {
+    wal_record_t rec = { .op = WAL_OP_INSERT_BATCH, .count = applied, .dims = batch->dims };
+    uint64_t *ids = NULL;
+    float *vecs = NULL;
+    size_t j = 0;
+    int ret = -1;
+
+    if (applied == 0)
+        return 0;
+    if ((ids = malloc(2 * applied * sizeof(uint64_t))) == NULL ||
+        (vecs = malloc(applied * batch->dims * sizeof(float) + 1)) == NULL) {
+        ret = 0;
+        for (size_t i = 0; i < batch->count && ret == 0; i++) {
+            wal_record_t one = {
+                .op = WAL_OP_INSERT, .id = batch->ids[i], .tag = batch->tags[i],
+                .vectors = batch->vectors.data + i * batch->dims, .dims = batch->dims
+            };
+            if (codes[i] == SUCCESS)
+                ret = wal_append(wal, &one);
+        }
+        goto cleanup;
+    }
+
+    for (size_t i = 0; i < batch->count; i++) {
+        if (codes[i] != SUCCESS)
+            continue;
+        ids[j] = batch->ids[i];
+        ids[applied + j] = batch->tags[i];
+        memcpy(vecs + j * batch->dims, batch->vectors.data + i * batch->dims,
+               batch->dims * sizeof(float));
+        j++;
+    }
+    rec.ids = ids;
+    rec.tags = ids + applied;
+    rec.vectors = vecs;
+    ret = wal_append(wal, &rec);
+
+cleanup:
+    free(ids);
+    free(vecs);
+    return ret;
+}
+
+/**
+ * @brief Handles a batch insert message.
+ *
+ * Applies every (id, tag, vector) entry of a `MSG_INSERT_BATCH` message
+ * under a single acquisition of the write lock and answers with one result
+ * code per entry (`MSG_BATCH_RESULT`). The batch is logged as one WAL
+ * record, before the lock is released: every entry when all were applied,
+ * or a copy holding only the applied entries otherwise.
+ *
+ * @param core Pointer to the VictorIndex database context.
+ * @param msg  Pointer to the input/output message buffer.
+ * @param wal  WAL writer (can be NULL).
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int handle_insert_batch_message(VictorIndex *core, buffer_t *msg, wal_t *wal) {
+    insert_batch_t batch;
+    int *codes;
+    size_t applied = 0;
+    int ret = 0;
+
+    if (buffer_read_insert_batch(msg, &batch) == -1) {
+        log_message(LOG_ERROR, "parsing insert batch message");
+        return -1;
+    }
+
+    if (wal) {
+        wal_record_t rec = { .op = WAL_OP_INSERT_BATCH, .count = batch.count, .dims = batch.dims };
+
+        if (!wal_fits(&rec)) {
+            insert_batch_free(&batch);
+            return buffer_write_op_result(msg, MSG_ERROR, 413,
+                "batch too large for the transaction log, split it");
+        }
+    }
+
+    if ((codes = calloc(batch.count + 1, sizeof(int))) == NULL) {
+        insert_batch_free(&batch);
+        return buffer_write_op_result(msg, MSG_ERROR, 500, "database out of memory");
+    }
+
+    pthread_rwlock_wrlock(&core->lock);
+    for (size_t i = 0; i < batch.count; i++) {
+        codes[i] = insert(core->index, batch.ids[i], batch.tags[i],
+                          (float32_t *)(batch.vectors.data + i * batch.dims),
+                          (uint16_t)batch.dims);
+        if (codes[i] == SUCCESS)
+            applied++;
+    }
+    if (wal && applied > 0) {
+        wal_record_t rec = {
+            .op = WAL_OP_INSERT_BATCH, .count = batch.count, .dims = batch.dims,
+            .ids = batch.ids, .tags = batch.tags, .vectors = batch.vectors.data
+        };
+        ret = applied == batch.count ? wal_append(wal, &rec)
+                                     : dump_applied_batch(&batch, codes, applied, wal);
+    }
+    count_ops(core, applied, 0);
+    pthread_rwlock_unlock(&core->lock);
+
+    if (applied < batch.count)
         log_message(LOG_WARNING,
-            "writing wal (%d) - message: %s",
-            errno, strerror(errno)
+            "insert batch: %zu of %zu entries rejected", batch.count - applied, batch.count
         );
 
-    core->op_add_counter++;
-cleanup:
-    if (vector) free(vector);
-    return buffer_write_op_result(msg, MSG_OP_RESULT, code, index_strerror(code));
+    if (wal && applied > 0 && ret != 0)
+        ret = buffer_write_op_result(msg, MSG_ERROR, 500, "transaction log write failed");
+    else
+        ret = buffer_write_batch_result(msg, codes, batch.count);
+    free(codes);
+    insert_batch_free(&batch);
+    return ret;
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Inserts the rows of a mapped rows file, logging progress.
+ *
+ * The write lock is taken for INGEST_CHUNK rows at a time, so searches
+ * keep running on the workers during a long ingest.
+ *
+ * @param skip Output indexes of the rows the index rejected, in order
+ *        (to free).
+ * @param nskip Output number of rejected rows.
+ * @return Number of rows processed: all of them, unless a rejected row
+ *         could not be recorded in @p skip for lack of memory.
+ */
+static size_t insert_rows(VictorIndex *core, const ingest_rows_t *rows, uint64_t start,
+                          size_t **skip, size_t *nskip) {
+    uint64_t last = start;
+    size_t i = 0, cap = 0, first = 0, skipped = 0;
+
+    *skip = NULL;
+    *nskip = 0;
+    while (i < rows->count) {
+        size_t end = rows->count - i > INGEST_CHUNK ? i + INGEST_CHUNK : rows->count;
+        uint64_t now;
+
+        pthread_rwlock_wrlock(&core->lock);
+        for (; i < end; i++) {
+            if (insert(core->index, rows->ids[i], rows->tags[i],
+                       (float32_t *)(rows->vectors + i * rows->dims), (uint16_t)rows->dims) == SUCCESS)
+                continue;
+            if (*nskip == cap) {
+                size_t *p = realloc(*skip, (cap ? cap * 2 : 64) * sizeof(size_t));
+                if (!p) {
+                    pthread_rwlock_unlock(&core->lock);
+                    count_ops(core, i - first - (*nskip - skipped), 0);
+                    return i;
+                }
+                *skip = p;
+                cap = cap ? cap * 2 : 64;
+            }
+            (*skip)[(*nskip)++] = i;
+        }
+        pthread_rwlock_unlock(&core->lock);
+        count_ops(core, end - first - (*nskip - skipped), 0);
+        first = end;
+        skipped = *nskip;
+
+        now = now_us();
+        if (now - last >= INGEST_PROGRESS_MS * 1000ULL && i < rows->count) {
+            log_message(LOG_INFO,
+                "Ingest: %zu of %zu rows (%d%%), %.0f rows/s",
+                i, rows->count, (int)((uint64_t)i * 100 / rows->count),
+                i * 1e6 / (double)(now - start)
+            );
+            last = now;
+        }
+    }
+    return i;
+}
+
+/**
+ * @brief Removes the rows insert_rows() inserted, when they cannot be logged.
+ *
+ * Like the inserts, the deletes take the write lock INGEST_CHUNK rows at
+ * a time.
+ *
+ * @param rows Rows processed by insert_rows() (`count` set to their number).
+ * @param skip Sorted indexes of the rows the index rejected.
+ * @param nskip Number of indexes in @p skip.
+ */
+static void remove_rows(VictorIndex *core, const ingest_rows_t *rows,
+                        const size_t *skip, size_t nskip) {
+    size_t i = 0, k = 0;
+
+    while (i < rows->count) {
+        size_t end = rows->count - i > INGEST_CHUNK ? i + INGEST_CHUNK : rows->count;
+        size_t removed = 0;
+
+        pthread_rwlock_wrlock(&core->lock);
+        for (; i < end; i++) {
+            if (k < nskip && skip[k] == i) {
+                k++;
+                continue;
+            }
+            if (delete(core->index, rows->ids[i]) == SUCCESS)
+                removed++;
+        }
+        pthread_rwlock_unlock(&core->lock);
+        count_ops(core, 0, removed);
+    }
+}
+
+/**
+ * @brief Handles a file ingest message.
+ *
+ * Inserts the rows of the file passed along with a `MSG_INSERT_FILE`
+ * message (see ingest.h). The file is copied into a rows file named after
+ * the LSN of the next WAL record, the rows are inserted from its mapping
+ * and a single INSERT_FILE record referencing it is logged. Rows the index
+ * rejects (e.g. a duplicate id) are left out of the rows file, as for
+ * `MSG_INSERT_BATCH`.
+ *
+ * The response is a `MSG_STATS_RESULT` report: rows in the file, rows
+ * inserted and rejected, bytes, elapsed time and insert speed. If the rows
+ * file cannot be rewritten or the record cannot be logged, the inserted
+ * rows are removed again, the rows file too, and the response is an error.
+ *
+ * @param core Pointer to the VictorIndex database context.
+ * @param msg  Pointer to the input/output message buffer, holding the
+ *             descriptor in `msg->fd`.
+ * @param wal  WAL writer.
+ *
+ * @return 0 on success, -1 on failure.
+ *
+ * @note Runs on the writer thread like the other writes, which completes
+ *       through its eventfd: the I/O thread keeps serving and searches go
+ *       on, other writes wait until the ingest completes. No export starts
+ *       while the rows are inserted, as they are logged by a single record.
+ */
+static int handle_insert_file_message(VictorIndex *core, buffer_t *msg, wal_t *wal) {
+    int sync = get_wal_sync() == WAL_SYNC_FSYNC;
+    size_t count, dims, done, applied, nskip, *skip;
+    uint64_t size, lsn, start, elapsed, rate;
+    char path[PATH_MAX];
+    ingest_rows_t rows;
+    struct stat st;
+    int ret;
+
+    if (buffer_read_insert_file(msg, &count, &dims) == -1) {
+        log_message(LOG_ERROR, "parsing insert file message");
+        return -1;
+    }
+    if (msg->fd < 0)
+        return buffer_write_op_result(msg, MSG_ERROR, 400, "no file descriptor passed");
+    size = ingest_size(count, dims);
+    if (size == 0 || fstat(msg->fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+        (uint64_t)st.st_size < size)
+        return buffer_write_op_result(msg, MSG_ERROR, 400, "file does not hold the rows announced");
+    if (!wal)
+        return buffer_write_op_result(msg, MSG_ERROR, 500, "transaction log unavailable");
+
+    start = now_us();
+    lsn = wal_lsn(wal);
+    ingest_path(path, sizeof(path), lsn);
+    log_message(LOG_INFO,
+        "Ingesting %zu rows of %zu dimensions (%" PRIu64 " bytes) into %s",
+        count, dims, size, path
+    );
+    if (ingest_copy(msg->fd, size, path, sync) != 0 || ingest_map(path, count, dims, &rows) != 0) {
+        log_message(LOG_WARNING,
+            "unable to copy ingested rows to '%s' (%d) - message: %s",
+            path, errno, strerror(errno)
+        );
+        unlink(path);
+        return buffer_write_op_result(msg, MSG_ERROR, 500, "unable to copy the rows");
+    }
+
+    __atomic_store_n(&core->ingesting, 1, __ATOMIC_RELAXED);
+    done = insert_rows(core, &rows, start, &skip, &nskip);
+    applied = done - nskip;
+    if (applied < count) {
+        log_message(LOG_WARNING,
+            "ingest: %zu of %zu rows rejected", count - applied, count
+        );
+        if (done < count)
+            log_message(LOG_WARNING, "ingest stopped after %zu rows: out of memory", done);
+    }
+
+    ret = 0;
+    rows.count = done; /* The rows past `done` were not inserted either. */
+    if (applied == 0)
+        unlink(path);
+    else if (applied < count && (ret = ingest_rewrite(path, &rows, skip, nskip, sync)) != 0)
+        log_message(LOG_WARNING,
+            "unable to rewrite ingested rows to '%s' (%d) - message: %s",
+            path, errno, strerror(errno)
+        );
+    if (applied > 0 && ret == 0) {
+        wal_record_t rec = { .op = WAL_OP_INSERT_FILE, .id = lsn, .count = applied, .dims = dims };
+
+        if ((ret = wal_append(wal, &rec)) != 0)
+            log_message(LOG_WARNING,
+                "writing wal (%d) - message: %s",
+                errno, strerror(errno)
+            );
+    }
+    if (ret != 0) {
+        /* Nothing replays these rows: take them out before anyone is told. */
+        remove_rows(core, &rows, skip, nskip);
+        unlink(path);
+    }
+    __atomic_store_n(&core->ingesting, 0, __ATOMIC_RELAXED);
+    ingest_unmap(&rows);
+    free(skip);
+    if (ret != 0) {
+        log_message(LOG_WARNING, "Ingest of %zu rows rolled back", applied);
+        return buffer_write_op_result(msg, MSG_ERROR, 500, "unable to log the ingested rows");
+    }
+
+    elapsed = now_us() - start;
+    rate = elapsed ? (uint64_t)(applied * 1e6 / (double)elapsed) : applied;
+    __atomic_fetch_add(&core->ingests, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&core->ingest_rows, applied, __ATOMIC_RELAXED);
+    if (applied > 0)
+        __atomic_store_n(&core->ingest_rate, rate, __ATOMIC_RELAXED);
+    log_message(LOG_INFO,
+        "Ingested %zu of %zu rows in %.3f s: %" PRIu64 " rows/s, %.1f MiB/s",
+        applied, count, elapsed / 1e6, rate,
+        elapsed ? size / (elapsed / 1e6) / (1024.0 * 1024.0) : 0.0
+    );
+
+    proto_stat_t report[] = {
+        { "rows",         count },
+        { "inserted",     applied },
+        { "rejected",     count - applied },
+        { "bytes",        size },
+        { "elapsed_us",   elapsed },
+        { "rows_per_sec", rate },
+    };
+    return buffer_write_stats(msg, report, sizeof(report) / sizeof(report[0]));
 }
 
 /**
@@ -157,19 +558,21 @@ cleanup:
  *
  * @warning If memory allocation fails, the function sends a 500 error response
  *          to the client.
+ *
+ * @note Runs on a search worker thread: the index is only read under the
+ *       shared side of `core->lock`.
  */
 static int handle_search_message(VictorIndex *core, buffer_t *msg) {
     uint64_t  *ids    = NULL;
     float32_t *distances = NULL;
 
     MatchResult *result  = NULL;
-    float32_t *vector    = NULL;
+    proto_vector_t vector;
     
     uint64_t tag;
-    size_t dims;
     int ret, n;
 
-    ret = buffer_read_search(msg, &tag, &vector, &dims, &n);
+    ret = buffer_read_search(msg, &tag, &vector, &n);
     if (ret == -1) {
         log_message(LOG_ERROR, "parsing lookup message");
         return -1;
@@ -183,7 +586,9 @@ static int handle_search_message(VictorIndex *core, buffer_t *msg) {
         goto cleanup;
     }
 
-    ret = search(core->index, tag, vector, (uint16_t)dims, result, n);
+    pthread_rwlock_rdlock(&core->lock);
+    ret = search(core->index, tag, (float32_t *)vector.data, (uint16_t)vector.dims, result, n);
+    pthread_rwlock_unlock(&core->lock);
     if (ret == SUCCESS) {
         int i = 0;
         if ((ids = calloc(n, sizeof(uint64_t))) == NULL || 
@@ -205,7 +610,7 @@ static int handle_search_message(VictorIndex *core, buffer_t *msg) {
         ret = buffer_write_op_result(msg, MSG_ERROR, ret, index_strerror(ret));
 
 cleanup:
-    if (vector)    free(vector);
+    proto_vector_free(&vector);
     if (result)    free(result);
     if (ids)       free(ids);
     if (distances) free(distances);
@@ -213,70 +618,322 @@ cleanup:
 }
 
 
+/** @brief Queries of one SEARCH_BATCH request, shared by the threads running them */
+typedef struct {
+    VictorIndex *core;
+    uint64_t     tag;
+    const float *queries;   /**< One row of `dims` components per query */
+    size_t       dims;
+    int          n;         /**< Results per query */
+    MatchResult *results;   /**< One row of `n` results per query */
+    int         *codes;     /**< search() result of each query */
+} search_batch_t;
+
 /**
- * @brief Loads and applies WAL operations to the VictorIndex database.
+ * @brief Runs query @p q of a batch (see workers_parallel()).
  *
- * This function reads and replays all operations stored in a Write-Ahead Log (WAL) file.
- * Each message is parsed and executed according to its type (e.g., `MSG_ADD`, `MSG_DEL`).
- * It ensures database state restoration after a crash or restart.
+ * The read lock is taken per query so a long batch does not hold back a
+ * pending insert or delete for its whole duration.
+ */
+static void run_batch_query(void *arg, size_t q) {
+    search_batch_t *job = (search_batch_t *)arg;
+
+    pthread_rwlock_rdlock(&job->core->lock);
+    job->codes[q] = search(job->core->index, job->tag,
+                           (float32_t *)(job->queries + q * job->dims), (uint16_t)job->dims,
+                           job->results + q * (size_t)job->n, job->n);
+    pthread_rwlock_unlock(&job->core->lock);
+}
+
+/**
+ * @brief Handles a batch search message.
  *
- * @param core Pointer to the VictorIndex database structure to apply the WAL to.
- * @param wal  FILE* pointer to an already opened WAL file in binary read mode.
+ * Runs every query of a `MSG_SEARCH_BATCH` message, spreading them over the
+ * idle search workers, and answers with one `MSG_MATCH_BATCH_RESULT` holding
+ * a result list per query, in request order. Result storage for the whole
+ * batch is allocated once. If any query fails, the response is an error
+ * carrying the code of the first failed query.
  *
- * @return 
- *   0 on successful import of all WAL entries,  
- *  -1 on failure due to I/O error or corrupted WAL content.
+ * @param core Pointer to the database structure.
+ * @param msg  Pointer to the input/output buffer containing the message.
  *
- * @note 
- *   If the WAL contains unknown message types, they will be skipped with a warning.
- *   If an error occurs and `errno` is 0, it is assumed the WAL is corrupted.
- *   If `errno` is non-zero, a system-level I/O error is assumed.
+ * @return 0 on success, -1 on failure.
+ *
+ * @note Runs on a search worker thread, like handle_search_message().
  */
-int victor_index_loadwal(VictorIndex *core, FILE *wal) {
-    buffer_t *buff = alloc_buffer();
-    int successful_entries = 0, failed_entries = 0;
+static int handle_search_batch_message(VictorIndex *core, buffer_t *msg) {
+    search_batch_t job = { .core = core };
+    proto_vector_t queries;
+    uint64_t *ids = NULL;
+    float32_t *distances = NULL;
+    size_t *counts = NULL;
+    size_t nq, total;
     int ret;
 
-    if (!buff) {
-        log_message(LOG_ERROR, "failed to allocate buffer");
+    if (buffer_read_search_batch(msg, &job.tag, &queries, &job.dims, &job.n) == -1) {
+        log_message(LOG_ERROR, "parsing search batch message");
         return -1;
     }
+    job.queries = queries.data;
+    nq = queries.dims / job.dims;
 
-    while ((ret = buffer_load_wal(buff, wal)) == 1) {
-        switch (buff->hdr.type) {
-            case MSG_INSERT:
-                if (handle_insert_message(core, buff, NULL) != 0 || 
-                    buff->hdr.type == MSG_ERROR)
-                    failed_entries++;
-                else
-                    successful_entries++;
+    if (job.n > 0 && nq > SIZE_MAX / sizeof(MatchResult) / (size_t)job.n) {
+        ret = buffer_write_op_result(msg, MSG_ERROR, 500, "database out of memory");
+        goto cleanup;
+    }
+    total = nq * (size_t)job.n;
 
-                break;
-            case MSG_DELETE:
-                if (handle_delete_message(core, buff, NULL) != 0 || 
-                    buff->hdr.type == MSG_ERROR)
-                    failed_entries++;
-                else
-                    successful_entries++;
-                break;
-            default:
-                log_message(LOG_WARNING,
-                    "unknown message type in WAL: %d", buff->hdr.type);
-                break;
+    if ((job.results = calloc(total + 1, sizeof(MatchResult))) == NULL ||
+        (job.codes = calloc(nq, sizeof(int))) == NULL ||
+        (ids = calloc(total + 1, sizeof(uint64_t))) == NULL ||
+        (distances = calloc(total + 1, sizeof(float32_t))) == NULL ||
+        (counts = calloc(nq, sizeof(size_t))) == NULL) {
+        ret = buffer_write_op_result(msg, MSG_ERROR, 500, "database out of memory");
+        goto cleanup;
+    }
+
+    workers_parallel(run_batch_query, &job, nq);
+
+    for (size_t q = 0; q < nq; q++) {
+        const MatchResult *row = job.results + q * (size_t)job.n;
+
+        if (job.codes[q] != SUCCESS) {
+            ret = buffer_write_op_result(msg, MSG_ERROR, job.codes[q], index_strerror(job.codes[q]));
+            goto cleanup;
+        }
+        while (counts[q] < (size_t)job.n && row[counts[q]].id != 0) {
+            ids[q * job.n + counts[q]] = row[counts[q]].id;
+            distances[q * job.n + counts[q]] = row[counts[q]].distance;
+            counts[q]++;
         }
     }
+    ret = buffer_write_match_batch_result(msg, ids, distances, counts, nq, (size_t)job.n);
+
+cleanup:
+    proto_vector_free(&queries);
+    free(job.results);
+    free(job.codes);
+    free(ids);
+    free(distances);
+    free(counts);
+    return ret;
+}
+
+
+/**
+ * @brief Handles a statistics request.
+ *
+ * Answers with a `MSG_STATS_RESULT` map of counters, including how long
+ * serving was paused to take export snapshots, file ingests, the I/O and
+ * output queue counters of the server loop and the checkpoint policy with
+ * its decisions.
+ *
+ * @param core Pointer to the VictorIndex database context.
+ * @param msg  Pointer to the input/output message buffer.
+ *
+ * @return 0 on success, -1 on failure.
+ *
+ * @note Runs on the I/O thread without the index lock: the counters the
+ *       writer thread changes are read atomically.
+ */
+static int handle_stats_message(VictorIndex *core, buffer_t *msg) {
+    proto_stat_t stats[9 + SERVER_IO_STATS + CHECKPOINT_STATS] = {
+        { "vectors",             __atomic_load_n(&core->vectors, __ATOMIC_RELAXED) },
+        { "pending_ops",         pending_ops(core) },
+        { "export_running",      core->export_pid ? 1 : 0 },
+        { "exports",             core->exports },
+        { "export_pause_us",     core->export_pause_us },
+        { "export_pause_max_us", core->export_pause_max_us },
+        { "ingests",             __atomic_load_n(&core->ingests, __ATOMIC_RELAXED) },
+        { "ingest_rows",         __atomic_load_n(&core->ingest_rows, __ATOMIC_RELAXED) },
+        { "ingest_rows_per_sec", __atomic_load_n(&core->ingest_rate, __ATOMIC_RELAXED) },
+    };
+    size_t n = 9 + server_io_stats(stats + 9);
+
+    n += checkpoint_stats(&core->policy, stats + n, wal_size(core->wal));
+    return buffer_write_stats(msg, stats, n);
+}
+
+/**
+ * @brief WAL record decoded for replay.
+ *
+ * `rec` points into the WAL record, into `vector` / `batch` for a
+ * message from a log of an older format, or into `rows` for an
+ * INSERT_FILE record, replayed as the INSERT_BATCH it stands for.
+ */
+typedef struct {
+    wal_record_t    rec;
+    proto_vector_t  vector;   /**< Decoded MSG_INSERT vector */
+    insert_batch_t  batch;    /**< Decoded MSG_INSERT_BATCH */
+    ingest_rows_t   rows;     /**< Rows file of an INSERT_FILE record */
+} index_op_t;
+
+/**
+ * @brief Maps the rows file of an INSERT_FILE record.
+ */
+static int decode_rows_file(index_op_t *op) {
+    char path[PATH_MAX];
+
+    ingest_path(path, sizeof(path), op->rec.id);
+    if (ingest_map(path, op->rec.count, op->rec.dims, &op->rows) != 0) {
+        log_message(LOG_ERROR,
+            "unable to map rows file '%s' (%d) - message: %s", path, errno, strerror(errno)
+        );
+        return -1;
+    }
+    op->rec.op = WAL_OP_INSERT_BATCH;
+    op->rec.ids = op->rows.ids;
+    op->rec.tags = op->rows.tags;
+    op->rec.vectors = op->rows.vectors;
+    return 0;
+}
+
+/**
+ * @brief Decodes a WAL record for replay (see replay_handler_t).
+ */
+static int index_decode(const wal_record_t *rec, void *ptr) {
+    index_op_t *op = (index_op_t *)ptr;
+    const buffer_t *msg = rec->msg;
+
+    memset(op, 0, sizeof(index_op_t));
+    op->rec = *rec;
+    op->rec.owned = NULL;
+    if (rec->op == WAL_OP_INSERT_FILE)
+        return decode_rows_file(op);
+    if (rec->op != WAL_OP_MESSAGE)
+        return (rec->op == WAL_OP_INSERT || rec->op == WAL_OP_INSERT_BATCH ||
+                rec->op == WAL_OP_DELETE) ? 0 : 1;
 
-    free(buff);
+    switch (msg->hdr.type) {
+    case MSG_INSERT:
+        if (buffer_read_insert(msg, &op->rec.id, &op->rec.tag, &op->vector) != 0)
+            return -1;
+        op->rec.op = WAL_OP_INSERT;
+        op->rec.vectors = op->vector.data;
+        op->rec.dims = op->vector.dims;
+        return 0;
+    case MSG_INSERT_BATCH:
+        if (buffer_read_insert_batch(msg, &op->batch) != 0)
+            return -1;
+        op->rec.op = WAL_OP_INSERT_BATCH;
+        op->rec.count = op->batch.count;
+        op->rec.dims = op->batch.dims;
+        op->rec.ids = op->batch.ids;
+        op->rec.tags = op->batch.tags;
+        op->rec.vectors = op->batch.vectors.data;
+        return 0;
+    case MSG_DELETE:
+        op->rec.op = WAL_OP_DELETE;
+        return buffer_read_delete(msg, &op->rec.id);
+    default:
+        return 1;
+    }
+}
+
+/**
+ * @brief Gets the number of ids a decoded WAL record changes (see replay_handler_t).
+ */
+static size_t index_entries(const void *ptr) {
+    const wal_record_t *rec = &((const index_op_t *)ptr)->rec;
+
+    return rec->op == WAL_OP_INSERT_BATCH ? rec->count : 1;
+}
+
+/**
+ * @brief Gets an id changed by a decoded WAL record (see replay_handler_t).
+ */
+static int index_entry(const void *ptr, size_t i, const void **key, size_t *klen) {
+    const wal_record_t *rec = &((const index_op_t *)ptr)->rec;
+
+    *key = rec->op == WAL_OP_INSERT_BATCH ? (const void *)&rec->ids[i] : (const void *)&rec->id;
+    *klen = sizeof(uint64_t);
+    return rec->op == WAL_OP_DELETE;
+}
+
+/**
+ * @brief Applies an entry of a decoded WAL record (see replay_handler_t).
+ *
+ * Replay runs before the server starts, so the index lock is not taken.
+ */
+static int index_apply(void *ctx, void *ptr, size_t i, int flags) {
+    VictorIndex *core = (VictorIndex *)ctx;
+    const wal_record_t *rec = &((index_op_t *)ptr)->rec;
+    uint64_t id = rec->id, tag = rec->tag;
+    const float *vector = rec->vectors;
 
-    if (ret == 0) {
-        if (failed_entries == 0) {
+    if (rec->op == WAL_OP_DELETE) {
+        if (delete(core->index, id) != SUCCESS)
+            return -1;
+        core->op_del_counter++;
+        return 0;
+    }
+    if (rec->op == WAL_OP_INSERT_BATCH) {
+        id = rec->ids[i];
+        tag = rec->tags[i];
+        vector += i * rec->dims;
+    }
+
+    if (flags & REPLAY_PURGE)
+        delete(core->index, id);
+    if (insert(core->index, id, tag, (float32_t *)vector, (uint16_t)rec->dims) != SUCCESS)
+        return -1;
+    core->op_add_counter++;
+    return 0;
+}
+
+/**
+ * @brief Releases a decoded WAL record (see replay_handler_t).
+ */
+static void index_release(void *ptr) {
+    index_op_t *op = (index_op_t *)ptr;
+
+    proto_vector_free(&op->vector);
+    insert_batch_free(&op->batch);
+    ingest_unmap(&op->rows);
+}
+
+/**
+ * @brief Loads and applies WAL operations to the VictorIndex database.
+ *
+ * This function replays all operations stored in the Write-Ahead Log (WAL)
+ * from the given position (inserts, insert batches, file ingests and deletes).
+ * Records are decoded in parallel and applied in log order (see replay_wal()),
+ * without encoding the responses. It ensures database state restoration
+ * after a crash or restart.
+ *
+ * @param core Pointer to the VictorIndex database structure to apply the WAL to.
+ * @param wal  WAL reader opened at the checkpoint LSN (see wal_reader_open()).
+ *
+ * @return 
+ *   0 on successful import of all WAL entries,  
+ *  -1 on failure due to I/O error or corrupted WAL content.
+ *
+ * @note 
+ *   If the WAL contains unknown message types, they will be skipped with a warning.
+ *   If an error occurs and `errno` is 0, it is assumed the WAL is corrupted.
+ *   If `errno` is non-zero, a system-level I/O error is assumed.
+ */
+int victor_index_loadwal(VictorIndex *core, wal_reader_t *wal) {
+    replay_handler_t handler = {
+        .core    = core,
+        .op_size = sizeof(index_op_t),
+        .decode  = index_decode,
+        .entries = index_entries,
+        .entry   = index_entry,
+        .apply   = index_apply,
+        .release = index_release
+    };
+    replay_stats_t stats;
+
+    if (replay_wal(wal, &handler, get_replay_compact(), &stats) == 0) {
+        if (stats.failed == 0) {
             log_message(LOG_INFO, 
-                "Transaction log recovered: %d operations restored successfully", 
-                successful_entries);
+                "Transaction log recovered: %" PRIu64 " operations restored successfully", 
+                stats.applied);
         } else {
             log_message(LOG_WARNING, 
-                "Transaction log recovered: %d successful, %d failed operations", 
-                successful_entries, failed_entries);
+                "Transaction log recovered: %" PRIu64 " successful, %" PRIu64 " failed operations", 
+                stats.applied, stats.failed);
         }
         return 0;
     }
@@ -290,169 +947,406 @@ int victor_index_loadwal(VictorIndex *core, FILE *wal) {
 }
 
 
+/**
+ * @brief Holds the response of a write until its WAL record is committed.
+ *
+ * Errors are sent at once: among them, writes whose record could not be
+ * appended, which must not wait for a group to be acknowledged.
+ * Called on the writer thread, where wal_pending() would race the commits
+ * of the loop: every logged write waits unless the log is never synced.
+ *
+ * @param wal WAL writer.
+ * @param msg Response written by the handler.
+ * @param ret Handler result.
+ * @return SERVER_COMMIT if a response must wait for the group commit, @p ret otherwise.
+ */
+static int logged(const wal_t *wal, const buffer_t *msg, int ret) {
+    return (ret == 0 && msg->hdr.type != MSG_ERROR && wal_durable(wal)) ? SERVER_COMMIT : ret;
+}
+
+/**
+ * @brief Refuses a write once the WAL failed (see wal_failed()).
+ *
+ * The database may hold changes the log lost, so nothing more is applied
+ * until the server is restarted and replays the log.
+ *
+ * @param msg Pointer to the input/output message buffer.
+ * @return 0 if the error response is written, -1 otherwise.
+ */
+static int refuse_write(buffer_t *msg) {
+    return buffer_write_op_result(msg, MSG_ERROR, 503,
+        "transaction log failed: writes are refused until restart");
+}
+
+/**
+ * @brief Dispatches one client request to its handler.
+ *
+ * Requests are handled in place: the response overwrites the request in `msg`.
+ * Writes are queued on the writer thread, which applies and logs them one
+ * at a time, and searches are deferred to the worker threads (see
+ * index_work()), so the I/O thread never waits for the write lock.
+ *
+ * @param ctx Pointer to the VictorIndex database context.
+ * @param msg Pointer to the input/output message buffer.
+ *
+ * @return 0 if a response must be sent, SERVER_WRITE for writes,
+ *         SERVER_DEFER for searches, -1 to close the connection.
+ */
+static int index_dispatch(void *ctx, buffer_t *msg) {
+    VictorIndex *core = (VictorIndex *)ctx;
+
+    switch (msg->hdr.type) {
+    case MSG_INSERT:
+    case MSG_INSERT_BATCH:
+    case MSG_INSERT_FILE:
+    case MSG_DELETE:
+        return wal_failed(core->wal) ? refuse_write(msg) : SERVER_WRITE;
+    case MSG_SEARCH:
+    case MSG_SEARCH_BATCH:
+        return SERVER_DEFER;
+    case MSG_STATS:
+        return handle_stats_message(core, msg);
+    case MSG_CONFIG:
+        return checkpoint_config(&core->policy, msg);
+    default:
+        log_message(LOG_WARNING,
+            "invalid protocol message type: %d",
+            msg->hdr.type
+        );
+        return -1;
+    }
+}
+
+/**
+ * @brief Runs a request deferred by index_dispatch() on a worker thread,
+ *        or a write on the writer thread.
+ *
+ * @param ctx Pointer to the VictorIndex database context.
+ * @param msg Pointer to the input/output message buffer.
+ *
+ * @return 0 if a response must be sent, SERVER_COMMIT for logged writes,
+ *         -1 to close the connection.
+ */
+static int index_work(void *ctx, buffer_t *msg) {
+    VictorIndex *core = (VictorIndex *)ctx;
+
+    switch (msg->hdr.type) {
+    case MSG_INSERT:
+    case MSG_INSERT_BATCH:
+    case MSG_INSERT_FILE:
+    case MSG_DELETE:
+        /* Queued before a group failed: not applied either. */
+        if (wal_failed(core->wal))
+            return refuse_write(msg);
+        break;
+    }
+
+    switch (msg->hdr.type) {
+    case MSG_INSERT: 
+        return logged(core->wal, msg, handle_insert_message(core, msg, core->wal));
+    case MSG_INSERT_BATCH:
+        return logged(core->wal, msg, handle_insert_batch_message(core, msg, core->wal));
+    case MSG_INSERT_FILE:
+        return logged(core->wal, msg, handle_insert_file_message(core, msg, core->wal));
+    case MSG_DELETE:
+        return logged(core->wal, msg, handle_delete_message(core, msg, core->wal));
+    case MSG_SEARCH:
+        return handle_search_message(core, msg);
+    case MSG_SEARCH_BATCH:
+        return handle_search_batch_message(core, msg);
+    default:
+        return -1;
+    }
+}
+
+/** @brief How often a running background export is polled (milliseconds) */
+#define EXPORT_POLL_MS 100
+
+/**
+ * @brief Closes the descriptors a forked child inherited, except stdio.
+ *
+ * Otherwise the child would keep client connections open after the server
+ * closed them, until the export completes.
+ */
+static void close_inherited_fds(void) {
+#if defined(SYS_close_range)
+    if (syscall(SYS_close_range, 3, ~0U, 0) == 0)
+        return;
+#endif
+    long max = sysconf(_SC_OPEN_MAX);
+    if (max < 0 || max > 65536)
+        max = 65536;
+    for (int fd = 3; fd < max; fd++)
+        close(fd);
+}
+
+/**
+ * @brief Starts exporting a copy-on-write snapshot of the index in a child process.
+ *
+ * The write lock is taken first: writes log their record before releasing
+ * it, so once the WAL is cut over to a new segment (see wal_cut()) the
+ * snapshot covers exactly the records before `export_lsn`. The lock is held
+ * across fork() so that no thread is inside the index when it is copied.
+ * Serving is only paused for the cutover and the fork itself; the export
+ * then runs while the loop keeps serving, and the parent's writes no longer
+ * affect the child's copy. No export starts during a file ingest, whose
+ * rows are inserted under several acquisitions of the lock but logged once. The child also flushes the export and replaces
+ * `INDEX_FILE` with it (see export_commit()), so the loop never waits for
+ * the disk.
+ *
+ * @param core Pointer to the VictorIndex database context.
+ */
+static void index_export_start(VictorIndex *core) {
+    uint64_t start = now_us(), pause, lsn;
+    pid_t pid;
+    int ret;
+
+    pthread_rwlock_wrlock(&core->lock);
+    if (__atomic_load_n(&core->ingesting, __ATOMIC_RELAXED)) {
+        pthread_rwlock_unlock(&core->lock);
+        return;
+    }
+
+    checkpoint_start(&core->policy, wal_size(core->wal));
+    if ((lsn = wal_cut(core->wal)) == 0) {
+        pthread_rwlock_unlock(&core->lock);
+        log_message(LOG_WARNING,
+            "unable to cut over WAL for export (%d) - message: %s",
+            errno, strerror(errno)
+        );
+        checkpoint_done(&core->policy, 0);
+        return;
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        /* Child: only the forking thread exists, write the snapshot and leave. */
+#if defined(__linux__)
+        /* Do not outlive the server and race the export of its next instance. */
+        if (prctl(PR_SET_PDEATHSIG, SIGKILL) != 0 || getppid() == 1)
+            _exit(SYSTEM_ERROR);
+#endif
+        close_inherited_fds();
+        ret = export(core->index, INDEX_TMP_FILE);
+        if (ret == SUCCESS && export_commit(INDEX_TMP_FILE, INDEX_FILE, INDEX_SUM_FILE) != 0)
+            ret = SYSTEM_ERROR;
+        _exit(ret);
+    }
+    if (pid > 0) {
+        /* Under the lock: the writer thread counts the next operations. */
+        core->export_ops = __atomic_exchange_n(&core->op_add_counter, 0, __ATOMIC_RELAXED) +
+                           __atomic_exchange_n(&core->op_del_counter, 0, __ATOMIC_RELAXED);
+    }
+    pthread_rwlock_unlock(&core->lock);
+
+    if (pid < 0) {
+        log_message(LOG_WARNING,
+            "unable to start background export (%d) - message: %s",
+            errno, strerror(errno)
+        );
+        checkpoint_done(&core->policy, 0);
+        return;
+    }
+
+    pause = now_us() - start;
+    core->export_pid = pid;
+    core->export_lsn = lsn;
+    core->export_pause_us = pause;
+    if (pause > core->export_pause_max_us)
+        core->export_pause_max_us = pause;
+
+    log_message(LOG_INFO,
+        "Exporting index to disk in background (%s, operations: %d, pause: %.3f ms)",
+        checkpoint_reason_name(core->policy.reason), core->export_ops, pause / 1000.0
+    );
+}
+
+/**
+ * @brief Completes a background export once its process has exited.
+ *
+ * On success the snapshot has replaced `INDEX_FILE`, the checkpoint is
+ * moved to `export_lsn` and the segments it covers are retired. On failure
+ * they stay and their operations count towards the next export.
+ *
+ * @param core Pointer to the VictorIndex database context.
+ * @param wait Block until the export completes.
+ * @return 1 while the export is still running, 0 otherwise.
+ */
+static int index_export_finish(VictorIndex *core, int wait) {
+    int status, ret;
+    pid_t r;
+
+    do {
+        r = waitpid(core->export_pid, &status, wait ? 0 : WNOHANG);
+    } while (r < 0 && errno == EINTR);
+    if (r == 0)
+        return 1;
+
+    core->export_pid = 0;
+    ret = (r < 0) ? SYSTEM_ERROR : WIFEXITED(status) ? WEXITSTATUS(status) : SYSTEM_ERROR;
+    /* Replaying records already in INDEX_FILE is harmless, missing some is not. */
+    if (ret == SUCCESS && wal_checkpoint_write(ICKPT_FILE, core->export_lsn) != 0)
+        ret = SYSTEM_ERROR;
+
+    checkpoint_done(&core->policy, ret == SUCCESS);
+    if (ret != SUCCESS) {
+        log_message(LOG_WARNING, 
+            "Error during index export: %s", index_strerror(ret));
+        /* The export may have stopped half way through export_commit(). */
+        export_recover(INDEX_FILE, INDEX_TMP_FILE, INDEX_SUM_FILE);
+        __atomic_fetch_add(&core->op_add_counter, core->export_ops, __ATOMIC_RELAXED);
+    } else {
+        log_message(LOG_INFO,
+            "Index exported successfully, checkpoint at LSN %" PRIu64, core->export_lsn);
+        wal_retire(IWAL_FILE, core->export_lsn);
+        ingest_retire(core->export_lsn);
+        core->exports++;
+    }
+    core->export_ops = 0;
+    return 0;
+}
+
+/**
+ * @brief Exports the index to disk when the checkpoint policy says so.
+ *
+ * Called by the server loop after every iteration. The export runs in the
+ * background (see index_export_start()), so the loop is woken up
+ * periodically until it completes.
+ *
+ * @param ctx Pointer to the VictorIndex database context.
+ * @return EXPORT_POLL_MS while an export is running, otherwise when the
+ *         policy must be asked again (see checkpoint_wakeup()).
+ */
+static int index_tick(void *ctx) {
+    VictorIndex *core = (VictorIndex *)ctx;
+    uint64_t ops = pending_ops(core);
+
+    if (core->export_pid && index_export_finish(core, 0))
+        return EXPORT_POLL_MS;
+
+    /* The database may hold writes the log lost: do not save them */
+    if (wal_failed(core->wal))
+        return -1;
+
+    if (checkpoint_due(&core->policy, ops, wal_size(core->wal)) == CHECKPOINT_NONE)
+        return checkpoint_wakeup(&core->policy, wal_size(core->wal));
+
+    index_export_start(core);
+    return core->export_pid ? EXPORT_POLL_MS : -1;
+}
+
+/**
+ * @brief Group-commits the WAL records of the writes handled so far.
+ *
+ * @param ctx Pointer to the VictorIndex database context.
+ * @param force Commit even if the group commit window is still open.
+ * @return See wal_commit(); a commit running on the writer thread is
+ *         SERVER_COMMIT_RUNNING.
+ */
+static int index_commit(void *ctx, int force) {
+    VictorIndex *core = (VictorIndex *)ctx;
+    int ret = wal_commit(core->wal, force);
+
+    return ret == WAL_COMMIT_RUNNING ? SERVER_COMMIT_RUNNING : ret;
+}
+
+/**
+ * @brief Tells whether the WAL writer thread wrote the group handed over.
+ *
+ * @param ctx Pointer to the VictorIndex database context.
+ * @param wait Block until it did.
+ * @return See wal_committed().
+ */
+static int index_committed(void *ctx, int wait) {
+    VictorIndex *core = (VictorIndex *)ctx;
+
+    return wal_committed(core->wal, wait);
+}
+
+/**
+ * @brief Gets the descriptor signalling the WAL writer thread completions.
+ */
+static int index_commit_fd(void *ctx) {
+    VictorIndex *core = (VictorIndex *)ctx;
+
+    return wal_fd(core->wal);
+}
+
 /**
  * @brief Starts the VictorIndex server loop, handling client requests and writing to WAL.
  *
- * This function implements the main server loop for the VictorIndex database. It accepts
- * incoming UNIX domain socket connections, processes protocol messages from clients,
- * and writes changes to a Write-Ahead Log (WAL) file for durability.
+ * This function opens the Write-Ahead Log (WAL) and runs the shared server loop
+ * (`server_loop()`) with the vector index protocol handlers. Changes are written
+ * to the WAL for durability.
  *
  * Supported message types:
  * - `MSG_INSERT`: Adds a new vector to the database and appends to the WAL.
+ * - `MSG_INSERT_BATCH`: Adds many vectors and appends one WAL record.
+ * - `MSG_INSERT_FILE`: Adds the vectors of a file passed by the client and
+ *   appends one WAL record referencing a copy of it.
  * - `MSG_DELETE`: Removes a vector and appends to the WAL.
- * - `MSG_SEARCH`: Performs a vector search (no WAL entry).
+ * - `MSG_SEARCH`: Performs a vector search (no WAL entry) on one of the
+ *   `core->workers` search threads, concurrently with other searches.
+ * - `MSG_SEARCH_BATCH`: Performs many searches at once, spread over the idle
+ *   search threads.
+ * - `MSG_STATS`: Reports server counters.
+ * - `MSG_CONFIG`: Changes the checkpoint policy.
+ *
+ * Writes run one at a time on the writer thread of the loop, concurrently
+ * with the searches; the I/O thread only answers STATS and CONFIG itself.
  *
- * The server uses `select()` to multiplex connections and listens until a termination
- * signal is received (`running == 0`), at which point it gracefully shuts down.
+ * The loop runs until a termination signal is received (`running == 0`),
+ * at which point it gracefully shuts down.
  *
  * @param core Pointer to the database structure.
  * @param server File descriptor of a bound and listening UNIX socket.
  *
  * @return 0 on clean shutdown, -1 on failure (e.g., memory, I/O, or socket error).
  *
- * @note The WAL file is opened in append mode. If it cannot be opened, the server
- *       fails to start. The server respects signals via the global `running` flag.
+ * @note The WAL is opened in a new segment starting at `core->wal_lsn`, with the durability mode and
+ *       group commit window of VICTOR_WAL_SYNC / VICTOR_WAL_WINDOW_MS (see
+ *       wal.h). If it cannot be opened, the server fails to start. The server respects signals via the global `running` flag.
  *
- * @warning Only `MSG_INSERT` and `MSG_DELETE` are persisted in the WAL.
- * @warning Maximum number of simultaneous connections is limited by `MAX_CONNECTIONS`.
- * @warning If `recv_msg` or `send_msg` fail, the client connection is closed.
+ * @warning Only `MSG_INSERT`, `MSG_INSERT_BATCH`, `MSG_INSERT_FILE` and `MSG_DELETE` are
+ *          persisted in the WAL.
+ * @warning If a request cannot be parsed or its response cannot be sent, the
+ *          client connection is closed.
  */
 int victor_index_server(VictorIndex *core, int server) {
-    FILE *wal = NULL;
-    int conn[MAX_CONNECTIONS];
-    fd_set set, check;
-    int max = server, n;
-    buffer_t *buff = alloc_buffer();
-    
-    if (!buff) {
-        log_message(LOG_ERROR, 
-            "failed to allocate buffer"
-        );
-        close(server);
-        return -1;
-    }
+    server_handler_t handler = {
+        .core      = core,
+        .dispatch  = index_dispatch,
+        .work      = index_work,
+        .tick      = index_tick,
+        .commit    = index_commit,
+        .committed = index_committed,
+        .commit_fd = index_commit_fd,
+        .workers   = core->workers
+    };
+    uint64_t vectors = 0;
+    int ret;
 
-    wal = fopen(IWAL_FILE, "ab");
-    if (!wal) { 
+    size(core->index, &vectors);
+    core->vectors = vectors;
+    core->wal = wal_open(IWAL_FILE, core->wal_lsn, get_wal_sync(), get_wal_window());
+    if (!core->wal) { 
         log_message(LOG_ERROR, 
             "failed to open WAL file '%s': %s", 
             IWAL_FILE, 
             strerror(errno)
         );
-        free(buff);
         close(server);
         return -1;
     }
-    for (int i=0; i < MAX_CONNECTIONS; i++) conn[i] = -1;
-
-    FD_ZERO(&set);
-    FD_ZERO(&check);
-    FD_SET(server, &set);
 
-    while (running) {
-        memcpy(&check, &set, sizeof(fd_set));
-        n = select(max+1, &check, NULL, NULL, NULL);
-        if (n < 0 && (errno == EAGAIN || errno == EINTR))
-            continue;
-        else if (n < 0) {
-            log_message(LOG_ERROR, 
-                "fatal error on select (%d) - %s",
-                errno, strerror(errno)
-            );
-            break;
-        }
-        if (FD_ISSET(server, &check)) {
-            int i;
-            int sd = unix_accept(server);
-            if (sd == -1)
-                if (errno != EAGAIN && errno != EINTR) {
-                    log_message(LOG_ERROR, 
-                        "fatal error on unix_accept (%d) - %s",
-                        errno, strerror(errno)
-                    );
-                    break;
-                }
-            for (i = 0; i < MAX_CONNECTIONS; i++)
-                if (conn[i] == -1) {
-                    conn[i] = sd;
-                    break;
-                }
-            if (i == MAX_CONNECTIONS) {
-                log_message(LOG_WARNING,
-                    "max connections reached - new client closed"
-                );
-                close(sd);
-            } else {
-                max = sd > max ? sd : max;
-                FD_SET(sd, &set);
-            }
-            n--;
-        }
+    ret = server_loop(server, &handler);
 
-        for (int i = 0; i < MAX_CONNECTIONS && n > 0; i++) {
-            int ret = 0;
-            if (FD_ISSET(conn[i], &check)) {
-                n--;
-                ret = recv_msg(conn[i], buff);
-                if (ret == -1) {
-                    log_message(LOG_WARNING,
-                        "connection closed due to protocol or receive error"
-                    );
-                    FD_CLR(conn[i], &set);
-                    close(conn[i]);
-                    conn[i] = -1;
-                    continue;
-                }
-                switch (buff->hdr.type) {
-                case MSG_INSERT: 
-                    ret = handle_insert_message(core, buff, wal);   
-                    break;
-                case MSG_DELETE:
-                    ret = handle_delete_message(core, buff, wal);
-                    break;
-                case MSG_SEARCH:
-                    ret = handle_search_message(core, buff);
-                    break;
-                default:
-                    log_message(LOG_WARNING,
-                        "invalid protocol message type: %d",
-                        buff->hdr.type
-                    );
-                    ret = -1;
-                }
-                if (ret != -1) {
-                    if (send_msg(conn[i], buff) == -1) {
-                        FD_CLR(conn[i], &set);
-                        close(conn[i]);
-                        conn[i] = -1;
-                    }
-                } else {
-                    FD_CLR(conn[i], &set);
-                    close(conn[i]);
-                    conn[i] = -1;
-                }
-            }
-        }
-        if (core->op_add_counter + core->op_del_counter > get_export_threshold()) {
-            int ret;
-            log_message(LOG_INFO, "Exporting index to disk (operations: %d)", 
-                       core->op_add_counter + core->op_del_counter);
-            if ((ret = export(core->index, INDEX_FILE)) != SUCCESS)
-                log_message(LOG_WARNING, 
-                    "Error during index export: %s", index_strerror(ret));
-            else {
-                log_message(LOG_INFO, "Index exported successfully, WAL file cleared");
-                unlink(IWAL_FILE);
-                core->op_add_counter = core->op_del_counter = 0;
-            }
-        }
+    if (core->export_pid) {
+        log_message(LOG_INFO, "Waiting for background export to complete");
+        index_export_finish(core, 1);
     }
-    log_message(LOG_INFO, "end main loop");
-    fclose(wal);
-    free(buff);
-    for (int i = 0; i < MAX_CONNECTIONS; i ++)
-        if (conn[i] != -1)
-            close(conn[i]);
+    wal_close(core->wal);
+    core->wal = NULL;
     close(server);
-    return 0;
-}
\ No newline at end of file
+    return ret;
+}
@@ -10,6 +10,10 @@
 #define __VICTOR_INDEX_SERVER
 
 #include <victor/victor.h>
+#include <stdio.h>
+#include "wal.h"
+#include "checkpoint.h"
+#include <pthread.h>
 
 /**
  * @brief Vector index database context structure.
@@ -30,6 +34,58 @@ typedef struct {
     
     /** @brief Counter for DELETE operations since last export */
     int op_del_counter;
+
+    /** @brief Write-Ahead Log opened for appending while serving (NULL otherwise) */
+    wal_t    *wal;
+
+    /** @brief LSN of the next WAL record, as left by replay */
+    uint64_t  wal_lsn;
+
+    /** @brief Number of search worker threads (0 searches on the I/O thread) */
+    int       workers;
+
+    /** @brief Decides when to export (see checkpoint.h) */
+    checkpoint_t policy;
+
+    /** @brief Process writing the background export, 0 if none is running */
+    pid_t     export_pid;
+
+    /** @brief Operations covered by the export in progress */
+    int       export_ops;
+
+    /** @brief First LSN not covered by the export in progress */
+    uint64_t  export_lsn;
+
+    /** @brief Completed background exports */
+    uint64_t  exports;
+
+    /** @brief Time serving was paused to take the last export snapshot (microseconds) */
+    uint64_t  export_pause_us;
+
+    /** @brief Longest pause to take an export snapshot (microseconds) */
+    uint64_t  export_pause_max_us;
+
+    /** @brief Completed file ingests (see ingest.h) */
+    uint64_t  ingests;
+
+    /** @brief Rows inserted by file ingests */
+    uint64_t  ingest_rows;
+
+    /** @brief Insert speed of the last file ingest (rows per second) */
+    uint64_t  ingest_rate;
+
+    /** @brief Vectors in the index, kept by the writer thread for STATS */
+    uint64_t  vectors;
+
+    /** @brief Set while the writer thread runs a file ingest (no export starts) */
+    int       ingesting;
+
+    /**
+     * @brief Guards `index`: searches hold it shared; writes, on the writer
+     *        thread, and exports hold it exclusively (see server_rwlock_init()).
+     *        Writes append their WAL record before releasing it.
+     */
+    pthread_rwlock_t lock;
 } VictorIndex;
 
 /**
@@ -48,13 +104,14 @@ extern int victor_index_server(VictorIndex *core, int server);
 /**
  * @brief Loads and replays Write-Ahead Log operations.
  *
- * Reads a WAL file and replays all recorded operations to restore
- * the database state after a restart or crash recovery.
+ * Reads the WAL segments not covered by the last checkpoint and replays
+ * the recorded operations to restore the database state after a restart
+ * or crash recovery.
  *
  * @param core Pointer to the VictorIndex database context.
- * @param wal FILE pointer to an opened WAL file in read mode.
+ * @param wal WAL reader opened at the checkpoint LSN.
  * @return 0 on success, -1 on failure or corruption.
  */
-extern int victor_index_loadwal(VictorIndex *core, FILE *wal);
+extern int victor_index_loadwal(VictorIndex *core, wal_reader_t *wal);
 
 #endif /* __VICTOR_SERVER */
\ No newline at end of file
@@ -0,0 +1,266 @@
+/**
+ * @file ingest.c
+ * @brief Bulk ingest of vectors from a file passed by the client.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE /* copy_file_range() */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ingest.h"
+#include "fileutils.h"
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+/** @brief Largest amount handed to the kernel by one copy call */
+#define COPY_CHUNK (1024 * 1024 * 1024)
+
+/** @brief Bounce buffer size, where the kernel cannot copy by itself */
+#define COPY_BUFFER (8 * 1024 * 1024)
+
+uint64_t ingest_size(size_t count, size_t dims) {
+    uint64_t row = 2 * sizeof(uint64_t) + (uint64_t)dims * sizeof(float);
+
+    if (count > UINT64_MAX / row)
+        return 0;
+    return (uint64_t)count * row;
+}
+
+void ingest_path(char *out, size_t len, uint64_t lsn) {
+    snprintf(out, len, "%s.%016" PRIx64, INGEST_FILE, lsn);
+}
+
+static int write_all(int fd, const uint8_t *p, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, p, len > COPY_CHUNK ? COPY_CHUNK : len);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return -1;
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+static int sync_fd(int fd) {
+#if defined(__linux__)
+    return fdatasync(fd);
+#else
+    return fsync(fd);
+#endif
+}
+
+/**
+ * @brief Gets how much of the @p left bytes to copy with one call.
+ */
+static size_t chunk(uint64_t left) {
+    return left > COPY_CHUNK ? COPY_CHUNK : (size_t)left;
+}
+
+/**
+ * @brief Copies @p size bytes of @p src, from offset 0, to the position of @p dst.
+ *
+ * The kernel copies the data (and may share the blocks) when it can:
+ * copy_file_range(), or sendfile() across file systems it does not
+ * handle. Otherwise the data goes through a bounce buffer.
+ */
+static int copy_fd(int src, int dst, uint64_t size) {
+    off_t in = 0;
+    uint8_t *buf;
+    ssize_t n;
+
+#if defined(__linux__)
+    for (int how = 0; how < 2; how++) {
+        while ((uint64_t)in < size) {
+            n = how == 0 ? copy_file_range(src, &in, dst, NULL, chunk(size - (uint64_t)in), 0)
+                         : sendfile(dst, src, &in, chunk(size - (uint64_t)in));
+            if (n > 0 || (n < 0 && errno == EINTR))
+                continue;
+            if (n == 0)
+                errno = EINVAL; /* The file is shorter than announced. */
+            break;
+        }
+        if ((uint64_t)in == size)
+            return 0;
+        if (n == 0 || (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP))
+            return -1;
+    }
+#endif
+
+    if ((buf = malloc(COPY_BUFFER)) == NULL)
+        return -1;
+    while ((uint64_t)in < size) {
+        n = pread(src, buf, size - (uint64_t)in > COPY_BUFFER ?
+                            COPY_BUFFER : (size_t)(size - (uint64_t)in), in);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0 || write_all(dst, buf, (size_t)n) != 0) {
+            if (n == 0)
+                errno = EINVAL;
+            free(buf);
+            return -1;
+        }
+        in += n;
+    }
+    free(buf);
+    return 0;
+}
+
+int ingest_copy(int src, uint64_t size, const char *path, int sync) {
+    int fd, err;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+        return -1;
+    if (copy_fd(src, fd, size) != 0 || (sync && sync_fd(fd) != 0))
+        goto fail;
+    if (close(fd) != 0) {
+        fd = -1;
+        goto fail;
+    }
+    if (sync && sync_dir_of(path) != 0) {
+        fd = -1;
+        goto fail;
+    }
+    return 0;
+
+fail:
+    err = errno;
+    if (fd >= 0)
+        close(fd);
+    unlink(path);
+    errno = err;
+    return -1;
+}
+
+int ingest_map(const char *path, size_t count, size_t dims, ingest_rows_t *rows) {
+    uint64_t size = ingest_size(count, dims);
+    struct stat st;
+    void *base;
+    int fd;
+
+    memset(rows, 0, sizeof(ingest_rows_t));
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+    /* The rows are used in place; converting a copy would defeat the purpose. */
+    errno = ENOTSUP;
+    return -1;
+#endif
+    if (count == 0 || dims == 0 || size == 0 || (uint64_t)(size_t)size != size) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    if ((uint64_t)st.st_size != size) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    base = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -1;
+#if defined(MADV_SEQUENTIAL)
+    (void)madvise(base, (size_t)size, MADV_SEQUENTIAL);
+#endif
+
+    rows->base = base;
+    rows->size = (size_t)size;
+    rows->count = count;
+    rows->dims = dims;
+    rows->ids = (const uint64_t *)base;
+    rows->tags = rows->ids + count;
+    rows->vectors = (const float *)(const void *)(rows->tags + count);
+    return 0;
+}
+
+void ingest_unmap(ingest_rows_t *rows) {
+    if (rows->base)
+        munmap(rows->base, rows->size);
+    memset(rows, 0, sizeof(ingest_rows_t));
+}
+
+/**
+ * @brief Writes the elements of an array, except the ones listed in @p skip.
+ */
+static int write_kept(int fd, const void *array, size_t elem, size_t count,
+                      const size_t *skip, size_t nskip) {
+    const uint8_t *p = (const uint8_t *)array;
+    size_t from = 0;
+
+    for (size_t i = 0; i <= nskip; i++) {
+        size_t to = i < nskip ? skip[i] : count;
+
+        if (to > from && write_all(fd, p + from * elem, (to - from) * elem) != 0)
+            return -1;
+        from = to + 1;
+    }
+    return 0;
+}
+
+int ingest_rewrite(const char *path, const ingest_rows_t *rows,
+                   const size_t *skip, size_t nskip, int sync) {
+    char tmp[PATH_MAX];
+    int fd, err;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+        return -1;
+    if (write_kept(fd, rows->ids, sizeof(uint64_t), rows->count, skip, nskip) != 0 ||
+        write_kept(fd, rows->tags, sizeof(uint64_t), rows->count, skip, nskip) != 0 ||
+        write_kept(fd, rows->vectors, rows->dims * sizeof(float), rows->count, skip, nskip) != 0 ||
+        (sync && sync_fd(fd) != 0))
+        goto fail;
+    if (close(fd) != 0) {
+        fd = -1;
+        goto fail;
+    }
+    fd = -1;
+    if (rename(tmp, path) != 0 || (sync && sync_dir_of(path) != 0))
+        goto fail;
+    return 0;
+
+fail:
+    err = errno;
+    if (fd >= 0)
+        close(fd);
+    unlink(tmp);
+    errno = err;
+    return -1;
+}
+
+void ingest_retire(uint64_t lsn) {
+    size_t nlen = strlen(INGEST_FILE);
+    struct dirent *de;
+    DIR *d;
+
+    if ((d = opendir(".")) == NULL)
+        return;
+    while ((de = readdir(d)) != NULL) {
+        const char *hex = de->d_name + nlen + 1;
+
+        /* Rows files and the leftovers of an interrupted ingest_rewrite(). */
+        if (strncmp(de->d_name, INGEST_FILE, nlen) != 0 || de->d_name[nlen] != '.' ||
+            strspn(hex, "0123456789abcdef") != 16 || (hex[16] && strcmp(hex + 16, ".tmp") != 0))
+            continue;
+        if (strtoull(hex, NULL, 16) < lsn)
+            unlink(de->d_name);
+    }
+    closedir(d);
+}
@@ -0,0 +1,110 @@
+/**
+ * @file ingest.h
+ * @brief Bulk ingest of vectors from a file passed by the client.
+ *
+ * A client on the same host sends an INSERT_FILE request along with a
+ * descriptor (SCM_RIGHTS) of a memfd or an open file holding the rows:
+ *
+ *     u64 ids[count], u64 tags[count], f32 vectors[count * dims]
+ *
+ * little endian and back to back, the body of a WAL INSERT_BATCH record.
+ * The rows never go through the socket. The server copies the file into
+ * the database directory (a kernel-side copy, or a reflink where the file
+ * system supports it), maps the copy and inserts straight from the
+ * mapping. The WAL then only gets a 32-byte INSERT_FILE record naming the
+ * copy, which replay maps the same way.
+ *
+ * The copy is named `INGEST_FILE.<LSN of its record, 16 hex digits>`. It
+ * is written and, in `fsync` mode, synced before the record is appended,
+ * and removed once a checkpoint covers the record (see ingest_retire()).
+ * Working on a private copy also protects the server from a client that
+ * truncates its file while it is being read.
+ */
+
+#ifndef __INGEST_H
+#define __INGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/** @brief Rows inserted per acquisition of the index write lock */
+#define INGEST_CHUNK 4096
+
+/** @brief Interval between progress messages of a running ingest (milliseconds) */
+#define INGEST_PROGRESS_MS 1000
+
+/** @brief Rows of a file, mapped read-only */
+typedef struct {
+    void           *base;     /**< Mapping, NULL if none */
+    size_t          size;     /**< Mapping size */
+    size_t          count;    /**< Number of rows */
+    size_t          dims;     /**< Components of each vector */
+    const uint64_t *ids;      /**< Row ids (count) */
+    const uint64_t *tags;     /**< Row tags (count) */
+    const float    *vectors;  /**< count * dims components, one row per entry */
+} ingest_rows_t;
+
+/**
+ * @brief Gets the size of a rows file.
+ *
+ * @return Size in bytes, or 0 if it overflows.
+ */
+extern uint64_t ingest_size(size_t count, size_t dims);
+
+/**
+ * @brief Gets the path of the rows file of the INSERT_FILE record at @p lsn.
+ */
+extern void ingest_path(char *out, size_t len, uint64_t lsn);
+
+/**
+ * @brief Copies a client file into a rows file.
+ *
+ * @param src Descriptor passed by the client, read from offset 0.
+ * @param size Bytes to copy.
+ * @param path Rows file to create.
+ * @param sync Make the copy durable (file data and directory entry).
+ * @return 0 on success, -1 on failure (errno is set; the copy is removed).
+ */
+extern int ingest_copy(int src, uint64_t size, const char *path, int sync);
+
+/**
+ * @brief Maps a rows file.
+ *
+ * @param path Rows file.
+ * @param count Number of rows it must hold.
+ * @param dims Components of each vector.
+ * @param rows Output mapping, released with ingest_unmap().
+ * @return 0 on success, -1 on failure (errno is set, EINVAL if the size
+ *         does not match, ENOTSUP on big endian hosts).
+ */
+extern int ingest_map(const char *path, size_t count, size_t dims, ingest_rows_t *rows);
+
+/**
+ * @brief Releases a mapping made by ingest_map() (or a zeroed one).
+ */
+extern void ingest_unmap(ingest_rows_t *rows);
+
+/**
+ * @brief Rewrites a rows file with only some of its rows.
+ *
+ * Used when the index rejected rows, so that replay does not retry them.
+ *
+ * @param path Rows file, replaced.
+ * @param rows Mapping of the original rows, still valid afterwards.
+ * @param skip Sorted indexes of the rows to leave out.
+ * @param nskip Number of indexes in @p skip.
+ * @param sync Make the new file durable.
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+extern int ingest_rewrite(const char *path, const ingest_rows_t *rows,
+                          const size_t *skip, size_t nskip, int sync);
+
+/**
+ * @brief Removes the rows files of the records before @p lsn.
+ *
+ * Must only be called once a checkpoint at @p lsn is durable.
+ */
+extern void ingest_retire(uint64_t lsn);
+
+#endif /* __INGEST_H */
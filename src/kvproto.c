@@ -101,15 +101,10 @@ static int buffer_write_kv_master(buffer_t *buf, int msg_type, void *key, size_t
         }
     }
     
-    size_t written = cbor_serialize(root, buf->data, MSG_MAXLEN);
-    if (written == 0 || written > MSG_MAXLEN) {
+    if (buffer_write_cbor(buf, msg_type, root) != 0) {
         ret = -1;
         goto cleanup;
     }
-
-
-    buf->hdr.len = (int)written;
-    buf->hdr.type = msg_type;
     ret = 0;
 cleanup:
     if (root) cbor_decref(&root);
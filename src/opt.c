@@ -54,10 +54,13 @@ void index_usage(const char *progname) {
         "Optional arguments:\n"
         "  -t <type>          Index type (flat | hnsw) [default: hnsw]\n"
         "  -m <method>        Similarity method (cosine | dotp | l2norm) [default: cosine]\n"
+        "  -w <threads>       Search worker threads, 0 searches on the I/O thread [default: CPU count]\n"
         "  -u <socket_path>   Path to UNIX socket [default: auto-generated]\n"
+        "  -h <host:port>     Listen on TCP instead (host * for every interface)\n"
         "\nExample:\n"
-        "  %s -n musicdb -d 128 -t hnsw -m cosine -u /tmp/musicdb.sock\n",
-        progname, progname
+        "  %s -n musicdb -d 128 -t hnsw -m cosine -u /tmp/musicdb.sock\n"
+        "  %s -n musicdb -d 128 -h 0.0.0.0:7701\n",
+        progname, progname, progname
     );
 }
 
@@ -77,6 +80,7 @@ void table_usage(const char *progname) {
         "  -n <dbname>        Name of the database to create or open\n"
         "Optional arguments:\n"
         "  -u <socket_path>   Path to UNIX socket [default: auto-generated]\n"
+        "  -h <host:port>     Listen on TCP instead (host * for every interface)\n"
         "  -D                 Enable debug mode (dumps all keys at startup)\n"
         "\nExample:\n"
         "  %s -n musicdb -u /tmp/musicdb.sock\n"
@@ -98,6 +102,7 @@ void table_usage(const char *progname) {
  * - -d: Vector dimensions (required)
  * - -t: Index type (flat|hnsw, default: hnsw)
  * - -m: Distance metric (cosine|dotp|l2norm, default: cosine)
+ * - -w: Search worker threads (default: number of online CPUs)
  * - -u: UNIX socket path (default: auto-generated)
  * - -h: TCP host:port (switches to TCP mode)
  *
@@ -108,7 +113,6 @@ void table_usage(const char *progname) {
  * @return 0 on success, -1 on error or missing required arguments
  * 
  * @note The function will print error messages to stderr for invalid arguments
- * @note TCP socket support is mentioned but marked as "not enabled"
  */
 int index_parse_arguments(int argc, char *argv[], IndexConfig *cfg) {
     int opt;
@@ -117,10 +121,11 @@ int index_parse_arguments(int argc, char *argv[], IndexConfig *cfg) {
     // Set default values for optional parameters
     cfg->i_type   = DEFAULT_INDEX_TYPE;
     cfg->i_method = DEFAULT_INDEX_METHOD;
+    cfg->workers  = DEFAULT_SEARCH_WORKERS;
     cfg->s_type   = DEFAULT_SOCKET_TYPE;
 
 
-    while ((opt = getopt(argc, argv, "d:t:n:m:u:h:")) != -1) {
+    while ((opt = getopt(argc, argv, "d:t:n:m:w:u:h:")) != -1) {
         switch (opt) {
             case 'n':  // Database name
                 cfg->name = optarg;
@@ -152,14 +157,23 @@ int index_parse_arguments(int argc, char *argv[], IndexConfig *cfg) {
                         optarg, "cosine"
                     );
                 break;
+            case 'w':  // Search worker threads
+                cfg->workers = atoi(optarg);
+                if (cfg->workers < 0) {
+                    fprintf(stderr, 
+                        "invalid argument for -w (threads): %s, using default\n", optarg
+                    );
+                    cfg->workers = DEFAULT_SEARCH_WORKERS;
+                }
+                break;
             case 'u':  // UNIX socket path
                 cfg->s_type = SOCKET_UNIX;
                 cfg->socket.unix_path = optarg;
                 break;
             case 'h':  // TCP host:port
                 cfg->s_type = SOCKET_TCP;
-                char *sep = strchr(optarg, ':');
-                if (!sep) {
+                char *sep = strrchr(optarg, ':');  // Last one: IPv6 addresses hold colons
+                if (!sep || atoi(sep + 1) <= 0 || atoi(sep + 1) > 65535) {
                     fprintf(stderr, "invalid TCP argument host:port - Abort\n");
                     return -1;
                 }
@@ -180,6 +194,11 @@ int index_parse_arguments(int argc, char *argv[], IndexConfig *cfg) {
         return -1;
     }
 
+    if (cfg->workers == DEFAULT_SEARCH_WORKERS) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        cfg->workers = ncpu > 0 ? (int)ncpu : 1;
+    }
+
     // Set default socket path if none was specified
     if (cfg->socket.unix_path == NULL)
         cfg->socket.unix_path = set_default_socket_path(NULL, cfg->name);
@@ -206,7 +225,6 @@ int index_parse_arguments(int argc, char *argv[], IndexConfig *cfg) {
  * @return 0 on success, -1 on error or missing required arguments
  * 
  * @note The function will print error messages to stderr for invalid arguments
- * @note TCP socket support is mentioned but marked as "not enabled"
  */
 int table_parse_arguments(int argc, char *argv[], TableConfig *cfg) {
     int opt;
@@ -227,8 +245,8 @@ int table_parse_arguments(int argc, char *argv[], TableConfig *cfg) {
                 break;
             case 'h':  // TCP host:port
                 cfg->s_type = SOCKET_TCP;
-                char *sep = strchr(optarg, ':');
-                if (!sep) {
+                char *sep = strrchr(optarg, ':');  // Last one: IPv6 addresses hold colons
+                if (!sep || atoi(sep + 1) <= 0 || atoi(sep + 1) > 65535) {
                     fprintf(stderr, "invalid TCP argument host:port - Abort\n");
                     return -1;
                 }
@@ -273,7 +291,6 @@ int table_parse_arguments(int argc, char *argv[], TableConfig *cfg) {
  * @param cfg Pointer to Config structure to display
  * 
  * @note Output is sent to stdout with a structured format
- * @note TCP socket functionality is marked as "not enabled"
  */
 void index_config_dump(const IndexConfig *cfg) {
     // Convert enum values to human-readable strings
@@ -296,6 +313,7 @@ void index_config_dump(const IndexConfig *cfg) {
     printf("║  Vector Dimensions     │ %-47d ║\n", cfg->i_dims);
     printf("║  Index Type            │ %-47s ║\n", index_type_str);
     printf("║  Similarity Method     │ %-47s ║\n", method_str);
+    printf("║  Search Workers        │ %-47d ║\n", cfg->workers);
     printf("╠═══════════════════════╪════════════════════════════════════════════════╣\n");
 
     // Display socket configuration based on type
@@ -303,7 +321,7 @@ void index_config_dump(const IndexConfig *cfg) {
         printf("║  Socket Type           │ %-47s ║\n", "UNIX Domain Socket");
         printf("║  Socket Path           │ %-47s ║\n", cfg->socket.unix_path);
     } else if (cfg->s_type == SOCKET_TCP) {
-        printf("║  Socket Type           │ %-47s ║\n", "TCP (not enabled)");
+        printf("║  Socket Type           │ %-47s ║\n", "TCP");
         printf("║  Host                  │ %-47s ║\n", cfg->socket.tcp.host);
         printf("║  Port                  │ %-47d ║\n", cfg->socket.tcp.port);
     } else {
@@ -329,7 +347,6 @@ void index_config_dump(const IndexConfig *cfg) {
  * @param cfg Pointer to TableConfig structure to display
  * 
  * @note Output is sent to stdout with a structured format
- * @note TCP socket functionality is marked as "not enabled"
  */
 void table_config_dump(const TableConfig *cfg) {  // Fixed: was IndexConfig instead of TableConfig
     printf("\n");
@@ -349,7 +366,7 @@ void table_config_dump(const TableConfig *cfg) {  // Fixed: was IndexConfig inst
         printf("║  Socket Type           │ %-47s ║\n", "UNIX Domain Socket");
         printf("║  Socket Path           │ %-47s ║\n", cfg->socket.unix_path);
     } else if (cfg->s_type == SOCKET_TCP) {
-        printf("║  Socket Type           │ %-47s ║\n", "TCP (not enabled)");
+        printf("║  Socket Type           │ %-47s ║\n", "TCP");
         printf("║  Host                  │ %-47s ║\n", cfg->socket.tcp.host);
         printf("║  Port                  │ %-47d ║\n", cfg->socket.tcp.port);
     } else {
@@ -24,6 +24,8 @@
 #define DEFAULT_INDEX_METHOD  COSINE
 /** @brief Default socket type for server connections (UNIX domain socket) */
 #define DEFAULT_SOCKET_TYPE   SOCKET_UNIX
+/** @brief Default number of search worker threads (-1 = one per online CPU) */
+#define DEFAULT_SEARCH_WORKERS -1
 
 #include "fileutils.h"
 
@@ -39,6 +41,7 @@ typedef struct {
     int i_dims;     /**< Vector dimensionality for the index */
     int i_type;     /**< Index type (e.g., HNSW_INDEX, FLAT_INDEX) */
     int i_method;   /**< Distance metric method (e.g., COSINE, L2, DOT_PRODUCT) */
+    int workers;    /**< Search worker threads (0 = search on the I/O thread) */
     int s_type;     /**< Socket type (SOCKET_TCP or SOCKET_UNIX) */
     
     /**
@@ -7,68 +7,246 @@
 #include "panic.h"
 
 /**
- * @brief Serializes an operation result response into a CBOR-encoded buffer.
+ * @brief Serializes a CBOR item tree as the payload of a buffer.
  *
- * Encodes a CBOR array of the form:
- *     [error_code:int, error_message:string]
+ * `cbor_serialize()` returns 0 when the destination is too small, so the
+ * payload area is doubled until the item fits or MSG_MAXLEN is reached.
  *
- * @param buf Output buffer where the CBOR message will be written.
- * @param msg_type The message type (MSG_INSERT_RESULT, MSG_DEL_RESULT, etc.).
- * @param code Error code (0 for success, non-zero for error).
- * @param msg Error message string (can be NULL for success).
- * @return 0 on success, -1 on error or insufficient buffer space.
+ * @param buf Output buffer.
+ * @param msg_type Message type stored in the header.
+ * @param root CBOR item to serialize.
+ * @return 0 on success, -1 if the encoding exceeds MSG_MAXLEN or on allocation failure.
  */
-int buffer_write_op_result(buffer_t *buf, int msg_type, int code, const char *msg) {
-    cbor_item_t *root = NULL;
-    cbor_item_t *c = NULL;
-    cbor_item_t *s = NULL;
+int buffer_write_cbor(buffer_t *buf, int msg_type, const cbor_item_t *root) {
     size_t written;
 
-    if (!buf || !buf->data) return -1;
+    for (;;) {
+        written = cbor_serialize(root, buf->data, buf->cap);
+        if (written > 0)
+            break;
+        if (buf->cap >= MSG_MAXLEN)
+            return -1;
+        if (buffer_reserve(buf, buf->cap * 2 < MSG_MAXLEN ? buf->cap * 2 : MSG_MAXLEN) != 0)
+            return -1;
+    }
+
+    if (written > MSG_MAXLEN || written > (size_t)INT_MAX)
+        return -1;
 
-    root = cbor_new_definite_array(2);
-    if (!root) return -1;
+    buf->hdr.len = (int)written;
+    buf->hdr.type = msg_type;
+    return 0;
+}
 
-    c = cbor_build_uint32((uint32_t)code);
-    if (!c) {
-        cbor_decref(&root);
+int buffer_encode_begin(buffer_t *buf, size_t max_len) {
+    if (max_len > MSG_MAXLEN)
+        return -1;
+    return buffer_reserve(buf, max_len);
+}
+
+int buffer_encode_end(buffer_t *buf, int msg_type, size_t len) {
+    if (len > MSG_MAXLEN)
+        return -1;
+    buf->hdr.len = (int)len;
+    buf->hdr.type = msg_type;
+    return 0;
+}
+
+/** @brief CBOR major types handled by the cursor */
+#define CBOR_MAJOR_UINT   0
+#define CBOR_MAJOR_BYTES  2
+#define CBOR_MAJOR_TEXT   3
+#define CBOR_MAJOR_ARRAY  4
+#define CBOR_MAJOR_MAP    5
+#define CBOR_MAJOR_TAG    6
+#define CBOR_MAJOR_SIMPLE 7
+
+void cursor_init(proto_cursor_t *cur, const buffer_t *buf) {
+    cur->p   = buf->data;
+    cur->end = buf->data + buf->hdr.len;
+}
+
+/**
+ * @brief Reads an item head: major type and argument.
+ *
+ * For floats (major type 7) the argument holds the raw bits and @p info
+ * tells the width (26 = single, 27 = double).
+ *
+ * @return 0 on success, -1 on truncated input or indefinite length.
+ */
+static int cursor_head(proto_cursor_t *cur, int *major, int *info, uint64_t *arg) {
+    size_t n;
+    uint8_t ib;
+
+    if (cur->p >= cur->end)
         return -1;
+    ib = *cur->p++;
+    *major = ib >> 5;
+    *info  = ib & 0x1f;
+
+    if (*info < 24) {
+        *arg = (uint64_t)*info;
+        return 0;
     }
-    if (!cbor_array_push(root, c)) {
-        cbor_decref(&c);
-        cbor_decref(&root);
+    if (*info > 27)
+        return -1;
+
+    n = (size_t)1 << (*info - 24);
+    if ((size_t)(cur->end - cur->p) < n)
+        return -1;
+    *arg = 0;
+    for (size_t i = 0; i < n; i++)
+        *arg = (*arg << 8) | cur->p[i];
+    cur->p += n;
+    return 0;
+}
+
+int cursor_array(proto_cursor_t *cur, size_t *len) {
+    int major, info;
+    uint64_t arg;
+
+    if (cursor_head(cur, &major, &info, &arg) != 0 || major != CBOR_MAJOR_ARRAY)
+        return -1;
+    /* Every element takes at least one byte. */
+    if (arg > (uint64_t)(cur->end - cur->p))
+        return -1;
+    *len = (size_t)arg;
+    return 0;
+}
+
+int cursor_uint(proto_cursor_t *cur, uint64_t *v) {
+    int major, info;
+
+    if (cursor_head(cur, &major, &info, v) != 0 || major != CBOR_MAJOR_UINT)
         return -1;
+    return 0;
+}
+
+int cursor_float(proto_cursor_t *cur, float *v) {
+    int major, info;
+    uint64_t arg;
+
+    if (cursor_head(cur, &major, &info, &arg) != 0 || major != CBOR_MAJOR_SIMPLE)
+        return -1;
+    if (info == 26) {
+        uint32_t bits = (uint32_t)arg;
+        memcpy(v, &bits, sizeof(float));
+        return 0;
     }
-    cbor_decref(&c);
+    if (info == 27) {
+        double d;
+        memcpy(&d, &arg, sizeof(double));
+        *v = (float)d;
+        return 0;
+    }
+    return -1;
+}
 
-    s = cbor_build_string(msg ? msg : "");
-    if (!s) {
-        cbor_decref(&root);
+/**
+ * @brief Reads the byte string of a float32 little endian typed array.
+ */
+static int cursor_typed_vector(proto_cursor_t *cur, proto_vector_t *vec) {
+    int major, info;
+    uint64_t len;
+    const uint8_t *p;
+
+    if (cursor_head(cur, &major, &info, &len) != 0 || major != CBOR_MAJOR_BYTES)
+        return -1;
+    if (len > (uint64_t)(cur->end - cur->p) || len % sizeof(float) != 0)
         return -1;
+    p = cur->p;
+    cur->p += len;
+    vec->dims = (size_t)(len / sizeof(float));
+    if (vec->dims == 0)
+        return 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (((uintptr_t)p % _Alignof(float)) == 0) {
+        vec->data = (const float *)(const void *)p;
+        return 0;
     }
-    if (!cbor_array_push(root, s)) {
-        cbor_decref(&s);
-        cbor_decref(&root);
+#endif
+    if ((vec->owned = malloc((size_t)len)) == NULL)
         return -1;
+    for (size_t i = 0; i < vec->dims; i++, p += 4) {
+        uint32_t bits = (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+                        (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+        memcpy(&vec->owned[i], &bits, sizeof(float));
     }
-    cbor_decref(&s);
+    vec->data = vec->owned;
+    return 0;
+}
 
-    written = cbor_serialize(root, buf->data, MSG_MAXLEN);
-    if (written == 0 || written > MSG_MAXLEN) {
-        cbor_decref(&root);
+int cursor_vector(proto_cursor_t *cur, proto_vector_t *vec) {
+    const uint8_t *start = cur->p;
+    int major, info;
+    uint64_t arg;
+    size_t dims;
+
+    memset(vec, 0, sizeof(proto_vector_t));
+    if (cursor_head(cur, &major, &info, &arg) != 0)
         return -1;
-    }
+    if (major == CBOR_MAJOR_TAG)
+        return arg == CBOR_TAG_FLOAT32_LE ? cursor_typed_vector(cur, vec) : -1;
 
-    if (written > (size_t)INT_MAX) {
-        cbor_decref(&root);
+    /* Fallback: array of floats, one item per component. */
+    cur->p = start;
+    if (cursor_array(cur, &dims) != 0)
         return -1;
+    vec->dims = dims;
+    if (dims == 0)
+        return 0;
+    if ((vec->owned = malloc(dims * sizeof(float))) == NULL)
+        return -1;
+    for (size_t i = 0; i < dims; i++) {
+        if (cursor_float(cur, &vec->owned[i]) != 0) {
+            proto_vector_free(vec);
+            return -1;
+        }
     }
+    vec->data = vec->owned;
+    return 0;
+}
 
-    buf->hdr.len = (int)written;
-    buf->hdr.type = msg_type;
+int cursor_done(const proto_cursor_t *cur) {
+    return cur->p == cur->end;
+}
 
-    cbor_decref(&root);
-    return 0;
+void proto_vector_free(proto_vector_t *vec) {
+    free(vec->owned);
+    vec->owned = NULL;
+    vec->data  = NULL;
+}
+
+/**
+ * @brief Serializes an operation result response into a CBOR-encoded buffer.
+ *
+ * Encodes a CBOR array of the form:
+ *     [error_code:int, error_message:string]
+ *
+ * @param buf Output buffer where the CBOR message will be written.
+ * @param msg_type The message type (MSG_INSERT_RESULT, MSG_DEL_RESULT, etc.).
+ * @param code Error code (0 for success, non-zero for error).
+ * @param msg Error message string (can be NULL for success).
+ * @return 0 on success, -1 on error or insufficient buffer space.
+ */
+int buffer_write_op_result(buffer_t *buf, int msg_type, int code, const char *msg) {
+    size_t mlen = msg ? strlen(msg) : 0;
+    uint8_t *p, *end;
+
+    if (!buf || !buf->data) return -1;
+    if (mlen > MSG_MAXLEN - 3 * CBOR_HEAD_MAX) return -1;
+    if (buffer_encode_begin(buf, 3 * CBOR_HEAD_MAX + mlen) != 0) return -1;
+
+    p   = buf->data;
+    end = buf->data + buf->cap;
+    p += cbor_encode_array_start(2, p, end - p);
+    p += cbor_encode_uint32((uint32_t)code, p, end - p);
+    p += cbor_encode_string_start(mlen, p, end - p);
+    memcpy(p, msg ? msg : "", mlen);
+    p += mlen;
+
+    return buffer_encode_end(buf, msg_type, p - buf->data);
 }
 
 /**
@@ -124,3 +302,68 @@ int buffer_read_op_result(const buffer_t *buf, int *code, char **msg) {
     cbor_decref(&root);
     return 0;
 }
+
+/**
+ * @brief Serializes a STATS_RESULT response into a CBOR-encoded buffer.
+ *
+ * Encodes a CBOR map of the form:
+ *     {name:string => value:uint, ...}
+ *
+ * @param buf Output buffer where the CBOR message will be written.
+ * @param stats Counters to report.
+ * @param n Number of counters.
+ * @return 0 on success, -1 on error or if the message exceeds MSG_MAXLEN.
+ */
+int buffer_write_stats(buffer_t *buf, const proto_stat_t *stats, size_t n) {
+    size_t max_len = CBOR_HEAD_MAX;
+    uint8_t *p, *end;
+
+    PANIC_IF(!buf, "buffer cannot be null");
+    PANIC_IF(!buf->data, "buffer data cannot be null");
+    PANIC_IF(n > 0 && !stats, "stats cannot be null");
+
+    for (size_t i = 0; i < n; i++)
+        max_len += 2 * CBOR_HEAD_MAX + strlen(stats[i].name);
+    if (buffer_encode_begin(buf, max_len) != 0)
+        return -1;
+
+    p   = buf->data;
+    end = buf->data + buf->cap;
+    p += cbor_encode_map_start(n, p, end - p);
+    for (size_t i = 0; i < n; i++) {
+        size_t len = strlen(stats[i].name);
+        p += cbor_encode_string_start(len, p, end - p);
+        memcpy(p, stats[i].name, len);
+        p += len;
+        p += cbor_encode_uint(stats[i].value, p, end - p);
+    }
+
+    return buffer_encode_end(buf, MSG_STATS_RESULT, p - buf->data);
+}
+
+int buffer_read_config(const buffer_t *buf, proto_setting_t *settings, size_t max, size_t *n) {
+    proto_cursor_t cur;
+    int major, info;
+    uint64_t count, len;
+
+    PANIC_IF(!buf, "buffer cannot be null");
+    PANIC_IF(!settings, "settings cannot be null");
+
+    cursor_init(&cur, buf);
+    if (cursor_head(&cur, &major, &info, &count) != 0 || major != CBOR_MAJOR_MAP || count > max)
+        return -1;
+    for (size_t i = 0; i < count; i++) {
+        if (cursor_head(&cur, &major, &info, &len) != 0 || major != CBOR_MAJOR_TEXT ||
+            len > (uint64_t)(cur.end - cur.p))
+            return -1;
+        settings[i].name = (const char *)cur.p;
+        settings[i].len  = (size_t)len;
+        cur.p += len;
+        if (cursor_uint(&cur, &settings[i].value) != 0)
+            return -1;
+    }
+    if (!cursor_done(&cur))
+        return -1;
+    *n = (size_t)count;
+    return 0;
+}
@@ -11,6 +11,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <cbor.h>
 #include "buffer.h"
 
 /* Vector protocol message types */
@@ -29,8 +30,195 @@
 #define MSG_OP_RESULT       0x0A
 #define MSG_ERROR           0x0B
 
+/*
+ * Types up to HDR_V1_MAX_TYPE (0x0E) can be sent with either header
+ * version. Types above it only exist in v2 frames (see buffer.h).
+ */
+
+/* Batch message types (v2 only) */
+#define MSG_INSERT_BATCH    0x10
+#define MSG_SEARCH_BATCH    0x11
+#define MSG_BATCH_RESULT    0x12
+#define MSG_MATCH_BATCH_RESULT 0x13
+
+/* Server statistics (v2 only) */
+#define MSG_STATS           0x14
+#define MSG_STATS_RESULT    0x15
+
+/* Runtime settings (v2 only), answered with a STATS_RESULT of the settings */
+#define MSG_CONFIG          0x16
+
+/* Moves the connection to shared-memory rings (v2 only, see shm.h) */
+#define MSG_SHM_ATTACH      0x17
+
+/* Inserts the rows of a file passed with SCM_RIGHTS (v2 only, see viproto.h),
+ * answered with a STATS_RESULT report */
+#define MSG_INSERT_FILE     0x18
+
 #define MSG_MAXLEN          0x0FFFFFFF
 
+/** @brief Largest encoding of a CBOR item head (initial byte + 64-bit argument) */
+#define CBOR_HEAD_MAX       9
+/** @brief Encoding size of a single precision CBOR float */
+#define CBOR_FLOAT4_LEN     5
+
+/** @brief RFC 8746 tag of a typed array of float32, little endian */
+#define CBOR_TAG_FLOAT32_LE 85
+
+/**
+ * @brief Single pass CBOR decoder over a message payload.
+ *
+ * Reads items in place, without building an item tree. Only definite
+ * length items are accepted.
+ */
+typedef struct {
+    const uint8_t *p;    /**< Next unread byte */
+    const uint8_t *end;  /**< End of the payload */
+} proto_cursor_t;
+
+/**
+ * @brief Float vector decoded from a message.
+ *
+ * When the vector was sent as a typed array (tag CBOR_TAG_FLOAT32_LE),
+ * `data` points into the message payload and is only valid as long as the
+ * message is. Vectors sent as an array of floats are copied to `owned`.
+ * Release with proto_vector_free().
+ */
+typedef struct {
+    const float *data;   /**< Vector components */
+    size_t       dims;   /**< Number of components */
+    float       *owned;  /**< Heap copy backing `data`, or NULL */
+} proto_vector_t;
+
+/**
+ * @brief Starts decoding the payload of a message.
+ *
+ * @param cur Cursor to initialize.
+ * @param buf Message whose payload is decoded.
+ */
+void cursor_init(
+    proto_cursor_t *cur,
+    const buffer_t *buf
+);
+
+/**
+ * @brief Reads the head of a definite length array.
+ *
+ * @param cur Cursor.
+ * @param len Output number of elements.
+ * @return 0 on success, -1 on malformed input or type mismatch.
+ */
+int cursor_array(
+    proto_cursor_t *cur,
+    size_t *len
+);
+
+/**
+ * @brief Reads an unsigned integer of any width.
+ *
+ * @param cur Cursor.
+ * @param v Output value.
+ * @return 0 on success, -1 on malformed input or type mismatch.
+ */
+int cursor_uint(
+    proto_cursor_t *cur,
+    uint64_t *v
+);
+
+/**
+ * @brief Reads a single or double precision float.
+ *
+ * @param cur Cursor.
+ * @param v Output value (doubles are narrowed).
+ * @return 0 on success, -1 on malformed input or type mismatch.
+ */
+int cursor_float(
+    proto_cursor_t *cur,
+    float *v
+);
+
+/**
+ * @brief Reads a float vector.
+ *
+ * Accepts a float32 little endian typed array, returned without copying
+ * when the host byte order and the payload alignment allow it, or an
+ * array of single/double precision floats, which is copied.
+ *
+ * @param cur Cursor.
+ * @param vec Output vector, to be released with proto_vector_free().
+ * @return 0 on success, -1 on malformed input or allocation failure.
+ */
+int cursor_vector(
+    proto_cursor_t *cur,
+    proto_vector_t *vec
+);
+
+/**
+ * @brief Tells whether the whole payload was consumed.
+ *
+ * @param cur Cursor.
+ * @return 1 if no bytes are left, 0 otherwise.
+ */
+int cursor_done(
+    const proto_cursor_t *cur
+);
+
+/**
+ * @brief Releases the copy backing a decoded vector, if any.
+ *
+ * @param vec Vector to release.
+ */
+void proto_vector_free(
+    proto_vector_t *vec
+);
+
+/**
+ * @brief Prepares a buffer for a payload encoded in place.
+ *
+ * Streaming writers compute an upper bound of their encoding, reserve it
+ * here and then emit the payload straight into `buf->data` with the
+ * `cbor_encode_*` primitives, without building an item tree.
+ *
+ * @param buf Output buffer.
+ * @param max_len Upper bound of the encoded payload size.
+ * @return 0 on success, -1 if @p max_len exceeds MSG_MAXLEN or on allocation failure.
+ */
+int buffer_encode_begin(
+    buffer_t *buf,
+    size_t max_len
+);
+
+/**
+ * @brief Completes a payload encoded in place.
+ *
+ * @param buf Output buffer.
+ * @param msg_type Message type stored in the header.
+ * @param len Number of payload bytes written.
+ * @return 0 on success, -1 if @p len exceeds MSG_MAXLEN.
+ */
+int buffer_encode_end(
+    buffer_t *buf,
+    int msg_type,
+    size_t len
+);
+
+/**
+ * @brief Serializes a CBOR item tree as the payload of a buffer.
+ *
+ * The payload area grows as needed (up to MSG_MAXLEN) and the header is
+ * populated with the payload length and @p msg_type.
+ *
+ * @param buf Output buffer.
+ * @param msg_type Message type stored in the header.
+ * @param root CBOR item to serialize.
+ * @return 0 on success, -1 if the encoding exceeds MSG_MAXLEN or on allocation failure.
+ */
+int buffer_write_cbor(
+    buffer_t *buf,
+    int msg_type,
+    const cbor_item_t *root
+);
+
 /**
  * @brief Serializes an operation result response into a CBOR-encoded buffer.
  *
@@ -69,4 +257,57 @@ int buffer_read_op_result(
     char **msg
 );
 
+/**
+ * @brief Named counter reported by a STATS request.
+ */
+typedef struct {
+    const char *name;    /**< Counter name */
+    uint64_t    value;   /**< Counter value */
+} proto_stat_t;
+
+/**
+ * @brief Serializes a STATS_RESULT response into a CBOR-encoded buffer.
+ *
+ * Encodes a CBOR map of the form:
+ *     {name:string => value:uint, ...}
+ *
+ * @param buf Output buffer where the CBOR message will be written.
+ * @param stats Counters to report.
+ * @param n Number of counters.
+ * @return 0 on success, -1 on error or if the message exceeds MSG_MAXLEN.
+ */
+int buffer_write_stats(
+    buffer_t *buf,
+    const proto_stat_t *stats,
+    size_t n
+);
+
+/**
+ * @brief Setting changed by a CONFIG request.
+ */
+typedef struct {
+    const char *name;    /**< Setting name, not NUL terminated (points into the request) */
+    size_t      len;     /**< Length of `name` */
+    uint64_t    value;   /**< New value */
+} proto_setting_t;
+
+/**
+ * @brief Deserializes a CONFIG request.
+ *
+ * Decodes a CBOR map of the form:
+ *     {name:string => value:uint, ...}
+ *
+ * @param buf Input buffer containing the CBOR-encoded message.
+ * @param settings Output settings, pointing into @p buf.
+ * @param max Capacity of @p settings.
+ * @param n Output number of settings.
+ * @return 0 on success, -1 on malformed input or more than @p max settings.
+ */
+int buffer_read_config(
+    const buffer_t *buf,
+    proto_setting_t *settings,
+    size_t max,
+    size_t *n
+);
+
 #endif /* __PROTOCOL_H */
\ No newline at end of file
@@ -0,0 +1,424 @@
+/**
+ * @file replay.c
+ * @brief Parallel Write-Ahead Log replay.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <time.h>
+#include "replay.h"
+#include "workers.h"
+#include "log.h"
+
+/** @brief Initial number of slots of the compaction map (power of 2) */
+#define COMPACT_INITIAL_SLOTS 1024
+
+/** @brief Records read together and decoded by one worker job */
+typedef struct {
+    work_t    work;
+    const replay_handler_t *handler;
+    size_t    n;                        /**< Records in the batch */
+    int       done;                     /**< Decoded (only read on the replaying thread) */
+    wal_record_t recs[REPLAY_BATCH];
+    buffer_t *msgs[REPLAY_BATCH];       /**< Messages of WAL_OP_MESSAGE records */
+    int       status[REPLAY_BATCH];     /**< Result of `decode` for each record */
+    uint8_t  *ops;                      /**< REPLAY_BATCH operations of `op_size` bytes */
+} batch_t;
+
+/** @brief Last operation on an id or key */
+typedef struct {
+    uint64_t hash;
+    uint64_t last;       /**< Sequence number of the last entry, 0 if the slot is free */
+    size_t   koff;       /**< Key offset in the arena */
+    size_t   klen;
+    uint32_t count;      /**< Entries on the key (saturates) */
+    int      first_del;  /**< The first entry removed the key */
+} slot_t;
+
+/** @brief Compaction map: open addressing, keys copied to an arena */
+typedef struct {
+    slot_t  *slots;
+    size_t   nslots, used;
+    uint8_t *arena;
+    size_t   asize, aused;
+} compact_map_t;
+
+/** @brief Replay pass state */
+typedef struct {
+    const replay_handler_t *handler;
+    compact_map_t *map;        /**< NULL if not compacting */
+    uint64_t       seq;        /**< Sequence number of the last entry */
+    int            err;        /**< errno of a failed scan */
+    replay_stats_t *stats;
+} pass_t;
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t hash_key(const void *key, size_t klen) {
+    const uint8_t *p = (const uint8_t *)key;
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < klen; i++)
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    return h ? h : 1;
+}
+
+/**
+ * @brief Finds the slot of a key, or the free slot where it belongs.
+ */
+static slot_t *map_find(const compact_map_t *map, uint64_t hash, const void *key, size_t klen) {
+    size_t mask = map->nslots - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        slot_t *s = &map->slots[i];
+
+        if (s->last == 0)
+            return s;
+        if (s->hash == hash && s->klen == klen &&
+            memcmp(map->arena + s->koff, key, klen) == 0)
+            return s;
+    }
+}
+
+static int map_grow(compact_map_t *map) {
+    size_t nslots = map->nslots ? map->nslots * 2 : COMPACT_INITIAL_SLOTS;
+    slot_t *old = map->slots, *slots;
+
+    if ((slots = calloc(nslots, sizeof(slot_t))) == NULL)
+        return -1;
+    for (size_t i = 0; i < map->nslots; i++) {
+        if (old[i].last == 0)
+            continue;
+        for (size_t j = old[i].hash & (nslots - 1);; j = (j + 1) & (nslots - 1)) {
+            if (slots[j].last == 0) {
+                slots[j] = old[i];
+                break;
+            }
+        }
+    }
+    map->slots = slots;
+    map->nslots = nslots;
+    free(old);
+    return 0;
+}
+
+/**
+ * @brief Records an entry on a key.
+ */
+static int map_update(compact_map_t *map, const void *key, size_t klen, int del, uint64_t seq) {
+    uint64_t hash = hash_key(key, klen);
+    slot_t *s;
+
+    if ((map->used + 1) * 2 > map->nslots && map_grow(map) != 0)
+        return -1;
+    s = map_find(map, hash, key, klen);
+    if (s->last == 0) {
+        if (map->aused + klen > map->asize) {
+            size_t asize = map->asize ? map->asize : 4096;
+            uint8_t *arena;
+
+            while (map->aused + klen > asize)
+                asize *= 2;
+            if ((arena = realloc(map->arena, asize)) == NULL)
+                return -1;
+            map->arena = arena;
+            map->asize = asize;
+        }
+        memcpy(map->arena + map->aused, key, klen);
+        s->hash = hash;
+        s->koff = map->aused;
+        s->klen = klen;
+        s->first_del = del;
+        map->aused += klen;
+        map->used++;
+    }
+    s->last = seq;
+    if (s->count < UINT32_MAX)
+        s->count++;
+    return 0;
+}
+
+static void map_free(compact_map_t *map) {
+    free(map->slots);
+    free(map->arena);
+}
+
+static void decode_batch(work_t *w) {
+    batch_t *b = (batch_t *)w;
+    const replay_handler_t *h = b->handler;
+
+    for (size_t i = 0; i < b->n; i++)
+        b->status[i] = h->decode(&b->recs[i], b->ops + i * h->op_size);
+}
+
+/**
+ * @brief Reads the next records of the log into a batch.
+ *
+ * @return 1 if the batch is full, otherwise the last wal_reader_next() result.
+ */
+static int fill_batch(wal_reader_t *wal, batch_t *b) {
+    int ret;
+
+    b->n = 0;
+    b->done = 0;
+    while (b->n < REPLAY_BATCH) {
+        if (!b->msgs[b->n] && (b->msgs[b->n] = alloc_buffer()) == NULL)
+            return -1;
+        wal_record_free(&b->recs[b->n]);
+        if ((ret = wal_reader_next(wal, &b->recs[b->n], b->msgs[b->n])) != 1)
+            return ret;
+        b->n++;
+    }
+    return 1;
+}
+
+/**
+ * @brief Waits until the workers have decoded a batch.
+ */
+static void wait_batch(workers_t *pool, batch_t *b) {
+    while (!b->done) {
+        struct pollfd pfd = { .fd = workers_fd(pool), .events = POLLIN };
+
+        /* Batches still being decoded must not be released: wait on errors too. */
+        poll(&pfd, 1, -1);
+        for (work_t *w = workers_collect(pool); w; w = w->next)
+            ((batch_t *)w)->done = 1;
+    }
+}
+
+/**
+ * @brief Compaction scan: records the last entry on every id or key.
+ *
+ * Records that cannot be decoded change nothing and are reported by the
+ * apply pass.
+ */
+static void scan_batch(pass_t *p, batch_t *b) {
+    const replay_handler_t *h = p->handler;
+
+    for (size_t i = 0; i < b->n; i++) {
+        void *op = b->ops + i * h->op_size;
+
+        if (b->status[i] != 0)
+            continue;
+        for (size_t e = 0, n = h->entries(op); e < n && p->err == 0; e++) {
+            const void *key;
+            size_t klen;
+            int del = h->entry(op, e, &key, &klen);
+
+            if (map_update(p->map, key, klen, del, ++p->seq) != 0)
+                p->err = errno ? errno : ENOMEM;
+        }
+        h->release(op);
+    }
+}
+
+/**
+ * @brief Describes the type of a record for log messages.
+ */
+static void record_type(const wal_record_t *rec, char *out, size_t len) {
+    if (rec->op == WAL_OP_MESSAGE)
+        snprintf(out, len, "message type %d", rec->msg->hdr.type);
+    else
+        snprintf(out, len, "%s", wal_op_name(rec->op));
+}
+
+/**
+ * @brief Applies the entries of a batch, or only the last ones on their key when compacting.
+ */
+static void apply_batch(pass_t *p, batch_t *b) {
+    const replay_handler_t *h = p->handler;
+    replay_stats_t *stats = p->stats;
+
+    for (size_t i = 0; i < b->n; i++) {
+        void *op = b->ops + i * h->op_size;
+        char type[32];
+
+        stats->records++;
+        switch (b->status[i]) {
+        case 0:
+            for (size_t e = 0, n = h->entries(op); e < n; e++) {
+                int flags = 0, del = 0;
+
+                stats->entries++;
+                p->seq++;
+                if (p->map) {
+                    const void *key;
+                    size_t klen;
+                    const slot_t *s;
+
+                    del = h->entry(op, e, &key, &klen);
+                    s = map_find(p->map, hash_key(key, klen), key, klen);
+                    if (s->last != p->seq) {
+                        stats->dropped++;
+                        continue;
+                    }
+                    /* Earlier entries were dropped: the key may be in another state than expected */
+                    if (s->count > 1)
+                        flags = del ? (s->first_del ? 0 : REPLAY_TOLERANT) : REPLAY_PURGE;
+                }
+                if (h->apply(h->core, op, e, flags) == 0 || (flags & REPLAY_TOLERANT))
+                    stats->applied++;
+                else
+                    stats->failed++;
+            }
+            h->release(op);
+            break;
+        case 1:
+            record_type(&b->recs[i], type, sizeof(type));
+            log_message(LOG_WARNING, "unknown WAL record type (%s)", type);
+            stats->skipped++;
+            break;
+        default:
+            record_type(&b->recs[i], type, sizeof(type));
+            log_message(LOG_ERROR, "malformed WAL record (%s)", type);
+            stats->failed++;
+            break;
+        }
+    }
+}
+
+static void log_progress(const wal_reader_t *wal, const char *what, uint64_t records, int64_t start) {
+    uint64_t done, total;
+    double elapsed = (now_ms() - start) / 1000.0;
+
+    wal_reader_progress(wal, &done, &total);
+    if (done == 0 || elapsed <= 0)
+        return;
+    log_message(LOG_INFO,
+        "%s transaction log: %d%% (%" PRIu64 " records, %.0f records/s, ETA %.0f s)",
+        what, (int)(done * 100 / total), records, records / elapsed,
+        elapsed * (double)(total - done) / (double)done
+    );
+}
+
+/**
+ * @brief Reads the whole log and hands the decoded batches to @p consume, in log order.
+ *
+ * Keeps up to `nslots` batches in flight. The operations of the records
+ * decoded successfully are released by @p consume.
+ *
+ * @return 0 at the end of the log, -1 on error (errno is set, 0 for a corrupted log).
+ */
+static int run_pass(wal_reader_t *wal, pass_t *p, void (*consume)(pass_t *, batch_t *),
+                    const char *what, workers_t *pool, batch_t *ring, size_t nslots) {
+    size_t head = 0, tail = 0;
+    int64_t start = now_ms(), last = start;
+    uint64_t records = 0;
+    int ret = 1, err = 0;
+
+    for (;;) {
+        batch_t *b;
+
+        while (ret == 1 && head - tail < nslots) {
+            b = &ring[head % nslots];
+            if ((ret = fill_batch(wal, b)) < 0)
+                err = errno;
+            if (b->n == 0)
+                break;
+            if (pool)
+                workers_submit(pool, &b->work);
+            else {
+                decode_batch(&b->work);
+                b->done = 1;
+            }
+            head++;
+        }
+        if (tail == head)
+            break;
+
+        b = &ring[tail++ % nslots];
+        if (pool)
+            wait_batch(pool, b);
+        consume(p, b);
+        records += b->n;
+
+        if (now_ms() - last >= REPLAY_PROGRESS_MS) {
+            last = now_ms();
+            log_progress(wal, what, records, start);
+        }
+    }
+
+    if (ret < 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+int replay_wal(wal_reader_t *wal, const replay_handler_t *handler, int compact,
+               replay_stats_t *stats) {
+    int threads = get_replay_threads();
+    size_t nslots = threads > 1 ? 2 * (size_t)threads : 1;
+    workers_t *pool = NULL;
+    compact_map_t map = { 0 };
+    pass_t pass = { .handler = handler, .stats = stats };
+    batch_t *ring;
+    int ret = 0, err = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    if ((ring = calloc(nslots, sizeof(batch_t))) == NULL)
+        return -1;
+    for (size_t i = 0; i < nslots; i++) {
+        ring[i].handler = handler;
+        ring[i].work.fn = decode_batch;
+        if ((ring[i].ops = malloc(REPLAY_BATCH * handler->op_size)) == NULL) {
+            ret = -1;
+            err = errno;
+            goto cleanup;
+        }
+    }
+    if (threads > 1 && (pool = workers_create(threads)) == NULL)
+        log_message(LOG_WARNING,
+            "unable to start replay threads (%d) - message: %s", errno, strerror(errno)
+        );
+
+    /* Compaction reads the log twice: find the last entry on each key, then apply those. */
+    if (compact) {
+        pass.map = &map;
+        if ((ret = run_pass(wal, &pass, scan_batch, "Scanning", pool, ring, nslots)) < 0) {
+            err = errno;
+            goto cleanup;
+        }
+        wal_reader_rewind(wal);
+        if (pass.err != 0) {
+            log_message(LOG_WARNING,
+                "unable to compact the transaction log (%d) - message: %s",
+                pass.err, strerror(pass.err)
+            );
+            pass.map = NULL;
+        } else {
+            log_message(LOG_INFO,
+                "Transaction log compacted: %" PRIu64 " operations on %zu keys, %" PRIu64 " superseded",
+                pass.seq, map.used, pass.seq - map.used
+            );
+        }
+        pass.seq = 0;
+    }
+    if ((ret = run_pass(wal, &pass, apply_batch, "Replaying", pool, ring, nslots)) < 0)
+        err = errno;
+
+cleanup:
+    workers_destroy(pool);
+    for (size_t i = 0; i < nslots; i++) {
+        for (size_t j = 0; j < REPLAY_BATCH && ring[i].msgs[j]; j++) {
+            wal_record_free(&ring[i].recs[j]);
+            free_buffer(ring[i].msgs[j]);
+        }
+        free(ring[i].ops);
+    }
+    free(ring);
+    map_free(&map);
+
+    if (ret < 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
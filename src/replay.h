@@ -0,0 +1,170 @@
+/**
+ * @file replay.h
+ * @brief Parallel Write-Ahead Log replay.
+ *
+ * Replay is split in two stages. Records are read in batches and decoded
+ * by a pool of worker threads, several batches at a time: binary records
+ * point into the mapped segments and need no work, messages from logs of
+ * older formats are CBOR decoded. The decoded operations are then applied to the
+ * database by the calling thread, strictly in log order, without encoding
+ * the responses a client would have received.
+ *
+ * With compaction, the log is scanned once beforehand to find the last
+ * operation on every id or key, and only that one is applied: an id that
+ * was inserted, deleted and inserted again is inserted once, a key PUT many
+ * times is PUT once. Since the log only holds operations that succeeded,
+ * the first operation on an id tells whether it existed before the log
+ * started, which decides the REPLAY_* flags the surviving operation is
+ * applied with.
+ */
+
+#ifndef __REPLAY_H
+#define __REPLAY_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "buffer.h"
+#include "wal.h"
+
+/** @brief Records decoded per worker job */
+#define REPLAY_BATCH 128
+
+/** @brief Upper bound of the default number of decoding threads */
+#define REPLAY_MAX_THREADS 8
+
+/** @brief Interval between progress log lines (milliseconds) */
+#define REPLAY_PROGRESS_MS 5000
+
+/**
+ * @brief Apply flags.
+ *
+ * REPLAY_PURGE: earlier operations on the id were dropped, so it may exist
+ * with other contents: remove it first (ignoring a failure).
+ * REPLAY_TOLERANT: the removed id may not exist; a failure is not an error.
+ */
+#define REPLAY_PURGE    0x01
+#define REPLAY_TOLERANT 0x02
+
+#define DEFAULT_REPLAY_COMPACT 1
+
+/**
+ * @brief Gets the number of replay decoding threads from environment or default value.
+ *
+ * Reads the VICTOR_REPLAY_THREADS environment variable. If not set or
+ * invalid, uses the number of online CPUs, up to REPLAY_MAX_THREADS.
+ * With 1, records are decoded on the replaying thread.
+ *
+ * @return Number of decoding threads
+ */
+static inline int get_replay_threads(void) {
+    const char *env_val = getenv("VICTOR_REPLAY_THREADS");
+    long cpus;
+    if (env_val) {
+        int threads = atoi(env_val);
+        if (threads > 0) {
+            return threads;
+        }
+    }
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        return 1;
+    return cpus > REPLAY_MAX_THREADS ? REPLAY_MAX_THREADS : (int)cpus;
+}
+
+/**
+ * @brief Tells whether replay compacts the log from environment or default value.
+ *
+ * Reads the VICTOR_REPLAY_COMPACT environment variable (`0` or `1`). If
+ * not set or invalid, returns DEFAULT_REPLAY_COMPACT.
+ *
+ * @return 1 to compact, 0 to apply every operation
+ */
+static inline int get_replay_compact(void) {
+    const char *env_val = getenv("VICTOR_REPLAY_COMPACT");
+    if (env_val) {
+        if (strcmp(env_val, "0") == 0) return 0;
+        if (strcmp(env_val, "1") == 0) return 1;
+    }
+    return DEFAULT_REPLAY_COMPACT;
+}
+
+/**
+ * @brief Database specific replay callbacks.
+ *
+ * Operations are opaque to the replayer: it reserves `op_size` bytes for
+ * each record and hands them to the callbacks. An operation changes one or
+ * more entries (ids or keys), e.g. one per vector of an insert batch.
+ */
+typedef struct {
+    /** @brief Database context passed to `apply` */
+    void   *core;
+
+    /** @brief Size of a decoded operation */
+    size_t  op_size;
+
+    /**
+     * @brief Decodes a record into @p op (worker threads, concurrently).
+     *
+     * Must not touch the database. The operation may point into @p rec,
+     * which stays valid until the operation is released.
+     *
+     * @return 0 on success, 1 if the record type is unknown (skipped),
+     *         -1 if the record is malformed.
+     */
+    int  (*decode)(const wal_record_t *rec, void *op);
+
+    /** @brief Gets the number of entries a decoded operation changes */
+    size_t (*entries)(const void *op);
+
+    /**
+     * @brief Gets the id or key of an entry.
+     *
+     * @return 1 if the entry removes it, 0 if it sets it.
+     */
+    int  (*entry)(const void *op, size_t i, const void **key, size_t *klen);
+
+    /**
+     * @brief Applies an entry of a decoded operation (replaying thread, in log order).
+     *
+     * @param core Database context.
+     * @param op Decoded operation.
+     * @param i Entry index.
+     * @param flags REPLAY_* flags.
+     * @return 0 if it was applied, -1 if the database rejected it.
+     */
+    int  (*apply)(void *core, void *op, size_t i, int flags);
+
+    /** @brief Releases what `decode` allocated */
+    void (*release)(void *op);
+} replay_handler_t;
+
+/** @brief Replay outcome */
+typedef struct {
+    uint64_t records;   /**< Records read */
+    uint64_t entries;   /**< Entries changed by the records */
+    uint64_t applied;   /**< Entries applied */
+    uint64_t dropped;   /**< Entries superseded by a later one (compaction) */
+    uint64_t failed;    /**< Entries rejected, and malformed records */
+    uint64_t skipped;   /**< Records of an unknown type */
+} replay_stats_t;
+
+/**
+ * @brief Replays every record of a log.
+ *
+ * Logs progress and an estimated time of completion every
+ * REPLAY_PROGRESS_MS while running.
+ *
+ * @param wal Reader opened at the first record to replay.
+ * @param handler Database callbacks.
+ * @param compact Scan the log first and apply only the last operation on
+ *        each id or key.
+ * @param stats Output counters.
+ * @return 0 once the end of the log was reached, -1 on I/O error (errno is
+ *         set) or corrupted log (errno is 0), see wal_reader_next().
+ */
+extern int replay_wal(wal_reader_t *wal, const replay_handler_t *handler, int compact,
+                      replay_stats_t *stats);
+
+#endif /* __REPLAY_H */
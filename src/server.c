@@ -3,6 +3,21 @@
 #include <errno.h>
 #include <string.h>
 #include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include "server.h"
+#include "socket.h"
+#include "evloop.h"
+#include "conn.h"
+#include "shm.h"
+#include "protocol.h"
+#include "workers.h"
+#include "uring.h"
+#include "log.h"
+
 /**
  * @brief Global flag to control server loop execution.
  *
@@ -23,3 +38,1171 @@ void handle_signal(int signo) {
     (void)signo;
     running = 0;
 }
+
+/**
+ * @brief Raises the soft descriptor limit up to the hard limit.
+ *
+ * The connection table grows with the descriptor numbers handed out by the
+ * kernel, so the soft limit is the effective connection cap.
+ */
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur == rl.rlim_max)
+        return;
+    rl.rlim_cur = rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) != 0)
+        log_message(LOG_WARNING, "unable to raise descriptor limit: %s", strerror(errno));
+}
+
+int server_rwlock_init(pthread_rwlock_t *lock) {
+    pthread_rwlockattr_t attr;
+    int ret;
+
+    if (pthread_rwlockattr_init(&attr) != 0)
+        return -1;
+#if defined(__GLIBC__)
+    /* glibc favors readers by default, which can starve the loop thread. */
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    ret = pthread_rwlock_init(lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    return ret == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Runs a deferred request on a worker thread.
+ */
+static void run_deferred(work_t *w) {
+    conn_req_t *req = (conn_req_t *)w;
+    const server_handler_t *handler = (const server_handler_t *)req->arg;
+
+    req->status = handler->work(handler->core, req->msg);
+}
+
+/**
+ * @brief Runs a SERVER_WRITE request on the writer thread.
+ *
+ * Only the job function differs from run_deferred(): it tells the writes
+ * from the reads queued behind them.
+ */
+static void run_write(work_t *w) {
+    run_deferred(w);
+}
+
+/** @brief Requests whose responses wait for the next group commit, FIFO */
+typedef struct {
+    work_t *head, *tail;
+} held_t;
+
+/**
+ * @brief State of the server loop.
+ *
+ * The loop runs on one of two I/O backends. The readiness backend waits
+ * for readiness events (epoll or kqueue, see evloop.h) and then makes the
+ * system calls itself. The io_uring backend has the kernel accept clients,
+ * receive into provided buffers and send responses, and only waits for
+ * the completions (see uring.h).
+ */
+typedef struct {
+    const server_handler_t *handler;
+    workers_t    *pool;
+    workers_t    *writer;     /**< Single thread running SERVER_WRITE requests in order */
+    conn_table_t  conns;
+    held_t        held;       /**< Responses waiting for the next commit */
+    held_t        flight;     /**< Responses waiting for the commit running in the background */
+    int           server;     /**< Listening socket */
+    int           commit_fd;
+    size_t        out_max;    /**< Output queue bound of each connection (bytes) */
+    evloop_t     *ev;         /**< Readiness backend, NULL with io_uring */
+#if defined(HAVE_IO_URING)
+    uring_t      *ring;       /**< io_uring backend, NULL with the readiness backend */
+    struct msghdr recv_hdr;   /**< Layout of the multishot receives (room for SCM_RIGHTS) */
+    int           pending;    /**< Operations whose last completion is still to come */
+    int           tcp;        /**< The listening socket is a TCP socket */
+    int           accepting;  /**< The multishot accept is armed */
+#endif
+} loop_t;
+
+/** @brief I/O counters reported by server_io_stats() */
+static struct {
+    int       uring;      /**< The io_uring backend is in use */
+    uint64_t  requests;   /**< Requests read */
+    uint64_t  calls;      /**< Event waits, accepts and descriptor passing calls */
+#if defined(HAVE_IO_URING)
+    uring_t  *ring;
+#endif
+} io;
+
+size_t server_io_stats(proto_stat_t *stats) {
+    uint64_t calls = io.calls + conn_syscalls;
+
+#if defined(HAVE_IO_URING)
+    if (io.ring)
+        calls += uring_calls(io.ring);
+#endif
+    stats[0].name = "io_uring";
+    stats[0].value = (uint64_t)io.uring;
+    stats[1].name = "io_requests";
+    stats[1].value = io.requests;
+    stats[2].name = "io_syscalls";
+    stats[2].value = calls;
+    stats[3].name = "out_queue_requests";
+    stats[3].value = conn_queues.requests;
+    stats[4].name = "out_queue_bytes";
+    stats[4].value = conn_queues.bytes;
+    stats[5].name = "out_queue_peak_bytes";
+    stats[5].value = conn_queues.peak;
+    stats[6].name = "out_stalls";
+    stats[6].value = conn_queues.stalls;
+    stats[7].name = "out_stalled";
+    stats[7].value = conn_queues.stalled;
+    return SERVER_IO_STATS;
+}
+
+/**
+ * @brief Queues a request until the next commit; the caller counts it in `inflight`.
+ */
+static void hold(held_t *held, conn_req_t *req) {
+    req->work.next = NULL;
+    if (held->tail)
+        held->tail->next = &req->work;
+    else
+        held->head = &req->work;
+    held->tail = &req->work;
+}
+
+#if defined(HAVE_IO_URING)
+static int ring_settle(loop_t *L, conn_t *conn);
+static void ring_close(loop_t *L, conn_t *conn);
+static int ring_watch(loop_t *L, int fd, conn_t *conn);
+#endif
+
+static int read_conn(loop_t *L, conn_t *conn);
+
+/**
+ * @brief Sends what can be sent and decides whether the connection stays open.
+ *
+ * A connection stalled by its output queue is read again once enough of
+ * its responses went out. A peer that shut down its sending side is kept
+ * until every response to its requests has been delivered.
+ *
+ * @return 0 if the connection stays open, -1 if it must be closed.
+ */
+static int settle_conn(loop_t *L, conn_t *conn) {
+    int r;
+
+#if defined(HAVE_IO_URING)
+    if (L->ring && !conn->shm)
+        return ring_settle(L, conn);
+#endif
+    for (;;) {
+        if ((r = conn_flush(conn)) == -1)
+            return -1;
+        if (!conn_resume(conn, L->out_max))
+            break;
+        if (read_conn(L, conn) == -1)
+            return -1;
+    }
+    return (conn->eof && r == 0) ? -1 : 0;
+}
+
+/**
+ * @brief Moves a connection to shared-memory rings (MSG_SHM_ATTACH).
+ *
+ * The success response carries the descriptors of the rings, so it is sent
+ * right away on the socket; every later frame goes through the rings. A
+ * failure is answered in @p msg like any other request.
+ *
+ * @return 1 if the connection was attached, 0 if @p msg holds an error
+ *         response, -1 if the connection must be closed.
+ */
+static int attach_shm(loop_t *L, conn_t *conn, buffer_t *msg) {
+    proto_cursor_t cur;
+    const uint8_t *frame;
+    int fds[SHM_FDS], len;
+    uint64_t size;
+    shm_t *sh;
+
+    cursor_init(&cur, msg);
+    if (cursor_uint(&cur, &size) != 0 || !cursor_done(&cur))
+        return buffer_write_op_result(msg, MSG_ERROR, 400, "invalid SHM_ATTACH message");
+    if (conn->head || conn->rlen > conn->roff)
+        return buffer_write_op_result(msg, MSG_ERROR, 409, "connection busy");
+    if ((sh = shm_create(size > SHM_RING_MAX ? SHM_RING_MAX : (size_t)size, fds)) == NULL) {
+        int err = errno;
+        log_message(LOG_WARNING,
+            "unable to create shared-memory rings (%d) - %s", err, strerror(err)
+        );
+        return buffer_write_op_result(msg, MSG_ERROR, err == ENOTSUP ? 501 : 500,
+                                      "shared memory unavailable");
+    }
+
+    io.calls++;
+    if (buffer_write_op_result(msg, MSG_OP_RESULT, 0, "success") != 0 ||
+        (len = buffer_encode_header(msg, &frame)) < 0 ||
+        send_fds(conn->fd, frame, (size_t)len, fds, SHM_FDS) != 0) {
+        close(fds[0]);
+        shm_close(sh);
+        return -1;
+    }
+    close(fds[0]);
+    conn_attach_shm(conn, sh);
+    if (conn_table_alias(&L->conns, shm_fd(sh), conn) != 0)
+        return -1;
+#if defined(HAVE_IO_URING)
+    if (L->ring)
+        return ring_watch(L, shm_fd(sh), conn) == 0 ? 1 : -1;
+#endif
+    return evloop_add(L->ev, shm_fd(sh), EV_READ) == 0 ? 1 : -1;
+}
+
+/**
+ * @brief Checks the socket of a connection attached to shared-memory rings.
+ *
+ * Nothing is read from it any more; it only tells when the client goes away.
+ *
+ * @return 0 if the connection stays open, -1 if it must be closed.
+ */
+static int check_attached(conn_t *conn) {
+    char b;
+    ssize_t r = recv(conn->fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return 0;
+    return -1;
+}
+
+/**
+ * @brief Handles every complete frame in the input of a connection.
+ *
+ * Requests deferred by the dispatcher are submitted to the worker pool,
+ * writes to the writer thread; the others are answered immediately.
+ * Deferred requests of a connection with writes queued go to the writer
+ * thread too, behind them. Responses the dispatcher asked to hold are
+ * queued until the next group commit. Frames are left in the input once
+ * the output queue is full (see conn_stall()).
+ *
+ * @return 0 on success, -1 if the connection must be closed.
+ */
+static int serve_frames(loop_t *L, conn_t *conn) {
+    const server_handler_t *handler = L->handler;
+    int f;
+
+    for (;;) {
+        buffer_t *msg;
+        conn_req_t *req;
+        int attach;
+
+        if (conn_stall(conn, L->out_max))
+            return 0;
+        if ((msg = alloc_buffer()) == NULL) {
+            log_message(LOG_WARNING, "unable to allocate request - connection closed");
+            return -1;
+        }
+        if ((f = conn_next_frame(conn, msg)) != 1) {
+            free_buffer(msg);
+            break;
+        }
+        io.requests++;
+        attach = msg->hdr.type == MSG_SHM_ATTACH && msg->hdr.version == HDR_V2;
+        if (attach && (f = attach_shm(L, conn, msg)) != 0) {
+            free_buffer(msg);
+            if (f == -1)
+                return -1;
+            continue;
+        }
+        if ((req = conn_push(conn, msg)) == NULL) {
+            free_buffer(msg);
+            log_message(LOG_WARNING, "unable to queue request - connection closed");
+            return -1;
+        }
+        if (attach) {
+            /* Refused: the error is answered in line. */
+            conn_ready(req);
+            continue;
+        }
+
+        req->status = handler->dispatch(handler->core, msg);
+        if (req->status == SERVER_WRITE || (req->status == SERVER_DEFER && conn->writing > 0)) {
+            req->arg = (void *)handler;
+            req->work.fn = req->status == SERVER_WRITE ? run_write : run_deferred;
+            if (req->status == SERVER_WRITE)
+                conn->writing++;
+            conn->inflight++;
+            workers_submit(L->writer, &req->work);
+            continue;
+        }
+        if (req->status == SERVER_DEFER && L->pool) {
+            req->arg = (void *)handler;
+            req->work.fn = run_deferred;
+            conn->inflight++;
+            workers_submit(L->pool, &req->work);
+            continue;
+        }
+        if (req->status == SERVER_COMMIT) {
+            req->status = 0;
+            conn->inflight++;
+            hold(&L->held, req);
+            continue;
+        }
+        if (req->status == SERVER_DEFER)
+            req->status = handler->work(handler->core, msg);
+        if (req->status == -1)
+            return -1;
+        conn_ready(req);
+    }
+    if (f == -1) {
+        log_message(LOG_WARNING,
+            "connection closed due to protocol error"
+        );
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads and handles requests until the socket would block or the output queue is full.
+ *
+ * A stalled connection is left unread: its bytes wait in the socket
+ * buffers, which eventually blocks the client's writes.
+ *
+ * @return 0 if the connection stays open, -1 if it must be closed.
+ */
+static int read_conn(loop_t *L, conn_t *conn) {
+    int r;
+
+    do {
+        if (serve_frames(L, conn) == -1)
+            return -1;
+        if (conn->stalled)
+            return 0;
+        r = conn_read(conn);
+    } while (r == 1);
+    return (r == -1 && !conn->eof) ? -1 : 0;
+}
+
+/**
+ * @brief Serves a connection that became readable and/or writable.
+ *
+ * Reads every byte the socket has available and handles each complete
+ * frame. A partially received frame stays in the connection's input area
+ * until the rest arrives, so a slow client never stalls the loop.
+ * Responses are written until the socket would block (v1 responses in
+ * request order, v2 responses as soon as they are ready); the remainder is
+ * sent on the next writable event or when a deferred request completes.
+ * A client that does not read its responses fills its output queue, and
+ * is then no longer read until they went out (see read_conn()).
+ *
+ * A connection attached to shared-memory rings is served when its doorbell
+ * @p fd rings, the same way.
+ *
+ * @return 0 if the connection stays open, -1 if it must be closed.
+ */
+static int serve_conn(loop_t *L, conn_t *conn, int fd, int events) {
+    if (conn->shm && fd == conn->fd)
+        return check_attached(conn) == 0 ? settle_conn(L, conn) : -1;
+
+    if ((events & (EV_READ | EV_HUP)) && read_conn(L, conn) == -1)
+        return -1;
+    return settle_conn(L, conn);
+}
+
+/**
+ * @brief Accepts every pending client on the listening socket.
+ *
+ * @return 0 on success, -1 on a fatal accept error.
+ */
+static int accept_clients(loop_t *L) {
+    for (;;) {
+        int sd;
+
+        io.calls++;
+        if ((sd = socket_accept(L->server)) == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                log_message(LOG_WARNING,
+                    "unable to accept new client (%d) - %s",
+                    errno, strerror(errno)
+                );
+                return 0;
+            }
+            log_message(LOG_ERROR,
+                "fatal error on accept (%d) - %s",
+                errno, strerror(errno)
+            );
+            return -1;
+        }
+        if (!conn_table_add(&L->conns, sd)) {
+            log_message(LOG_WARNING, "unable to register new client - closed");
+            close(sd);
+            continue;
+        }
+        if (evloop_add(L->ev, sd, EV_READ | EV_WRITE) != 0) {
+            log_message(LOG_WARNING,
+                "unable to watch new client (%d) - %s", errno, strerror(errno)
+            );
+            conn_table_remove(&L->conns, sd);
+            close(sd);
+        }
+    }
+}
+
+/**
+ * @brief Unregisters and closes a client connection.
+ */
+static void close_conn(loop_t *L, conn_t *conn) {
+    int fd = conn->fd;
+
+#if defined(HAVE_IO_URING)
+    if (L->ring) {
+        ring_close(L, conn);
+        return;
+    }
+#endif
+    if (conn->shm) {
+        evloop_del(L->ev, shm_fd(conn->shm));
+        conn_table_unalias(&L->conns, shm_fd(conn->shm));
+    }
+    evloop_del(L->ev, fd);
+    conn_table_remove(&L->conns, fd);
+    close(fd);
+}
+
+/**
+ * @brief Delivers the responses of deferred requests completed by the workers.
+ */
+static void complete_deferred(loop_t *L, work_t *done) {
+    while (done) {
+        conn_req_t *req = (conn_req_t *)done;
+        conn_t *conn = req->conn;
+
+        done = done->next;
+        if (conn_complete(req) == -1)
+            continue;
+        if (req->status == -1 || settle_conn(L, conn) == -1)
+            close_conn(L, conn);
+    }
+}
+
+/**
+ * @brief Takes the requests the writer thread completed.
+ *
+ * Writes whose response waits for the commit of their changes are held
+ * (they are counted in `inflight` already); the other responses are
+ * delivered.
+ */
+static void complete_writes(loop_t *L, work_t *done) {
+    while (done) {
+        conn_req_t *req = (conn_req_t *)done;
+
+        done = done->next;
+        if (req->work.fn == run_write)
+            req->conn->writing--;
+        if (req->status == SERVER_COMMIT) {
+            req->status = 0;
+            hold(&L->held, req);
+            continue;
+        }
+        req->work.next = NULL;
+        complete_deferred(L, &req->work);
+    }
+}
+
+/**
+ * @brief Answers held requests whose commit failed with an error.
+ *
+ * Their changes are applied in memory, but may not survive a restart, so
+ * they must not be acknowledged.
+ */
+static void fail_held(work_t *held) {
+    for (work_t *w = held; w; w = w->next) {
+        conn_req_t *req = (conn_req_t *)w;
+
+        if (buffer_write_op_result(req->msg, MSG_ERROR, 500, "transaction log write failed") != 0)
+            req->status = -1;
+    }
+}
+
+/**
+ * @brief Commits the changes of the held requests and delivers their responses.
+ *
+ * The requests of a commit running in the background move to `flight`
+ * and are answered once it completes; requests held meanwhile wait for it
+ * before their own commit is started.
+ *
+ * @return Milliseconds to wait before retrying, or -1 to wait for events only.
+ */
+static int commit_held(loop_t *L, int force) {
+    const server_handler_t *handler = L->handler;
+    int r;
+
+    if (L->flight.head) {
+        if ((r = handler->committed(handler->core, force)) == 0)
+            return -1;
+        if (r < 0)
+            fail_held(L->flight.head);
+        complete_deferred(L, L->flight.head);
+        L->flight.head = L->flight.tail = NULL;
+    }
+    if (!L->held.head)
+        return -1;
+    if ((r = handler->commit ? handler->commit(handler->core, force) : 0) > 0)
+        return r;
+    if (r == SERVER_COMMIT_RUNNING) {
+        L->flight = L->held;
+    } else {
+        if (r < 0)
+            fail_held(L->held.head);
+        complete_deferred(L, L->held.head);
+    }
+    L->held.head = L->held.tail = NULL;
+    return -1;
+}
+
+/**
+ * @brief Runs the housekeeping of a loop iteration: tick and group commit.
+ *
+ * @return Timeout of the next wait in milliseconds, -1 to wait for events only.
+ */
+static int end_iteration(loop_t *L) {
+    const server_handler_t *handler = L->handler;
+    int wake = handler->tick ? handler->tick(handler->core) : -1;
+    int timeout = commit_held(L, 0);
+
+    if (wake >= 0 && (timeout < 0 || wake < timeout))
+        timeout = wake;
+    return timeout;
+}
+
+/**
+ * @brief Runs the loop on the readiness backend.
+ *
+ * @return 0 on clean shutdown, -1 on failure.
+ */
+static int evloop_run(loop_t *L) {
+    ev_event_t events[SERVER_MAX_EVENTS];
+    int timeout = -1;
+
+    if ((L->ev = evloop_create()) == NULL ||
+        evloop_add(L->ev, L->server, EV_READ) != 0 ||
+        (L->pool && evloop_add(L->ev, workers_fd(L->pool), EV_READ) != 0) ||
+        (L->writer && evloop_add(L->ev, workers_fd(L->writer), EV_READ) != 0) ||
+        (L->commit_fd >= 0 && evloop_add(L->ev, L->commit_fd, EV_READ) != 0)) {
+        log_message(LOG_ERROR,
+            "failed to initialize event loop (%d) - %s",
+            errno, strerror(errno)
+        );
+        return -1;
+    }
+
+    while (running) {
+        int n;
+
+        io.calls++;
+        n = evloop_wait(L->ev, events, SERVER_MAX_EVENTS, timeout);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            continue;
+        else if (n < 0) {
+            log_message(LOG_ERROR, 
+                "fatal error on event wait (%d) - %s",
+                errno, strerror(errno)
+            );
+            return -1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            conn_t *conn;
+            if (events[i].fd == L->server) {
+                if (accept_clients(L) == -1)
+                    return -1;
+                continue;
+            }
+            if (L->pool && events[i].fd == workers_fd(L->pool)) {
+                complete_deferred(L, workers_collect(L->pool));
+                continue;
+            }
+            if (L->writer && events[i].fd == workers_fd(L->writer)) {
+                complete_writes(L, workers_collect(L->writer));
+                continue;
+            }
+            if (events[i].fd == L->commit_fd)
+                continue;   /* The commit is collected below. */
+            if ((conn = conn_table_get(&L->conns, events[i].fd)) == NULL)
+                continue;
+            if (serve_conn(L, conn, events[i].fd, events[i].events) == -1)
+                close_conn(L, conn);
+        }
+        timeout = end_iteration(L);
+    }
+    return 0;
+}
+
+#if defined(HAVE_IO_URING)
+
+/** @brief Provided buffers of the multishot receives (a power of two) */
+#define RING_BUFS       256
+
+/** @brief Size of each provided buffer */
+#define RING_BUF_SIZE   (32 * 1024)
+
+/** @brief Submission queue size */
+#define RING_ENTRIES    1024
+
+/** @brief Delay before accepting again after running out of descriptors (milliseconds) */
+#define RING_ACCEPT_RETRY_MS 100
+
+/** @brief Operation kinds, in the upper half of `user_data` (the descriptor is in the lower half) */
+enum {
+    RING_ACCEPT = 1,
+    RING_RECV,
+    RING_SEND,
+    RING_POLL,
+    RING_CANCEL
+};
+
+static uint64_t ring_data(int kind, int fd) {
+    return (uint64_t)kind << 32 | (uint32_t)fd;
+}
+
+/**
+ * @brief Gets a submission entry, logging a failure.
+ */
+static struct io_uring_sqe *ring_sqe(loop_t *L) {
+    struct io_uring_sqe *sqe = uring_sqe(L->ring);
+
+    if (!sqe)
+        log_message(LOG_WARNING,
+            "io_uring submission queue full (%d) - %s", errno, strerror(errno)
+        );
+    return sqe;
+}
+
+static int ring_accept(loop_t *L) {
+    struct io_uring_sqe *sqe = ring_sqe(L);
+
+    if (!sqe)
+        return -1;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = L->server;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = ring_data(RING_ACCEPT, L->server);
+    L->pending++;
+    L->accepting = 1;
+    return 0;
+}
+
+/**
+ * @brief Watches a descriptor for readability (multishot poll).
+ *
+ * @param conn Connection the descriptor belongs to (its doorbell), or NULL.
+ */
+static int ring_watch(loop_t *L, int fd, conn_t *conn) {
+    struct io_uring_sqe *sqe = ring_sqe(L);
+
+    if (!sqe)
+        return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = ring_data(RING_POLL, fd);
+    L->pending++;
+    if (conn)
+        conn->ring_ops++;
+    return 0;
+}
+
+/**
+ * @brief Starts receiving on a client socket (multishot, into provided buffers).
+ */
+static int ring_recv(loop_t *L, conn_t *conn) {
+    struct io_uring_sqe *sqe = ring_sqe(L);
+
+    if (!sqe)
+        return -1;
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&L->recv_hdr;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = (uint16_t)uring_buf_group(L->ring);
+    sqe->msg_flags = MSG_CMSG_CLOEXEC;
+    sqe->user_data = ring_data(RING_RECV, conn->fd);
+    L->pending++;
+    conn->ring_ops++;
+    conn->receiving = 1;
+    return 0;
+}
+
+/**
+ * @brief Stops the multishot receive of a stalled connection.
+ *
+ * Bytes received until the cancellation completes are kept in the input
+ * area; the receive is armed again by ring_settle() once the output queue
+ * drained.
+ */
+static void ring_pause(loop_t *L, conn_t *conn) {
+    struct io_uring_sqe *sqe = ring_sqe(L);
+
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = ring_data(RING_RECV, conn->fd);
+    sqe->user_data = ring_data(RING_CANCEL, conn->fd);
+}
+
+/**
+ * @brief Cancels every operation on a descriptor.
+ */
+static void ring_cancel(loop_t *L, int fd) {
+    struct io_uring_sqe *sqe = ring_sqe(L);
+
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = ring_data(RING_CANCEL, fd);
+}
+
+/**
+ * @brief Sends the ready responses of a connection, unless a send is running.
+ *
+ * A connection stalled by its output queue gets its receive back once
+ * enough responses went out.
+ *
+ * @return 0 if the connection stays open, -1 if it must be closed.
+ */
+static int ring_settle(loop_t *L, conn_t *conn) {
+    struct io_uring_sqe *sqe;
+    int cnt;
+
+    if (conn->closing || (conn->send && conn->send->cnt > 0))
+        return 0;
+    if (conn_resume(conn, L->out_max)) {
+        if (serve_frames(L, conn) == -1)
+            return -1;
+        if (!conn->stalled && !conn->receiving && !conn->eof && ring_recv(L, conn) != 0)
+            return -1;
+    }
+    if ((cnt = conn_send_begin(conn)) == -1)
+        return -1;
+    if (cnt == 0)
+        return (conn->eof && !conn->head) ? -1 : 0;
+    if ((sqe = ring_sqe(L)) == NULL)
+        return -1;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&conn->send->mh;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = ring_data(RING_SEND, conn->fd);
+    L->pending++;
+    conn->ring_ops++;
+    return 0;
+}
+
+/**
+ * @brief Releases a connection closed by ring_close() once nothing is pending on it.
+ */
+static void ring_release(loop_t *L, conn_t *conn) {
+    int fd = conn->fd;
+
+    if (conn->ring_ops > 0)
+        return;
+    if (conn->shm)
+        conn_table_unalias(&L->conns, shm_fd(conn->shm));
+    conn_table_remove(&L->conns, fd);
+    close(fd);
+}
+
+/**
+ * @brief Closes a client connection on the io_uring backend.
+ *
+ * The kernel may still be using the connection (a receive armed, a send
+ * running), so its operations are cancelled and the connection is only
+ * released once the last one completed. Until then the socket stays open,
+ * so that its descriptor cannot be reused by a new client.
+ */
+static void ring_close(loop_t *L, conn_t *conn) {
+    if (conn->closing)
+        return;
+    conn->closing = 1;
+    shutdown(conn->fd, SHUT_RDWR);
+    ring_cancel(L, conn->fd);
+    if (conn->shm)
+        ring_cancel(L, shm_fd(conn->shm));
+    ring_release(L, conn);
+}
+
+/**
+ * @brief Handles the completion of a multishot receive.
+ */
+static void ring_received(loop_t *L, conn_t *conn, int res, unsigned flags) {
+    const struct io_uring_recvmsg_out *out = NULL;
+    int more = (flags & IORING_CQE_F_MORE) != 0;
+    unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    int close = 0;
+
+    if (!more) {
+        conn->ring_ops--;
+        conn->receiving = 0;
+    }
+    if (flags & IORING_CQE_F_BUFFER)
+        out = (const struct io_uring_recvmsg_out *)uring_buf(L->ring, bid);
+
+    if (conn->closing) {
+        /* Nothing more is read from a closed connection. */
+    } else if (res == -ENOBUFS) {
+        /* Every buffer is in use: receive again, they are back by now. */
+    } else if (res == -ECANCELED) {
+        /* Paused by ring_pause(). */
+    } else if (res < 0) {
+        close = res != -EINTR && res != -EAGAIN;
+    } else if (conn->shm) {
+        close = 1;      /* See check_attached(). */
+    } else if (!out || out->payloadlen == 0) {
+        conn->eof = 1;
+        close = settle_conn(L, conn) == -1;
+        more = 1;       /* Do not receive again. */
+    } else {
+        const uint8_t *ctl = (const uint8_t *)(out + 1) + L->recv_hdr.msg_namelen;
+        struct msghdr mh;
+
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_control = (void *)ctl;
+        mh.msg_controllen = out->controllen;
+        close = conn_feed(conn, ctl + L->recv_hdr.msg_controllen, out->payloadlen, &mh) != 0 ||
+                serve_frames(L, conn) == -1 || settle_conn(L, conn) == -1;
+    }
+    if (out)
+        uring_buf_recycle(L->ring, bid);
+
+    if (close)
+        ring_close(L, conn);
+    else if (conn->closing)
+        ring_release(L, conn);
+    else if (conn->stalled) {
+        if (conn->receiving)
+            ring_pause(L, conn);
+    } else if (!more && ring_recv(L, conn) != 0)
+        ring_close(L, conn);
+}
+
+/**
+ * @brief Handles the completion of a send.
+ */
+static void ring_sent(loop_t *L, conn_t *conn, int res) {
+    conn->ring_ops--;
+    if (conn->closing) {
+        conn->send->cnt = 0;
+        ring_release(L, conn);
+        return;
+    }
+    if (res < 0) {
+        conn->send->cnt = 0;
+        if (res != -EPIPE && res != -ECONNRESET)
+            log_message(LOG_WARNING, "send failed (%d) - %s", -res, strerror(-res));
+        ring_close(L, conn);
+        return;
+    }
+    conn_send_end(conn, (size_t)res);
+    if (settle_conn(L, conn) == -1)
+        ring_close(L, conn);
+}
+
+/**
+ * @brief Handles a new client accepted by the multishot accept.
+ */
+static void ring_accepted(loop_t *L, int sd) {
+    static const int one = 1;
+    conn_t *conn;
+
+    if (L->tcp)
+        setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if ((conn = conn_table_add(&L->conns, sd)) == NULL) {
+        log_message(LOG_WARNING, "unable to register new client - closed");
+        close(sd);
+        return;
+    }
+    if (ring_recv(L, conn) != 0) {
+        conn_table_remove(&L->conns, sd);
+        close(sd);
+    }
+}
+
+/**
+ * @brief Dispatches a completion.
+ *
+ * @return 0 on success, -1 on a fatal error.
+ */
+static int ring_complete(loop_t *L, uint64_t data, int res, unsigned flags) {
+    int kind = (int)(data >> 32), fd = (int)(uint32_t)data;
+    int last = !(flags & IORING_CQE_F_MORE);
+    conn_t *conn;
+
+    if (kind != RING_CANCEL && last)
+        L->pending--;
+    switch (kind) {
+    case RING_ACCEPT:
+        if (res >= 0)
+            ring_accepted(L, res);
+        else if (res == -EMFILE || res == -ENFILE || res == -ENOBUFS || res == -ENOMEM)
+            log_message(LOG_WARNING,
+                "unable to accept new client (%d) - %s", -res, strerror(-res)
+            );
+        else if (res != -EINTR && res != -ECONNABORTED && res != -ECANCELED) {
+            log_message(LOG_ERROR,
+                "fatal error on accept (%d) - %s", -res, strerror(-res)
+            );
+            return -1;
+        }
+        if (last)
+            L->accepting = 0;
+        return 0;
+    case RING_POLL:
+        if (L->pool && fd == workers_fd(L->pool))
+            complete_deferred(L, workers_collect(L->pool));
+        if (L->writer && fd == workers_fd(L->writer))
+            complete_writes(L, workers_collect(L->writer));
+        if (fd == L->commit_fd || (L->pool && fd == workers_fd(L->pool)) ||
+            (L->writer && fd == workers_fd(L->writer)))
+            return last && running && ring_watch(L, fd, NULL) != 0 ? -1 : 0;
+        /* A shared-memory doorbell. */
+        if ((conn = conn_table_get(&L->conns, fd)) == NULL)
+            return 0;
+        if (last)
+            conn->ring_ops--;
+        if (conn->closing)
+            ring_release(L, conn);
+        else if (serve_conn(L, conn, fd, EV_READ) == -1 || (last && ring_watch(L, fd, conn) != 0))
+            ring_close(L, conn);
+        return 0;
+    case RING_RECV:
+    case RING_SEND:
+        if ((conn = conn_table_get(&L->conns, fd)) == NULL) {
+            if (kind == RING_RECV && (flags & IORING_CQE_F_BUFFER))
+                uring_buf_recycle(L->ring, flags >> IORING_CQE_BUFFER_SHIFT);
+            return 0;
+        }
+        if (kind == RING_RECV)
+            ring_received(L, conn, res, flags);
+        else
+            ring_sent(L, conn, res);
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Handles the completions available.
+ *
+ * @return 0 on success, -1 on a fatal error.
+ */
+static int ring_reap(loop_t *L) {
+    struct io_uring_cqe *cqe;
+
+    while ((cqe = uring_peek(L->ring)) != NULL) {
+        uint64_t data = cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+
+        uring_seen(L->ring);
+        if (ring_complete(L, data, res, flags) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Sets up the io_uring backend.
+ *
+ * @return 0 on success, -1 if it is not available (errno is set).
+ */
+static int ring_init(loop_t *L) {
+    static union {
+        struct cmsghdr hdr;
+        char           space[CMSG_SPACE(CONN_FDS_MAX * sizeof(int))];
+    } ctl;
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+
+    if ((L->ring = uring_create(RING_ENTRIES, RING_BUFS, RING_BUF_SIZE)) == NULL)
+        return -1;
+    /* Multishot receives only use the lengths, to lay out each buffer. */
+    memset(&L->recv_hdr, 0, sizeof(L->recv_hdr));
+    L->recv_hdr.msg_control = ctl.space;
+    L->recv_hdr.msg_controllen = sizeof(ctl.space);
+    L->tcp = getsockname(L->server, (struct sockaddr *)&addr, &len) == 0 &&
+             (addr.ss_family == AF_INET || addr.ss_family == AF_INET6);
+    return 0;
+}
+
+/**
+ * @brief Cancels what is pending and waits for it, so that no buffer is in use.
+ */
+static void ring_drain(loop_t *L) {
+    struct io_uring_sqe *sqe = uring_sqe(L->ring);
+
+    if (sqe) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL;
+        sqe->user_data = ring_data(RING_CANCEL, -1);
+    }
+    while (L->pending > 0 && uring_enter(L->ring, 1, 1000) == 0 && uring_peek(L->ring))
+        ring_reap(L);
+}
+
+/**
+ * @brief Runs the loop on the io_uring backend.
+ *
+ * @return 0 on clean shutdown, -1 on failure.
+ */
+static int ring_run(loop_t *L) {
+    int timeout = -1;
+
+    if (ring_accept(L) != 0 ||
+        (L->pool && ring_watch(L, workers_fd(L->pool), NULL) != 0) ||
+        (L->writer && ring_watch(L, workers_fd(L->writer), NULL) != 0) ||
+        (L->commit_fd >= 0 && ring_watch(L, L->commit_fd, NULL) != 0))
+        return -1;
+
+    while (running) {
+        if (uring_enter(L->ring, 1, timeout) != 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            log_message(LOG_ERROR,
+                "fatal error on io_uring wait (%d) - %s",
+                errno, strerror(errno)
+            );
+            return -1;
+        }
+        if (ring_reap(L) != 0)
+            return -1;
+        timeout = end_iteration(L);
+        if (!L->accepting) {
+            /* Accepting failed for lack of descriptors: retry a bit later. */
+            if (timeout < 0 || timeout > RING_ACCEPT_RETRY_MS)
+                timeout = RING_ACCEPT_RETRY_MS;
+            if (ring_accept(L) != 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+#endif /* HAVE_IO_URING */
+
+/**
+ * @brief Runs the shared server loop.
+ *
+ * On the readiness backend, the listening socket and every client are
+ * registered edge-triggered in the event loop. Clients live in a
+ * connection table indexed by descriptor, so each wakeup costs O(ready
+ * descriptors) regardless of how many idle clients are connected. Client
+ * sockets are non-blocking and each one keeps its own partial-frame and
+ * pending-output state (see conn.h).
+ *
+ * On the io_uring backend (VICTOR_IO=uring, see uring.h), the kernel
+ * accepts clients and receives their bytes into provided buffers with
+ * multishot operations, and sends the responses asynchronously; the loop
+ * only makes one io_uring_enter() call per iteration to submit the new
+ * operations and wait for completions. The connection state and the frame
+ * handling are the same. If io_uring is not available, the readiness
+ * backend is used.
+ *
+ * Requests the handler defers are run by `handler->workers` threads, and
+ * writes by a writer thread of their own, one at a time. Their completion
+ * is signalled through descriptors watched by the same loop, so the loop
+ * keeps accepting and reading while the workers and the writer are busy.
+ *
+ * Requests the handler holds for a commit are answered after
+ * `handler->commit` ran at the end of the iteration, so every change made
+ * during an iteration shares a single commit. A commit may complete in the
+ * background (e.g. on the WAL writer thread), signalled through
+ * `handler->commit_fd`: the loop keeps serving, and the changes made
+ * meanwhile share the next commit.
+ *
+ * @param server File descriptor of a bound and listening socket.
+ * @param handler Protocol callbacks.
+ * @return 0 on clean shutdown, -1 on failure.
+ */
+int server_loop(int server, const server_handler_t *handler) {
+    loop_t L;
+    int ret;
+
+    memset(&L, 0, sizeof(L));
+    L.handler = handler;
+    L.server = server;
+    L.commit_fd = handler->commit_fd ? handler->commit_fd(handler->core) : -1;
+    L.out_max = get_output_queue_bytes();
+    raise_fd_limit();
+    conn_table_init(&L.conns);
+
+    if (handler->work && handler->workers > 0) {
+        if ((L.pool = workers_create(handler->workers)) == NULL) {
+            log_message(LOG_ERROR,
+                "failed to start %d worker threads", handler->workers
+            );
+            return -1;
+        }
+        log_message(LOG_INFO, "Worker threads: %d", handler->workers);
+    }
+    if (handler->work && (L.writer = workers_create(1)) == NULL) {
+        log_message(LOG_ERROR, "failed to start the writer thread");
+        workers_destroy(L.pool);
+        return -1;
+    }
+    if (set_nonblocking(server, 1) != 0) {
+        log_message(LOG_ERROR,
+            "failed to initialize event loop (%d) - %s",
+            errno, strerror(errno)
+        );
+        workers_destroy(L.writer);
+        workers_destroy(L.pool);
+        return -1;
+    }
+
+#if defined(HAVE_IO_URING)
+    if (get_io_uring()) {
+        if (ring_init(&L) == 0) {
+            io.uring = 1;
+            io.ring = L.ring;
+            log_message(LOG_INFO, "I/O backend: io_uring");
+        } else {
+            log_message(LOG_WARNING,
+                "io_uring unavailable (%d) - %s, using epoll", errno, strerror(errno)
+            );
+        }
+    }
+    ret = L.ring ? ring_run(&L) : evloop_run(&L);
+#else
+    if (get_io_uring())
+        log_message(LOG_WARNING, "io_uring backend not built in, using the event loop");
+    ret = evloop_run(&L);
+#endif
+    log_message(LOG_INFO, "end main loop");
+    /* The queued writes run to completion and share the last commit. */
+    if (L.writer)
+        complete_writes(&L, workers_destroy(L.writer));
+    commit_held(&L, 1);
+    if (L.pool)
+        complete_deferred(&L, workers_destroy(L.pool));
+#if defined(HAVE_IO_URING)
+    if (L.ring) {
+        ring_drain(&L);
+        io.calls += uring_calls(L.ring);
+        io.ring = NULL;
+        uring_destroy(L.ring);
+    }
+#endif
+    conn_table_destroy(&L.conns);
+    evloop_destroy(L.ev);
+    return ret;
+}
@@ -2,17 +2,45 @@
 #define __VICTOR_SERVER
 #include <signal.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include "buffer.h"
+#include "protocol.h"
 
-#define MAX_CONNECTIONS  128
-#define DEFAULT_EXPORT_THRESHOLD 10
+/** @brief No operation count limit on checkpoints by default (see checkpoint.h) */
+#define DEFAULT_EXPORT_THRESHOLD 0
+
+/** @brief Maximum number of readiness events handled per loop iteration */
+#define SERVER_MAX_EVENTS 256
+
+/** @brief Number of counters added by server_io_stats() */
+#define SERVER_IO_STATS 8
+
+/** @brief Returned by `dispatch` to run the request through `work` on a worker thread */
+#define SERVER_DEFER 1
+
+/** @brief Returned by `dispatch` to hold the response until the next `commit` */
+#define SERVER_COMMIT 2
+
+/**
+ * @brief Returned by `dispatch` to run the request through `work` on the writer thread.
+ *
+ * The writer thread runs these requests one at a time, in arrival order,
+ * so the loop never waits for a write. `work` may return SERVER_COMMIT
+ * for them.
+ */
+#define SERVER_WRITE 3
+
+/** @brief Returned by `commit` when the commit completes in the background (see `committed`) */
+#define SERVER_COMMIT_RUNNING (-2)
 
 /**
  * @brief Gets the export threshold from environment or default value.
  * 
- * Reads the VICTOR_EXPORT_THRESHOLD environment variable.
- * If not set or invalid, returns DEFAULT_EXPORT_THRESHOLD.
+ * Reads the VICTOR_EXPORT_THRESHOLD environment variable: the number of
+ * operations that starts a checkpoint, on top of the limits of the
+ * checkpoint policy. If not set or invalid, returns DEFAULT_EXPORT_THRESHOLD.
  * 
- * @return Export threshold value
+ * @return Export threshold value, 0 if there is none
  */
 static inline int get_export_threshold(void) {
     const char *env_val = getenv("VICTOR_EXPORT_THRESHOLD");
@@ -25,7 +53,133 @@ static inline int get_export_threshold(void) {
     return DEFAULT_EXPORT_THRESHOLD;
 }
 
+/**
+ * @brief Protocol callbacks plugged into the shared server loop.
+ *
+ * Each server (index, table) provides its own request dispatcher and a
+ * periodic hook used for housekeeping such as exporting to disk.
+ */
+typedef struct {
+    /** @brief Server specific database context passed to the callbacks */
+    void *core;
+
+    /**
+     * @brief Handles one request in place on the loop thread.
+     *
+     * The request is read from @p msg and the response is written back into
+     * the same buffer. Returning -1 closes the client connection, returning
+     * SERVER_DEFER or SERVER_WRITE hands the untouched request over to `work`.
+     */
+    int (*dispatch)(void *core, buffer_t *msg);
+
+    /**
+     * @brief Handles a deferred request in place on a worker thread (may be NULL).
+     *
+     * Runs concurrently with the loop thread and with other workers, so it
+     * must only touch state protected against concurrent access. Returning -1
+     * closes the client connection.
+     *
+     * SERVER_WRITE requests run on the writer thread, and so do the
+     * SERVER_DEFER requests of a connection while it has writes queued
+     * there, so that they see them.
+     */
+    int (*work)(void *core, buffer_t *msg);
+
+    /**
+     * @brief Number of worker threads running SERVER_DEFER requests, 0 runs them on the loop thread.
+     *
+     * The writer thread is started whenever `work` is set.
+     */
+    int workers;
+
+    /**
+     * @brief Called once per loop iteration after all events are handled (may be NULL).
+     *
+     * Returns -1, or a number of milliseconds after which the loop must wake
+     * up and call it again even if no event arrives (e.g. to poll background
+     * work).
+     */
+    int (*tick)(void *core);
+
+    /**
+     * @brief Makes the changes of SERVER_COMMIT requests durable (may be NULL).
+     *
+     * Called after `tick` while responses are held, and with @p force set on
+     * shutdown. Returns 0 to release the held responses, -1 if the commit
+     * failed (they are then replaced by an error), a positive number of
+     * milliseconds after which it must be called again, or
+     * SERVER_COMMIT_RUNNING if the commit was started in the background.
+     * With @p force set, it completes the commit before returning.
+     */
+    int (*commit)(void *core, int force);
+
+    /**
+     * @brief Tells whether the commit running in the background completed (may be NULL).
+     *
+     * Required if `commit` returns SERVER_COMMIT_RUNNING: the responses it
+     * covers are released once this returns 1, or replaced by an error if
+     * it returns -1 (the commit failed). With @p wait set, blocks until it
+     * completed. Responses held meanwhile wait for the next commit.
+     */
+    int (*committed)(void *core, int wait);
+
+    /**
+     * @brief Gets a descriptor readable when a background commit completes (may be NULL).
+     *
+     * Watched by the loop, which then calls `committed`.
+     */
+    int (*commit_fd)(void *core);
+} server_handler_t;
+
+/**
+ * @brief Runs the shared edge-triggered server loop.
+ *
+ * Accepts clients on @p server, reads requests, hands them to
+ * `handler->dispatch` (and `handler->work` when deferred) and sends back the
+ * responses until a termination signal clears the global `running` flag.
+ * Responses to v1 requests keep request order; responses to v2 requests,
+ * which carry the request id, are sent as soon as they are ready. Responses
+ * to requests that changed the database are held until the changes of the
+ * whole loop iteration were committed in one go (group commit).
+ *
+ * @param server File descriptor of a bound and listening socket.
+ * @param handler Protocol callbacks.
+ * @return 0 on clean shutdown, -1 on failure.
+ */
+extern int server_loop(int server, const server_handler_t *handler);
+
+/**
+ * @brief Gets the I/O counters of the server loop, for a STATS report.
+ *
+ * `io_uring` tells whether the io_uring backend is in use, `io_requests`
+ * counts the requests read and `io_syscalls` the system calls the loop
+ * made to wait for events and to accept, receive and send. Their ratio
+ * compares the backends.
+ *
+ * The output queues of the connections follow: the requests queued and
+ * the response bytes waiting to be sent across connections
+ * (`out_queue_requests`, `out_queue_bytes`), the largest queue of a
+ * connection so far (`out_queue_peak_bytes`), how many times a full queue
+ * stopped the server from reading a connection (`out_stalls`) and how
+ * many connections are stalled now (`out_stalled`).
+ *
+ * @param stats Output array of SERVER_IO_STATS counters.
+ * @return SERVER_IO_STATS.
+ */
+extern size_t server_io_stats(proto_stat_t *stats);
+
+/**
+ * @brief Initializes a reader/writer lock that favors writers.
+ *
+ * Used to share a database between the loop thread (writer) and the worker
+ * threads (readers) without starving the writer when readers keep arriving.
+ *
+ * @param lock Lock to initialize.
+ * @return 0 on success, -1 on failure.
+ */
+extern int server_rwlock_init(pthread_rwlock_t *lock);
+
 extern void handle_signal(int signo);
 
-extern sig_atomic_t running;
-#endif
\ No newline at end of file
+extern volatile sig_atomic_t running;
+#endif
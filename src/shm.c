@@ -0,0 +1,212 @@
+/**
+ * @file shm.c
+ * @brief Shared-memory ring transport for clients on the same host.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE /* memfd_create() */
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "shm.h"
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+/** @brief Offsets of the ring positions in the header (see shm.h) */
+#define SHM_REQ_HEAD   64
+#define SHM_REQ_TAIL   128
+#define SHM_RESP_HEAD  192
+#define SHM_RESP_TAIL  256
+
+struct shm {
+    uint8_t  *hdr;        /**< Header mapping */
+    uint8_t  *req;        /**< Request ring, mapped twice back to back */
+    uint8_t  *resp;       /**< Response ring, mapped twice back to back */
+    size_t    size;       /**< Size of each ring */
+    uint64_t *req_head;   /**< Positions shared with the client */
+    uint64_t *req_tail;
+    uint64_t *resp_head;
+    uint64_t *resp_tail;
+    uint64_t  seen;       /**< Request head checked by the last shm_poll() */
+    uint64_t  tail;       /**< Request bytes consumed */
+    uint64_t  head;       /**< Response bytes produced */
+    int       doorbell;   /**< Server doorbell, read side */
+    int       peer;       /**< Client doorbell, write side */
+    int       kick;       /**< The client must be woken up */
+};
+
+#if defined(__linux__)
+/**
+ * @brief Maps a ring twice in a row, so that any span of it is contiguous.
+ */
+static uint8_t *map_ring(int fd, off_t off, size_t size) {
+    uint8_t *p = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED)
+        return NULL;
+    if (mmap(p, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, off) == MAP_FAILED ||
+        mmap(p + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, off) == MAP_FAILED) {
+        munmap(p, 2 * size);
+        return NULL;
+    }
+    return p;
+}
+
+static size_t ring_size(size_t want) {
+    size_t size = SHM_RING_MIN;
+
+    if (want == 0)
+        return SHM_RING_DEFAULT;
+    while (size < want && size < SHM_RING_MAX)
+        size *= 2;
+    return size;
+}
+
+shm_t *shm_create(size_t want, int fds[SHM_FDS]) {
+    shm_t *sh = calloc(1, sizeof(shm_t));
+    int fd = -1, err;
+
+    if (!sh)
+        return NULL;
+    sh->doorbell = sh->peer = -1;
+    sh->size = ring_size(want);
+
+    if ((fd = memfd_create("victor-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0 ||
+        ftruncate(fd, (off_t)(SHM_HDR_LEN + 2 * sh->size)) != 0 ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0)
+        goto fail;
+    sh->hdr = mmap(NULL, SHM_HDR_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (sh->hdr == MAP_FAILED) {
+        sh->hdr = NULL;
+        goto fail;
+    }
+    if ((sh->req = map_ring(fd, SHM_HDR_LEN, sh->size)) == NULL ||
+        (sh->resp = map_ring(fd, (off_t)(SHM_HDR_LEN + sh->size), sh->size)) == NULL)
+        goto fail;
+    if ((sh->doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+        (sh->peer = eventfd(0, EFD_CLOEXEC)) < 0)
+        goto fail;
+
+    memcpy(sh->hdr, SHM_MAGIC, 4);
+    *(uint32_t *)(sh->hdr + 4) = SHM_VERSION;
+    *(uint64_t *)(sh->hdr + 8) = sh->size;
+    sh->req_head  = (uint64_t *)(sh->hdr + SHM_REQ_HEAD);
+    sh->req_tail  = (uint64_t *)(sh->hdr + SHM_REQ_TAIL);
+    sh->resp_head = (uint64_t *)(sh->hdr + SHM_RESP_HEAD);
+    sh->resp_tail = (uint64_t *)(sh->hdr + SHM_RESP_TAIL);
+
+    fds[0] = fd;
+    fds[1] = sh->doorbell;
+    fds[2] = sh->peer;
+    return sh;
+
+fail:
+    err = errno;
+    if (fd >= 0)
+        close(fd);
+    shm_close(sh);
+    errno = err;
+    return NULL;
+}
+#else
+shm_t *shm_create(size_t want, int fds[SHM_FDS]) {
+    (void)want;
+    (void)fds;
+    errno = ENOTSUP;
+    return NULL;
+}
+#endif
+
+int shm_fd(const shm_t *sh) {
+    return sh->doorbell;
+}
+
+int shm_poll(shm_t *sh) {
+    uint64_t count, head;
+
+    while (read(sh->doorbell, &count, sizeof(count)) > 0)
+        ;
+    head = __atomic_load_n(sh->req_head, __ATOMIC_ACQUIRE);
+    if (head - sh->tail > sh->size) {
+        errno = EPROTO;
+        return -1;
+    }
+    if (head == sh->seen)
+        return 0;
+    sh->seen = head;
+    return 1;
+}
+
+const uint8_t *shm_peek(const shm_t *sh, size_t *avail) {
+    *avail = (size_t)(sh->seen - sh->tail);
+    return sh->req + (sh->tail & (sh->size - 1));
+}
+
+size_t shm_size(const shm_t *sh) {
+    return sh->size;
+}
+
+void shm_consume(shm_t *sh, size_t n) {
+    sh->tail += n;
+    __atomic_store_n(sh->req_tail, sh->tail, __ATOMIC_RELEASE);
+    sh->kick = 1;
+}
+
+ssize_t shm_writev(shm_t *sh, const struct iovec *iov, int cnt) {
+    uint64_t tail = __atomic_load_n(sh->resp_tail, __ATOMIC_ACQUIRE);
+    uint8_t *p = sh->resp + (sh->head & (sh->size - 1));
+    size_t room, done = 0;
+
+    if (sh->head - tail > sh->size) {
+        errno = EPROTO;
+        return -1;
+    }
+    if ((room = sh->size - (size_t)(sh->head - tail)) == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    for (int i = 0; i < cnt && done < room; i++) {
+        size_t n = iov[i].iov_len < room - done ? iov[i].iov_len : room - done;
+        memcpy(p + done, iov[i].iov_base, n);
+        done += n;
+    }
+    sh->head += done;
+    __atomic_store_n(sh->resp_head, sh->head, __ATOMIC_RELEASE);
+    sh->kick = 1;
+    return (ssize_t)done;
+}
+
+void shm_kick(shm_t *sh) {
+    uint64_t one = 1;
+    ssize_t w;
+
+    if (!sh->kick)
+        return;
+    sh->kick = 0;
+    do {
+        w = write(sh->peer, &one, sizeof(one));
+    } while (w < 0 && errno == EINTR);
+}
+
+void shm_close(shm_t *sh) {
+    if (!sh)
+        return;
+    if (sh->resp)
+        munmap(sh->resp, 2 * sh->size);
+    if (sh->req)
+        munmap(sh->req, 2 * sh->size);
+    if (sh->hdr)
+        munmap(sh->hdr, SHM_HDR_LEN);
+    if (sh->doorbell >= 0)
+        close(sh->doorbell);
+    if (sh->peer >= 0)
+        close(sh->peer);
+    free(sh);
+}
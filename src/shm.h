@@ -0,0 +1,123 @@
+/**
+ * @file shm.h
+ * @brief Shared-memory ring transport for clients on the same host.
+ *
+ * A client connected over the UNIX socket can move its traffic to a pair
+ * of single-producer single-consumer byte rings in shared memory, so that
+ * requests and responses no longer cross the kernel. It sends a v2
+ * MSG_SHM_ATTACH request, whose payload is the ring size it wants (CBOR
+ * unsigned, 0 for SHM_RING_DEFAULT), on an otherwise idle connection. The
+ * server answers with a MSG_OP_RESULT frame carrying three descriptors
+ * (SCM_RIGHTS): the memfd holding the rings, the server doorbell and the
+ * client doorbell (eventfds). From then on, frames are exchanged through
+ * the rings, in the same format as on the socket; the socket only tells
+ * when either side goes away. If the attach fails, the error is answered
+ * on the socket as usual.
+ *
+ * Layout of the memfd (native byte order, offsets in bytes):
+ *
+ *     0      "VSHM", u32 version (SHM_VERSION), u64 size (of each ring)
+ *     64     u64 request head   written by the client (bytes produced)
+ *     128    u64 request tail   written by the server (bytes consumed)
+ *     192    u64 response head  written by the server
+ *     256    u64 response tail  written by the client
+ *     SHM_HDR_LEN          request ring data (size bytes)
+ *     SHM_HDR_LEN + size   response ring data (size bytes)
+ *
+ * Heads and tails only grow; byte `n` of a stream is at `n % size` in its
+ * ring. A producer stores the data, then the head (release); a consumer
+ * loads the head (acquire), reads the data, then stores the tail. After
+ * producing or consuming, a side writes the other one's doorbell. A
+ * request frame must fit in the ring; responses of any size are streamed.
+ *
+ * The memfd is sealed against resizing, so a client cannot make the
+ * server fault on the mapping, and the ring positions it writes are
+ * checked before use. Only available on Linux (memfd, eventfd).
+ */
+
+#ifndef __SHM_H
+#define __SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define SHM_MAGIC        "VSHM"
+#define SHM_VERSION      1
+
+/** @brief Size of the header in front of the rings (a multiple of any page size) */
+#define SHM_HDR_LEN      (64 * 1024)
+
+/** @brief Ring sizes, rounded up to a power of two within these bounds */
+#define SHM_RING_MIN     (64 * 1024)
+#define SHM_RING_MAX     (256 * 1024 * 1024)
+#define SHM_RING_DEFAULT (4 * 1024 * 1024)
+
+/** @brief Number of descriptors handed to the client: memfd, server doorbell, client doorbell */
+#define SHM_FDS          3
+
+/** @brief Server side of an attached client */
+typedef struct shm shm_t;
+
+/**
+ * @brief Creates the rings of a client.
+ *
+ * @param size Requested ring size, 0 for SHM_RING_DEFAULT.
+ * @param fds Output descriptors to send to the client. The caller closes
+ *        `fds[0]` (the memfd) once sent; the doorbells belong to the rings.
+ * @return Pointer to the rings, or NULL on failure (errno is set,
+ *         ENOTSUP where shared-memory rings are not available).
+ */
+extern shm_t *shm_create(size_t size, int fds[SHM_FDS]);
+
+/**
+ * @brief Gets the server doorbell, readable when the client produced or consumed bytes.
+ */
+extern int shm_fd(const shm_t *sh);
+
+/**
+ * @brief Drains the server doorbell and checks for new request bytes.
+ *
+ * @return 1 if request bytes arrived since the last call, 0 if not, -1 if
+ *         the client corrupted the ring positions.
+ */
+extern int shm_poll(shm_t *sh);
+
+/**
+ * @brief Gets the unread request bytes, contiguous even across the ring end.
+ *
+ * @param avail Output number of bytes.
+ * @return Pointer to the first unread byte.
+ */
+extern const uint8_t *shm_peek(const shm_t *sh, size_t *avail);
+
+/**
+ * @brief Gets the size of each ring (the largest request frame).
+ */
+extern size_t shm_size(const shm_t *sh);
+
+/**
+ * @brief Releases request bytes to the client.
+ */
+extern void shm_consume(shm_t *sh, size_t n);
+
+/**
+ * @brief Copies response bytes into the response ring, as many as fit.
+ *
+ * @return Number of bytes copied, or -1 with errno EAGAIN if the ring is
+ *         full (the server doorbell rings once the client read some).
+ */
+extern ssize_t shm_writev(shm_t *sh, const struct iovec *iov, int cnt);
+
+/**
+ * @brief Rings the client doorbell if bytes were produced or consumed since the last call.
+ */
+extern void shm_kick(shm_t *sh);
+
+/**
+ * @brief Unmaps the rings and closes the doorbells.
+ */
+extern void shm_close(shm_t *sh);
+
+#endif /* __SHM_H */
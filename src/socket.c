@@ -1,10 +1,21 @@
+#if defined(__linux__)
+#define _GNU_SOURCE /* accept4() */
+#endif
+
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <errno.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include "socket.h"
 
 /**
  * @brief Receives exactly `len` bytes from a file descriptor.
@@ -82,7 +93,7 @@ int unix_server(const char *path) {
         close(sd);
         return -1;
     }
-    if (listen(sd, 5) != 0) {
+    if (listen(sd, get_listen_backlog()) != 0) {
         close(sd);
         return -1;
     }
@@ -90,6 +101,75 @@ int unix_server(const char *path) {
 }
 
 
+/**
+ * @brief Creates a TCP server listening on the specified address.
+ *
+ * Every address @p host resolves to is tried in turn until one can be
+ * bound. `SO_REUSEADDR`, `SO_REUSEPORT` (where available, if requested)
+ * and `TCP_NODELAY` are set before binding.
+ *
+ * @param host Host name or address, or NULL, "" or "*" for every interface.
+ * @param port TCP port number.
+ * @param backlog Length of the queue of pending connections.
+ * @param reuseport Set `SO_REUSEPORT`.
+ * @return A listening socket file descriptor on success, -1 on failure.
+ */
+int tcp_server(const char *host, int port, int backlog, int reuseport) {
+    struct addrinfo hints, *res, *ai;
+    char name[256], service[16];
+    int sd = -1, one = 1, err;
+
+    if (host && host[0] == '[') {
+        /* [v6 address] */
+        size_t len = strcspn(host + 1, "]");
+        if (len >= sizeof(name)) {
+            errno = EINVAL;
+            return -1;
+        }
+        memcpy(name, host + 1, len);
+        name[len] = '\0';
+        host = name;
+    }
+    if (host && (host[0] == '\0' || strcmp(host, "*") == 0))
+        host = NULL;
+    if (port <= 0 || port > 65535) {
+        errno = EINVAL;
+        return -1;
+    }
+    snprintf(service, sizeof(service), "%d", port);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    if ((err = getaddrinfo(host, service, &hints, &res)) != 0) {
+        errno = err == EAI_SYSTEM ? errno : EADDRNOTAVAIL;
+        return -1;
+    }
+
+    for (ai = res; ai; ai = ai->ai_next) {
+        sd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sd < 0)
+            continue;
+        setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#ifdef SO_REUSEPORT
+        if (reuseport)
+            setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+#else
+        (void)reuseport;
+#endif
+        setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (bind(sd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(sd, backlog) == 0)
+            break;
+        err = errno;
+        close(sd);
+        errno = err;
+        sd = -1;
+    }
+    freeaddrinfo(res);
+    return sd;
+}
+
 /**
  * @brief Connects to a UNIX domain socket server at the specified path.
  *
@@ -139,3 +219,96 @@ int unix_accept(int server_fd) {
         return -1;
     return client_fd;
 }
+
+/**
+ * @brief Accepts an incoming connection on a UNIX domain or TCP listening socket.
+ *
+ * Uses accept4() where available, so that the connection is created
+ * non-blocking in a single system call. The peer address tells TCP
+ * connections apart, which get `TCP_NODELAY`.
+ *
+ * @param server_fd File descriptor of the listening server socket.
+ * @return A new file descriptor for the accepted connection, or -1 on error.
+ */
+int socket_accept(int server_fd) {
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    int fd, one = 1;
+
+#if defined(__linux__)
+    fd = accept4(server_fd, (struct sockaddr *)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+        return -1;
+#else
+    fd = accept(server_fd, (struct sockaddr *)&addr, &addrlen);
+    if (fd < 0)
+        return -1;
+    if (set_nonblocking(fd, 1) != 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) != 0) {
+        close(fd);
+        return -1;
+    }
+#endif
+    if (addr.ss_family == AF_INET || addr.ss_family == AF_INET6)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+/**
+ * @brief Sends bytes along with descriptors on a UNIX domain socket (SCM_RIGHTS).
+ *
+ * @param fd Connected UNIX domain socket.
+ * @param buf Bytes to send.
+ * @param len Number of bytes.
+ * @param fds Descriptors to pass.
+ * @param nfds Number of descriptors (at most 16).
+ * @return 0 if every byte was sent, -1 on error.
+ */
+int send_fds(int fd, const void *buf, size_t len, const int *fds, int nfds) {
+    union {
+        struct cmsghdr hdr;
+        char           space[CMSG_SPACE(16 * sizeof(int))];
+    } ctl;
+    struct iovec iov = { (void *)buf, len };
+    struct msghdr mh;
+    struct cmsghdr *cm;
+    ssize_t w;
+
+    if (nfds <= 0 || nfds > 16 || len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&mh, 0, sizeof(mh));
+    memset(&ctl, 0, sizeof(ctl));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctl.space;
+    mh.msg_controllen = CMSG_SPACE((size_t)nfds * sizeof(int));
+    cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN((size_t)nfds * sizeof(int));
+    memcpy(CMSG_DATA(cm), fds, (size_t)nfds * sizeof(int));
+
+    do {
+        w = sendmsg(fd, &mh, MSG_NOSIGNAL);
+    } while (w < 0 && errno == EINTR);
+    if (w < 0)
+        return -1;
+    /* The descriptors went with the first byte: the rest is plain data. */
+    return send_all(fd, (const uint8_t *)buf + w, len - (size_t)w);
+}
+
+/**
+ * @brief Switches a descriptor between blocking and non-blocking mode.
+ *
+ * @param fd File descriptor to update.
+ * @param enable Non-zero to set `O_NONBLOCK`, zero to clear it.
+ * @return 0 on success, -1 on failure.
+ */
+int set_nonblocking(int fd, int enable) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+    flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(fd, F_SETFL, flags);
+}
@@ -2,6 +2,49 @@
 #define _IO_SOCKET__H 1
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/** @brief Default length of the queue of pending connections (capped by the kernel) */
+#define DEFAULT_LISTEN_BACKLOG SOMAXCONN
+
+/**
+ * @brief Gets the listen backlog from environment or default value.
+ *
+ * Reads the VICTOR_LISTEN_BACKLOG environment variable: the number of
+ * connections the kernel queues until the server accepts them. If not set
+ * or invalid, returns DEFAULT_LISTEN_BACKLOG.
+ *
+ * @return Listen backlog
+ */
+static inline int get_listen_backlog(void) {
+    const char *env_val = getenv("VICTOR_LISTEN_BACKLOG");
+    if (env_val) {
+        int backlog = atoi(env_val);
+        if (backlog > 0) {
+            return backlog;
+        }
+    }
+    return DEFAULT_LISTEN_BACKLOG;
+}
+
+/**
+ * @brief Tells whether the TCP port is shared with other listeners.
+ *
+ * Reads the VICTOR_REUSEPORT environment variable (`0` or `1`): with `1`,
+ * the port is bound with `SO_REUSEPORT`, so several servers of the same
+ * user can listen on it and the kernel spreads the clients over them. Off
+ * by default, so that a server started twice on a port fails to bind
+ * instead of splitting the clients between two databases.
+ *
+ * @return 1 to share the port, 0 to bind it exclusively
+ */
+static inline int get_reuseport(void) {
+    const char *env_val = getenv("VICTOR_REUSEPORT");
+    return env_val && strcmp(env_val, "1") == 0;
+}
+
 /**
  * @brief Receives exactly `len` bytes from a file descriptor.
  *
@@ -39,10 +82,32 @@ extern int send_all(int fd, const void *buf, size_t len);
  *
  * @param path Filesystem path where the socket will be created (e.g., "/tmp/mysocket").
  * @return A listening socket file descriptor on success, -1 on failure.
+ *
+ * @note The listen backlog is get_listen_backlog().
  */
 extern int unix_server(const char *path);
 
 
+/**
+ * @brief Creates a TCP server listening on the specified address.
+ *
+ * The socket is bound with `SO_REUSEADDR`, so the server can restart while
+ * connections of the previous run linger. With @p reuseport it is also
+ * bound with `SO_REUSEPORT` where available, so several listeners can
+ * share the port; otherwise a port in use fails with `EADDRINUSE`.
+ * `TCP_NODELAY` is set
+ * on it and on every accepted connection (see socket_accept()), since
+ * responses are written whole and must not wait for Nagle's algorithm.
+ *
+ * @param host Host name or address to bind (an IPv6 address may be
+ *        enclosed in brackets), or NULL, "" or "*" for every interface.
+ * @param port TCP port number.
+ * @param backlog Length of the queue of pending connections (see get_listen_backlog()).
+ * @param reuseport Share the port with other listeners (see get_reuseport()).
+ * @return A listening socket file descriptor on success, -1 on failure (errno is set).
+ */
+extern int tcp_server(const char *host, int port, int backlog, int reuseport);
+
 /**
  * @brief Connects to a UNIX domain socket server at the specified path.
  *
@@ -61,4 +126,41 @@ extern int unix_connect(const char *path);
  * @return Descriptor del socket conectado, o -1 en error.
  */
 extern int unix_accept(int server_fd);
+
+/**
+ * @brief Accepts an incoming connection on a UNIX domain or TCP listening socket.
+ *
+ * The connection is returned non-blocking and close-on-exec; TCP
+ * connections also get `TCP_NODELAY`.
+ *
+ * @param server_fd File descriptor of the listening server socket.
+ * @return A new file descriptor for the accepted connection, or -1 on error
+ *         (errno is EAGAIN once no connection is pending on a non-blocking socket).
+ */
+extern int socket_accept(int server_fd);
+
+/**
+ * @brief Sends bytes along with descriptors on a UNIX domain socket (SCM_RIGHTS).
+ *
+ * The descriptors are attached to the first byte; the caller keeps its own
+ * copies open.
+ *
+ * @param fd Connected UNIX domain socket.
+ * @param buf Bytes to send (at least one).
+ * @param len Number of bytes.
+ * @param fds Descriptors to pass.
+ * @param nfds Number of descriptors (at most 16).
+ * @return 0 if every byte was sent, -1 on error (a short send of a
+ *         non-blocking socket is an error, errno is EAGAIN).
+ */
+extern int send_fds(int fd, const void *buf, size_t len, const int *fds, int nfds);
+
+/**
+ * @brief Switches a descriptor between blocking and non-blocking mode.
+ *
+ * @param fd File descriptor to update.
+ * @param enable Non-zero to set `O_NONBLOCK`, zero to clear it.
+ * @return 0 on success, -1 on failure.
+ */
+extern int set_nonblocking(int fd, int enable);
 #endif
\ No newline at end of file
@@ -10,7 +10,9 @@
 #include <unistd.h>
 #include <signal.h>
 #include <inttypes.h>
+#include <time.h>
 #include "fileutils.h"
+#include "export.h"
 #include "socket.h"
 #include "table_server.h"
 #include "server.h"
@@ -21,7 +23,7 @@
  * @brief Entry point for the VictorDB table (key-value) server.
  *
  * Initializes the table database environment, loads the configuration and WAL,
- * registers signal handlers, and starts the UNIX socket server to handle
+ * registers signal handlers, and starts the UNIX socket (or TCP) server to handle
  * incoming client connections and key-value protocol messages.
  *
  * The program expects arguments to configure the database name and socket path.
@@ -34,7 +36,7 @@
  * 4. Import existing table file if present
  * 5. Replay WAL file if present to restore recent changes
  * 6. Register signal handlers for graceful shutdown
- * 7. Create and bind UNIX domain socket
+ * 7. Create and bind the UNIX domain socket, or the TCP socket with -h
  * 8. Start main server loop
  *
  * @param argc Argument count (should be greater than 1)
@@ -77,6 +79,17 @@ int main(int argc, char *argv[]) {
     core.name = cfg.name;
     core.op_add_counter = 0;
     core.op_del_counter = 0;
+    core.wal = NULL;
+    core.wal_lsn = 1;
+    checkpoint_init(&core.policy);
+
+    // Check the last export, completing it if it was interrupted
+    if (export_recover(TABLE_FILE, TABLE_TMP_FILE, TABLE_SUM_FILE) != 0) {
+        log_message(LOG_ERROR, 
+            "Failed to validate key-value table file (%s): %s", TABLE_FILE, strerror(errno)
+        );
+        return -1;
+    }
 
     // Import existing table file if present
     if (access(TABLE_FILE, F_OK) == 0) {
@@ -96,24 +109,47 @@ int main(int argc, char *argv[]) {
     
     log_message(LOG_INFO, "Key-value table initialized successfully");
 
-    // Replay WAL file if present to restore recent changes
-    if (access(TWAL_FILE, F_OK) == 0) {
-        log_message(LOG_INFO, "Loading transaction log...");
-        FILE *wal = fopen(TWAL_FILE, "rb");
-        if (wal == NULL) {
-            log_message(LOG_ERROR, 
-                "Failed to open transaction log (%s): %s", TWAL_FILE, strerror(errno)
-            );
-            destroy_kvtable(&core.table);
-            return -1;
-        }
-        if (victor_table_loadwal(&core, wal) != 0) {
-            fclose(wal);
-            destroy_kvtable(&core.table);
-            return -1;
-        }
-        fclose(wal);
+    // Replay the log segments not covered by the table file
+    uint64_t ckpt;
+    if (wal_checkpoint_read(TCKPT_FILE, &ckpt) != 0) {
+        log_message(LOG_ERROR, 
+            "Failed to read checkpoint (%s): %s", TCKPT_FILE, strerror(errno)
+        );
+        destroy_kvtable(&core.table);
+        return -1;
+    }
+    log_message(LOG_INFO, "Loading transaction log from LSN %" PRIu64 "...", ckpt);
+    wal_reader_t *wal = wal_reader_open(TWAL_FILE, ckpt);
+    if (wal == NULL) {
+        log_message(LOG_ERROR, 
+            "Failed to open transaction log (%s): %s", TWAL_FILE, strerror(errno)
+        );
+        destroy_kvtable(&core.table);
+        return -1;
+    }
+    struct timespec replay_start, replay_end;
+    clock_gettime(CLOCK_MONOTONIC, &replay_start);
+    if (victor_table_loadwal(&core, wal) != 0) {
+        wal_reader_close(wal);
+        destroy_kvtable(&core.table);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &replay_end);
+    if (wal_reader_truncate(wal) != 0) {
+        log_message(LOG_ERROR, 
+            "Failed to truncate the torn end of the transaction log: %s", strerror(errno)
+        );
+        wal_reader_close(wal);
+        destroy_kvtable(&core.table);
+        return -1;
     }
+    core.wal_lsn = wal_reader_lsn(wal);
+    uint64_t replayed, wal_total;
+    wal_reader_progress(wal, &replayed, &wal_total);
+    checkpoint_replayed(&core.policy, wal_total,
+        (uint64_t)((int64_t)(replay_end.tv_sec - replay_start.tv_sec) * 1000 +
+                   (replay_end.tv_nsec - replay_start.tv_nsec) / 1000000));
+    wal_reader_close(wal);
 
     // Register signal handlers for graceful shutdown
     memset(&sa, 0, sizeof(sa));
@@ -123,20 +159,29 @@ int main(int argc, char *argv[]) {
     sigaction(SIGTERM, &sa, NULL);
     sigaction(SIGHUP,  &sa, NULL);
 
-    // Create and bind UNIX domain socket
-    server = unix_server(cfg.socket.unix_path);
+    // Create and bind the listening socket
+    if (cfg.s_type == SOCKET_TCP)
+        server = tcp_server(cfg.socket.tcp.host, cfg.socket.tcp.port, get_listen_backlog(),
+                            get_reuseport());
+    else
+        server = unix_server(cfg.socket.unix_path);
     if (server == -1) {
         log_message(LOG_ERROR, 
-            "Failed to create UNIX socket server: %s", strerror(errno)
+            "Failed to create %s socket server: %s",
+            cfg.s_type == SOCKET_TCP ? "TCP" : "UNIX", strerror(errno)
         );
         destroy_kvtable(&core.table);
         return -1;
     }
 
     log_message(LOG_INFO, "VictorDB Table Server started successfully!");
-    log_message(LOG_INFO, "Socket: %s", cfg.socket.unix_path);
+    if (cfg.s_type == SOCKET_TCP)
+        log_message(LOG_INFO, "Socket: TCP %s:%d", cfg.socket.tcp.host, cfg.socket.tcp.port);
+    else
+        log_message(LOG_INFO, "Socket: %s", cfg.socket.unix_path);
     log_message(LOG_INFO, "Database root: %s", get_database_cwd());
-    log_message(LOG_INFO, "Export threshold: %d operations", get_export_threshold());
+    log_message(LOG_INFO, "WAL sync: %s (group commit window: %d ms)",
+                wal_sync_name(get_wal_sync()), get_wal_window());
     
     uint64_t sz = 0;
     kv_size(core.table, &sz);
@@ -1,16 +1,20 @@
 #include <victor/victor.h>
 #include <victor/victorkv.h>
 #include <limits.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
 #include "fileutils.h"
+#include "export.h"
 #include "kvproto.h"
 #include "protocol.h"
 #include "socket.h"
 #include "buffer.h"
 #include "table_server.h"
 #include "server.h"
+#include "wal.h"
+#include "replay.h"
 #include "log.h"
 
 /**
@@ -31,11 +35,11 @@
  *
  * @param core Pointer to the VictorTable database context.
  * @param msg  Pointer to the input/output message buffer.
- * @param wal  FILE pointer to the Write-Ahead Log (can be NULL).
+ * @param wal  Write-Ahead Log writer (can be NULL).
  *
  * @return 0 on success, -1 on failure, or error code response written into the message buffer.
  */
-static int handle_del_message(VictorTable *core, buffer_t *msg, FILE *wal) {
+static int handle_del_message(VictorTable *core, buffer_t *msg, wal_t *wal) {
     void   *key = NULL;
     size_t klen;
     int ret;
@@ -51,12 +55,13 @@ static int handle_del_message(VictorTable *core, buffer_t *msg, FILE *wal) {
             table_strerror(ret)
         );
     } else {
+        wal_record_t rec = { .op = WAL_OP_DEL, .key = key, .klen = klen };
+
         core->op_del_counter++;
-        if (wal && buffer_dump_wal(msg, wal) != 0)
-            log_message(LOG_WARNING,
-                "writing wal (%d) - message: %s",
-                errno, strerror(errno)
-            );
+        if (wal && wal_append(wal, &rec) != 0) {
+            free(key);
+            return buffer_write_op_result(msg, MSG_ERROR, 500, "transaction log write failed");
+        }
     }
     
     if (key) free(key);
@@ -79,14 +84,14 @@ static int handle_del_message(VictorTable *core, buffer_t *msg, FILE *wal) {
  *
  * @param core Pointer to the VictorTable database context.
  * @param msg  Pointer to the input/output message buffer.
- * @param wal  FILE pointer to the Write-Ahead Log (can be NULL).
+ * @param wal  Write-Ahead Log writer (can be NULL).
  *
  * @return 0 on success, -1 on failure.
  *
  * @note The function dynamically allocates memory for key and value, which
  *       are freed before returning.
  */
-static int handle_put_message(VictorTable *core, buffer_t *msg, FILE *wal) {
+static int handle_put_message(VictorTable *core, buffer_t *msg, wal_t *wal) {
     void   *key = NULL, *val = NULL;
     size_t klen, vlen;
     int ret;
@@ -97,6 +102,16 @@ static int handle_put_message(VictorTable *core, buffer_t *msg, FILE *wal) {
         return -1;
     }
 
+    if (wal) {
+        wal_record_t rec = { .op = WAL_OP_PUT, .klen = klen, .vlen = vlen };
+
+        if (!wal_fits(&rec)) {
+            free(key);
+            free(val);
+            return buffer_write_op_result(msg, MSG_ERROR, 413, "entry too large for the transaction log");
+        }
+    }
+
     if ((ret = kv_put(core->table, key, (int)klen, val, (int)vlen)) != KV_SUCCESS) {
         if (ret == SYSTEM_ERROR)
             log_message(LOG_ERROR, 
@@ -111,11 +126,14 @@ static int handle_put_message(VictorTable *core, buffer_t *msg, FILE *wal) {
         goto cleanup;
     }
 
-    if (wal && buffer_dump_wal(msg, wal) != 0)
-        log_message(LOG_WARNING,
-            "writing wal (%d) - message: %s",
-            errno, strerror(errno)
-        );
+    if (wal) {
+        wal_record_t rec = { .op = WAL_OP_PUT, .key = key, .klen = klen, .val = val, .vlen = vlen };
+        if (wal_append(wal, &rec) != 0) {
+            free(key);
+            free(val);
+            return buffer_write_op_result(msg, MSG_ERROR, 500, "transaction log write failed");
+        }
+    }
 
     core->op_add_counter++;
 cleanup:
@@ -173,15 +191,115 @@ static int handle_get_message(VictorTable *core, buffer_t *msg) {
 }
 
 
+/**
+ * @brief WAL record decoded for replay.
+ *
+ * `rec` points into the WAL record, or at `key` / `val` for a message from
+ * a log of an older format.
+ */
+typedef struct {
+    wal_record_t rec;
+    void        *key, *val;  /**< Decoded MSG_PUT / MSG_DEL key, and value */
+} table_op_t;
+
+/**
+ * @brief Decodes a WAL record for replay (see replay_handler_t).
+ */
+static int table_decode(const wal_record_t *rec, void *ptr) {
+    table_op_t *op = (table_op_t *)ptr;
+    buffer_t *msg = (buffer_t *)rec->msg;
+    size_t klen = 0, vlen = 0;
+    int ret;
+
+    op->rec = *rec;
+    op->rec.owned = NULL;
+    op->key = op->val = NULL;
+    if (rec->op != WAL_OP_MESSAGE)
+        return (rec->op == WAL_OP_PUT || rec->op == WAL_OP_DEL) ? 0 : 1;
+
+    switch (msg->hdr.type) {
+    case MSG_PUT:
+        op->rec.op = WAL_OP_PUT;
+        ret = buffer_read_put(msg, &op->key, &klen, &op->val, &vlen);
+        break;
+    case MSG_DEL:
+        op->rec.op = WAL_OP_DEL;
+        ret = buffer_read_del(msg, &op->key, &klen);
+        break;
+    default:
+        return 1;
+    }
+    op->rec.key = op->key;
+    op->rec.klen = klen;
+    op->rec.val = op->val;
+    op->rec.vlen = vlen;
+    return ret;
+}
+
+/**
+ * @brief Gets the number of keys a decoded WAL record changes (see replay_handler_t).
+ */
+static size_t table_entries(const void *ptr) {
+    (void)ptr;
+    return 1;
+}
+
+/**
+ * @brief Gets the key changed by a decoded WAL record (see replay_handler_t).
+ */
+static int table_entry(const void *ptr, size_t i, const void **key, size_t *klen) {
+    const wal_record_t *rec = &((const table_op_t *)ptr)->rec;
+
+    (void)i;
+    *key = rec->key;
+    *klen = rec->klen;
+    return rec->op == WAL_OP_DEL;
+}
+
+/**
+ * @brief Applies a decoded WAL record (see replay_handler_t).
+ */
+static int table_apply(void *ctx, void *ptr, size_t i, int flags) {
+    VictorTable *core = (VictorTable *)ctx;
+    const wal_record_t *rec = &((table_op_t *)ptr)->rec;
+
+    (void)i;
+    if (rec->op == WAL_OP_PUT) {
+        if (flags & REPLAY_PURGE)
+            kv_del(core->table, (void *)rec->key, (int)rec->klen);
+        if (kv_put(core->table, (void *)rec->key, (int)rec->klen,
+                   (void *)rec->val, (int)rec->vlen) != KV_SUCCESS)
+            return -1;
+        core->op_add_counter++;
+    } else {
+        if (kv_del(core->table, (void *)rec->key, (int)rec->klen) != KV_SUCCESS)
+            return -1;
+        core->op_del_counter++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Releases a decoded WAL record (see replay_handler_t).
+ */
+static void table_release(void *ptr) {
+    table_op_t *op = (table_op_t *)ptr;
+
+    free(op->key);
+    free(op->val);
+}
+
 /**
  * @brief Loads and applies WAL operations to the VictorTable database.
  *
- * This function reads and replays all operations stored in a Write-Ahead Log (WAL) file.
- * Each message is parsed and executed according to its type (e.g., `MSG_PUT`, `MSG_DEL`).
- * It ensures database state restoration after a crash or restart.
+ * This function replays all operations stored in the Write-Ahead Log (WAL)
+ * from the given position (puts and deletes). Records are decoded in
+ * parallel and applied in log order (see replay_wal()), without encoding
+ * the responses. It ensures database state restoration after a crash or
+ * restart.
  *
  * @param core Pointer to the VictorTable database structure to apply the WAL to.
- * @param wal  FILE* pointer to an already opened WAL file in binary read mode.
+ * @param wal  WAL reader opened at the checkpoint LSN (see wal_reader_open()).
  *
  * @return 
  *   0 on successful import of all WAL entries,  
@@ -192,46 +310,22 @@ static int handle_get_message(VictorTable *core, buffer_t *msg) {
  *   If an error occurs and `errno` is 0, it is assumed the WAL is corrupted.
  *   If `errno` is non-zero, a system-level I/O error is assumed.
  */
-int victor_table_loadwal(VictorTable *core, FILE *wal) {
-    buffer_t *buff = alloc_buffer();
-    int successful_entries = 0, failed_entries = 0;
-    int ret;
+int victor_table_loadwal(VictorTable *core, wal_reader_t *wal) {
+    replay_handler_t handler = {
+        .core    = core,
+        .op_size = sizeof(table_op_t),
+        .decode  = table_decode,
+        .entries = table_entries,
+        .entry   = table_entry,
+        .apply   = table_apply,
+        .release = table_release
+    };
+    replay_stats_t stats;
 
-    if (!buff) {
-        log_message(LOG_ERROR, "Failed to allocate buffer for WAL processing");
-        return -1;
-    }
-
-    while ((ret = buffer_load_wal(buff, wal)) == 1) {
-        switch (buff->hdr.type) {
-            case MSG_PUT:
-                if (handle_put_message(core, buff, NULL) != 0 || 
-                    buff->hdr.type == MSG_ERROR)
-                    failed_entries++;
-                else
-                    successful_entries++;
-
-                break;
-            case MSG_DEL:
-                if (handle_del_message(core, buff, NULL) != 0 || 
-                    buff->hdr.type == MSG_ERROR)
-                    failed_entries++;
-                else
-                    successful_entries++;
-                break;
-            default:
-                log_message(LOG_WARNING,
-                    "unknown message type in WAL: %d", buff->hdr.type);
-                break;
-        }
-    }
-
-    free(buff);
-
-    if (ret == 0) {
+    if (replay_wal(wal, &handler, get_replay_compact(), &stats) == 0) {
         log_message(LOG_INFO, 
-            "WAL import completed: %d entries loaded successfully, %d with errors", 
-            successful_entries, failed_entries);
+            "WAL import completed: %" PRIu64 " entries loaded successfully, %" PRIu64 " with errors", 
+            stats.applied, stats.failed);
         return 0;
     }
 
@@ -244,169 +338,255 @@ int victor_table_loadwal(VictorTable *core, FILE *wal) {
 }
 
 
+/**
+ * @brief Handles a statistics request.
+ *
+ * Answers with a `MSG_STATS_RESULT` map of counters, including the I/O and
+ * output queue counters of the server loop and the checkpoint policy with
+ * its decisions.
+ *
+ * @param core Pointer to the VictorTable database context.
+ * @param msg  Pointer to the input/output message buffer.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int handle_stats_message(VictorTable *core, buffer_t *msg) {
+    uint64_t sz = 0;
+
+    kv_size(core->table, &sz);
+    proto_stat_t stats[2 + SERVER_IO_STATS + CHECKPOINT_STATS] = {
+        { "keys",        sz },
+        { "pending_ops", (uint64_t)(core->op_add_counter + core->op_del_counter) },
+    };
+    size_t n = 2 + server_io_stats(stats + 2);
+
+    n += checkpoint_stats(&core->policy, stats + n, wal_size(core->wal));
+    return buffer_write_stats(msg, stats, n);
+}
+
+/**
+ * @brief Holds the response of a write until its WAL record is committed.
+ *
+ * Errors are sent at once: among them, writes whose record could not be
+ * appended, which must not wait for a group to be acknowledged.
+ *
+ * @param wal WAL writer.
+ * @param msg Response written by the handler.
+ * @param ret Handler result.
+ * @return SERVER_COMMIT if a response must wait for the group commit, @p ret otherwise.
+ */
+static int logged(const wal_t *wal, const buffer_t *msg, int ret) {
+    return (ret == 0 && msg->hdr.type != MSG_ERROR && wal_pending(wal)) ? SERVER_COMMIT : ret;
+}
+
+/**
+ * @brief Refuses a write once the WAL failed (see wal_failed()).
+ *
+ * The table may hold changes the log lost, so nothing more is applied
+ * until the server is restarted and replays the log.
+ *
+ * @param msg Pointer to the input/output message buffer.
+ * @return 0 if the error response is written, -1 otherwise.
+ */
+static int refuse_write(buffer_t *msg) {
+    return buffer_write_op_result(msg, MSG_ERROR, 503,
+        "transaction log failed: writes are refused until restart");
+}
+
+/**
+ * @brief Dispatches one client request to its handler.
+ *
+ * Requests are handled in place: the response overwrites the request in `msg`.
+ *
+ * @param ctx Pointer to the VictorTable database context.
+ * @param msg Pointer to the input/output message buffer.
+ *
+ * @return 0 if a response must be sent, SERVER_COMMIT for logged writes,
+ *         -1 to close the connection.
+ */
+static int table_dispatch(void *ctx, buffer_t *msg) {
+    VictorTable *core = (VictorTable *)ctx;
+
+    if ((msg->hdr.type == MSG_PUT || msg->hdr.type == MSG_DEL) && wal_failed(core->wal))
+        return refuse_write(msg);
+
+    switch (msg->hdr.type) {
+    case MSG_PUT: 
+        return logged(core->wal, msg, handle_put_message(core, msg, core->wal));
+    case MSG_DEL:
+        return logged(core->wal, msg, handle_del_message(core, msg, core->wal));
+    case MSG_GET:
+        return handle_get_message(core, msg);
+    case MSG_STATS:
+        return handle_stats_message(core, msg);
+    case MSG_CONFIG:
+        return checkpoint_config(&core->policy, msg);
+    default:
+        log_message(LOG_WARNING,
+            "invalid protocol message type: %d",
+            msg->hdr.type
+        );
+        return -1;
+    }
+}
+
+/**
+ * @brief Dumps the table to disk when the checkpoint policy says so.
+ *
+ * Called by the server loop after every iteration. The WAL is cut over to
+ * a new segment first. The table is dumped to `TABLE_TMP_FILE`, which then
+ * replaces `TABLE_FILE` (see export_commit()); on success the checkpoint is
+ * moved to the cut and the segments before it are retired, since their
+ * operations are now part of `TABLE_FILE`.
+ *
+ * @param ctx Pointer to the VictorTable database context.
+ * @return When the policy must be asked again (see checkpoint_wakeup()).
+ */
+static int table_tick(void *ctx) {
+    VictorTable *core = (VictorTable *)ctx;
+    uint64_t ops = (uint64_t)(core->op_add_counter + core->op_del_counter);
+    uint64_t lsn;
+    int ret, ok = 0;
+
+    /* The table may hold writes the log lost: do not save them */
+    if (wal_failed(core->wal))
+        return -1;
+
+    if (checkpoint_due(&core->policy, ops, wal_size(core->wal)) == CHECKPOINT_NONE)
+        return checkpoint_wakeup(&core->policy, wal_size(core->wal));
+
+    checkpoint_start(&core->policy, wal_size(core->wal));
+    if ((lsn = wal_cut(core->wal)) == 0) {
+        log_message(LOG_WARNING,
+            "unable to cut over WAL for export (%d) - message: %s",
+            errno, strerror(errno)
+        );
+        checkpoint_done(&core->policy, 0);
+        return checkpoint_wakeup(&core->policy, wal_size(core->wal));
+    }
+
+    log_message(LOG_INFO, "Exporting table to disk (%s, operations: %d)", 
+               checkpoint_reason_name(core->policy.reason),
+               core->op_add_counter + core->op_del_counter);
+    if ((ret = kv_dump(core->table, TABLE_TMP_FILE)) != KV_SUCCESS) {
+        log_message(LOG_WARNING, 
+            "Error during table export: %s", table_strerror(ret));
+        unlink(TABLE_TMP_FILE);
+    } else if (export_commit(TABLE_TMP_FILE, TABLE_FILE, TABLE_SUM_FILE) != 0) {
+        log_message(LOG_WARNING,
+            "unable to replace '%s' (%d) - message: %s",
+            TABLE_FILE, errno, strerror(errno)
+        );
+        export_recover(TABLE_FILE, TABLE_TMP_FILE, TABLE_SUM_FILE);
+    } else if (wal_checkpoint_write(TCKPT_FILE, lsn) != 0)
+        log_message(LOG_WARNING,
+            "unable to write checkpoint '%s' (%d) - message: %s",
+            TCKPT_FILE, errno, strerror(errno)
+        );
+    else {
+        log_message(LOG_INFO, 
+            "Table exported successfully, checkpoint at LSN %" PRIu64, lsn);
+        wal_retire(TWAL_FILE, lsn);
+        core->op_add_counter = core->op_del_counter = 0;
+        ok = 1;
+    }
+    checkpoint_done(&core->policy, ok);
+    return checkpoint_wakeup(&core->policy, wal_size(core->wal));
+}
+
+/**
+ * @brief Group-commits the WAL records of the writes handled so far.
+ *
+ * @param ctx Pointer to the VictorTable database context.
+ * @param force Commit even if the group commit window is still open.
+ * @return See wal_commit(); a commit running on the writer thread is
+ *         SERVER_COMMIT_RUNNING.
+ */
+static int table_commit(void *ctx, int force) {
+    VictorTable *core = (VictorTable *)ctx;
+    int ret = wal_commit(core->wal, force);
+
+    return ret == WAL_COMMIT_RUNNING ? SERVER_COMMIT_RUNNING : ret;
+}
+
+/**
+ * @brief Tells whether the WAL writer thread wrote the group handed over.
+ *
+ * @param ctx Pointer to the VictorTable database context.
+ * @param wait Block until it did.
+ * @return See wal_committed().
+ */
+static int table_committed(void *ctx, int wait) {
+    VictorTable *core = (VictorTable *)ctx;
+
+    return wal_committed(core->wal, wait);
+}
+
+/**
+ * @brief Gets the descriptor signalling the WAL writer thread completions.
+ */
+static int table_commit_fd(void *ctx) {
+    VictorTable *core = (VictorTable *)ctx;
+
+    return wal_fd(core->wal);
+}
+
 /**
  * @brief Starts the VictorTable server loop, handling client requests and writing to WAL.
  *
- * This function implements the main server loop for the VictorTable key-value database. 
- * It accepts incoming UNIX domain socket connections, processes protocol messages from clients,
- * and writes changes to a Write-Ahead Log (WAL) file for durability.
+ * This function opens the Write-Ahead Log (WAL) and runs the shared server loop
+ * (`server_loop()`) with the key-value protocol handlers. Changes are written
+ * to the WAL for durability.
  *
  * Supported message types:
  * - `MSG_PUT`: Adds a new key-value pair to the database and appends to the WAL.
  * - `MSG_DEL`: Removes a key-value pair and appends to the WAL.
  * - `MSG_GET`: Performs a key lookup (no WAL entry).
+ * - `MSG_STATS`: Reports server counters.
+ * - `MSG_CONFIG`: Changes the checkpoint policy.
  *
- * The server uses `select()` to multiplex connections and listens until a termination
- * signal is received (`running == 0`), at which point it gracefully shuts down.
+ * The loop runs until a termination signal is received (`running == 0`),
+ * at which point it gracefully shuts down.
  *
  * @param core Pointer to the VictorTable database structure.
  * @param server File descriptor of a bound and listening UNIX socket.
  *
  * @return 0 on clean shutdown, -1 on failure (e.g., memory, I/O, or socket error).
  *
- * @note The WAL file is opened in append mode. If it cannot be opened, the server
- *       fails to start. The server respects signals via the global `running` flag.
+ * @note The WAL is opened in a new segment starting at `core->wal_lsn`, with the durability mode and
+ *       group commit window of VICTOR_WAL_SYNC / VICTOR_WAL_WINDOW_MS (see
+ *       wal.h). If it cannot be opened, the server fails to start. The server respects signals via the global `running` flag.
  *
  * @warning Only `MSG_PUT` and `MSG_DEL` are persisted in the WAL.
- * @warning Maximum number of simultaneous connections is limited by `MAX_CONNECTIONS`.
- * @warning If `recv_msg` or `send_msg` fail, the client connection is closed.
+ * @warning If a request cannot be parsed or its response cannot be sent, the
+ *          client connection is closed.
  */
 int victor_table_server(VictorTable *core, int server) {
-    FILE *wal = NULL;
-    int conn[MAX_CONNECTIONS];
-    fd_set set, check;
-    int max = server, n;
-    buffer_t *buff = alloc_buffer();
-    
-    if (!buff) {
-        log_message(LOG_ERROR, 
-            "failed to allocate buffer"
-        );
-        close(server);
-        return -1;
-    }
+    server_handler_t handler = {
+        .core      = core,
+        .dispatch  = table_dispatch,
+        .tick      = table_tick,
+        .commit    = table_commit,
+        .committed = table_committed,
+        .commit_fd = table_commit_fd
+    };
+    int ret;
 
-    wal = fopen(TWAL_FILE, "ab");
-    if (!wal) { 
+    core->wal = wal_open(TWAL_FILE, core->wal_lsn, get_wal_sync(), get_wal_window());
+    if (!core->wal) { 
         log_message(LOG_ERROR, 
             "failed to open WAL file '%s': %s", 
             TWAL_FILE, 
             strerror(errno)
         );
-        free(buff);
         close(server);
         return -1;
     }
-    for (int i=0; i < MAX_CONNECTIONS; i++) conn[i] = -1;
-
-    FD_ZERO(&set);
-    FD_ZERO(&check);
-    FD_SET(server, &set);
-
-    while (running) {
-        memcpy(&check, &set, sizeof(fd_set));
-        n = select(max+1, &check, NULL, NULL, NULL);
-        if (n < 0 && (errno == EAGAIN || errno == EINTR))
-            continue;
-        else if (n < 0) {
-            log_message(LOG_ERROR, 
-                "fatal error on select (%d) - %s",
-                errno, strerror(errno)
-            );
-            break;
-        }
-        if (FD_ISSET(server, &check)) {
-            int i;
-            int sd = unix_accept(server);
-            if (sd == -1)
-                if (errno != EAGAIN && errno != EINTR) {
-                    log_message(LOG_ERROR, 
-                        "fatal error on unix_accept (%d) - %s",
-                        errno, strerror(errno)
-                    );
-                    break;
-                }
-            for (i = 0; i < MAX_CONNECTIONS; i++)
-                if (conn[i] == -1) {
-                    conn[i] = sd;
-                    break;
-                }
-            if (i == MAX_CONNECTIONS) {
-                log_message(LOG_WARNING,
-                    "max connections reached - new client closed"
-                );
-                close(sd);
-            } else {
-                max = sd > max ? sd : max;
-                FD_SET(sd, &set);
-            }
-            n--;
-        }
 
-        for (int i = 0; i < MAX_CONNECTIONS && n > 0; i++) {
-            int ret = 0;
-            if (FD_ISSET(conn[i], &check)) {
-                n--;
-                ret = recv_msg(conn[i], buff);
-                if (ret == -1) {
-                    log_message(LOG_WARNING,
-                        "connection closed due to protocol or receive error"
-                    );
-                    FD_CLR(conn[i], &set);
-                    close(conn[i]);
-                    conn[i] = -1;
-                    continue;
-                }
-                switch (buff->hdr.type) {
-                case MSG_PUT: 
-                    ret = handle_put_message(core, buff, wal);   
-                    break;
-                case MSG_DEL:
-                    ret = handle_del_message(core, buff, wal);
-                    break;
-                case MSG_GET:
-                    ret = handle_get_message(core, buff);
-                    break;
-                default:
-                    log_message(LOG_WARNING,
-                        "invalid protocol message type: %d",
-                        buff->hdr.type
-                    );
-                    ret = -1;
-                }
-                if (ret != -1) {
-                    if (send_msg(conn[i], buff) == -1) {
-                        FD_CLR(conn[i], &set);
-                        close(conn[i]);
-                        conn[i] = -1;
-                    }
-                } else {
-                    FD_CLR(conn[i], &set);
-                    close(conn[i]);
-                    conn[i] = -1;
-                }
-            }
-        }
-        if (core->op_add_counter + core->op_del_counter > get_export_threshold()) {
-            int ret;
-            log_message(LOG_INFO, "Exporting table to disk (operations: %d)", 
-                       core->op_add_counter + core->op_del_counter);
-            if ((ret = kv_dump(core->table, TABLE_FILE)) != KV_SUCCESS)
-                log_message(LOG_WARNING, 
-                    "Error during table export: %s", table_strerror(ret));
-            else {
-                log_message(LOG_INFO, "Table exported successfully, WAL file cleared");
-                unlink(TWAL_FILE);
-                core->op_add_counter = core->op_del_counter = 0;
-            }
-        }
-    }
-    log_message(LOG_INFO, "end main loop");
-    fclose(wal);
-    free(buff);
-    for (int i = 0; i < MAX_CONNECTIONS; i ++)
-        if (conn[i] != -1)
-            close(conn[i]);
+    ret = server_loop(server, &handler);
+
+    wal_close(core->wal);
+    core->wal = NULL;
     close(server);
-    return 0;
-}
\ No newline at end of file
+    return ret;
+}
@@ -12,6 +12,8 @@
 #include <victor/victor.h>
 #include <victor/victorkv.h>
 #include <stdio.h>
+#include "wal.h"
+#include "checkpoint.h"
 #include <stdint.h>
 
 
@@ -26,6 +28,9 @@ typedef struct {
     KVTable  *table;          /**< Pointer to the key-value table */
     int op_add_counter;  /**< Counter for PUT operations */
     int op_del_counter;  /**< Counter for DELETE operations */
+    wal_t    *wal;            /**< Write-Ahead Log opened while serving (NULL otherwise) */
+    uint64_t  wal_lsn;        /**< LSN of the next WAL record, as left by replay */
+    checkpoint_t policy;      /**< Decides when to export (see checkpoint.h) */
 } VictorTable;
 
 
@@ -33,10 +38,10 @@ typedef struct {
  * @brief Loads and applies WAL operations to the VictorTable database.
  *
  * @param core Pointer to the VictorTable database structure.
- * @param wal  FILE* pointer to an opened WAL file in binary read mode.
+ * @param wal  WAL reader opened at the checkpoint LSN.
  * @return 0 on success, -1 on failure.
  */
-extern int victor_table_loadwal(VictorTable *core, FILE *wal);
+extern int victor_table_loadwal(VictorTable *core, wal_reader_t *wal);
 
 /**
  * @brief Starts the VictorTable server loop.
@@ -0,0 +1,312 @@
+/**
+ * @file uring.c
+ * @brief Minimal io_uring wrapper used by the io_uring I/O backend.
+ */
+
+#include "uring.h"
+
+#if defined(HAVE_IO_URING)
+
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+struct uring {
+    int       fd;
+    unsigned  features;
+
+    uint8_t  *sq_map, *cq_map;   /**< Queue mappings (the same one with IORING_FEAT_SINGLE_MMAP) */
+    size_t    sq_map_len, cq_map_len;
+    struct io_uring_sqe *sqes;
+    size_t    sqes_len;
+    unsigned *sq_head, *sq_tail, sq_mask, sq_entries;
+    unsigned *cq_head, *cq_tail, cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned  sq_local;          /**< Tail including the entries not submitted yet */
+
+    struct io_uring_buf_ring *br;  /**< Provided buffer ring, NULL if none */
+    size_t    br_len;
+    uint8_t  *bufs;
+    unsigned  nbufs;
+    size_t    buf_size;
+    uint16_t  br_tail;
+
+    uint64_t  calls;             /**< io_uring_enter() calls */
+};
+
+/** @brief Group id of the provided buffers */
+#define URING_BGID 1
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned wait, unsigned flags, void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, argsz);
+}
+
+static int sys_register(int fd, unsigned op, void *arg, unsigned nargs) {
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nargs);
+}
+
+static int map_queues(uring_t *u, const struct io_uring_params *p) {
+    u->sq_map_len = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    u->cq_map_len = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_map_len > u->sq_map_len)
+            u->sq_map_len = u->cq_map_len;
+        u->cq_map_len = u->sq_map_len;
+    }
+    u->sq_map = mmap(NULL, u->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_map == MAP_FAILED) {
+        u->sq_map = NULL;
+        return -1;
+    }
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_map = u->sq_map;
+    } else {
+        u->cq_map = mmap(NULL, u->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_map == MAP_FAILED) {
+            u->cq_map = NULL;
+            return -1;
+        }
+    }
+    u->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        u->sqes = NULL;
+        return -1;
+    }
+
+    u->sq_head = (unsigned *)(u->sq_map + p->sq_off.head);
+    u->sq_tail = (unsigned *)(u->sq_map + p->sq_off.tail);
+    u->sq_mask = *(unsigned *)(u->sq_map + p->sq_off.ring_mask);
+    u->sq_entries = p->sq_entries;
+    u->cq_head = (unsigned *)(u->cq_map + p->cq_off.head);
+    u->cq_tail = (unsigned *)(u->cq_map + p->cq_off.tail);
+    u->cq_mask = *(unsigned *)(u->cq_map + p->cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(u->cq_map + p->cq_off.cqes);
+    u->sq_local = *u->sq_tail;
+
+    /* Entry i always sits in slot i. */
+    for (unsigned i = 0; i < p->sq_entries; i++)
+        ((unsigned *)(u->sq_map + p->sq_off.array))[i] = i;
+    return 0;
+}
+
+static int setup_bufs(uring_t *u, unsigned nbufs, size_t buf_size) {
+    struct io_uring_buf_reg reg;
+
+    u->br_len = nbufs * sizeof(struct io_uring_buf);
+    u->br = mmap(NULL, u->br_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->br == MAP_FAILED) {
+        u->br = NULL;
+        return -1;
+    }
+    if ((u->bufs = malloc(nbufs * buf_size)) == NULL)
+        return -1;
+    u->nbufs = nbufs;
+    u->buf_size = buf_size;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+    reg.ring_entries = nbufs;
+    reg.bgid = URING_BGID;
+    if (sys_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        munmap(u->br, u->br_len);
+        u->br = NULL;
+        return -1;
+    }
+    for (unsigned i = 0; i < nbufs; i++)
+        uring_buf_recycle(u, i);
+    return 0;
+}
+
+/**
+ * @brief Checks that a multishot receive into provided buffers works (Linux 6.0).
+ *
+ * Older kernels accept the buffer ring but fail the receive itself.
+ */
+static int probe_recv(uring_t *u) {
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    struct msghdr mh;
+    int sv[2], ret = -1;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0)
+        return -1;
+    memset(&mh, 0, sizeof(mh));
+    if ((sqe = uring_sqe(u)) == NULL)
+        goto out;
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = sv[0];
+    sqe->addr = (uint64_t)(uintptr_t)&mh;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    if (write(sv[1], "", 1) != 1)
+        goto out;
+    close(sv[1]);
+    sv[1] = -1;
+
+    /* The byte, then the end of the stream. */
+    for (int n = 0; n < 2; n++) {
+        if (uring_enter(u, 1, 1000) != 0 || (cqe = uring_peek(u)) == NULL)
+            goto out;
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+            uring_buf_recycle(u, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        if (n == 0)
+            ret = cqe->res > 0 && (cqe->flags & IORING_CQE_F_MORE) ? 0 : -1;
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            uring_seen(u);
+            break;
+        }
+        uring_seen(u);
+    }
+out:
+    close(sv[0]);
+    if (sv[1] >= 0)
+        close(sv[1]);
+    if (ret != 0)
+        errno = EINVAL;
+    return ret;
+}
+
+uring_t *uring_create(unsigned entries, unsigned bufs, size_t buf_size) {
+    struct io_uring_params p;
+    uring_t *u = calloc(1, sizeof(uring_t));
+    int err;
+
+    if (!u)
+        return NULL;
+    memset(&p, 0, sizeof(p));
+#if defined(IORING_SETUP_SUBMIT_ALL) && defined(IORING_SETUP_COOP_TASKRUN)
+    p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+#endif
+    if ((u->fd = sys_setup(entries, &p)) < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        u->fd = sys_setup(entries, &p);
+    }
+    if (u->fd < 0) {
+        free(u);
+        return NULL;
+    }
+    u->features = p.features;
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        errno = EINVAL;
+        goto fail;
+    }
+    if (map_queues(u, &p) != 0)
+        goto fail;
+    if (bufs > 0 && (setup_bufs(u, bufs, buf_size) != 0 || probe_recv(u) != 0))
+        goto fail;
+    return u;
+
+fail:
+    err = errno;
+    uring_destroy(u);
+    errno = err;
+    return NULL;
+}
+
+struct io_uring_sqe *uring_sqe(uring_t *u) {
+    struct io_uring_sqe *sqe;
+
+    if (u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries &&
+        uring_enter(u, 0, 0) != 0)
+        return NULL;
+    sqe = &u->sqes[u->sq_local & u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_local++;
+    return sqe;
+}
+
+int uring_enter(uring_t *u, unsigned wait, int timeout_ms) {
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned submit, flags = 0;
+    int r;
+
+    __atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+    submit = u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (wait > 0) {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        if (timeout_ms >= 0) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000LL;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+        }
+    } else if (submit == 0) {
+        return 0;
+    }
+    u->calls++;
+    r = sys_enter(u->fd, submit, wait, flags, wait > 0 ? &arg : NULL, wait > 0 ? sizeof(arg) : 0);
+    if (r < 0 && errno == ETIME)
+        return 0;
+    return r < 0 ? -1 : 0;
+}
+
+struct io_uring_cqe *uring_peek(uring_t *u) {
+    unsigned head = *u->cq_head;
+
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &u->cqes[head & u->cq_mask];
+}
+
+void uring_seen(uring_t *u) {
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+unsigned uring_buf_group(const uring_t *u) {
+    (void)u;
+    return URING_BGID;
+}
+
+uint8_t *uring_buf(const uring_t *u, unsigned bid) {
+    return u->bufs + (size_t)bid * u->buf_size;
+}
+
+void uring_buf_recycle(uring_t *u, unsigned bid) {
+    struct io_uring_buf *b = &u->br->bufs[u->br_tail & (u->nbufs - 1)];
+
+    b->addr = (uint64_t)(uintptr_t)uring_buf(u, bid);
+    b->len = (uint32_t)u->buf_size;
+    b->bid = (uint16_t)bid;
+    u->br_tail++;
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+uint64_t uring_calls(const uring_t *u) {
+    return u->calls;
+}
+
+void uring_destroy(uring_t *u) {
+    if (!u)
+        return;
+    /* Closing the ring cancels what is pending before the buffers go away. */
+    if (u->fd >= 0)
+        close(u->fd);
+    if (u->br)
+        munmap(u->br, u->br_len);
+    free(u->bufs);
+    if (u->sqes)
+        munmap(u->sqes, u->sqes_len);
+    if (u->cq_map && u->cq_map != u->sq_map)
+        munmap(u->cq_map, u->cq_map_len);
+    if (u->sq_map)
+        munmap(u->sq_map, u->sq_map_len);
+    free(u);
+}
+
+#endif /* HAVE_IO_URING */
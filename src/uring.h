@@ -0,0 +1,124 @@
+/**
+ * @file uring.h
+ * @brief Minimal io_uring wrapper used by the io_uring I/O backend.
+ *
+ * Talks to the kernel through the raw system calls and <linux/io_uring.h>,
+ * so the backend needs no extra library. It covers what the servers use:
+ * a submission and a completion queue mapped once, timed waits, and a ring
+ * of provided buffers for multishot receives.
+ *
+ * The backend is built in when the kernel headers are available (see
+ * HAVE_IO_URING) and selected at run time with VICTOR_IO=uring. When the
+ * running kernel lacks a required feature, uring_create() fails and the
+ * servers keep using epoll.
+ */
+
+#ifndef __URING_H
+#define __URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(HAVE_IO_URING) && !defined(VICTOR_NO_IO_URING) && \
+    defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+/** @brief The io_uring backend is built in (define VICTOR_NO_IO_URING to leave it out) */
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#if defined(HAVE_IO_URING)
+#include <linux/io_uring.h>
+#endif
+
+/**
+ * @brief Tells whether the io_uring backend is requested.
+ *
+ * Reads the VICTOR_IO environment variable: `uring` selects io_uring,
+ * `epoll` (the default) the readiness-based loop.
+ *
+ * @return 1 if io_uring is requested, 0 otherwise.
+ */
+static inline int get_io_uring(void) {
+    const char *env_val = getenv("VICTOR_IO");
+    return env_val && strcmp(env_val, "uring") == 0;
+}
+
+#if defined(HAVE_IO_URING)
+
+/** @brief Opaque ring handle */
+typedef struct uring uring_t;
+
+/**
+ * @brief Sets up a ring.
+ *
+ * @param entries Submission queue size (rounded up to a power of two).
+ * @param bufs Number of provided buffers for multishot receives (a power of
+ *        two), 0 for none.
+ * @param buf_size Size of each provided buffer.
+ * @return Pointer to the ring, or NULL on failure (errno is set, ENOSYS or
+ *         EINVAL if the kernel is too old).
+ */
+extern uring_t *uring_create(unsigned entries, unsigned bufs, size_t buf_size);
+
+/**
+ * @brief Gets a zeroed submission entry, submitting queued ones if the queue is full.
+ *
+ * @return Pointer to the entry, or NULL if the queue cannot be drained.
+ */
+extern struct io_uring_sqe *uring_sqe(uring_t *u);
+
+/**
+ * @brief Submits the queued entries and waits for completions.
+ *
+ * @param wait Number of completions to wait for (0 to only submit).
+ * @param timeout_ms Longest wait in milliseconds, -1 to wait forever.
+ * @return 0 on success or timeout, -1 on error (EINTR included, so that
+ *         signals can stop the loop).
+ */
+extern int uring_enter(uring_t *u, unsigned wait, int timeout_ms);
+
+/**
+ * @brief Gets the oldest unseen completion.
+ *
+ * @return Pointer to the completion, or NULL if there is none.
+ */
+extern struct io_uring_cqe *uring_peek(uring_t *u);
+
+/**
+ * @brief Releases the completion returned by uring_peek().
+ */
+extern void uring_seen(uring_t *u);
+
+/**
+ * @brief Gets the group id of the provided buffers (`sqe->buf_group`).
+ */
+extern unsigned uring_buf_group(const uring_t *u);
+
+/**
+ * @brief Gets the provided buffer a completion was stored in.
+ *
+ * @param bid Buffer id (`cqe->flags >> IORING_CQE_BUFFER_SHIFT`).
+ */
+extern uint8_t *uring_buf(const uring_t *u, unsigned bid);
+
+/**
+ * @brief Hands a provided buffer back to the kernel.
+ */
+extern void uring_buf_recycle(uring_t *u, unsigned bid);
+
+/**
+ * @brief Gets the number of io_uring_enter() calls made so far.
+ */
+extern uint64_t uring_calls(const uring_t *u);
+
+/**
+ * @brief Releases the ring (may be NULL). Pending operations are cancelled.
+ */
+extern void uring_destroy(uring_t *u);
+
+#endif /* HAVE_IO_URING */
+
+#endif /* __URING_H */
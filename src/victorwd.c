@@ -4,7 +4,13 @@
  *
  * This utility reads and displays the contents of VictorDB WAL files,
  * showing operation types, keys, values, and raw data in both hex and ASCII formats.
- * Supports both table WAL (db.twal) and index WAL (db.iwal) files.
+ * Supports both table WAL (db.twal) and index WAL (db.iwal) files, in the
+ * binary record format and in the wire message format of older versions.
+ *
+ * It can also write a compacted copy of a log, holding only the last
+ * operation on every id or key (see replay_wal()). The rows files of
+ * INSERT_FILE records (see ingest.h) are looked up in the current
+ * directory; their rows are written to the copy as INSERT records.
  */
 
 #include <stdio.h>
@@ -14,14 +20,21 @@
 #include <errno.h>
 #include <time.h>
 #include <ctype.h>
+#include <inttypes.h>
 
 #include "buffer.h"
 #include "protocol.h"
 #include "kvproto.h"
 #include "viproto.h"
 #include "fileutils.h"
+#include "wal.h"
+#include "ingest.h"
+#include "replay.h"
 #include "log.h"
 
+/** @brief Records appended to the compacted log between two commits */
+#define COMPACT_COMMIT_RECORDS 4096
+
 /**
  * @brief Print data in hex dump format with ASCII representation.
  */
@@ -106,6 +119,8 @@ static const char* get_message_type_name(int type) {
         case MSG_GET:           return "GET";
         case MSG_GET_RESULT:    return "GET_RESULT";
         case MSG_OP_RESULT:     return "OP_RESULT";
+        case MSG_INSERT_BATCH:  return "INSERT_BATCH";
+        case MSG_BATCH_RESULT:  return "BATCH_RESULT";
         case MSG_ERROR:         return "ERROR";
         default:                return "UNKNOWN";
     }
@@ -114,10 +129,11 @@ static const char* get_message_type_name(int type) {
 /**
  * @brief Dump a single WAL entry with detailed information.
  */
-static void dump_wal_entry(const buffer_t *buf, int entry_num, bool verbose) {
+static void dump_wal_entry(buffer_t *buf, int entry_num, bool verified, bool verbose) {
     printf("=== Entry #%d ===\n", entry_num);
     printf("Message Type: 0x%02x (%s)\n", buf->hdr.type, get_message_type_name(buf->hdr.type));
     printf("Message Length: %d bytes\n", buf->hdr.len);
+    printf("Checksum: %s\n", verified ? "CRC-32C ok" : "none (legacy log)");
     
     // Try to parse based on message type
     switch (buf->hdr.type) {
@@ -125,33 +141,26 @@ static void dump_wal_entry(const buffer_t *buf, int entry_num, bool verbose) {
             void *key = NULL, *val = NULL;
             size_t klen = 0, vlen = 0;
             
-            // Create a mutable copy for parsing
-            buffer_t *temp_buf = alloc_buffer();
-            if (temp_buf) {
-                memcpy(temp_buf, buf, sizeof(buffer_t));
+            if (buffer_read_put(buf, &key, &klen, &val, &vlen) == 0) {
+                printf("Operation: PUT\n");
+                printf("Key (%zu bytes): ", klen);
+                print_safe_string(key, klen);
+                printf("\n");
+                printf("Value (%zu bytes): ", vlen);
+                print_safe_string(val, vlen);
+                printf("\n");
                 
-                if (buffer_read_put(temp_buf, &key, &klen, &val, &vlen) == 0) {
-                    printf("Operation: PUT\n");
-                    printf("Key (%zu bytes): ", klen);
-                    print_safe_string(key, klen);
-                    printf("\n");
-                    printf("Value (%zu bytes): ", vlen);
-                    print_safe_string(val, vlen);
-                    printf("\n");
-                    
-                    if (verbose) {
-                        printf("Key hex dump:\n");
-                        print_hex_dump(key, klen, "  ");
-                        printf("Value hex dump:\n");
-                        print_hex_dump(val, vlen, "  ");
-                    }
-                    
-                    if (key) free(key);
-                    if (val) free(val);
-                } else {
-                    printf("Failed to parse PUT message\n");
+                if (verbose) {
+                    printf("Key hex dump:\n");
+                    print_hex_dump(key, klen, "  ");
+                    printf("Value hex dump:\n");
+                    print_hex_dump(val, vlen, "  ");
                 }
-                free(temp_buf);
+                
+                if (key) free(key);
+                if (val) free(val);
+            } else {
+                printf("Failed to parse PUT message\n");
             }
             break;
         }
@@ -160,26 +169,20 @@ static void dump_wal_entry(const buffer_t *buf, int entry_num, bool verbose) {
             void *key = NULL;
             size_t klen = 0;
             
-            buffer_t *temp_buf = alloc_buffer();
-            if (temp_buf) {
-                memcpy(temp_buf, buf, sizeof(buffer_t));
+            if (buffer_read_del(buf, &key, &klen) == 0) {
+                printf("Operation: DELETE\n");
+                printf("Key (%zu bytes): ", klen);
+                print_safe_string(key, klen);
+                printf("\n");
                 
-                if (buffer_read_del(temp_buf, &key, &klen) == 0) {
-                    printf("Operation: DELETE\n");
-                    printf("Key (%zu bytes): ", klen);
-                    print_safe_string(key, klen);
-                    printf("\n");
-                    
-                    if (verbose) {
-                        printf("Key hex dump:\n");
-                        print_hex_dump(key, klen, "  ");
-                    }
-                    
-                    if (key) free(key);
-                } else {
-                    printf("Failed to parse DELETE message\n");
+                if (verbose) {
+                    printf("Key hex dump:\n");
+                    print_hex_dump(key, klen, "  ");
                 }
-                free(temp_buf);
+                
+                if (key) free(key);
+            } else {
+                printf("Failed to parse DELETE message\n");
             }
             break;
         }
@@ -188,36 +191,52 @@ static void dump_wal_entry(const buffer_t *buf, int entry_num, bool verbose) {
             void *key = NULL;
             size_t klen = 0;
             
-            buffer_t *temp_buf = alloc_buffer();
-            if (temp_buf) {
-                memcpy(temp_buf, buf, sizeof(buffer_t));
+            if (buffer_read_get(buf, &key, &klen) == 0) {
+                printf("Operation: GET\n");
+                printf("Key (%zu bytes): ", klen);
+                print_safe_string(key, klen);
+                printf("\n");
                 
-                if (buffer_read_get(temp_buf, &key, &klen) == 0) {
-                    printf("Operation: GET\n");
-                    printf("Key (%zu bytes): ", klen);
-                    print_safe_string(key, klen);
-                    printf("\n");
-                    
-                    if (verbose) {
-                        printf("Key hex dump:\n");
-                        print_hex_dump(key, klen, "  ");
-                    }
-                    
-                    if (key) free(key);
-                } else {
-                    printf("Failed to parse GET message\n");
+                if (verbose) {
+                    printf("Key hex dump:\n");
+                    print_hex_dump(key, klen, "  ");
                 }
-                free(temp_buf);
+                
+                if (key) free(key);
+            } else {
+                printf("Failed to parse GET message\n");
             }
             break;
         }
         
+        case MSG_INSERT_BATCH: {
+            insert_batch_t batch;
+
+            if (buffer_read_insert_batch(buf, &batch) == 0) {
+                printf("Operation: INSERT_BATCH\n");
+                printf("Entries: %zu (%zu dimensions)\n", batch.count, batch.dims);
+
+                if (verbose) {
+                    for (size_t i = 0; i < batch.count; i++)
+                        printf("  [%zu] id=%llu tag=%llu\n", i,
+                               (unsigned long long)batch.ids[i],
+                               (unsigned long long)batch.tags[i]);
+                }
+
+                insert_batch_free(&batch);
+            } else {
+                printf("Failed to parse INSERT_BATCH message\n");
+            }
+            break;
+        }
+
         default:
             printf("Operation: %s (raw data only)\n", get_message_type_name(buf->hdr.type));
             break;
     }
     
-    if (verbose || (buf->hdr.type != MSG_PUT && buf->hdr.type != MSG_DEL && buf->hdr.type != MSG_GET)) {
+    if (verbose || (buf->hdr.type != MSG_PUT && buf->hdr.type != MSG_DEL && buf->hdr.type != MSG_GET &&
+                    buf->hdr.type != MSG_INSERT_BATCH)) {
         printf("Raw message data:\n");
         print_hex_dump(buf->data, buf->hdr.len, "  ");
     }
@@ -225,24 +244,346 @@ static void dump_wal_entry(const buffer_t *buf, int entry_num, bool verbose) {
     printf("\n");
 }
 
+/**
+ * @brief Print the first components of a vector.
+ */
+static void print_vector(const float *v, size_t dims) {
+    printf("[");
+    for (size_t i = 0; i < dims && i < 8; i++)
+        printf("%s%g", i ? ", " : "", v[i]);
+    printf("%s]", dims > 8 ? ", ..." : "");
+}
+
+/**
+ * @brief Dump a binary WAL record.
+ */
+static void dump_wal_record(const wal_record_t *rec, int entry_num, bool verbose) {
+    printf("=== Entry #%d ===\n", entry_num);
+    printf("Record Type: %d (%s, binary)\n", rec->op, wal_op_name(rec->op));
+    printf("Checksum: CRC-32C ok\n");
+
+    switch (rec->op) {
+        case WAL_OP_INSERT:
+            printf("Operation: INSERT\n");
+            printf("Id: %llu, Tag: %llu\n", (unsigned long long)rec->id, (unsigned long long)rec->tag);
+            printf("Vector (%zu dimensions): ", rec->dims);
+            print_vector(rec->vectors, rec->dims);
+            printf("\n");
+            if (verbose) {
+                printf("Vector hex dump:\n");
+                print_hex_dump(rec->vectors, rec->dims * sizeof(float), "  ");
+            }
+            break;
+
+        case WAL_OP_DELETE:
+            printf("Operation: DELETE\n");
+            printf("Id: %llu\n", (unsigned long long)rec->id);
+            break;
+
+        case WAL_OP_INSERT_BATCH:
+            printf("Operation: INSERT_BATCH\n");
+            printf("Entries: %zu (%zu dimensions)\n", rec->count, rec->dims);
+            if (verbose) {
+                for (size_t i = 0; i < rec->count; i++) {
+                    printf("  [%zu] id=%llu tag=%llu ", i,
+                           (unsigned long long)rec->ids[i], (unsigned long long)rec->tags[i]);
+                    print_vector(rec->vectors + i * rec->dims, rec->dims);
+                    printf("\n");
+                }
+            }
+            break;
+
+        case WAL_OP_INSERT_FILE: {
+            char path[PATH_MAX];
+
+            ingest_path(path, sizeof(path), rec->id);
+            printf("Operation: INSERT_FILE\n");
+            printf("Rows file: %s\n", path);
+            printf("Entries: %zu (%zu dimensions)\n", rec->count, rec->dims);
+            break;
+        }
+
+        case WAL_OP_PUT:
+        case WAL_OP_DEL:
+            printf("Operation: %s\n", rec->op == WAL_OP_PUT ? "PUT" : "DELETE");
+            printf("Key (%zu bytes): ", rec->klen);
+            print_safe_string(rec->key, rec->klen);
+            printf("\n");
+            if (rec->op == WAL_OP_PUT) {
+                printf("Value (%zu bytes): ", rec->vlen);
+                print_safe_string(rec->val, rec->vlen);
+                printf("\n");
+            }
+            if (verbose) {
+                printf("Key hex dump:\n");
+                print_hex_dump(rec->key, rec->klen, "  ");
+                if (rec->op == WAL_OP_PUT) {
+                    printf("Value hex dump:\n");
+                    print_hex_dump(rec->val, rec->vlen, "  ");
+                }
+            }
+            break;
+    }
+
+    printf("\n");
+}
+
+/**
+ * @brief WAL record decoded for compaction (index or table operation).
+ */
+typedef struct {
+    wal_record_t    rec;
+    proto_vector_t  vector;   /**< Decoded MSG_INSERT vector (older formats) */
+    insert_batch_t  batch;    /**< Decoded MSG_INSERT_BATCH */
+    ingest_rows_t   rows;     /**< Rows file of an INSERT_FILE record */
+    void           *key, *val; /**< Decoded MSG_PUT / MSG_DEL key, and value */
+} compact_op_t;
+
+/** @brief Compacted log being written */
+typedef struct {
+    wal_t    *wal;
+    uint64_t  records;        /**< Records appended */
+} compact_out_t;
+
+/**
+ * @brief Decodes a record, converting the messages of older formats and
+ *        the rows files of INSERT_FILE records into INSERT_BATCH records.
+ */
+static int compact_decode(const wal_record_t *rec, void *ptr) {
+    compact_op_t *op = (compact_op_t *)ptr;
+    buffer_t *msg = (buffer_t *)rec->msg;
+
+    memset(op, 0, sizeof(compact_op_t));
+    op->rec = *rec;
+    op->rec.owned = NULL;
+    if (rec->op == WAL_OP_INSERT_FILE) {
+        char path[PATH_MAX];
+
+        ingest_path(path, sizeof(path), rec->id);
+        if (ingest_map(path, rec->count, rec->dims, &op->rows) != 0) {
+            fprintf(stderr, "Error: Cannot map rows file '%s': %s\n", path, strerror(errno));
+            return -1;
+        }
+        op->rec.op = WAL_OP_INSERT_BATCH;
+        op->rec.ids = op->rows.ids;
+        op->rec.tags = op->rows.tags;
+        op->rec.vectors = op->rows.vectors;
+        return 0;
+    }
+    if (rec->op != WAL_OP_MESSAGE)
+        return (rec->op >= WAL_OP_INSERT && rec->op <= WAL_OP_DEL) ? 0 : 1;
+
+    switch (msg->hdr.type) {
+    case MSG_INSERT:
+        op->rec.op = WAL_OP_INSERT;
+        if (buffer_read_insert(msg, &op->rec.id, &op->rec.tag, &op->vector) != 0)
+            return -1;
+        op->rec.vectors = op->vector.data;
+        op->rec.dims = op->vector.dims;
+        return 0;
+    case MSG_INSERT_BATCH:
+        op->rec.op = WAL_OP_INSERT_BATCH;
+        if (buffer_read_insert_batch(msg, &op->batch) != 0)
+            return -1;
+        op->rec.count = op->batch.count;
+        op->rec.dims = op->batch.dims;
+        op->rec.ids = op->batch.ids;
+        op->rec.tags = op->batch.tags;
+        op->rec.vectors = op->batch.vectors.data;
+        return 0;
+    case MSG_DELETE:
+        op->rec.op = WAL_OP_DELETE;
+        return buffer_read_delete(msg, &op->rec.id);
+    case MSG_PUT:
+        op->rec.op = WAL_OP_PUT;
+        if (buffer_read_put(msg, &op->key, &op->rec.klen, &op->val, &op->rec.vlen) != 0)
+            return -1;
+        break;
+    case MSG_DEL:
+        op->rec.op = WAL_OP_DEL;
+        if (buffer_read_del(msg, &op->key, &op->rec.klen) != 0)
+            return -1;
+        break;
+    default:
+        return 1;
+    }
+    op->rec.key = op->key;
+    op->rec.val = op->val;
+    return 0;
+}
+
+static size_t compact_entries(const void *ptr) {
+    const wal_record_t *rec = &((const compact_op_t *)ptr)->rec;
+
+    return rec->op == WAL_OP_INSERT_BATCH ? rec->count : 1;
+}
+
+static int compact_entry(const void *ptr, size_t i, const void **key, size_t *klen) {
+    const wal_record_t *rec = &((const compact_op_t *)ptr)->rec;
+
+    switch (rec->op) {
+    case WAL_OP_PUT:
+    case WAL_OP_DEL:
+        *key = rec->key;
+        *klen = rec->klen;
+        return rec->op == WAL_OP_DEL;
+    case WAL_OP_INSERT_BATCH:
+        *key = &rec->ids[i];
+        *klen = sizeof(uint64_t);
+        return 0;
+    default:
+        *key = &rec->id;
+        *klen = sizeof(uint64_t);
+        return rec->op == WAL_OP_DELETE;
+    }
+}
+
+static int compact_append(compact_out_t *out, const wal_record_t *rec) {
+    if (wal_append(out->wal, rec) != 0)
+        return -1;
+    if (++out->records % COMPACT_COMMIT_RECORDS == 0 && wal_commit(out->wal, 1) != 0)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Writes the surviving entry to the compacted log.
+ *
+ * REPLAY_PURGE becomes a delete record before the entry, so that replaying
+ * the compacted log leaves the id or key in the same state as the original.
+ * A REPLAY_TOLERANT delete removes an id or key created after the
+ * checkpoint: it does not exist when the compacted log is replayed, so
+ * nothing is written.
+ */
+static int compact_apply(void *ctx, void *ptr, size_t i, int flags) {
+    compact_out_t *out = (compact_out_t *)ctx;
+    const wal_record_t *rec = &((compact_op_t *)ptr)->rec;
+    wal_record_t entry = *rec;
+
+    if (flags & REPLAY_TOLERANT)
+        return 0;
+    if (rec->op == WAL_OP_INSERT_BATCH) {
+        entry.op = WAL_OP_INSERT;
+        entry.id = rec->ids[i];
+        entry.tag = rec->tags[i];
+        entry.vectors = rec->vectors + i * rec->dims;
+    }
+    if (flags & REPLAY_PURGE) {
+        wal_record_t del = entry;
+
+        del.op = entry.op == WAL_OP_PUT ? WAL_OP_DEL : WAL_OP_DELETE;
+        if (compact_append(out, &del) != 0)
+            return -1;
+    }
+    return compact_append(out, &entry);
+}
+
+static void compact_release(void *ptr) {
+    compact_op_t *op = (compact_op_t *)ptr;
+
+    proto_vector_free(&op->vector);
+    insert_batch_free(&op->batch);
+    ingest_unmap(&op->rows);
+    free(op->key);
+    free(op->val);
+}
+
+/**
+ * @brief Writes a compacted copy of a log.
+ *
+ * The copy starts at @p lsn, so it can replace the segments of the log
+ * while the server is stopped.
+ *
+ * @return 0 on success, 1 on failure.
+ */
+static int compact_wal(const char *wal_file, uint64_t lsn, const char *output) {
+    compact_out_t out = { 0 };
+    replay_handler_t handler = {
+        .core    = &out,
+        .op_size = sizeof(compact_op_t),
+        .decode  = compact_decode,
+        .entries = compact_entries,
+        .entry   = compact_entry,
+        .apply   = compact_apply,
+        .release = compact_release
+    };
+    replay_stats_t stats;
+    wal_reader_t *wal, *existing;
+    wal_record_t probe = { 0 };
+    buffer_t *buf;
+    int ret = 1, busy;
+
+    // Never append to a log that already has records
+    if ((buf = alloc_buffer()) == NULL) {
+        fprintf(stderr, "Error: Failed to allocate buffer\n");
+        return 1;
+    }
+    existing = wal_reader_open(output, 1);
+    busy = existing && wal_reader_next(existing, &probe, buf) != 0;
+    wal_record_free(&probe);
+    wal_reader_close(existing);
+    free_buffer(buf);
+    if (busy) {
+        fprintf(stderr, "Error: Output log '%s' already has records\n", output);
+        return 1;
+    }
+
+    if ((wal = wal_reader_open(wal_file, lsn)) == NULL) {
+        fprintf(stderr, "Error: Failed to open WAL file '%s': %s\n", wal_file, strerror(errno));
+        return 1;
+    }
+    out.wal = wal_open(output, lsn, WAL_SYNC_FSYNC, 0);
+    if (!out.wal) {
+        fprintf(stderr, "Error: Failed to create '%s': %s\n", output, strerror(errno));
+        goto cleanup;
+    }
+
+    if (replay_wal(wal, &handler, 1, &stats) != 0) {
+        fprintf(stderr, "Error: Failed to read WAL file '%s': %s\n", wal_file,
+                errno ? strerror(errno) : "invalid record or checksum mismatch");
+        goto cleanup;
+    }
+    if (wal_commit(out.wal, 1) != 0 || stats.failed > 0) {
+        fprintf(stderr, "Error: Failed to write '%s' (%" PRIu64 " failed entries)\n",
+                output, stats.failed);
+        goto cleanup;
+    }
+
+    printf("Compacted %s from LSN %" PRIu64 " into %s\n", wal_file, lsn, output);
+    printf("Records: %" PRIu64 " -> %" PRIu64 "\n", stats.records, out.records);
+    printf("Operations: %" PRIu64 " -> %" PRIu64 " (%" PRIu64 " superseded, %" PRIu64 " skipped records)\n",
+           stats.entries, stats.applied, stats.dropped, stats.skipped);
+    ret = 0;
+
+cleanup:
+    if (out.wal)
+        wal_close(out.wal);
+    wal_reader_close(wal);
+    return ret;
+}
+
 /**
  * @brief Print usage information.
  */
 static void print_usage(const char *prog_name) {
     printf("Usage: %s [OPTIONS] [WAL_FILE]\n", prog_name);
     printf("\nVictorDB WAL Dump Utility\n");
-    printf("Reads and displays the contents of VictorDB Write-Ahead Log files.\n\n");
+    printf("Reads and displays the contents of VictorDB Write-Ahead Log files.\n");
+    printf("WAL_FILE is a segment file, or a log prefix to dump all its segments.\n\n");
     printf("OPTIONS:\n");
     printf("  -v, --verbose     Show detailed hex dumps of all data\n");
     printf("  -t, --table       Dump table WAL file (db.twal) - default if no file specified\n");
     printf("  -i, --index       Dump index WAL file (db.iwal)\n");
     printf("  -c, --count       Only show entry count, don't dump contents\n");
+    printf("  -C, --compact OUT Write the last operation on each id or key to log OUT\n");
+    printf("                    (from the checkpoint when no WAL_FILE is given)\n");
     printf("  -h, --help        Show this help message\n\n");
     printf("EXAMPLES:\n");
     printf("  %s                    # Dump table WAL (db.twal) from current directory\n", prog_name);
-    printf("  %s -v db.twal         # Verbose dump of specific WAL file\n", prog_name);
+    printf("  %s -v db.twal.0000000000000001  # Verbose dump of one segment\n", prog_name);
     printf("  %s -i                 # Dump index WAL (db.iwal)\n", prog_name);
     printf("  %s -c                 # Just count entries in table WAL\n", prog_name);
+    printf("  %s -i -C db.iwal.new  # Compact index WAL into db.iwal.new.<LSN>\n", prog_name);
     printf("\n");
 }
 
@@ -252,17 +593,22 @@ int main(int argc, char *argv[]) {
     bool count_only = false;
     bool use_index_wal = false;
     char *wal_file = NULL;
+    char *compact_file = NULL;
     
     struct option long_options[] = {
         {"verbose", no_argument, 0, 'v'},
         {"table", no_argument, 0, 't'},
         {"index", no_argument, 0, 'i'},
         {"count", no_argument, 0, 'c'},
+        {"compact", required_argument, 0, 'C'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
+
+    // The WAL reader reports invalid records through the log
+    set_logfile(stderr);
     
-    while ((opt = getopt_long(argc, argv, "vtich", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "vticC:h", long_options, NULL)) != -1) {
         switch (opt) {
             case 'v':
                 verbose = true;
@@ -276,6 +622,9 @@ int main(int argc, char *argv[]) {
             case 'c':
                 count_only = true;
                 break;
+            case 'C':
+                compact_file = optarg;
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -292,8 +641,20 @@ int main(int argc, char *argv[]) {
         wal_file = use_index_wal ? IWAL_FILE : TWAL_FILE;
     }
     
-    // Open WAL file
-    FILE *wal = fopen(wal_file, "rb");
+    if (compact_file) {
+        uint64_t lsn = 1;
+
+        // The server log only needs compacting from the checkpoint
+        if (optind >= argc &&
+            wal_checkpoint_read(use_index_wal ? ICKPT_FILE : TCKPT_FILE, &lsn) != 0) {
+            fprintf(stderr, "Error: Failed to read checkpoint: %s\n", strerror(errno));
+            return 1;
+        }
+        return compact_wal(wal_file, lsn, compact_file);
+    }
+
+    // Open WAL file (a single segment, or every segment of a prefix)
+    wal_reader_t *wal = wal_reader_open(wal_file, 1);
     if (!wal) {
         fprintf(stderr, "Error: Failed to open WAL file '%s': %s\n", wal_file, strerror(errno));
         return 1;
@@ -306,24 +667,36 @@ int main(int argc, char *argv[]) {
     buffer_t *buf = alloc_buffer();
     if (!buf) {
         fprintf(stderr, "Error: Failed to allocate buffer\n");
-        fclose(wal);
+        wal_reader_close(wal);
         return 1;
     }
     
     int entry_count = 0;
     int ret;
     
-    while ((ret = buffer_load_wal(buf, wal)) == 1) {
+    wal_record_t rec;
+    while ((ret = wal_reader_next(wal, &rec, buf)) == 1) {
         entry_count++;
         
         if (!count_only) {
-            dump_wal_entry(buf, entry_count, verbose);
+            if (rec.op == WAL_OP_MESSAGE)
+                dump_wal_entry(buf, entry_count, wal_reader_verified(wal), verbose);
+            else
+                dump_wal_record(&rec, entry_count, verbose);
         }
+        wal_record_free(&rec);
     }
     
     if (ret == -1) {
         fprintf(stderr, "Warning: Error reading WAL file at entry %d: %s\n", 
-                entry_count + 1, strerror(errno));
+                entry_count + 1, errno ? strerror(errno) : "invalid record or checksum mismatch");
+    }
+
+    const char *torn_path;
+    uint64_t torn_off, torn_len;
+    if (wal_reader_torn(wal, &torn_path, &torn_off, &torn_len)) {
+        printf("Torn tail: %s at offset %" PRIu64 " (%" PRIu64 " bytes, "
+               "dropped by the server at startup)\n", torn_path, torn_off, torn_len);
     }
     
     printf("=====================================\n");
@@ -333,8 +706,8 @@ int main(int argc, char *argv[]) {
         printf("WAL file is empty or contains no valid entries.\n");
     }
     
-    free(buf);
-    fclose(wal);
+    free_buffer(buf);
+    wal_reader_close(wal);
     
     return 0;
 }
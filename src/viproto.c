@@ -11,6 +11,7 @@
 #include <cbor.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include "panic.h"
 
 
@@ -20,12 +21,12 @@
  * Encodes a CBOR array of the form:
  *     [uint64_t id, [float32]]
  *
- * This function builds a CBOR array with two elements:
+ * The message is encoded straight into the provided buffer with the
+ * `cbor_encode_*` primitives (no intermediate item tree):
  *   - The first element is an unsigned 64-bit integer representing the ID.
  *   - The second element is an array of float32 values representing the vector.
  *
- * The resulting CBOR-encoded message is written into the provided buffer
- * and the buffer header is populated accordingly (type = MSG_INSERT).
+ * The buffer header is populated accordingly (type = MSG_INSERT).
  *
  * @param buf Output buffer where the CBOR message will be written.
  * @param id  Unique identifier to include in the message.
@@ -34,86 +35,26 @@
  * @return 0 on success, -1 on error or if the message exceeds buffer size.
  */
 int buffer_write_insert(buffer_t *buf, uint64_t id, uint64_t tag, const float *vec, size_t dims) {
-    cbor_item_t *root = NULL;
-    cbor_item_t *vec_arr = NULL; 
-    cbor_item_t *id_item = NULL;
-    cbor_item_t *tag_item = NULL;
-    size_t written;
+    uint8_t *p, *end;
 
     PANIC_IF(!buf, "buffer cannot be null");
     PANIC_IF(!buf->data, "buffer data cannot be null");
     PANIC_IF(!vec && dims > 0, "vector cannot be null with non-zero dimensions");
 
-    root = cbor_new_definite_array(3);
-    if (!root) return -1;
-
-    vec_arr = cbor_new_definite_array(dims);
-    if (!vec_arr) {
-        cbor_decref(&root);
-        return -1;
-    }
-
-    id_item = cbor_build_uint64(id);
-    if (!id_item) {
-        cbor_decref(&vec_arr);
-        cbor_decref(&root);
-        return -1;
-    }
-    if (!cbor_array_push(root, id_item)) {
-        cbor_decref(&id_item);
-        cbor_decref(&vec_arr);
-        cbor_decref(&root);
-        return -1;
-    }
-    cbor_decref(&id_item);
-
-    tag_item = cbor_build_uint64(tag);
-    if (!tag_item) {
-        cbor_decref(&vec_arr);
-        cbor_decref(&root);
-        return -1;
-    }
-    if (!cbor_array_push(root, tag_item)) {
-        cbor_decref(&tag_item);
-        cbor_decref(&vec_arr);
-        cbor_decref(&root);
-        return -1;
-    }
-    cbor_decref(&tag_item);
-
-    for (size_t i = 0; i < dims; i++) {
-        cbor_item_t *f = cbor_build_float4(vec[i]);
-        if (!f) {
-            cbor_decref(&vec_arr);
-            cbor_decref(&root);
-            return -1;
-        }
-        if (!cbor_array_push(vec_arr, f)) {
-            cbor_decref(&f);
-            cbor_decref(&vec_arr);
-            cbor_decref(&root);
-            return -1;
-        }
-        cbor_decref(&f);
-    }
-    if (!cbor_array_push(root, vec_arr)) {
-        cbor_decref(&vec_arr);
-        cbor_decref(&root);
-        return -1;
-    }
-    cbor_decref(&vec_arr);
-
-    written = cbor_serialize(root, buf->data, MSG_MAXLEN);
-    if (written == 0 || written > MSG_MAXLEN) {
-        cbor_decref(&root);
+    if (dims > (MSG_MAXLEN - 4 * CBOR_HEAD_MAX) / CBOR_FLOAT4_LEN) return -1;
+    if (buffer_encode_begin(buf, 4 * CBOR_HEAD_MAX + dims * CBOR_FLOAT4_LEN) != 0)
         return -1;
-    }
 
-    buf->hdr.len = (int)written;
-    buf->hdr.type = MSG_INSERT;
+    p   = buf->data;
+    end = buf->data + buf->cap;
+    p += cbor_encode_array_start(3, p, end - p);
+    p += cbor_encode_uint64(id, p, end - p);
+    p += cbor_encode_uint64(tag, p, end - p);
+    p += cbor_encode_array_start(dims, p, end - p);
+    for (size_t i = 0; i < dims; i++)
+        p += cbor_encode_single(vec[i], p, end - p);
 
-    cbor_decref(&root);
-    return 0;
+    return buffer_encode_end(buf, MSG_INSERT, p - buf->data);
 }
 
 
@@ -123,100 +64,42 @@ int buffer_write_insert(buffer_t *buf, uint64_t id, uint64_t tag, const float *v
  * Expects a CBOR array of the form:
  *     [uint64_t id, [float32]]
  *
- * The function parses the CBOR message and extracts:
+ * The message is validated and decoded in a single pass (see proto_cursor_t):
  *   - A 64-bit unsigned integer as the ID.
- *   - A float vector from the second element.
+ *   - A float vector from the second element, either a float32 little
+ *     endian typed array (returned in place, without copying) or an array
+ *     of floats (copied).
  *
- * Memory for the vector is dynamically allocated and must be freed by the caller.
+ * The vector must be released with proto_vector_free() and, when borrowed,
+ * is only valid as long as @p buf is unchanged.
  *
  * @param buf Input buffer containing the CBOR message.
  * @param id Output pointer to the decoded 64-bit ID.
- * @param vec Output pointer to the float vector (allocated).
- * @param dims Output number of elements in the vector.
+ * @param vec Output vector.
  * @return 0 on success, -1 on malformed input or memory allocation failure.
  */
-int buffer_read_insert(const buffer_t *buf, uint64_t *id, uint64_t *tag, float **vec, size_t *dims) {
-    struct cbor_load_result result;
-    cbor_item_t *root = NULL;
-    cbor_item_t *id_item  = NULL;
-    cbor_item_t *tag_item = NULL;
-    cbor_item_t *vec_arr  = NULL;
+int buffer_read_insert(const buffer_t *buf, uint64_t *id, uint64_t *tag, proto_vector_t *vec) {
+    proto_cursor_t cur;
+    size_t len;
 
     PANIC_IF(!buf, "buffer cannot be null");
     PANIC_IF(!buf->data, "buffer data cannot be null");
     PANIC_IF(!id, "id output parameter cannot be null");
     PANIC_IF(!tag, "tag output parameter cannon be null");
     PANIC_IF(!vec, "vec output parameter cannot be null");
-    PANIC_IF(!dims, "dims output parameter cannot be null");
     if (buf->hdr.len == 0 || buf->hdr.len > MSG_MAXLEN) return -1;
 
-    root = cbor_load(buf->data, buf->hdr.len, &result);
-    if (!root || !cbor_isa_array(root) || cbor_array_size(root) != 3) {
-        if (root) cbor_decref(&root);
-        return -1;
-    }
-
-    // Extract ID
-    id_item = cbor_array_handle(root)[0];
-    if (!id_item || !cbor_isa_uint(id_item) || cbor_int_get_width(id_item) > CBOR_INT_64) {
-        cbor_decref(&root);
-        return -1;
-    }
-    *id = cbor_get_uint64(id_item);
-
-    // Extract Tag
-    tag_item = cbor_array_handle(root)[1];
-    if (!tag_item || !cbor_isa_uint(tag_item) || cbor_int_get_width(tag_item) > CBOR_INT_64) {
-        cbor_decref(&root);
+    cursor_init(&cur, buf);
+    if (cursor_array(&cur, &len) != 0 || len != 3 ||
+        cursor_uint(&cur, id) != 0 ||
+        cursor_uint(&cur, tag) != 0 ||
+        cursor_vector(&cur, vec) != 0)
         return -1;
-    }
-    *tag = cbor_get_uint64(tag_item);
 
-    // Extract vector
-    vec_arr = cbor_array_handle(root)[2];
-    if (!vec_arr || !cbor_isa_array(vec_arr)) {
-        cbor_decref(&root);
-        return -1;
-    }
-
-    *dims = cbor_array_size(vec_arr);
-    if (*dims == 0) {
-        *vec = NULL;
-        cbor_decref(&root);
-        return 0;
-    }
-
-    *vec = malloc(sizeof(float) * (*dims));
-    if (!*vec) {
-        cbor_decref(&root);
+    if (!cursor_done(&cur)) {
+        proto_vector_free(vec);
         return -1;
     }
-
-    for (size_t i = 0; i < *dims; i++) {
-        cbor_item_t *f = cbor_array_handle(vec_arr)[i];
-        if (!f || !cbor_isa_float_ctrl(f)) {
-            free(*vec);
-            *vec = NULL;
-            cbor_decref(&root);
-            return -1;
-        }
-
-        switch (cbor_float_get_width(f)) {
-            case CBOR_FLOAT_32:
-                (*vec)[i] = cbor_float_get_float4(f);
-                break;
-            case CBOR_FLOAT_64:
-                (*vec)[i] = (float)cbor_float_get_float8(f);
-                break;
-            default:
-                free(*vec);
-                *vec = NULL;
-                cbor_decref(&root);
-                return -1;
-        }
-    }
-
-    cbor_decref(&root);
     return 0;
 }
 
@@ -226,6 +109,8 @@ int buffer_read_insert(const buffer_t *buf, uint64_t *id, uint64_t *tag, float *
  * Encodes a CBOR array of the form:
  *     [[float32], int]
  *
+ * The message is encoded straight into the buffer, without an item tree.
+ *
  * @param buf Output buffer where the CBOR message will be written.
  * @param vec Pointer to the float vector to search.
  * @param dims Number of elements in the vector.
@@ -233,86 +118,26 @@ int buffer_read_insert(const buffer_t *buf, uint64_t *id, uint64_t *tag, float *
  * @return 0 on success, -1 on error or insufficient buffer space.
  */
 int buffer_write_search(buffer_t *buf, uint64_t tag, const float *vec, size_t dims, int n) {
-    cbor_item_t *root = NULL;
-    cbor_item_t *vec_arr = NULL;
-    cbor_item_t *n_item = NULL;
-    cbor_item_t *tag_item = NULL;
-    size_t written;
+    uint8_t *p, *end;
 
     PANIC_IF(!buf, "buffer cannot be null");
     PANIC_IF(!buf->data, "buffer data cannot be null");
     PANIC_IF(!vec && dims > 0, "vector cannot be null with non-zero dimensions");
 
-    root = cbor_new_definite_array(3);
-    if (!root) return -1;
-
-    vec_arr = cbor_new_definite_array(dims);
-    if (!vec_arr) {
-        cbor_decref(&root);
-        return -1;
-    }
-
-    tag_item = cbor_build_uint64(tag);
-    if (!tag_item) {
-        cbor_decref(&vec_arr);
-        cbor_decref(&root);
-        return -1;
-    }
-    if (!cbor_array_push(root, tag_item)) {
-        cbor_decref(&tag_item);
-        cbor_decref(&vec_arr);
-        cbor_decref(&root);
-        return -1;
-    }
-    cbor_decref(&tag_item);
-
-
-
-    for (size_t i = 0; i < dims; i++) {
-        cbor_item_t *f = cbor_build_float4(vec[i]);
-        if (!f) {
-            cbor_decref(&vec_arr);
-            cbor_decref(&root);
-            return -1;
-        }
-        if (!cbor_array_push(vec_arr, f)) {
-            cbor_decref(&f);
-            cbor_decref(&vec_arr);
-            cbor_decref(&root);
-            return -1;
-        }
-        cbor_decref(&f);
-    }
-    if (!cbor_array_push(root, vec_arr)) {
-        cbor_decref(&vec_arr);
-        cbor_decref(&root);
-        return -1;
-    }
-    cbor_decref(&vec_arr);
-
-    n_item = cbor_build_uint32((uint32_t)n);
-    if (!n_item) {
-        cbor_decref(&root);
-        return -1;
-    }
-    if (!cbor_array_push(root, n_item)) {
-        cbor_decref(&n_item);
-        cbor_decref(&root);
-        return -1;
-    }
-    cbor_decref(&n_item);
-
-    written = cbor_serialize(root, buf->data, MSG_MAXLEN);
-    if (written == 0 || written > MSG_MAXLEN) {
-        cbor_decref(&root);
+    if (dims > (MSG_MAXLEN - 4 * CBOR_HEAD_MAX) / CBOR_FLOAT4_LEN) return -1;
+    if (buffer_encode_begin(buf, 4 * CBOR_HEAD_MAX + dims * CBOR_FLOAT4_LEN) != 0)
         return -1;
-    }
 
-    buf->hdr.len = (int)written;
-    buf->hdr.type = MSG_SEARCH;
+    p   = buf->data;
+    end = buf->data + buf->cap;
+    p += cbor_encode_array_start(3, p, end - p);
+    p += cbor_encode_uint64(tag, p, end - p);
+    p += cbor_encode_array_start(dims, p, end - p);
+    for (size_t i = 0; i < dims; i++)
+        p += cbor_encode_single(vec[i], p, end - p);
+    p += cbor_encode_uint32((uint32_t)n, p, end - p);
 
-    cbor_decref(&root);
-    return 0;
+    return buffer_encode_end(buf, MSG_SEARCH, p - buf->data);
 }
 
 /**
@@ -321,118 +146,37 @@ int buffer_write_search(buffer_t *buf, uint64_t tag, const float *vec, size_t di
  * Expects a CBOR array of the form:
  *     [[float32], int]
  *
- * The function allocates memory for the vector, which must be freed by the caller.
+ * The vector is decoded as in buffer_read_insert() and must be released
+ * with proto_vector_free().
  *
  * @param buf Input buffer containing the CBOR message.
- * @param vec Output pointer to the float vector (allocated).
- * @param dims Output number of elements in the vector.
+ * @param vec Output vector.
  * @param n Output number of results requested.
  * @return 0 on success, -1 on malformed input or memory allocation failure.
  */
-int buffer_read_search(const buffer_t *buf, uint64_t *tag, float **vec, size_t *dims, int *n) {
-    struct cbor_load_result result;
-    cbor_item_t *root = NULL;
-    cbor_item_t *vec_arr = NULL;
-    cbor_item_t *n_item = NULL;
-    cbor_item_t *tag_item = NULL;
+int buffer_read_search(const buffer_t *buf, uint64_t *tag, proto_vector_t *vec, int *n) {
+    proto_cursor_t cur;
+    uint64_t count;
+    size_t len;
 
     PANIC_IF(!buf, "buffer cannot be null");
     PANIC_IF(!buf->data, "buffer data cannot be null");
     PANIC_IF(!tag, "tag output parameter cannot be null");
     PANIC_IF(!vec, "vec output parameter cannot be null");
-    PANIC_IF(!dims, "dims output parameter cannot be null");
     PANIC_IF(!n, "n output parameter cannot be null");
     if (buf->hdr.len == 0 || buf->hdr.len > MSG_MAXLEN) return -1;
 
-    root = cbor_load(buf->data, buf->hdr.len, &result);
-    if (!root || !cbor_isa_array(root) || cbor_array_size(root) != 3) {
-        if (root) cbor_decref(&root);
-        return -1;
-    }
-
-
-    // Extract Tag
-    tag_item = cbor_array_handle(root)[0];
-    if (!tag_item || !cbor_isa_uint(tag_item) || cbor_int_get_width(tag_item) > CBOR_INT_64) {
-        cbor_decref(&root);
+    cursor_init(&cur, buf);
+    if (cursor_array(&cur, &len) != 0 || len != 3 ||
+        cursor_uint(&cur, tag) != 0 ||
+        cursor_vector(&cur, vec) != 0)
         return -1;
-    }
-    *tag = cbor_get_uint64(tag_item);
 
-    vec_arr = cbor_array_handle(root)[1];
-    if (!vec_arr || !cbor_isa_array(vec_arr)) {
-        cbor_decref(&root);
+    if (cursor_uint(&cur, &count) != 0 || count > INT_MAX || !cursor_done(&cur)) {
+        proto_vector_free(vec);
         return -1;
     }
-
-    *dims = cbor_array_size(vec_arr);
-    if (*dims == 0) {
-        *vec = NULL;
-    } else {
-        *vec = malloc(sizeof(float) * (*dims));
-        if (!*vec) {
-            cbor_decref(&root);
-            return -1;
-        }
-
-        for (size_t i = 0; i < *dims; i++) {
-            cbor_item_t *f = cbor_array_handle(vec_arr)[i];
-            if (!f || !cbor_isa_float_ctrl(f)) {
-                free(*vec);
-                *vec = NULL;
-                cbor_decref(&root);
-                return -1;
-            }
-            switch (cbor_float_get_width(f)) {
-                case CBOR_FLOAT_32:
-                    (*vec)[i] = cbor_float_get_float4(f);
-                    break;
-                case CBOR_FLOAT_64:
-                    (*vec)[i] = (float)cbor_float_get_float8(f);
-                    break;
-                default:
-                    free(*vec);
-                    *vec = NULL;
-                    cbor_decref(&root);
-                    return -1;
-            }
-        }
-    }
-
-    n_item = cbor_array_handle(root)[2];
-    if (!n_item || !cbor_isa_uint(n_item)) {
-        if (*vec) {
-            free(*vec);
-            *vec = NULL;
-        }
-        cbor_decref(&root);
-        return -1;
-    }
-    
-    // Handle different integer sizes from CBOR encoding
-    switch (cbor_int_get_width(n_item)) {
-        case CBOR_INT_8:
-            *n = (int)cbor_get_uint8(n_item);
-            break;
-        case CBOR_INT_16:
-            *n = (int)cbor_get_uint16(n_item);
-            break;
-        case CBOR_INT_32:
-            *n = (int)cbor_get_uint32(n_item);
-            break;
-        case CBOR_INT_64:
-            *n = (int)cbor_get_uint64(n_item);
-            break;
-        default:
-            if (*vec) {
-                free(*vec);
-                *vec = NULL;
-            }
-            cbor_decref(&root);
-            return -1;
-    }
-
-    cbor_decref(&root);
+    *n = (int)count;
     return 0;
 }
 
@@ -442,6 +186,8 @@ int buffer_read_search(const buffer_t *buf, uint64_t *tag, float **vec, size_t *
  * Encodes a CBOR array of the form:
  *     [[id:uint64, distance:float], ...]
  *
+ * The message is encoded straight into the buffer, without an item tree.
+ *
  * @param buf Output buffer where the CBOR message will be written.
  * @param ids Array of result identifiers.
  * @param distances Array of distances to the search vector.
@@ -454,71 +200,29 @@ int buffer_write_match_result(
     const float    *distances,
     size_t n
 ) {
-    cbor_item_t *root = NULL;
-    size_t written;
+    /* Each entry is [id:uint64, distance:float32] */
+    const size_t entry_max = 1 + CBOR_HEAD_MAX + CBOR_FLOAT4_LEN;
+    uint8_t *p, *end;
 
     PANIC_IF(!buf, "buffer cannot be null");
     PANIC_IF(!buf->data, "buffer data cannot be null");
     PANIC_IF(!ids, "ids array cannot be null");
     PANIC_IF(!distances, "distances array cannot be null");
 
-    root = cbor_new_definite_array(n);
-    if (!root) return -1;
+    if (n > (MSG_MAXLEN - CBOR_HEAD_MAX) / entry_max) return -1;
+    if (buffer_encode_begin(buf, CBOR_HEAD_MAX + n * entry_max) != 0)
+        return -1;
 
+    p   = buf->data;
+    end = buf->data + buf->cap;
+    p += cbor_encode_array_start(n, p, end - p);
     for (size_t i = 0; i < n; i++) {
-        cbor_item_t *pair = cbor_new_definite_array(2);
-        if (!pair) {
-            cbor_decref(&root);
-            return -1;
-        }
-
-        cbor_item_t *id_item = cbor_build_uint64(ids[i]);
-        if (!id_item) {
-            cbor_decref(&pair);
-            cbor_decref(&root);
-            return -1;
-        }
-        if (!cbor_array_push(pair, id_item)) {
-            cbor_decref(&id_item);
-            cbor_decref(&pair);
-            cbor_decref(&root);
-            return -1;
-        }
-        cbor_decref(&id_item);
-
-        cbor_item_t *distance_item = cbor_build_float4(distances[i]);
-        if (!distance_item) {
-            cbor_decref(&pair);
-            cbor_decref(&root);
-            return -1;
-        }
-        if (!cbor_array_push(pair, distance_item)) {
-            cbor_decref(&distance_item);
-            cbor_decref(&pair);
-            cbor_decref(&root);
-            return -1;
-        }
-        cbor_decref(&distance_item);
-
-        if (!cbor_array_push(root, pair)) {
-            cbor_decref(&pair);
-            cbor_decref(&root);
-            return -1;
-        }
-        cbor_decref(&pair);
-    }
-
-    written = cbor_serialize(root, buf->data, MSG_MAXLEN);
-    if (written == 0 || written > MSG_MAXLEN) {
-        cbor_decref(&root);
-        return -1;
+        p += cbor_encode_array_start(2, p, end - p);
+        p += cbor_encode_uint64(ids[i], p, end - p);
+        p += cbor_encode_single(distances[i], p, end - p);
     }
 
-    buf->hdr.len = (int)written;
-    buf->hdr.type = MSG_MATCH_RESULT;
-
-    cbor_decref(&root);
-    return 0;
+    return buffer_encode_end(buf, MSG_MATCH_RESULT, p - buf->data);
 }
 
 /**
@@ -601,7 +305,6 @@ int buffer_read_match_result(
 int buffer_write_delete(buffer_t *buf, uint64_t id) {
     cbor_item_t *root = NULL;
     cbor_item_t *id_item = NULL;
-    size_t written;
 
     PANIC_IF(!buf, "buffer cannot be null");
     PANIC_IF(!buf->data, "buffer data cannot be null");
@@ -621,15 +324,11 @@ int buffer_write_delete(buffer_t *buf, uint64_t id) {
     }
     cbor_decref(&id_item);
 
-    written = cbor_serialize(root, buf->data, MSG_MAXLEN);
-    if (written == 0 || written > MSG_MAXLEN) {
+    if (buffer_write_cbor(buf, MSG_DELETE, root) != 0) {
         cbor_decref(&root);
         return -1;
     }
 
-    buf->hdr.len = (int)written;
-    buf->hdr.type = MSG_DELETE;
-
     cbor_decref(&root);
     return 0;
 }
@@ -669,3 +368,425 @@ int buffer_read_delete(const buffer_t *buf, uint64_t *id) {
     cbor_decref(&root);
     return 0;
 }
+
+/**
+ * @brief Emits a float32 little endian typed array (RFC 8746, tag 85).
+ *
+ * @return Pointer past the encoded item.
+ */
+static uint8_t *encode_typed_floats(uint8_t *p, uint8_t *end, const float *vec, size_t n) {
+    p += cbor_encode_tag(CBOR_TAG_FLOAT32_LE, p, end - p);
+    p += cbor_encode_bytestring_start(n * sizeof(float), p, end - p);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(p, vec, n * sizeof(float));
+    p += n * sizeof(float);
+#else
+    for (size_t i = 0; i < n; i++) {
+        uint32_t bits;
+        memcpy(&bits, &vec[i], sizeof(bits));
+        *p++ = (uint8_t)bits;
+        *p++ = (uint8_t)(bits >> 8);
+        *p++ = (uint8_t)(bits >> 16);
+        *p++ = (uint8_t)(bits >> 24);
+    }
+#endif
+    return p;
+}
+
+/**
+ * @brief Serializes an INSERT_BATCH request into a CBOR-encoded buffer.
+ *
+ * Encodes a CBOR array of the form:
+ *     [[id:uint64, ...], [tag:uint64, ...], dims:uint, vectors]
+ *
+ * The vectors travel as one float32 little endian typed array, so the
+ * server can apply them without decoding a CBOR item per component.
+ *
+ * @param buf Output buffer where the CBOR message will be written.
+ * @param ids Entry ids.
+ * @param tags Entry tags.
+ * @param vecs count * dims components, one row per entry.
+ * @param count Number of entries.
+ * @param dims Components of each vector.
+ * @return 0 on success, -1 on error or if the message exceeds MSG_MAXLEN.
+ */
+int buffer_write_insert_batch(
+    buffer_t *buf,
+    const uint64_t *ids,
+    const uint64_t *tags,
+    const float *vecs,
+    size_t count,
+    size_t dims
+) {
+    uint8_t *p, *end;
+    size_t max_len;
+
+    PANIC_IF(!buf, "buffer cannot be null");
+    PANIC_IF(!buf->data, "buffer data cannot be null");
+    PANIC_IF(count > 0 && (!ids || !tags), "ids and tags cannot be null");
+    PANIC_IF(count > 0 && dims > 0 && !vecs, "vectors cannot be null");
+
+    if (dims > 0 && count > MSG_MAXLEN / sizeof(float) / dims) return -1;
+    if (count > MSG_MAXLEN / (2 * CBOR_HEAD_MAX)) return -1;
+    max_len = 6 * CBOR_HEAD_MAX + 2 * count * CBOR_HEAD_MAX + count * dims * sizeof(float);
+    if (buffer_encode_begin(buf, max_len) != 0)
+        return -1;
+
+    p   = buf->data;
+    end = buf->data + buf->cap;
+    p += cbor_encode_array_start(4, p, end - p);
+    p += cbor_encode_array_start(count, p, end - p);
+    for (size_t i = 0; i < count; i++)
+        p += cbor_encode_uint64(ids[i], p, end - p);
+    p += cbor_encode_array_start(count, p, end - p);
+    for (size_t i = 0; i < count; i++)
+        p += cbor_encode_uint64(tags[i], p, end - p);
+    p += cbor_encode_uint(dims, p, end - p);
+    p = encode_typed_floats(p, end, vecs, count * dims);
+
+    return buffer_encode_end(buf, MSG_INSERT_BATCH, p - buf->data);
+}
+
+/**
+ * @brief Deserializes an INSERT_BATCH request from a CBOR-encoded buffer.
+ *
+ * Expects a CBOR array of the form:
+ *     [[id:uint, ...], [tag:uint, ...], dims:uint, vectors]
+ *
+ * The vector block must hold exactly count * dims components. It is either
+ * a float32 little endian typed array (returned in place) or a flat array
+ * of floats (copied).
+ *
+ * @param buf Input buffer containing the CBOR message.
+ * @param batch Output batch, to be released with insert_batch_free().
+ * @return 0 on success, -1 on malformed input or memory allocation failure.
+ */
+int buffer_read_insert_batch(const buffer_t *buf, insert_batch_t *batch) {
+    proto_cursor_t cur;
+    size_t len, ntags;
+    uint64_t dims;
+
+    PANIC_IF(!buf, "buffer cannot be null");
+    PANIC_IF(!buf->data, "buffer data cannot be null");
+    PANIC_IF(!batch, "batch output parameter cannot be null");
+    memset(batch, 0, sizeof(insert_batch_t));
+    if (buf->hdr.len == 0 || buf->hdr.len > MSG_MAXLEN) return -1;
+
+    cursor_init(&cur, buf);
+    if (cursor_array(&cur, &len) != 0 || len != 4 ||
+        cursor_array(&cur, &batch->count) != 0)
+        return -1;
+
+    if (batch->count > 0) {
+        batch->ids = malloc(2 * batch->count * sizeof(uint64_t));
+        if (!batch->ids)
+            return -1;
+        batch->tags = batch->ids + batch->count;
+    }
+    for (size_t i = 0; i < batch->count; i++)
+        if (cursor_uint(&cur, &batch->ids[i]) != 0)
+            goto fail;
+
+    if (cursor_array(&cur, &ntags) != 0 || ntags != batch->count)
+        goto fail;
+    for (size_t i = 0; i < batch->count; i++)
+        if (cursor_uint(&cur, &batch->tags[i]) != 0)
+            goto fail;
+
+    if (cursor_uint(&cur, &dims) != 0 || dims > UINT16_MAX)
+        goto fail;
+    batch->dims = (size_t)dims;
+
+    if (cursor_vector(&cur, &batch->vectors) != 0)
+        goto fail;
+    if (batch->vectors.dims != batch->count * batch->dims || !cursor_done(&cur))
+        goto fail;
+    return 0;
+
+fail:
+    insert_batch_free(batch);
+    return -1;
+}
+
+void insert_batch_free(insert_batch_t *batch) {
+    free(batch->ids);
+    batch->ids = batch->tags = NULL;
+    proto_vector_free(&batch->vectors);
+}
+
+/**
+ * @brief Serializes an INSERT_FILE request into a CBOR-encoded buffer.
+ *
+ * Encodes a CBOR array of the form:
+ *     [count:uint, dims:uint]
+ *
+ * @param buf Output buffer where the CBOR message will be written.
+ * @param count Number of rows in the file sent along.
+ * @param dims Components of each vector.
+ * @return 0 on success, -1 on error.
+ */
+int buffer_write_insert_file(buffer_t *buf, size_t count, size_t dims) {
+    uint8_t *p, *end;
+
+    PANIC_IF(!buf, "buffer cannot be null");
+    PANIC_IF(!buf->data, "buffer data cannot be null");
+
+    if (buffer_encode_begin(buf, 3 * CBOR_HEAD_MAX) != 0)
+        return -1;
+
+    p   = buf->data;
+    end = buf->data + buf->cap;
+    p += cbor_encode_array_start(2, p, end - p);
+    p += cbor_encode_uint(count, p, end - p);
+    p += cbor_encode_uint(dims, p, end - p);
+
+    return buffer_encode_end(buf, MSG_INSERT_FILE, p - buf->data);
+}
+
+/**
+ * @brief Deserializes an INSERT_FILE request from a CBOR-encoded buffer.
+ *
+ * Expects a CBOR array of the form:
+ *     [count:uint, dims:uint]
+ *
+ * @param buf Input buffer containing the CBOR message.
+ * @param count Output number of rows in the file.
+ * @param dims Output components of each vector (1 to UINT16_MAX).
+ * @return 0 on success, -1 on malformed input.
+ */
+int buffer_read_insert_file(const buffer_t *buf, size_t *count, size_t *dims) {
+    proto_cursor_t cur;
+    uint64_t c, d;
+    size_t len;
+
+    PANIC_IF(!buf, "buffer cannot be null");
+    PANIC_IF(!buf->data, "buffer data cannot be null");
+    PANIC_IF(!count, "count output parameter cannot be null");
+    PANIC_IF(!dims, "dims output parameter cannot be null");
+    if (buf->hdr.len == 0 || buf->hdr.len > MSG_MAXLEN) return -1;
+
+    cursor_init(&cur, buf);
+    if (cursor_array(&cur, &len) != 0 || len != 2 ||
+        cursor_uint(&cur, &c) != 0 || (uint64_t)(size_t)c != c ||
+        cursor_uint(&cur, &d) != 0 || d == 0 || d > UINT16_MAX ||
+        !cursor_done(&cur))
+        return -1;
+    *count = (size_t)c;
+    *dims = (size_t)d;
+    return 0;
+}
+
+/**
+ * @brief Serializes a BATCH_RESULT response into a CBOR-encoded buffer.
+ *
+ * Encodes a CBOR array of the form:
+ *     [code:uint, ...]
+ *
+ * @param buf Output buffer where the CBOR message will be written.
+ * @param codes Result codes, one per batch entry.
+ * @param count Number of codes.
+ * @return 0 on success, -1 on error or if the message exceeds MSG_MAXLEN.
+ */
+int buffer_write_batch_result(buffer_t *buf, const int *codes, size_t count) {
+    uint8_t *p, *end;
+
+    PANIC_IF(!buf, "buffer cannot be null");
+    PANIC_IF(!buf->data, "buffer data cannot be null");
+    PANIC_IF(count > 0 && !codes, "codes array cannot be null");
+
+    if (count > (MSG_MAXLEN - CBOR_HEAD_MAX) / CBOR_HEAD_MAX) return -1;
+    if (buffer_encode_begin(buf, CBOR_HEAD_MAX + count * CBOR_HEAD_MAX) != 0)
+        return -1;
+
+    p   = buf->data;
+    end = buf->data + buf->cap;
+    p += cbor_encode_array_start(count, p, end - p);
+    for (size_t i = 0; i < count; i++)
+        p += cbor_encode_uint((uint64_t)(unsigned int)codes[i], p, end - p);
+
+    return buffer_encode_end(buf, MSG_BATCH_RESULT, p - buf->data);
+}
+
+/**
+ * @brief Deserializes a BATCH_RESULT response from a CBOR-encoded buffer.
+ *
+ * @param buf Input buffer containing the CBOR message.
+ * @param codes Output array of result codes (preallocated).
+ * @param n Maximum number of codes to read.
+ * @param out_count Output number of codes in the response.
+ * @return 0 on success, -1 on malformed input or if more than @p n codes are present.
+ */
+int buffer_read_batch_result(const buffer_t *buf, int *codes, size_t n, size_t *out_count) {
+    proto_cursor_t cur;
+    size_t count;
+
+    PANIC_IF(!buf, "buffer cannot be null");
+    PANIC_IF(!buf->data, "buffer data cannot be null");
+    PANIC_IF(!out_count, "out_count cannot be null");
+    if (buf->hdr.len == 0 || buf->hdr.len > MSG_MAXLEN) return -1;
+
+    cursor_init(&cur, buf);
+    if (cursor_array(&cur, &count) != 0 || count > n)
+        return -1;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t code;
+        if (cursor_uint(&cur, &code) != 0 || code > INT_MAX)
+            return -1;
+        codes[i] = (int)code;
+    }
+    if (!cursor_done(&cur))
+        return -1;
+    *out_count = count;
+    return 0;
+}
+
+/**
+ * @brief Serializes a SEARCH_BATCH request into a CBOR-encoded buffer.
+ *
+ * Encodes a CBOR array of the form:
+ *     [tag:uint64, n:uint, dims:uint, vectors]
+ *
+ * @param buf Output buffer where the CBOR message will be written.
+ * @param tag Tag filter applied to every query.
+ * @param vecs count * dims components, one row per query.
+ * @param count Number of queries.
+ * @param dims Components of each query vector.
+ * @param n Number of results requested per query.
+ * @return 0 on success, -1 on error or if the message exceeds MSG_MAXLEN.
+ */
+int buffer_write_search_batch(
+    buffer_t *buf,
+    uint64_t tag,
+    const float *vecs,
+    size_t count,
+    size_t dims,
+    int n
+) {
+    uint8_t *p, *end;
+
+    PANIC_IF(!buf, "buffer cannot be null");
+    PANIC_IF(!buf->data, "buffer data cannot be null");
+    PANIC_IF(count > 0 && dims > 0 && !vecs, "vectors cannot be null");
+    PANIC_IF(n < 0, "n cannot be negative");
+
+    if (dims > 0 && count > (MSG_MAXLEN - 6 * CBOR_HEAD_MAX) / sizeof(float) / dims) return -1;
+    if (buffer_encode_begin(buf, 6 * CBOR_HEAD_MAX + count * dims * sizeof(float)) != 0)
+        return -1;
+
+    p   = buf->data;
+    end = buf->data + buf->cap;
+    p += cbor_encode_array_start(4, p, end - p);
+    p += cbor_encode_uint64(tag, p, end - p);
+    p += cbor_encode_uint(n, p, end - p);
+    p += cbor_encode_uint(dims, p, end - p);
+    p = encode_typed_floats(p, end, vecs, count * dims);
+
+    return buffer_encode_end(buf, MSG_SEARCH_BATCH, p - buf->data);
+}
+
+/**
+ * @brief Deserializes a SEARCH_BATCH request from a CBOR-encoded buffer.
+ *
+ * Expects a CBOR array of the form:
+ *     [tag:uint, n:uint, dims:uint, vectors]
+ *
+ * @param buf Input buffer containing the CBOR message.
+ * @param tag Output tag filter.
+ * @param vecs Output query block, to be released with proto_vector_free().
+ * @param dims Output components of each query vector.
+ * @param n Output number of results requested per query.
+ * @return 0 on success, -1 on malformed input or memory allocation failure.
+ */
+int buffer_read_search_batch(
+    const buffer_t *buf,
+    uint64_t *tag,
+    proto_vector_t *vecs,
+    size_t *dims,
+    int *n
+) {
+    proto_cursor_t cur;
+    uint64_t count, d;
+    size_t len;
+
+    PANIC_IF(!buf, "buffer cannot be null");
+    PANIC_IF(!buf->data, "buffer data cannot be null");
+    PANIC_IF(!tag, "tag output parameter cannot be null");
+    PANIC_IF(!vecs, "vecs output parameter cannot be null");
+    PANIC_IF(!dims, "dims output parameter cannot be null");
+    PANIC_IF(!n, "n output parameter cannot be null");
+    if (buf->hdr.len == 0 || buf->hdr.len > MSG_MAXLEN) return -1;
+
+    cursor_init(&cur, buf);
+    if (cursor_array(&cur, &len) != 0 || len != 4 ||
+        cursor_uint(&cur, tag) != 0 ||
+        cursor_uint(&cur, &count) != 0 || count > INT_MAX ||
+        cursor_uint(&cur, &d) != 0 || d == 0 || d > UINT16_MAX ||
+        cursor_vector(&cur, vecs) != 0)
+        return -1;
+
+    if (vecs->dims == 0 || vecs->dims % d != 0 || !cursor_done(&cur)) {
+        proto_vector_free(vecs);
+        return -1;
+    }
+    *dims = (size_t)d;
+    *n = (int)count;
+    return 0;
+}
+
+/**
+ * @brief Serializes a MATCH_BATCH_RESULT response into a CBOR-encoded buffer.
+ *
+ * Encodes a CBOR array with one MATCH_RESULT list per query:
+ *     [[[id:uint64, distance:float], ...], ...]
+ *
+ * @param buf Output buffer where the CBOR message will be written.
+ * @param ids Result identifiers, count rows of stride entries.
+ * @param distances Distances, laid out like ids.
+ * @param counts Number of results of each query.
+ * @param count Number of queries.
+ * @param stride Distance between two rows.
+ * @return 0 on success, -1 on error or if the message exceeds MSG_MAXLEN.
+ */
+int buffer_write_match_batch_result(
+    buffer_t *buf,
+    const uint64_t *ids,
+    const float *distances,
+    const size_t *counts,
+    size_t count,
+    size_t stride
+) {
+    /* Each entry is [id:uint64, distance:float32] */
+    const size_t entry_max = 1 + CBOR_HEAD_MAX + CBOR_FLOAT4_LEN;
+    size_t max_len = CBOR_HEAD_MAX;
+    uint8_t *p, *end;
+
+    PANIC_IF(!buf, "buffer cannot be null");
+    PANIC_IF(!buf->data, "buffer data cannot be null");
+    PANIC_IF(count > 0 && (!ids || !distances || !counts), "result arrays cannot be null");
+
+    for (size_t q = 0; q < count; q++) {
+        PANIC_IF(counts[q] > stride, "result count exceeds row size");
+        if (counts[q] > (MSG_MAXLEN - max_len) / entry_max) return -1;
+        max_len += CBOR_HEAD_MAX + counts[q] * entry_max;
+        if (max_len > MSG_MAXLEN) return -1;
+    }
+    if (buffer_encode_begin(buf, max_len) != 0)
+        return -1;
+
+    p   = buf->data;
+    end = buf->data + buf->cap;
+    p += cbor_encode_array_start(count, p, end - p);
+    for (size_t q = 0; q < count; q++) {
+        const uint64_t *row_ids = ids + q * stride;
+        const float *row_dist = distances + q * stride;
+
+        p += cbor_encode_array_start(counts[q], p, end - p);
+        for (size_t i = 0; i < counts[q]; i++) {
+            p += cbor_encode_array_start(2, p, end - p);
+            p += cbor_encode_uint64(row_ids[i], p, end - p);
+            p += cbor_encode_single(row_dist[i], p, end - p);
+        }
+    }
+
+    return buffer_encode_end(buf, MSG_MATCH_BATCH_RESULT, p - buf->data);
+}
@@ -40,20 +40,20 @@ int buffer_write_insert(
  * Expects a CBOR array of the form:
  *     [uint64_t id, [float32]]
  *
- * The function allocates memory for the vector, which must be freed by the caller.
+ * The vector may be sent as a float32 little endian typed array (RFC 8746,
+ * tag 85), in which case it points into @p buf, or as an array of floats,
+ * in which case it is copied. Release it with proto_vector_free().
  *
  * @param buf Input buffer containing the CBOR message.
  * @param id Output pointer to the decoded 64-bit ID.
- * @param vec Output pointer to the float vector (allocated).
- * @param dims Output number of elements in the vector.
+ * @param vec Output vector.
  * @return 0 on success, -1 on malformed input or memory allocation failure.
  */
 int buffer_read_insert(
     const buffer_t *buf,
     uint64_t *id,
     uint64_t *tag,
-    float **vec,
-    size_t *dims
+    proto_vector_t *vec
 );
 
 /**
@@ -82,19 +82,18 @@ int buffer_write_search(
  * Expects a CBOR array of the form:
  *     [[float32], int]
  *
- * The function allocates memory for the vector, which must be freed by the caller.
+ * The vector is decoded as in buffer_read_insert(). Release it with
+ * proto_vector_free().
  *
  * @param buf Input buffer containing the CBOR message.
- * @param vec Output pointer to the float vector (allocated).
- * @param dims Output number of elements in the vector.
+ * @param vec Output vector.
  * @param n Output number of results requested.
  * @return 0 on success, -1 on malformed input or memory allocation failure.
  */
 int buffer_read_search(
     const buffer_t *buf,
     uint64_t *tag,
-    float **vec,
-    size_t *dims,
+    proto_vector_t *vec,
     int *n
 );
 
@@ -170,4 +169,212 @@ int buffer_read_delete(
     uint64_t *id
 );
 
+/**
+ * @brief Decoded INSERT_BATCH request.
+ *
+ * Entry `i` is (`ids[i]`, `tags[i]`, `vectors.data + i * dims`).
+ * Release with insert_batch_free().
+ */
+typedef struct {
+    size_t          count;    /**< Number of entries */
+    size_t          dims;     /**< Components of each vector */
+    uint64_t       *ids;      /**< Entry ids (count) */
+    uint64_t       *tags;     /**< Entry tags (count), same allocation as `ids` */
+    proto_vector_t  vectors;  /**< count * dims components, one row per entry */
+} insert_batch_t;
+
+/**
+ * @brief Serializes an INSERT_BATCH request into a CBOR-encoded buffer.
+ *
+ * Encodes a CBOR array of the form:
+ *     [[id:uint64, ...], [tag:uint64, ...], dims:uint, vectors]
+ *
+ * where `vectors` is a float32 little endian typed array (RFC 8746, tag 85)
+ * holding the @p count vectors back to back.
+ *
+ * @param buf Output buffer where the CBOR message will be written.
+ * @param ids Entry ids.
+ * @param tags Entry tags.
+ * @param vecs @p count * @p dims components, one row per entry.
+ * @param count Number of entries.
+ * @param dims Components of each vector.
+ * @return 0 on success, -1 on error or if the message exceeds MSG_MAXLEN.
+ */
+int buffer_write_insert_batch(
+    buffer_t *buf,
+    const uint64_t *ids,
+    const uint64_t *tags,
+    const float *vecs,
+    size_t count,
+    size_t dims
+);
+
+/**
+ * @brief Deserializes an INSERT_BATCH request from a CBOR-encoded buffer.
+ *
+ * The vector block may be a typed array, returned in place, or a flat
+ * array of floats (see buffer_read_insert()).
+ *
+ * @param buf Input buffer containing the CBOR message.
+ * @param batch Output batch, to be released with insert_batch_free().
+ * @return 0 on success, -1 on malformed input or memory allocation failure.
+ */
+int buffer_read_insert_batch(
+    const buffer_t *buf,
+    insert_batch_t *batch
+);
+
+/**
+ * @brief Releases the memory held by a decoded batch.
+ *
+ * @param batch Batch to release.
+ */
+void insert_batch_free(
+    insert_batch_t *batch
+);
+
+/**
+ * @brief Serializes an INSERT_FILE request into a CBOR-encoded buffer.
+ *
+ * Encodes a CBOR array of the form:
+ *     [count:uint, dims:uint]
+ *
+ * The rows travel in a file whose descriptor is sent along with the frame
+ * (SCM_RIGHTS): u64 ids[count], u64 tags[count], then f32 vectors[count *
+ * dims], all little endian and back to back.
+ *
+ * @param buf Output buffer where the CBOR message will be written.
+ * @param count Number of rows in the file.
+ * @param dims Components of each vector.
+ * @return 0 on success, -1 on error.
+ */
+int buffer_write_insert_file(
+    buffer_t *buf,
+    size_t count,
+    size_t dims
+);
+
+/**
+ * @brief Deserializes an INSERT_FILE request from a CBOR-encoded buffer.
+ *
+ * @param buf Input buffer containing the CBOR message.
+ * @param count Output number of rows in the file.
+ * @param dims Output components of each vector.
+ * @return 0 on success, -1 on malformed input.
+ */
+int buffer_read_insert_file(
+    const buffer_t *buf,
+    size_t *count,
+    size_t *dims
+);
+
+/**
+ * @brief Serializes a BATCH_RESULT response into a CBOR-encoded buffer.
+ *
+ * Encodes a CBOR array of the form:
+ *     [code:uint, ...]
+ *
+ * with one result code per entry of the batch, in request order.
+ *
+ * @param buf Output buffer where the CBOR message will be written.
+ * @param codes Result codes.
+ * @param count Number of codes.
+ * @return 0 on success, -1 on error or if the message exceeds MSG_MAXLEN.
+ */
+int buffer_write_batch_result(
+    buffer_t *buf,
+    const int *codes,
+    size_t count
+);
+
+/**
+ * @brief Deserializes a BATCH_RESULT response from a CBOR-encoded buffer.
+ *
+ * @param buf Input buffer containing the CBOR message.
+ * @param codes Output array of result codes (preallocated).
+ * @param n Maximum number of codes to read.
+ * @param out_count Output number of codes in the response.
+ * @return 0 on success, -1 on malformed input or if more than @p n codes are present.
+ */
+int buffer_read_batch_result(
+    const buffer_t *buf,
+    int *codes,
+    size_t n,
+    size_t *out_count
+);
+
+/**
+ * @brief Serializes a SEARCH_BATCH request into a CBOR-encoded buffer.
+ *
+ * Encodes a CBOR array of the form:
+ *     [tag:uint64, n:uint, dims:uint, vectors]
+ *
+ * where `vectors` is a float32 little endian typed array holding the
+ * @p count query vectors back to back. Every query shares @p tag and @p n.
+ *
+ * @param buf Output buffer where the CBOR message will be written.
+ * @param tag Tag filter applied to every query.
+ * @param vecs @p count * @p dims components, one row per query.
+ * @param count Number of queries.
+ * @param dims Components of each query vector.
+ * @param n Number of results requested per query.
+ * @return 0 on success, -1 on error or if the message exceeds MSG_MAXLEN.
+ */
+int buffer_write_search_batch(
+    buffer_t *buf,
+    uint64_t tag,
+    const float *vecs,
+    size_t count,
+    size_t dims,
+    int n
+);
+
+/**
+ * @brief Deserializes a SEARCH_BATCH request from a CBOR-encoded buffer.
+ *
+ * The query block may be a typed array, returned in place, or a flat array
+ * of floats (see buffer_read_insert()). Its length must be a non-zero
+ * multiple of @p dims; query `i` starts at `vecs->data + i * dims`.
+ *
+ * @param buf Input buffer containing the CBOR message.
+ * @param tag Output tag filter.
+ * @param vecs Output query block, to be released with proto_vector_free().
+ * @param dims Output components of each query vector.
+ * @param n Output number of results requested per query.
+ * @return 0 on success, -1 on malformed input or memory allocation failure.
+ */
+int buffer_read_search_batch(
+    const buffer_t *buf,
+    uint64_t *tag,
+    proto_vector_t *vecs,
+    size_t *dims,
+    int *n
+);
+
+/**
+ * @brief Serializes a MATCH_BATCH_RESULT response into a CBOR-encoded buffer.
+ *
+ * Encodes a CBOR array with one MATCH_RESULT list per query:
+ *     [[[id:uint64, distance:float], ...], ...]
+ *
+ * The results of query `q` are the first `counts[q]` entries of row `q` in
+ * @p ids and @p distances, whose rows are @p stride entries apart.
+ *
+ * @param buf Output buffer where the CBOR message will be written.
+ * @param ids Result identifiers, @p count rows of @p stride entries.
+ * @param distances Distances, laid out like @p ids.
+ * @param counts Number of results of each query.
+ * @param count Number of queries.
+ * @param stride Distance between two rows.
+ * @return 0 on success, -1 on error or if the message exceeds MSG_MAXLEN.
+ */
+int buffer_write_match_batch_result(
+    buffer_t *buf,
+    const uint64_t *ids,
+    const float *distances,
+    const size_t *counts,
+    size_t count,
+    size_t stride
+);
+
 #endif /* __VIPROTO_H */
\ No newline at end of file
@@ -0,0 +1,1447 @@
+/**
+ * @file wal.c
+ * @brief Segmented Write-Ahead Log with group commit and checkpoints.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE /* fallocate() */
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "wal.h"
+#include "fileutils.h"
+#include "socket.h"
+#include "crc32c.h"
+#include "uring.h"
+#include "log.h"
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+/** @brief Largest record body (the largest message payload) */
+#define RECORD_MAXLEN 0x0FFFFFFF
+
+/** @brief Size of the WAL_OP_COMMIT record ending every group */
+#define TRAILER_LEN (WAL_RECORD_HDR_LEN + 16)
+
+struct wal {
+    char      *prefix;
+    int        fd;         /**< Current segment */
+    size_t     seg_size;   /**< Bytes written to the current segment */
+    wal_sync_t sync;
+    int        window_ms;
+
+    /* Records may be appended on another thread than the one committing
+     * them: the front buffer and the counters below are under `front`,
+     * taken before `lock`. `lsn` and `appended` are also read atomically. */
+    pthread_mutex_t front;
+    uint64_t   lsn;        /**< LSN of the next record */
+    uint64_t   appended;   /**< Record bytes appended since the log was opened */
+    uint8_t   *buf;        /**< Records not handed to the writer yet, room for the trailer (front buffer) */
+    size_t     len, cap;
+    int        pending;    /**< Responses wait for the records in `buf` */
+    int64_t    since_ms;   /**< When the oldest record in `buf` was appended */
+
+    uint8_t   *back;       /**< Group written by the writer thread (back buffer) */
+    size_t     back_len, back_cap;
+    uint64_t   back_lsn;   /**< LSN following the last record of `back` */
+    int        busy;       /**< `back` is being written, under `lock` */
+    uint64_t   groups;     /**< Groups handed over so far */
+    uint64_t   written;    /**< Groups the writer thread is done with, under `lock` */
+    uint64_t   failed;     /**< Number of the last group that could not be written, under `lock` */
+    int        broken;     /**< A group or a record failed: nothing more is written, under `lock` */
+    uint64_t   flight;     /**< Last group handed over by wal_commit() without waiting */
+    uint64_t   reported;   /**< Groups whose outcome wal_commit() or wal_committed() returned */
+    int        stop;       /**< The writer thread must exit, under `lock` */
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;  /**< Signalled when `busy` or `stop` changes */
+    pthread_t  thread;
+    int        done_rd;    /**< Readable once a group handed over is written */
+    int        done_wr;
+#if defined(HAVE_IO_URING)
+    uring_t   *ring;       /**< Ring of the writer thread (VICTOR_IO=uring, `fsync` mode), or NULL */
+#endif
+};
+
+/** @brief Segment mapped in memory */
+typedef struct {
+    uint8_t   *base;
+    size_t     size;
+    int        grouped;    /**< WAL_FORMAT_GROUPED: groups end with a WAL_OP_COMMIT record */
+} wal_map_t;
+
+struct wal_reader {
+    char      *prefix;
+    uint64_t  *bases;      /**< First LSN of each segment, ascending */
+    wal_map_t *maps;       /**< Mapping of each binary segment, kept until close */
+    size_t     nsegs, seg; /**< Number of segments, next one to open */
+    size_t     first_seg;  /**< First segment to read */
+    int        legacy;     /**< The single-file log is still to be read */
+    int        has_legacy; /**< There is a single-file log */
+    FILE      *cur;        /**< File being read (older formats) */
+    wal_map_t *map;        /**< Segment being read (binary formats) */
+    size_t     map_off;    /**< Offset of the next record in `map` */
+    char       path[PATH_MAX]; /**< Path of `cur` (of the torn file once `torn` is set) */
+    int        cur_legacy; /**< `cur` is the single-file log (no LSNs) */
+    int        cur_crc;    /**< Records in `cur` carry a checksum */
+    int        verified;   /**< The last record returned had a valid checksum */
+    uint64_t   lsn;        /**< LSN of the next record in `cur` */
+    uint64_t   from;       /**< First LSN to return */
+
+    uint64_t   total;      /**< Size of the files to read */
+    uint64_t   consumed;   /**< Size of the files read completely */
+
+    int        torn;       /**< The log ends with a partially written record */
+    uint64_t   torn_off;   /**< Offset of the first invalid byte */
+    uint64_t   torn_len;   /**< Number of invalid bytes */
+};
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static uint32_t get_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void put_le16(uint8_t *p, uint16_t v) {
+    p[0] = v; p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void put_le64(uint8_t *p, uint64_t v) {
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint16_t get_le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_le64(const uint8_t *p) {
+    return (uint64_t)get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+/**
+ * @brief Copies values of 4 or 8 bytes, converting them to or from little endian.
+ */
+static void copy_le(void *dst, const void *src, size_t n, size_t width) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(dst, src, n * width);
+#else
+    const uint8_t *s = (const uint8_t *)src;
+    uint8_t *d = (uint8_t *)dst;
+
+    for (size_t i = 0; i < n; i++, s += width, d += width)
+        for (size_t k = 0; k < width; k++)
+            d[k] = s[width - 1 - k];
+#endif
+}
+
+static size_t pad8(size_t len) {
+    return (len + 7) & ~(size_t)7;
+}
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int write_all(int fd, const uint8_t *p, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+static int sync_fd(int fd) {
+#if defined(__linux__)
+    return fdatasync(fd);
+#else
+    return fsync(fd);
+#endif
+}
+
+static void segment_path(char *out, size_t len, const char *prefix, uint64_t base) {
+    snprintf(out, len, "%s.%016" PRIx64, prefix, base);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Lists the first LSN of every segment of a log, in ascending order.
+ *
+ * @return 0 on success (the caller frees `*bases`), -1 on failure.
+ */
+static int list_segments(const char *prefix, uint64_t **bases, size_t *n) {
+    char dir[PATH_MAX];
+    const char *name;
+    size_t nlen, cap = 0;
+    struct dirent *de;
+    DIR *d;
+
+    *bases = NULL;
+    *n = 0;
+    split_path(prefix, dir, sizeof(dir), &name);
+    nlen = strlen(name);
+    if ((d = opendir(dir)) == NULL)
+        return -1;
+
+    while ((de = readdir(d)) != NULL) {
+        const char *hex = de->d_name + nlen + 1;
+        char *end;
+        uint64_t base;
+
+        if (strncmp(de->d_name, name, nlen) != 0 || de->d_name[nlen] != '.' ||
+            strlen(hex) != 16 || strspn(hex, "0123456789abcdef") != 16)
+            continue;
+        base = strtoull(hex, &end, 16);
+        if (*n == cap) {
+            uint64_t *p = realloc(*bases, (cap ? cap * 2 : 16) * sizeof(uint64_t));
+            if (!p) {
+                closedir(d);
+                free(*bases);
+                *bases = NULL;
+                return -1;
+            }
+            *bases = p;
+            cap = cap ? cap * 2 : 16;
+        }
+        (*bases)[(*n)++] = base;
+    }
+    closedir(d);
+    if (*n > 1)
+        qsort(*bases, *n, sizeof(uint64_t), cmp_u64);
+    return 0;
+}
+
+/**
+ * @brief Starts a new segment whose first record is @p lsn.
+ *
+ * A segment left empty by a previous run (or by torn tail truncation) is
+ * reused. The blocks of a new segment are reserved up front, without
+ * changing its size, so that appends do not allocate them one at a time.
+ */
+static int open_segment(wal_t *wal, uint64_t lsn) {
+    uint8_t hdr[WAL_SEGMENT_HDR_LEN];
+    char path[PATH_MAX];
+    struct stat st;
+    int fd;
+
+    segment_path(path, sizeof(path), wal->prefix, lsn);
+    fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0)
+        goto fail;
+    /* An empty segment may have been started by a version of another format. */
+    if (st.st_size <= WAL_SEGMENT_HDR_LEN) {
+        memcpy(hdr, WAL_SEGMENT_MAGIC, 4);
+        put_be32(hdr + 4, WAL_FORMAT_GROUPED);
+        if (ftruncate(fd, 0) != 0 || write_all(fd, hdr, sizeof(hdr)) != 0)
+            goto fail;
+        st.st_size = sizeof(hdr);
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+        /* Best effort: not every file system supports it. */
+        (void)fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, WAL_SEGMENT_SIZE);
+#endif
+    } else if (pread(fd, hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+               memcmp(hdr, WAL_SEGMENT_MAGIC, 4) != 0 ||
+               get_be32(hdr + 4) != WAL_FORMAT_GROUPED) {
+        errno = EINVAL;
+        goto fail;
+    }
+    if (wal->sync == WAL_SYNC_FSYNC && sync_dir_of(path) != 0)
+        goto fail;
+    if (wal->fd >= 0)
+        close(wal->fd);
+    wal->fd = fd;
+    wal->seg_size = (size_t)st.st_size;
+    return 0;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+#if defined(HAVE_IO_URING)
+/** @brief Largest group written through the ring (a single write) */
+#define RING_WRITE_MAX (1024 * 1024 * 1024)
+
+/**
+ * @brief Writes and syncs a group with one io_uring_enter() call.
+ *
+ * The write and the fdatasync() are linked, so the sync only starts once
+ * the whole group is written. A short write cancels the sync; the rest is
+ * then written and synced the usual way.
+ */
+static int ring_write_sync(wal_t *wal, const uint8_t *p, size_t len) {
+    struct io_uring_sqe *w = uring_sqe(wal->ring), *f;
+    struct io_uring_cqe *cqe;
+    int res[2] = { -ECANCELED, -ECANCELED };
+
+    if (!w || (f = uring_sqe(wal->ring)) == NULL)
+        return write_all(wal->fd, p, len) == 0 ? sync_fd(wal->fd) : -1;
+    w->opcode = IORING_OP_WRITE;
+    w->fd = wal->fd;
+    w->addr = (uint64_t)(uintptr_t)p;
+    w->len = (uint32_t)len;
+    w->off = (uint64_t)-1;  /* Append at the file position (O_APPEND). */
+    w->flags = IOSQE_IO_LINK;
+    w->user_data = 0;
+    f->opcode = IORING_OP_FSYNC;
+    f->fd = wal->fd;
+    f->fsync_flags = IORING_FSYNC_DATASYNC;
+    f->user_data = 1;
+
+    for (int n = 0; n < 2; ) {
+        if (uring_enter(wal->ring, 2 - (unsigned)n, -1) != 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while ((cqe = uring_peek(wal->ring)) != NULL) {
+            res[cqe->user_data & 1] = cqe->res;
+            uring_seen(wal->ring);
+            n++;
+        }
+    }
+    if (res[0] < 0) {
+        errno = -res[0];
+        return -1;
+    }
+    if ((size_t)res[0] < len)
+        return write_all(wal->fd, p + res[0], len - (size_t)res[0]) == 0 ? sync_fd(wal->fd) : -1;
+    if (res[1] < 0) {
+        errno = -res[1];
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+/**
+ * @brief Removes a group that could not be written from the segment.
+ *
+ * The segment is cut back to where the group started, so that the records
+ * of writes answered with an error are not replayed after a restart.
+ *
+ * @return 0 on success, -1 if the group may still be in the log.
+ */
+static int drop_group(wal_t *wal, size_t start) {
+    if (ftruncate(wal->fd, (off_t)start) != 0)
+        return -1;
+    if (wal->sync == WAL_SYNC_FSYNC && sync_fd(wal->fd) != 0)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Ends the group of @p len bytes at @p p with its WAL_OP_COMMIT record.
+ *
+ * The record holds the length and the CRC-32C of the group, so that the
+ * reader can tell a complete group from one torn by a crash.
+ *
+ * @return Size of the group, trailer included.
+ */
+static size_t end_group(uint8_t *p, size_t len) {
+    uint8_t *t = p + len;
+
+    put_le32(t + 4, TRAILER_LEN - WAL_RECORD_HDR_LEN);
+    put_le16(t + 8, WAL_OP_COMMIT);
+    put_le16(t + 10, 0);
+    put_le32(t + 12, 1);
+    put_le64(t + 16, (uint64_t)len);
+    put_le32(t + 24, crc32c(0, p, len));
+    put_le32(t + 28, 0);
+    put_le32(t, crc32c(0, t + 4, TRAILER_LEN - 4));
+    return len + TRAILER_LEN;
+}
+
+/**
+ * @brief Writes a group of records out, syncing them in `fsync` mode.
+ *
+ * Runs on the writer thread, which owns the segment while a group is
+ * handed over. The group is ended with its trailer (see end_group()),
+ * which the buffer has room for. A group that fails is removed (see
+ * drop_group()), and the caller breaks the log: every later group fails
+ * with EIO.
+ *
+ * @param lsn LSN following the last record of the group, first of the
+ *        next segment if this one is full.
+ */
+static int wal_write(wal_t *wal, uint8_t *p, size_t len, uint64_t lsn) {
+    size_t start = wal->seg_size;
+    int ret;
+
+    len = end_group(p, len);
+
+#if defined(HAVE_IO_URING)
+    if (wal->ring && len <= RING_WRITE_MAX)
+        ret = ring_write_sync(wal, p, len);
+    else
+#endif
+    if ((ret = write_all(wal->fd, p, len)) == 0 && wal->sync == WAL_SYNC_FSYNC)
+        ret = sync_fd(wal->fd);
+
+    if (ret != 0) {
+        int err = errno;
+
+        if (drop_group(wal, start) != 0)
+            log_message(LOG_ERROR,
+                "unable to remove a failed group from the WAL (%d) - message: %s",
+                errno, strerror(errno)
+            );
+        errno = err;
+        return ret;
+    }
+    wal->seg_size += len;
+
+    if (wal->seg_size >= WAL_SEGMENT_SIZE && open_segment(wal, lsn) != 0)
+        log_message(LOG_WARNING,
+            "unable to start a new WAL segment (%d) - message: %s", errno, strerror(errno)
+        );
+    return 0;
+}
+
+static void notify(wal_t *wal) {
+    uint64_t one = 1;
+    ssize_t w;
+    do {
+        w = write(wal->done_wr, &one, wal->done_rd == wal->done_wr ? sizeof(one) : 1);
+    } while (w < 0 && errno == EINTR);
+}
+
+static void drain(wal_t *wal) {
+    uint8_t buf[64];
+    while (read(wal->done_rd, buf, sizeof(buf)) > 0)
+        ;
+}
+
+static int open_notify(wal_t *wal) {
+#if defined(__linux__)
+    wal->done_rd = wal->done_wr = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return wal->done_rd < 0 ? -1 : 0;
+#else
+    int fds[2];
+    if (pipe(fds) != 0)
+        return -1;
+    set_nonblocking(fds[0], 1);
+    set_nonblocking(fds[1], 1);
+    wal->done_rd = fds[0];
+    wal->done_wr = fds[1];
+    return 0;
+#endif
+}
+
+static void close_notify(wal_t *wal) {
+    close(wal->done_rd);
+    if (wal->done_wr != wal->done_rd)
+        close(wal->done_wr);
+}
+
+/**
+ * @brief Writer thread: writes each group handed over, then signals its completion.
+ *
+ * Once a group failed, the later ones are not written: they fail with EIO.
+ */
+static void *writer_main(void *arg) {
+    wal_t *wal = (wal_t *)arg;
+
+    pthread_mutex_lock(&wal->lock);
+    for (;;) {
+        int ret, broken;
+
+        while (!wal->busy && !wal->stop)
+            pthread_cond_wait(&wal->cond, &wal->lock);
+        if (!wal->busy)
+            break;
+        broken = wal->broken;
+        pthread_mutex_unlock(&wal->lock);
+
+        if (broken) {
+            errno = EIO;
+            ret = -1;
+        } else if ((ret = wal_write(wal, wal->back, wal->back_len, wal->back_lsn)) != 0)
+            log_message(LOG_ERROR,
+                "writing wal (%d) - message: %s: writes are refused until the server restarts",
+                errno, strerror(errno)
+            );
+
+        pthread_mutex_lock(&wal->lock);
+        if (ret != 0) {
+            wal->failed = wal->written + 1;
+            wal->broken = 1;
+        }
+        wal->written++;
+        wal->busy = 0;
+        pthread_cond_broadcast(&wal->cond);
+        notify(wal);
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return NULL;
+}
+
+/**
+ * @brief Hands the current group to the writer thread.
+ *
+ * The front and back buffers are swapped, so the next group is collected
+ * while this one is written. Waits for the previous group first: at most
+ * one group is in flight. Called with `front` held.
+ */
+static void submit(wal_t *wal) {
+    uint8_t *p;
+    size_t cap;
+
+    pthread_mutex_lock(&wal->lock);
+    while (wal->busy)
+        pthread_cond_wait(&wal->cond, &wal->lock);
+    p = wal->back;
+    cap = wal->back_cap;
+    wal->back = wal->buf;
+    wal->back_cap = wal->cap;
+    wal->back_len = wal->len;
+    wal->back_lsn = wal->lsn;
+    wal->buf = p;
+    wal->cap = cap;
+    wal->len = 0;
+    wal->pending = 0;
+    wal->busy = 1;
+    wal->groups++;
+    pthread_cond_broadcast(&wal->cond);
+    pthread_mutex_unlock(&wal->lock);
+}
+
+/**
+ * @brief Reports the outcome of the groups handed over up to @p upto.
+ *
+ * A report covers the groups since the previous one. Only the last failure
+ * is remembered, so a group that failed after @p upto also fails this
+ * report: writes may be answered with an error although they were logged,
+ * never the other way around.
+ *
+ * @param wait Wait until the groups are written.
+ * @return 1 if they were written, 0 if they are not yet, -1 if one failed.
+ */
+static int report(wal_t *wal, uint64_t upto, int wait) {
+    uint64_t failed;
+    int ret;
+
+    pthread_mutex_lock(&wal->lock);
+    while (wait && wal->written < upto)
+        pthread_cond_wait(&wal->cond, &wal->lock);
+    if (wal->written < upto) {
+        pthread_mutex_unlock(&wal->lock);
+        return 0;
+    }
+    failed = wal->failed;
+    pthread_mutex_unlock(&wal->lock);
+
+    if (upto <= wal->reported)
+        return 1;
+    ret = failed > wal->reported ? -1 : 1;
+    wal->reported = upto;
+    return ret;
+}
+
+/**
+ * @brief Waits until the group in flight, if any, is written.
+ *
+ * Its outcome is left to the next report (see report()).
+ */
+static void wait_idle(wal_t *wal) {
+    pthread_mutex_lock(&wal->lock);
+    while (wal->busy)
+        pthread_cond_wait(&wal->cond, &wal->lock);
+    pthread_mutex_unlock(&wal->lock);
+}
+
+const char *wal_sync_name(wal_sync_t sync) {
+    switch (sync) {
+    case WAL_SYNC_NONE:  return "none";
+    case WAL_SYNC_FLUSH: return "flush";
+    case WAL_SYNC_FSYNC: return "fsync";
+    default:             return "unknown";
+    }
+}
+
+wal_t *wal_open(const char *prefix, uint64_t lsn, wal_sync_t sync, int window_ms) {
+    wal_t *wal = calloc(1, sizeof(wal_t));
+
+    if (!wal)
+        return NULL;
+    wal->fd = -1;
+    wal->lsn = lsn;
+    wal->sync = sync;
+    wal->window_ms = window_ms;
+    if ((wal->prefix = strdup(prefix)) == NULL || open_segment(wal, lsn) != 0)
+        goto fail;
+    if (open_notify(wal) != 0)
+        goto fail;
+#if defined(HAVE_IO_URING)
+    /* Only a synced group takes two system calls to write. */
+    if (sync == WAL_SYNC_FSYNC && get_io_uring() && (wal->ring = uring_create(4, 0, 0)) == NULL)
+        log_message(LOG_WARNING,
+            "io_uring unavailable for the WAL (%d) - %s", errno, strerror(errno)
+        );
+#endif
+    pthread_mutex_init(&wal->front, NULL);
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->cond, NULL);
+    if ((errno = pthread_create(&wal->thread, NULL, writer_main, wal)) != 0) {
+        pthread_mutex_destroy(&wal->front);
+        pthread_mutex_destroy(&wal->lock);
+        pthread_cond_destroy(&wal->cond);
+        close_notify(wal);
+#if defined(HAVE_IO_URING)
+        uring_destroy(wal->ring);
+#endif
+        goto fail;
+    }
+    return wal;
+
+fail:
+    if (wal->fd >= 0)
+        close(wal->fd);
+    free(wal->prefix);
+    free(wal);
+    return NULL;
+}
+
+/**
+ * @brief Computes the body length of a record.
+ *
+ * @return 0 on success, -1 if the record cannot be encoded.
+ */
+static int record_len(const wal_record_t *rec, size_t *len) {
+    if (rec->dims > UINT16_MAX)
+        return -1;
+    switch (rec->op) {
+    case WAL_OP_INSERT:
+        *len = 2 * sizeof(uint64_t) + rec->dims * sizeof(float);
+        return 0;
+    case WAL_OP_DELETE:
+        *len = sizeof(uint64_t);
+        return 0;
+    case WAL_OP_INSERT_FILE:
+        *len = 2 * sizeof(uint64_t);
+        return 0;
+    case WAL_OP_INSERT_BATCH:
+        if (rec->count > RECORD_MAXLEN / (2 * sizeof(uint64_t) + rec->dims * sizeof(float)))
+            return -1;
+        *len = rec->count * (2 * sizeof(uint64_t) + rec->dims * sizeof(float));
+        return 0;
+    case WAL_OP_PUT:
+    case WAL_OP_DEL:
+        *len = rec->op == WAL_OP_PUT ? rec->vlen : 0;
+        if (rec->klen > RECORD_MAXLEN || *len > RECORD_MAXLEN - rec->klen)
+            return -1;
+        *len += rec->klen;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief Encodes a record (see the format in wal.h).
+ */
+static void encode_record(const wal_record_t *rec, size_t len, uint8_t *p) {
+    uint8_t *body = p + WAL_RECORD_HDR_LEN;
+    uint32_t count = rec->op == WAL_OP_INSERT_BATCH ? (uint32_t)rec->count
+                   : (rec->op == WAL_OP_PUT || rec->op == WAL_OP_DEL) ? (uint32_t)rec->klen : 1;
+
+    put_le32(p + 4, (uint32_t)len);
+    put_le16(p + 8, (uint16_t)rec->op);
+    put_le16(p + 10, (uint16_t)rec->dims);
+    put_le32(p + 12, count);
+
+    switch (rec->op) {
+    case WAL_OP_INSERT:
+        put_le64(body, rec->id);
+        put_le64(body + 8, rec->tag);
+        copy_le(body + 16, rec->vectors, rec->dims, sizeof(float));
+        break;
+    case WAL_OP_DELETE:
+        put_le64(body, rec->id);
+        break;
+    case WAL_OP_INSERT_FILE:
+        put_le64(body, rec->id);
+        put_le64(body + 8, (uint64_t)rec->count);
+        break;
+    case WAL_OP_INSERT_BATCH:
+        copy_le(body, rec->ids, rec->count, sizeof(uint64_t));
+        copy_le(body + rec->count * 8, rec->tags, rec->count, sizeof(uint64_t));
+        copy_le(body + rec->count * 16, rec->vectors, rec->count * rec->dims, sizeof(float));
+        break;
+    default:
+        memcpy(body, rec->key, rec->klen);
+        if (rec->op == WAL_OP_PUT && rec->vlen > 0)
+            memcpy(body + rec->klen, rec->val, rec->vlen);
+        break;
+    }
+    memset(body + len, 0, pad8(len) - len);
+    put_le32(p, crc32c(0, p + 4, WAL_RECORD_HDR_LEN - 4 + pad8(len)));
+}
+
+int wal_fits(const wal_record_t *rec) {
+    size_t len;
+
+    return record_len(rec, &len) == 0;
+}
+
+/**
+ * @brief Fails the log after a record could not be appended.
+ *
+ * Its operation is applied already, so the database holds a change the
+ * log lost, as after a failed group.
+ *
+ * @return -1, with errno set to @p err.
+ */
+static int append_failed(wal_t *wal, int err) {
+    log_message(LOG_ERROR,
+        "appending to wal (%d) - message: %s: writes are refused until the server restarts",
+        err, strerror(err)
+    );
+    pthread_mutex_lock(&wal->lock);
+    wal->broken = 1;
+    pthread_mutex_unlock(&wal->lock);
+    errno = err;
+    return -1;
+}
+
+int wal_append(wal_t *wal, const wal_record_t *rec) {
+    size_t len, rlen;
+    int ret = 0;
+
+    pthread_mutex_lock(&wal->front);
+    if (record_len(rec, &len) != 0) {
+        ret = append_failed(wal, EINVAL);
+        goto done;
+    }
+
+    rlen = WAL_RECORD_HDR_LEN + pad8(len);
+    if (wal->len + rlen + TRAILER_LEN > wal->cap) {
+        size_t cap = wal->cap ? wal->cap : WAL_BUFFER_SIZE;
+        uint8_t *p;
+
+        while (cap < wal->len + rlen + TRAILER_LEN)
+            cap *= 2;
+        if ((p = realloc(wal->buf, cap)) == NULL) {
+            ret = append_failed(wal, ENOMEM);
+            goto done;
+        }
+        wal->buf = p;
+        wal->cap = cap;
+    }
+
+    if (wal->len == 0)
+        wal->since_ms = now_ms();
+    encode_record(rec, len, wal->buf + wal->len);
+    wal->len += rlen;
+    __atomic_store_n(&wal->appended, wal->appended + rlen, __ATOMIC_RELAXED);
+    __atomic_store_n(&wal->lsn, wal->lsn + 1, __ATOMIC_RELAXED);
+
+    if (wal->sync != WAL_SYNC_NONE)
+        wal->pending = 1;
+    else if (wal->len >= WAL_BUFFER_SIZE)
+        submit(wal);
+done:
+    pthread_mutex_unlock(&wal->front);
+    return ret;
+}
+
+uint64_t wal_lsn(const wal_t *wal) {
+    return __atomic_load_n(&wal->lsn, __ATOMIC_RELAXED);
+}
+
+uint64_t wal_size(const wal_t *wal) {
+    return __atomic_load_n(&wal->appended, __ATOMIC_RELAXED);
+}
+
+int wal_pending(const wal_t *wal) {
+    return wal->pending;
+}
+
+int wal_durable(const wal_t *wal) {
+    return wal->sync != WAL_SYNC_NONE;
+}
+
+/**
+ * @brief Hands the group over unless the window is still open (see wal_commit()).
+ *
+ * Called with `front` held.
+ */
+static int commit_front(wal_t *wal) {
+    if (wal->len == 0) {
+        /* Groups handed over by wal_cut() are reported with the writes. */
+        int ret = report(wal, wal->groups, 0);
+
+        if (ret != 0)
+            return ret < 0 ? -1 : 0;
+        wal->flight = wal->groups;
+        return WAL_COMMIT_RUNNING;
+    }
+    if (wal->window_ms > 0) {
+        int64_t left = wal->since_ms + wal->window_ms - now_ms();
+        if (left > 0)
+            return (int)left;
+    }
+    submit(wal);
+    wal->flight = wal->groups;
+    return WAL_COMMIT_RUNNING;
+}
+
+int wal_commit(wal_t *wal, int force) {
+    uint64_t groups;
+    int ret;
+
+    if (!force && wal->sync == WAL_SYNC_NONE)
+        return 0;
+    pthread_mutex_lock(&wal->front);
+    if (!force) {
+        ret = commit_front(wal);
+        pthread_mutex_unlock(&wal->front);
+        return ret;
+    }
+    if (wal->len > 0)
+        submit(wal);
+    groups = wal->groups;
+    pthread_mutex_unlock(&wal->front);
+    return report(wal, groups, 1) < 0 ? -1 : 0;
+}
+
+int wal_committed(wal_t *wal, int wait) {
+    drain(wal);
+    return report(wal, wal->flight, wait);
+}
+
+int wal_fd(const wal_t *wal) {
+    return wal->done_rd;
+}
+
+int wal_failed(wal_t *wal) {
+    int broken;
+
+    pthread_mutex_lock(&wal->lock);
+    broken = wal->broken;
+    pthread_mutex_unlock(&wal->lock);
+    return broken;
+}
+
+uint64_t wal_cut(wal_t *wal) {
+    uint64_t lsn = 0;
+
+    pthread_mutex_lock(&wal->front);
+    if (wal->len > 0)
+        submit(wal);
+    /* The writer thread is idle: the segment is ours until the next group,
+     * which cannot be appended while `front` is held. A group that failed
+     * is reported to its writes, and fails the cut: the database may hold
+     * their changes. An empty segment already starts at the next LSN. */
+    wait_idle(wal);
+    if (wal_failed(wal))
+        errno = EIO;
+    else if (wal->seg_size <= WAL_SEGMENT_HDR_LEN || open_segment(wal, wal->lsn) == 0)
+        lsn = wal->lsn;
+    pthread_mutex_unlock(&wal->front);
+    return lsn;
+}
+
+void wal_close(wal_t *wal) {
+    if (!wal)
+        return;
+    wal_commit(wal, 1);
+
+    pthread_mutex_lock(&wal->lock);
+    wal->stop = 1;
+    pthread_cond_broadcast(&wal->cond);
+    pthread_mutex_unlock(&wal->lock);
+    pthread_join(wal->thread, NULL);
+    pthread_mutex_destroy(&wal->front);
+    pthread_mutex_destroy(&wal->lock);
+    pthread_cond_destroy(&wal->cond);
+    close_notify(wal);
+#if defined(HAVE_IO_URING)
+    uring_destroy(wal->ring);
+#endif
+
+    close(wal->fd);
+    free(wal->prefix);
+    free(wal->buf);
+    free(wal->back);
+    free(wal);
+}
+
+wal_reader_t *wal_reader_open(const char *prefix, uint64_t lsn) {
+    wal_reader_t *r = calloc(1, sizeof(wal_reader_t));
+    char path[PATH_MAX];
+    struct stat st;
+
+    if (!r)
+        return NULL;
+    if ((r->prefix = strdup(prefix)) == NULL ||
+        list_segments(prefix, &r->bases, &r->nsegs) != 0 ||
+        (r->maps = calloc(r->nsegs + 1, sizeof(wal_map_t))) == NULL) {
+        free(r->bases);
+        free(r->prefix);
+        free(r);
+        return NULL;
+    }
+    /* Skip the segments followed by one that starts at or before `lsn`. */
+    while (r->seg + 1 < r->nsegs && r->bases[r->seg + 1] <= lsn)
+        r->seg++;
+    r->first_seg = r->seg;
+    r->has_legacy = r->legacy = stat(prefix, &st) == 0;
+    if (r->legacy)
+        r->total = (uint64_t)st.st_size;
+    for (size_t i = r->seg; i < r->nsegs; i++) {
+        segment_path(path, sizeof(path), prefix, r->bases[i]);
+        if (stat(path, &st) == 0)
+            r->total += (uint64_t)st.st_size;
+    }
+    r->from = r->lsn = lsn;
+    return r;
+}
+
+/**
+ * @brief Reads the header of the file just opened by the reader.
+ *
+ * Files without one (the single-file log of older versions) hold records
+ * without checksums.
+ *
+ * @return The record format (0 for a file without header), -1 if the
+ *         header is truncated or of an unknown version.
+ */
+static int read_segment_header(wal_reader_t *r) {
+    uint8_t hdr[WAL_SEGMENT_HDR_LEN];
+    size_t n = fread(hdr, 1, sizeof(hdr), r->cur);
+    uint32_t format;
+
+    r->cur_crc = 0;
+    if (n == 0 || memcmp(hdr, WAL_SEGMENT_MAGIC, n < 4 ? n : 4) != 0) {
+        rewind(r->cur);
+        return 0;
+    }
+    if (n < sizeof(hdr))
+        return -1;
+    r->cur_crc = 1;
+    format = get_be32(hdr + 4);
+    if (format != WAL_FORMAT_CRC32C &&
+        ((format != WAL_FORMAT_BINARY && format != WAL_FORMAT_GROUPED) || r->cur_legacy)) {
+        log_message(LOG_ERROR, "unsupported WAL format %u in '%s'", format, r->path);
+        return -1;
+    }
+    return (int)format;
+}
+
+/**
+ * @brief Points the arrays of a record at the mapped segment.
+ *
+ * On big endian hosts, they are converted into a copy instead.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int view_arrays(wal_record_t *rec, const uint8_t *ids, const uint8_t *tags, size_t n,
+                       const uint8_t *vectors, size_t nfloats) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    (void)n;
+    (void)nfloats;
+    rec->ids = (const uint64_t *)(const void *)ids;
+    rec->tags = (const uint64_t *)(const void *)tags;
+    rec->vectors = (const float *)(const void *)vectors;
+    return 0;
+#else
+    uint8_t *copy = malloc(2 * n * sizeof(uint64_t) + nfloats * sizeof(float) + 1);
+
+    if (!copy)
+        return -1;
+    copy_le(copy, ids, n, sizeof(uint64_t));
+    copy_le(copy + n * 8, tags, n, sizeof(uint64_t));
+    copy_le(copy + n * 16, vectors, nfloats, sizeof(float));
+    rec->owned = copy;
+    rec->ids = (const uint64_t *)(const void *)copy;
+    rec->tags = (const uint64_t *)(const void *)(copy + n * 8);
+    rec->vectors = (const float *)(const void *)(copy + n * 16);
+    return 0;
+#endif
+}
+
+/**
+ * @brief Tells whether a record with a known op and a valid checksum starts at @p p.
+ *
+ * @param rlen Output size of the record, header and padding included.
+ */
+static int record_valid(const uint8_t *p, size_t left, size_t *rlen) {
+    size_t len;
+    uint16_t op;
+
+    if (left < WAL_RECORD_HDR_LEN || (len = get_le32(p + 4)) > RECORD_MAXLEN ||
+        (*rlen = WAL_RECORD_HDR_LEN + pad8(len)) > left)
+        return 0;
+    /* Cheap enough to check first when scanning garbage (see records_after()). */
+    op = get_le16(p + 8);
+    if (op < WAL_OP_INSERT || op > WAL_OP_COMMIT)
+        return 0;
+    return crc32c(0, p + 4, *rlen - 4) == get_le32(p);
+}
+
+/**
+ * @brief Decodes the next record of the mapped segment.
+ *
+ * @return 1 if a record was decoded, 2 if a group trailer was skipped, 0 at
+ *         the end of the segment, -1 if the record is invalid, -2 on
+ *         allocation failure.
+ */
+static int map_next(wal_reader_t *r, wal_record_t *rec) {
+    const uint8_t *p = r->map->base + r->map_off, *body = p + WAL_RECORD_HDR_LEN;
+    size_t left = r->map->size - r->map_off, len, rlen, count, dims;
+
+    if (left == 0)
+        return 0;
+    if (!record_valid(p, left, &rlen))
+        return -1;
+    len = get_le32(p + 4);
+
+    rec->op = get_le16(p + 8);
+    rec->dims = dims = get_le16(p + 10);
+    count = get_le32(p + 12);
+    switch (rec->op) {
+    case WAL_OP_INSERT:
+        if (count != 1 || len != 16 + dims * sizeof(float))
+            return -1;
+        rec->id = get_le64(body);
+        rec->tag = get_le64(body + 8);
+        if (view_arrays(rec, body, body, 0, body + 16, dims) != 0)
+            return -2;
+        break;
+    case WAL_OP_DELETE:
+        if (count != 1 || len != 8)
+            return -1;
+        rec->id = get_le64(body);
+        break;
+    case WAL_OP_INSERT_FILE:
+        if (count != 1 || len != 16 || (uint64_t)(size_t)get_le64(body + 8) != get_le64(body + 8))
+            return -1;
+        rec->id = get_le64(body);
+        rec->count = (size_t)get_le64(body + 8);
+        break;
+    case WAL_OP_INSERT_BATCH:
+        if (count > len / 16 || len != count * (16 + dims * sizeof(float)))
+            return -1;
+        rec->count = count;
+        if (view_arrays(rec, body, body + count * 8, count, body + count * 16, count * dims) != 0)
+            return -2;
+        break;
+    case WAL_OP_PUT:
+    case WAL_OP_DEL:
+        if (count > len || (rec->op == WAL_OP_DEL && count != len))
+            return -1;
+        rec->key = body;
+        rec->klen = count;
+        rec->val = body + count;
+        rec->vlen = len - count;
+        break;
+    case WAL_OP_COMMIT:
+        if (!r->map->grouped || count != 1 || len != TRAILER_LEN - WAL_RECORD_HDR_LEN)
+            return -1;
+        r->map_off += rlen;
+        return 2;
+    default:
+        return -1;
+    }
+    r->map_off += rlen;
+    return 1;
+}
+
+/**
+ * @brief Maps the binary segment just opened by the reader.
+ */
+static int map_segment(wal_reader_t *r, wal_map_t *m) {
+    struct stat st;
+    void *base;
+
+    if (fstat(fileno(r->cur), &st) != 0)
+        return -1;
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(r->cur), 0);
+    if (base == MAP_FAILED)
+        return -1;
+    m->base = (uint8_t *)base;
+    m->size = (size_t)st.st_size;
+    fclose(r->cur);
+    r->cur = NULL;
+    return 0;
+}
+
+/**
+ * @brief Reads and verifies the checksum following a record.
+ */
+static int check_record(const buffer_t *buf, FILE *file) {
+    uint8_t raw[HDR_V2_LEN], crc[WAL_CRC_LEN];
+    int hlen;
+
+    if (fread(crc, 1, sizeof(crc), file) != sizeof(crc) ||
+        (hlen = buffer_wal_header(buf, raw)) < 0)
+        return -1;
+    return crc32c(crc32c(0, raw, hlen), buf->data, buf->hdr.len) == get_be32(crc) ? 0 : -1;
+}
+
+/**
+ * @brief Tells whether no segment after the current file holds records.
+ */
+static int tail_empty(const wal_reader_t *r) {
+    char path[PATH_MAX];
+    struct stat st;
+
+    for (size_t i = r->seg; i < r->nsegs; i++) {
+        segment_path(path, sizeof(path), r->prefix, r->bases[i]);
+        if (stat(path, &st) != 0 || st.st_size > WAL_SEGMENT_HDR_LEN)
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Tells whether the valid record at offset @p off ends a complete group.
+ *
+ * The group it covers must lie in the segment and match its checksum.
+ */
+static int group_complete(const wal_map_t *m, size_t off) {
+    const uint8_t *p = m->base + off;
+    uint64_t len;
+
+    if (get_le16(p + 8) != WAL_OP_COMMIT)
+        return 0;
+    len = get_le64(p + WAL_RECORD_HDR_LEN);
+    if (len > off - WAL_SEGMENT_HDR_LEN)
+        return 0;
+    return crc32c(0, p - len, (size_t)len) == get_le32(p + WAL_RECORD_HDR_LEN + 8);
+}
+
+/**
+ * @brief Tells whether acknowledged records follow offset @p off of a mapped segment.
+ *
+ * In a WAL_FORMAT_GROUPED segment, that is a complete group (see
+ * group_complete()): the records of the last group, written when the
+ * process or the system crashed, may be valid or not in any order, since
+ * the pages of a write do not reach the disk in order. In older segments,
+ * any valid record counts. Records start at multiples of 8 bytes, so
+ * every such offset is tried.
+ */
+static int records_after(const wal_map_t *m, size_t off) {
+    size_t rlen;
+
+    for (size_t o = off + 8; o + WAL_RECORD_HDR_LEN <= m->size; o += 8) {
+        if (record_valid(m->base + o, m->size - o, &rlen) &&
+            (!m->grouped || group_complete(m, o)))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Handles an invalid record found at offset @p off of the current file.
+ *
+ * At the end of the log it is the remains of an interrupted write: reading
+ * stops there and the tail is recorded for wal_reader_truncate(). Anywhere
+ * else acknowledged records would be lost, so it is reported as corruption:
+ * when a later segment holds records, or when acknowledged records follow
+ * in the same segment (see records_after(); files of the formats older than
+ * WAL_FORMAT_BINARY are only checked for later segments).
+ *
+ * @return 0 at a torn tail, -1 otherwise (errno is 0 for corrupted content).
+ */
+static int reader_invalid(wal_reader_t *r, off_t off) {
+    struct stat st;
+
+    if (r->cur && ferror(r->cur))
+        return -1;
+    if (!tail_empty(r) || (r->map && records_after(r->map, (size_t)off))) {
+        log_message(LOG_ERROR,
+            "invalid WAL record in '%s' at offset %lld", r->path, (long long)off);
+        errno = 0;
+        return -1;
+    }
+    if (r->map) {
+        st.st_size = (off_t)r->map->size;
+        r->map = NULL;
+    } else {
+        if (fstat(fileno(r->cur), &st) != 0)
+            return -1;
+        fclose(r->cur);
+        r->cur = NULL;
+    }
+    r->torn = 1;
+    r->torn_off = (uint64_t)off;
+    r->torn_len = (uint64_t)(st.st_size - off);
+    return 0;
+}
+
+/**
+ * @brief Opens the next file of the log.
+ *
+ * @return 1 if a file was opened, 0 at the end of the log (or at a torn
+ *         header), -1 on error (errno is 0 for corrupted content).
+ */
+static int reader_open_next(wal_reader_t *r) {
+    wal_map_t *m = NULL;
+    int format;
+
+    if (r->legacy) {
+        snprintf(r->path, sizeof(r->path), "%s", r->prefix);
+        r->legacy = 0;
+        r->cur_legacy = 1;
+    } else if (r->seg < r->nsegs) {
+        segment_path(r->path, sizeof(r->path), r->prefix, r->bases[r->seg]);
+        m = &r->maps[r->seg];
+        r->lsn = r->bases[r->seg++];
+        r->cur_legacy = 0;
+        /* Mapped in a previous pass (see wal_reader_rewind()) */
+        if (m->base) {
+            r->map = m;
+            r->map_off = WAL_SEGMENT_HDR_LEN;
+            return 1;
+        }
+    } else
+        return 0;
+
+    if ((r->cur = fopen(r->path, "rb")) == NULL)
+        return -1;
+    if ((format = read_segment_header(r)) < 0) {
+        if (r->cur_crc) {
+            errno = 0;
+            return -1;
+        }
+        return reader_invalid(r, 0);
+    }
+    if (format == WAL_FORMAT_BINARY || format == WAL_FORMAT_GROUPED) {
+        if (map_segment(r, m) != 0)
+            return -1;
+        m->grouped = format == WAL_FORMAT_GROUPED;
+        r->map = m;
+        r->map_off = WAL_SEGMENT_HDR_LEN;
+    }
+    return 1;
+}
+
+int wal_reader_next(wal_reader_t *r, wal_record_t *rec, buffer_t *buf) {
+    for (;;) {
+        off_t off;
+        int ret;
+
+        memset(rec, 0, sizeof(*rec));
+        if (r->torn)
+            return 0;
+        if (!r->cur && !r->map && (ret = reader_open_next(r)) != 1)
+            return ret;
+
+        if (r->map) {
+            off = (off_t)r->map_off;
+            ret = map_next(r, rec);
+            if (ret == 0) {
+                r->consumed += r->map->size;
+                r->map = NULL;
+                continue;
+            }
+            if (ret == -2)
+                return -1;
+            if (ret < 0)
+                return reader_invalid(r, off);
+            if (ret == 2)
+                continue;
+            r->verified = 1;
+            if (r->lsn++ >= r->from)
+                return 1;
+            wal_record_free(rec);
+            continue;
+        }
+
+        off = ftello(r->cur);
+        ret = buffer_load_wal(buf, r->cur);
+        if (ret == 0) {
+            r->consumed += (uint64_t)ftello(r->cur);
+            fclose(r->cur);
+            r->cur = NULL;
+            continue;
+        }
+        if (ret > 0 && r->cur_crc && check_record(buf, r->cur) != 0)
+            ret = -1;
+        if (ret < 0)
+            return reader_invalid(r, off);
+        r->verified = r->cur_crc;
+        rec->op = WAL_OP_MESSAGE;
+        rec->msg = buf;
+        if (r->cur_legacy)
+            return 1;
+        if (r->lsn++ >= r->from)
+            return 1;
+    }
+}
+
+void wal_record_free(wal_record_t *rec) {
+    free(rec->owned);
+    rec->owned = NULL;
+}
+
+const char *wal_op_name(int op) {
+    switch (op) {
+    case WAL_OP_MESSAGE:      return "MESSAGE";
+    case WAL_OP_INSERT:       return "INSERT";
+    case WAL_OP_DELETE:       return "DELETE";
+    case WAL_OP_INSERT_BATCH: return "INSERT_BATCH";
+    case WAL_OP_PUT:          return "PUT";
+    case WAL_OP_DEL:          return "DEL";
+    case WAL_OP_INSERT_FILE:  return "INSERT_FILE";
+    case WAL_OP_COMMIT:       return "COMMIT";
+    default:                  return "UNKNOWN";
+    }
+}
+
+void wal_reader_rewind(wal_reader_t *r) {
+    if (r->cur)
+        fclose(r->cur);
+    r->cur = NULL;
+    r->map = NULL;
+    r->seg = r->first_seg;
+    r->legacy = r->has_legacy;
+    r->lsn = r->from;
+    r->consumed = 0;
+    r->verified = 0;
+    r->torn = 0;
+}
+
+void wal_reader_progress(const wal_reader_t *r, uint64_t *done, uint64_t *total) {
+    off_t pos = r->cur ? ftello(r->cur) : r->map ? (off_t)r->map_off : 0;
+
+    *done = r->consumed + (pos > 0 ? (uint64_t)pos : 0);
+    *total = r->total > *done ? r->total : *done;
+}
+
+int wal_reader_verified(const wal_reader_t *r) {
+    return r->verified;
+}
+
+int wal_reader_torn(const wal_reader_t *r, const char **path, uint64_t *off, uint64_t *len) {
+    if (!r->torn)
+        return 0;
+    *path = r->path;
+    *off = r->torn_off;
+    *len = r->torn_len;
+    return 1;
+}
+
+int wal_reader_truncate(wal_reader_t *r) {
+    char path[PATH_MAX];
+    int fd;
+
+    if (!r->torn)
+        return 0;
+    if ((fd = open(r->path, O_WRONLY | O_CLOEXEC)) < 0)
+        return -1;
+    if (ftruncate(fd, (off_t)r->torn_off) != 0 || fsync(fd) != 0) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    /* Empty segments past the tail would start after LSNs that are reused. */
+    for (size_t i = r->seg; i < r->nsegs; i++) {
+        segment_path(path, sizeof(path), r->prefix, r->bases[i]);
+        unlink(path);
+    }
+    r->nsegs = r->seg;
+    log_message(LOG_WARNING,
+        "WAL ends with a partially written record: truncated '%s' at offset %" PRIu64
+        " (%" PRIu64 " bytes dropped)", r->path, r->torn_off, r->torn_len);
+    return 0;
+}
+
+uint64_t wal_reader_lsn(const wal_reader_t *r) {
+    return r->lsn > r->from ? r->lsn : r->from;
+}
+
+void wal_reader_close(wal_reader_t *r) {
+    if (!r)
+        return;
+    if (r->cur)
+        fclose(r->cur);
+    for (size_t i = 0; i < r->nsegs; i++)
+        if (r->maps[i].base)
+            munmap(r->maps[i].base, r->maps[i].size);
+    free(r->maps);
+    free(r->bases);
+    free(r->prefix);
+    free(r);
+}
+
+int wal_checkpoint_read(const char *path, uint64_t *lsn) {
+    FILE *f = fopen(path, "r");
+    int ret;
+
+    *lsn = 1;
+    if (!f)
+        return errno == ENOENT ? 0 : -1;
+    ret = fscanf(f, "%" SCNu64, lsn) == 1 && *lsn > 0 ? 0 : -1;
+    fclose(f);
+    return ret;
+}
+
+int wal_checkpoint_write(const char *path, uint64_t lsn) {
+    char tmp[PATH_MAX];
+    FILE *f;
+    int ret;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if ((f = fopen(tmp, "w")) == NULL)
+        return -1;
+    ret = (fprintf(f, "%" PRIu64 "\n", lsn) > 0 && fflush(f) == 0 && fsync(fileno(f)) == 0) ? 0 : -1;
+    if (fclose(f) != 0)
+        ret = -1;
+    if (ret == 0 && rename(tmp, path) == 0 && sync_dir_of(path) == 0)
+        return 0;
+    unlink(tmp);
+    return -1;
+}
+
+void wal_retire(const char *prefix, uint64_t lsn) {
+    char path[PATH_MAX];
+    uint64_t *bases;
+    size_t n;
+
+    if (list_segments(prefix, &bases, &n) != 0)
+        return;
+    for (size_t i = 0; i + 1 < n && bases[i + 1] <= lsn; i++) {
+        segment_path(path, sizeof(path), prefix, bases[i]);
+        unlink(path);
+    }
+    free(bases);
+    unlink(prefix);
+}
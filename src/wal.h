@@ -0,0 +1,483 @@
+/**
+ * @file wal.h
+ * @brief Segmented Write-Ahead Log with group commit.
+ *
+ * The log of a database is a sequence of segment files named
+ * `<prefix>.<first LSN, 16 hex digits>`. Every record has a log sequence
+ * number (LSN): the LSN of the first record of its segment plus its
+ * position in the segment. A new segment is started when the current one
+ * exceeds WAL_SEGMENT_SIZE, when the server starts and at every checkpoint.
+ *
+ * A segment starts with an 8-byte header, WAL_SEGMENT_MAGIC followed by the
+ * record format version (big endian). Records are stored in their own
+ * binary encoding (WAL_FORMAT_GROUPED), independent of the CBOR wire
+ * protocol, every field little endian:
+ *
+ *     0  u32 crc     CRC-32C of bytes 4 .. end of the padded body
+ *     4  u32 len     body length
+ *     8  u16 op      WAL_OP_*
+ *    10  u16 dims    vector components (INSERT, INSERT_BATCH)
+ *    12  u32 count   entries (INSERT_BATCH), key length (PUT, DEL), else 1
+ *    16  body, zero padded to a multiple of 8 bytes:
+ *          INSERT        u64 id, u64 tag, f32 vector[dims]
+ *          DELETE        u64 id
+ *          INSERT_BATCH  u64 ids[count], u64 tags[count], f32 vectors[count * dims]
+ *          PUT           key[count], value[len - count]
+ *          DEL           key[count]
+ *          INSERT_FILE   u64 file, u64 rows
+ *          COMMIT        u64 group length, u32 group CRC-32C, u32 zero
+ *
+ * Every group of records written at once (see below) ends with a COMMIT
+ * record, which holds the length and the CRC-32C of the records of the
+ * group before it. It takes no LSN and is not returned by the reader.
+ * An INSERT_FILE record stands for an INSERT_BATCH of `rows` entries kept
+ * in a rows file of the database directory instead of the log (see
+ * ingest.h), named after `file`, the LSN of the record. The file holds
+ * the body such an INSERT_BATCH record would have.
+ *
+ * Records stay 8-byte aligned in the file, so the replayer maps segments
+ * in memory and uses ids and vectors in place, without parsing or copying
+ * (on little endian hosts). Segments of format WAL_FORMAT_BINARY, written
+ * by older versions, hold the same records without COMMIT ones. Segments
+ * of format WAL_FORMAT_CRC32C hold message frames (see buffer_wal_header())
+ * each followed by its CRC-32C (big endian); they are still read, as wire
+ * messages (WAL_OP_MESSAGE).
+ *
+ * On replay, an invalid record in the last group of the log, the one not
+ * ended by a valid COMMIT record, is the remains of a write interrupted by
+ * a crash: the pages of a group may reach the disk in any order, so valid
+ * records may follow it. It is dropped with the rest of the file (see
+ * wal_reader_truncate()). An invalid record followed by a complete group
+ * is corruption and fails the replay, since acknowledged writes would be
+ * lost. In segments of the older formats, any valid record that follows
+ * counts.
+ *
+ * A checkpoint file records the LSN up to which the on-disk database
+ * (`db.index`, `db.table`) covers the log. It is replaced atomically and
+ * durably, and only then are the segments it covers retired. Replay starts
+ * at the checkpoint LSN, so it only reads the segments still needed.
+ *
+ * Records appended while serving are collected in memory and written with
+ * a single write() (and, depending on the durability mode, a single
+ * fdatasync()) per group commit. The server loop commits once per event
+ * loop iteration, or once per time window when one is configured, and
+ * holds the responses of the logged requests until their group is
+ * committed (see SERVER_COMMIT in server.h).
+ *
+ * Groups are written by a dedicated writer thread, so the loop never waits
+ * for the disk: a commit swaps the buffer being filled with the one the
+ * writer is done with (double buffering) and returns WAL_COMMIT_RUNNING.
+ * The writer signals wal_fd() once the group is written, and the loop
+ * releases the held responses. While a group is in flight, the next one
+ * keeps filling up; it is handed over once the previous one is written.
+ * Segment blocks are preallocated (fallocate() with FALLOC_FL_KEEP_SIZE on
+ * Linux), so appends and syncs do not have to allocate them.
+ *
+ * Records may be appended on another thread than the one committing them
+ * (the index server applies writes on a writer thread of its own):
+ * wal_append(), wal_commit() and wal_cut() exclude each other, and
+ * wal_lsn() and wal_size() may be called from any thread.
+ *
+ * A group that cannot be written or synced is cut off the segment, so no
+ * part of it is replayed, and its writes are answered with an error (see
+ * wal_committed()). Their changes are already applied in memory, though,
+ * and the records that follow would build on them: the log fails for good
+ * (see wal_failed()). Every later group fails, and so does wal_cut(), so
+ * that no checkpoint saves the changes of the failed writes; the server
+ * refuses writes until it is restarted and replays the log.
+ *
+ * Durability modes (VICTOR_WAL_SYNC):
+ * - `none`:  records are written when the in-memory buffer fills up, on
+ *            export and on shutdown. Responses are not delayed. A crash of
+ *            the process may lose acknowledged operations.
+ * - `flush`: records are handed to the kernel before their responses are
+ *            sent. Acknowledged operations survive a crash of the process,
+ *            but not of the operating system or a power loss. (default)
+ * - `fsync`: records are written and flushed to stable storage with
+ *            fdatasync() before their responses are sent. Acknowledged
+ *            operations survive a power loss. With VICTOR_IO=uring, the
+ *            write and the fdatasync() of a group are linked io_uring
+ *            operations submitted with a single system call.
+ */
+
+#ifndef __VICTOR_WAL_H
+#define __VICTOR_WAL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+
+/** @brief Size at which buffered records are written out in `none` mode */
+#define WAL_BUFFER_SIZE (64 * 1024)
+
+/** @brief Size after which a new segment is started */
+#define WAL_SEGMENT_SIZE (64 * 1024 * 1024)
+
+/** @brief Magic bytes opening every segment */
+#define WAL_SEGMENT_MAGIC "VWAL"
+
+/** @brief Size of the segment header (magic + format version) */
+#define WAL_SEGMENT_HDR_LEN 8
+
+/** @brief Record format: message frame followed by its CRC-32C */
+#define WAL_FORMAT_CRC32C 1
+
+/** @brief Record format: binary records */
+#define WAL_FORMAT_BINARY 2
+
+/** @brief Record format: binary records in groups ended by a COMMIT record (written by this version) */
+#define WAL_FORMAT_GROUPED 3
+
+/** @brief Size of the checksum trailing every WAL_FORMAT_CRC32C record */
+#define WAL_CRC_LEN 4
+
+/** @brief Size of the fixed header of a binary record */
+#define WAL_RECORD_HDR_LEN 16
+
+/** @brief Record operations */
+#define WAL_OP_MESSAGE      0   /**< Wire message, from a log of an older format */
+#define WAL_OP_INSERT       1
+#define WAL_OP_DELETE       2
+#define WAL_OP_INSERT_BATCH 3
+#define WAL_OP_PUT          4
+#define WAL_OP_DEL          5
+#define WAL_OP_INSERT_FILE  6
+#define WAL_OP_COMMIT       7   /**< End of a group, skipped by the reader */
+
+/**
+ * @brief Logged operation.
+ *
+ * Filled by the caller for wal_append(). Records returned by
+ * wal_reader_next() point into the mapped segment (or into the buffer
+ * passed along for WAL_OP_MESSAGE) and stay valid until the reader is
+ * closed; release them with wal_record_free().
+ */
+typedef struct {
+    int             op;        /**< WAL_OP_* */
+    uint64_t        id, tag;   /**< INSERT, DELETE; `id` is the rows file of INSERT_FILE */
+    size_t          count;     /**< INSERT_BATCH, INSERT_FILE entries */
+    size_t          dims;      /**< Vector components */
+    const uint64_t *ids;       /**< INSERT_BATCH ids (count) */
+    const uint64_t *tags;      /**< INSERT_BATCH tags (count) */
+    const float    *vectors;   /**< INSERT vector, INSERT_BATCH vectors (count * dims) */
+    const void     *key;       /**< PUT, DEL */
+    const void     *val;       /**< PUT */
+    size_t          klen, vlen;
+    const buffer_t *msg;       /**< WAL_OP_MESSAGE */
+    void           *owned;     /**< Converted copy of the arrays (big endian hosts), or NULL */
+} wal_record_t;
+
+/** @brief Durability modes */
+typedef enum {
+    WAL_SYNC_NONE  = 0,
+    WAL_SYNC_FLUSH = 1,
+    WAL_SYNC_FSYNC = 2
+} wal_sync_t;
+
+#define DEFAULT_WAL_SYNC   WAL_SYNC_FLUSH
+#define DEFAULT_WAL_WINDOW 0
+
+/** @brief Returned by wal_commit() when the group is being written by the writer thread */
+#define WAL_COMMIT_RUNNING (-2)
+
+/** @brief Opaque WAL writer handle */
+typedef struct wal wal_t;
+
+/** @brief Opaque WAL reader handle */
+typedef struct wal_reader wal_reader_t;
+
+/**
+ * @brief Gets the WAL durability mode from environment or default value.
+ *
+ * Reads the VICTOR_WAL_SYNC environment variable (`none`, `flush` or
+ * `fsync`). If not set or invalid, returns DEFAULT_WAL_SYNC.
+ *
+ * @return Durability mode
+ */
+static inline wal_sync_t get_wal_sync(void) {
+    const char *env_val = getenv("VICTOR_WAL_SYNC");
+    if (env_val) {
+        if (strcmp(env_val, "none") == 0)  return WAL_SYNC_NONE;
+        if (strcmp(env_val, "flush") == 0) return WAL_SYNC_FLUSH;
+        if (strcmp(env_val, "fsync") == 0) return WAL_SYNC_FSYNC;
+    }
+    return DEFAULT_WAL_SYNC;
+}
+
+/**
+ * @brief Gets the group commit window from environment or default value.
+ *
+ * Reads the VICTOR_WAL_WINDOW_MS environment variable: records are then
+ * committed at most once every that many milliseconds instead of once per
+ * event loop iteration. If not set or invalid, returns DEFAULT_WAL_WINDOW.
+ *
+ * @return Window in milliseconds, 0 to commit every iteration
+ */
+static inline int get_wal_window(void) {
+    const char *env_val = getenv("VICTOR_WAL_WINDOW_MS");
+    if (env_val) {
+        int window = atoi(env_val);
+        if (window > 0) {
+            return window;
+        }
+    }
+    return DEFAULT_WAL_WINDOW;
+}
+
+/**
+ * @brief Gets the name of a durability mode.
+ */
+extern const char *wal_sync_name(wal_sync_t sync);
+
+/**
+ * @brief Opens the log for appending, in a new segment.
+ *
+ * @param prefix Segment file prefix (e.g. IWAL_FILE).
+ * @param lsn LSN of the next record, as returned by wal_reader_lsn() after replay.
+ * @param sync Durability mode.
+ * @param window_ms Group commit window, 0 to commit every iteration.
+ * @return Pointer to the writer, or NULL on failure (errno is set).
+ */
+extern wal_t *wal_open(const char *prefix, uint64_t lsn, wal_sync_t sync, int window_ms);
+
+/**
+ * @brief Tells whether a record can be encoded.
+ *
+ * Records are checked before their operation is applied: a record of
+ * more than 256 MiB (e.g. a batch of vectors sent with small integer ids)
+ * cannot be logged.
+ *
+ * @param rec Operation to log (not WAL_OP_MESSAGE).
+ * @return 1 if wal_append() can encode it, 0 otherwise.
+ */
+extern int wal_fits(const wal_record_t *rec);
+
+/**
+ * @brief Appends a record to the current group.
+ *
+ * The operation is applied already when its record is appended: on
+ * failure, the log fails as if a group had failed (see wal_failed()).
+ *
+ * @param wal WAL writer.
+ * @param rec Operation to log (not WAL_OP_MESSAGE).
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+extern int wal_append(wal_t *wal, const wal_record_t *rec);
+
+/**
+ * @brief Gets the LSN the next appended record gets.
+ */
+extern uint64_t wal_lsn(const wal_t *wal);
+
+/**
+ * @brief Gets the number of record bytes appended since the log was opened.
+ */
+extern uint64_t wal_size(const wal_t *wal);
+
+/**
+ * @brief Tells whether responses must wait for the next wal_commit().
+ *
+ * Only meaningful on the thread that appends and commits: another thread
+ * may hand the records over meanwhile (see wal_durable()).
+ *
+ * @return 1 if records waiting for a commit were appended in a durable
+ *         mode, 0 otherwise.
+ */
+extern int wal_pending(const wal_t *wal);
+
+/**
+ * @brief Tells whether responses wait for their records to be committed.
+ *
+ * @return 1 in `flush` and `fsync` modes, 0 in `none` mode.
+ */
+extern int wal_durable(const wal_t *wal);
+
+/**
+ * @brief Commits the current group.
+ *
+ * The group is handed to the writer thread. Without @p force, the call
+ * returns at once; with it, it waits until every group is written.
+ *
+ * @param wal WAL writer.
+ * @param force Commit even if the group commit window is still open, and
+ *        wait for the write.
+ * @return 0 when the group is committed (or there was nothing to commit),
+ *         WAL_COMMIT_RUNNING when it is being written (see wal_committed()),
+ *         the number of milliseconds left in the window when the commit
+ *         was postponed, -1 if a group was not written (it is dropped,
+ *         see wal_committed()).
+ */
+extern int wal_commit(wal_t *wal, int force);
+
+/**
+ * @brief Tells whether the group handed over by wal_commit() is written.
+ *
+ * An I/O error is logged by the writer thread, the group dropped from the
+ * log and the log failed (see wal_failed()). The outcome covers the groups
+ * handed over since the last one reported, including those written by
+ * wal_cut(); a failure of a later group fails it too, so a write may be
+ * reported as failed although it was logged, but never the other way
+ * around.
+ *
+ * @param wal WAL writer.
+ * @param wait Block until it is.
+ * @return 1 if it is written, 0 if it is not yet, -1 if it failed.
+ */
+extern int wal_committed(wal_t *wal, int wait);
+
+/**
+ * @brief Tells whether a group failed, after which nothing more is logged.
+ *
+ * The database then holds changes that are not in the log: writes must be
+ * refused and checkpoints skipped until the server is restarted.
+ *
+ * @param wal WAL writer.
+ * @return 1 if the log failed, 0 otherwise.
+ */
+extern int wal_failed(wal_t *wal);
+
+/**
+ * @brief Gets a descriptor that becomes readable when the writer thread completes a group.
+ *
+ * It is non-blocking and drained by wal_committed().
+ */
+extern int wal_fd(const wal_t *wal);
+
+/**
+ * @brief Commits pending records and starts a new segment.
+ *
+ * Called at the point a snapshot of the database is taken: the snapshot
+ * covers every record before the returned LSN, which is the first LSN of
+ * the new segment. A group that fails is reported to its writes by
+ * wal_commit() or wal_committed().
+ *
+ * @return LSN of the next record, or 0 on failure (the log failed, see
+ *         wal_failed(), or the new segment cannot be created).
+ */
+extern uint64_t wal_cut(wal_t *wal);
+
+/**
+ * @brief Commits pending records and closes the WAL.
+ */
+extern void wal_close(wal_t *wal);
+
+/**
+ * @brief Opens the log for replay.
+ *
+ * Segments entirely before @p lsn are skipped without being read, and so
+ * are the records before @p lsn in the first needed segment. A log file
+ * named @p prefix itself (the single-file log of older versions) is read
+ * first, in full.
+ *
+ * @param prefix Segment file prefix (e.g. IWAL_FILE).
+ * @param lsn First LSN to replay (the checkpoint LSN).
+ * @return Pointer to the reader, or NULL on failure.
+ */
+extern wal_reader_t *wal_reader_open(const char *prefix, uint64_t lsn);
+
+/**
+ * @brief Reads the next record to replay.
+ *
+ * Reading stops before a torn tail (see wal_reader_torn()).
+ *
+ * @param r Reader.
+ * @param rec Output record.
+ * @param buf Buffer receiving the message of a WAL_OP_MESSAGE record.
+ * @return 1 if a record was read into @p rec, 0 at the end of the log,
+ *         -1 on I/O error (errno is set) or corrupted content (errno is 0).
+ */
+extern int wal_reader_next(wal_reader_t *r, wal_record_t *rec, buffer_t *buf);
+
+/**
+ * @brief Releases what wal_reader_next() allocated for a record.
+ */
+extern void wal_record_free(wal_record_t *rec);
+
+/**
+ * @brief Gets the name of a record operation.
+ */
+extern const char *wal_op_name(int op);
+
+/**
+ * @brief Restarts reading from the position the reader was opened at.
+ */
+extern void wal_reader_rewind(wal_reader_t *r);
+
+/**
+ * @brief Reports how much of the log was read.
+ *
+ * @param r Reader.
+ * @param done Output number of bytes read so far.
+ * @param total Output size of the files to read, as of wal_reader_open().
+ */
+extern void wal_reader_progress(const wal_reader_t *r, uint64_t *done, uint64_t *total);
+
+/**
+ * @brief Tells whether the last record read was protected by a checksum.
+ *
+ * @return 1 if its checksum was verified, 0 if it comes from a log written
+ *         before checksums were introduced.
+ */
+extern int wal_reader_verified(const wal_reader_t *r);
+
+/**
+ * @brief Reports the torn tail found at the end of the log, if any.
+ *
+ * @param r Reader that returned 0 from wal_reader_next().
+ * @param path Output file holding the tail.
+ * @param off Output offset of the first invalid byte.
+ * @param len Output number of invalid bytes.
+ * @return 1 if the log ends with a torn tail, 0 otherwise.
+ */
+extern int wal_reader_torn(const wal_reader_t *r, const char **path, uint64_t *off, uint64_t *len);
+
+/**
+ * @brief Cuts off the torn tail found at the end of the log, if any.
+ *
+ * Must be called once replay is complete and before the log is opened for
+ * appending, so that new records do not follow invalid bytes.
+ *
+ * @return 0 on success (or if there was nothing to cut), -1 on failure.
+ */
+extern int wal_reader_truncate(wal_reader_t *r);
+
+/**
+ * @brief Gets the LSN following the last record read.
+ */
+extern uint64_t wal_reader_lsn(const wal_reader_t *r);
+
+/**
+ * @brief Closes a reader.
+ */
+extern void wal_reader_close(wal_reader_t *r);
+
+/**
+ * @brief Reads a checkpoint file.
+ *
+ * @param path Checkpoint file path.
+ * @param lsn Output LSN covered by the database file, 1 if there is no checkpoint.
+ * @return 0 on success (including a missing file), -1 if it cannot be read.
+ */
+extern int wal_checkpoint_read(const char *path, uint64_t *lsn);
+
+/**
+ * @brief Atomically and durably replaces a checkpoint file.
+ *
+ * @param path Checkpoint file path.
+ * @param lsn LSN covered by the database file.
+ * @return 0 on success, -1 on failure (the previous checkpoint is kept).
+ */
+extern int wal_checkpoint_write(const char *path, uint64_t lsn);
+
+/**
+ * @brief Removes the segments whose records are all before @p lsn.
+ *
+ * Must only be called once a checkpoint at @p lsn is durable.
+ *
+ * @param prefix Segment file prefix.
+ * @param lsn Checkpoint LSN.
+ */
+extern void wal_retire(const char *prefix, uint64_t lsn);
+
+#endif
@@ -0,0 +1,283 @@
+/**
+ * @file workers.c
+ * @brief Fixed-size thread pool used to run requests off the event loop.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include "workers.h"
+#include "socket.h"
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+struct workers {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+
+    work_t *head, *tail;   /**< Pending jobs, FIFO */
+    work_t *done;          /**< Completed jobs, LIFO */
+    int     stop;
+
+    int notify_rd;         /**< Readable while completions are pending */
+    int notify_wr;         /**< Written when `done` becomes non-empty */
+
+    int        nthreads;
+    pthread_t *threads;
+};
+
+/** @brief Pool of the calling thread, NULL outside of worker threads */
+static __thread workers_t *current;
+
+/** @brief Shared state of a workers_parallel() call */
+typedef struct {
+    void  (*fn)(void *arg, size_t i);
+    void   *arg;
+    size_t  n;
+    size_t  next;          /**< Next iteration to run (atomic) */
+    int     running;       /**< Helpers currently running, under the pool lock */
+    pthread_cond_t idle;   /**< Signalled when `running` drops to 0 */
+} parallel_t;
+
+/** @brief Job queued to let an idle worker take part in a parallel_t */
+typedef struct {
+    work_t      work;
+    parallel_t *task;
+} helper_t;
+
+static void run_iterations(parallel_t *task) {
+    size_t i;
+    while ((i = __atomic_fetch_add(&task->next, 1, __ATOMIC_RELAXED)) < task->n)
+        task->fn(task->arg, i);
+}
+
+static void run_helper(work_t *w) {
+    run_iterations(((helper_t *)w)->task);
+}
+
+static void notify(workers_t *pool) {
+    uint64_t one = 1;
+    ssize_t w;
+    do {
+        w = write(pool->notify_wr, &one, pool->notify_rd == pool->notify_wr ? sizeof(one) : 1);
+    } while (w < 0 && errno == EINTR);
+}
+
+static void drain(workers_t *pool) {
+    uint8_t buf[64];
+    while (read(pool->notify_rd, buf, sizeof(buf)) > 0)
+        ;
+}
+
+static void *worker_main(void *arg) {
+    workers_t *pool = (workers_t *)arg;
+
+    current = pool;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        work_t *w;
+        while (!pool->head && !pool->stop)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        if (!pool->head)
+            break;
+
+        w = pool->head;
+        pool->head = w->next;
+        if (!pool->head)
+            pool->tail = NULL;
+
+        if (w->fn == run_helper) {
+            /* Helpers belong to a waiting workers_parallel() call, not to the loop. */
+            parallel_t *task = ((helper_t *)w)->task;
+            task->running++;
+            pthread_mutex_unlock(&pool->lock);
+            run_helper(w);
+            pthread_mutex_lock(&pool->lock);
+            if (--task->running == 0)
+                pthread_cond_signal(&task->idle);
+            continue;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        w->fn(w);
+
+        pthread_mutex_lock(&pool->lock);
+        w->next = pool->done;
+        pool->done = w;
+        if (!w->next)
+            notify(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static int open_notify(workers_t *pool) {
+#if defined(__linux__)
+    pool->notify_rd = pool->notify_wr = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return pool->notify_rd < 0 ? -1 : 0;
+#else
+    int fds[2];
+    if (pipe(fds) != 0)
+        return -1;
+    set_nonblocking(fds[0], 1);
+    set_nonblocking(fds[1], 1);
+    pool->notify_rd = fds[0];
+    pool->notify_wr = fds[1];
+    return 0;
+#endif
+}
+
+static void close_notify(workers_t *pool) {
+    close(pool->notify_rd);
+    if (pool->notify_wr != pool->notify_rd)
+        close(pool->notify_wr);
+}
+
+workers_t *workers_create(int nthreads) {
+    workers_t *pool;
+
+    if (nthreads <= 0)
+        return NULL;
+    if ((pool = calloc(1, sizeof(workers_t))) == NULL)
+        return NULL;
+    if ((pool->threads = calloc((size_t)nthreads, sizeof(pthread_t))) == NULL) {
+        free(pool);
+        return NULL;
+    }
+    if (open_notify(pool) != 0) {
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0) {
+            workers_destroy(pool);
+            return NULL;
+        }
+        pool->nthreads++;
+    }
+    return pool;
+}
+
+int workers_fd(const workers_t *pool) {
+    return pool->notify_rd;
+}
+
+void workers_submit(workers_t *pool, work_t *w) {
+    w->next = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail)
+        pool->tail->next = w;
+    else
+        pool->head = w;
+    pool->tail = w;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+work_t *workers_collect(workers_t *pool) {
+    work_t *done, *fifo = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    drain(pool);
+    done = pool->done;
+    pool->done = NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    /* Hand completions back in the order they finished. */
+    while (done) {
+        work_t *next = done->next;
+        done->next = fifo;
+        fifo = done;
+        done = next;
+    }
+    return fifo;
+}
+
+work_t *workers_destroy(workers_t *pool) {
+    work_t *done;
+
+    if (!pool)
+        return NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    done = workers_collect(pool);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->cond);
+    close_notify(pool);
+    free(pool->threads);
+    free(pool);
+    return done;
+}
+
+void workers_parallel(void (*fn)(void *arg, size_t i), void *arg, size_t n) {
+    workers_t *pool = current;
+    parallel_t task = { .fn = fn, .arg = arg, .n = n };
+    helper_t *helpers = NULL;
+    size_t nhelpers = 0;
+
+    if (pool && n > 1) {
+        nhelpers = n - 1 < (size_t)pool->nthreads - 1 ? n - 1 : (size_t)pool->nthreads - 1;
+        if (nhelpers > 0 && (helpers = calloc(nhelpers, sizeof(helper_t))) == NULL)
+            nhelpers = 0;
+    }
+    if (nhelpers == 0) {
+        run_iterations(&task);
+        return;
+    }
+
+    pthread_cond_init(&task.idle, NULL);
+    pthread_mutex_lock(&pool->lock);
+    for (size_t i = 0; i < nhelpers; i++) {
+        helpers[i].work.fn = run_helper;
+        helpers[i].work.next = NULL;
+        helpers[i].task = &task;
+        if (pool->tail)
+            pool->tail->next = &helpers[i].work;
+        else
+            pool->head = &helpers[i].work;
+        pool->tail = &helpers[i].work;
+    }
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_iterations(&task);
+
+    /*
+     * Every iteration has been claimed: drop the helpers no worker picked up
+     * yet and wait for the ones still finishing their last iteration.
+     */
+    pthread_mutex_lock(&pool->lock);
+    for (work_t **link = &pool->head, *prev = NULL; *link; ) {
+        work_t *w = *link;
+        if (w->fn == run_helper && ((helper_t *)w)->task == &task) {
+            *link = w->next;
+            if (pool->tail == w)
+                pool->tail = prev;
+        } else {
+            prev = w;
+            link = &w->next;
+        }
+    }
+    while (task.running > 0)
+        pthread_cond_wait(&task.idle, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_cond_destroy(&task.idle);
+    free(helpers);
+}
@@ -0,0 +1,90 @@
+/**
+ * @file workers.h
+ * @brief Fixed-size thread pool used to run requests off the event loop.
+ *
+ * Jobs are executed in FIFO order by the worker threads. Completed jobs are
+ * handed back to the event loop thread, which is woken up through a
+ * descriptor that becomes readable whenever completions are waiting.
+ */
+
+#ifndef __WORKERS_H
+#define __WORKERS_H
+
+#include <stddef.h>
+
+/**
+ * @brief Unit of work executed by the pool.
+ *
+ * Embed it in the request structure and recover the container in @p fn.
+ */
+typedef struct work {
+    void (*fn)(struct work *w);  /**< Function run on a worker thread */
+    struct work *next;           /**< Queue link (internal) */
+} work_t;
+
+/** @brief Opaque thread pool handle */
+typedef struct workers workers_t;
+
+/**
+ * @brief Starts a pool of worker threads.
+ *
+ * @param nthreads Number of threads (must be positive).
+ * @return Pointer to the pool, or NULL on failure.
+ */
+extern workers_t *workers_create(int nthreads);
+
+/**
+ * @brief Gets the completion notification descriptor.
+ *
+ * The descriptor becomes readable when completed jobs are waiting to be
+ * collected. It must be watched for EV_READ by the event loop.
+ *
+ * @param pool Thread pool.
+ * @return File descriptor.
+ */
+extern int workers_fd(const workers_t *pool);
+
+/**
+ * @brief Queues a job for execution.
+ *
+ * @param pool Thread pool.
+ * @param w Job to run.
+ */
+extern void workers_submit(workers_t *pool, work_t *w);
+
+/**
+ * @brief Takes every completed job.
+ *
+ * Also clears the notification descriptor.
+ *
+ * @param pool Thread pool.
+ * @return List of completed jobs (linked through `next`), or NULL.
+ */
+extern work_t *workers_collect(workers_t *pool);
+
+/**
+ * @brief Runs the queued jobs to completion and stops the threads.
+ *
+ * Completed jobs that were not collected are returned so the caller can
+ * release them.
+ *
+ * @param pool Thread pool (may be NULL).
+ * @return List of completed, uncollected jobs, or NULL.
+ */
+extern work_t *workers_destroy(workers_t *pool);
+
+/**
+ * @brief Runs `fn(arg, i)` for every i in [0, n) and waits for completion.
+ *
+ * When called from a worker thread, idle workers of the same pool help with
+ * the iterations; otherwise (or if no helper can be queued) everything runs
+ * on the calling thread. The caller always takes part, so this never waits
+ * for a worker to become free and cannot deadlock a busy pool.
+ *
+ * @param fn Function called once per iteration, possibly concurrently.
+ * @param arg Argument passed to @p fn.
+ * @param n Number of iterations.
+ */
+extern void workers_parallel(void (*fn)(void *arg, size_t i), void *arg, size_t n);
+
+#endif /* __WORKERS_H */